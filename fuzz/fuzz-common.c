@@ -193,9 +193,16 @@ static void load_fixed_hostkeys(void) {
     buf_free(b);
 }
 
+/* keeps the packet framing of a negotiated encrypt-then-MAC algorithm */
+static const struct dropbear_hash dropbear_nohash_etm = {NULL, 16, 0, 0, 1};
+
 void fuzz_kex_fakealgos(void) {
     ses.newkeys->recv.crypt_mode = &dropbear_mode_none;
-    ses.newkeys->recv.algo_mac = &dropbear_nohash;
+    if (ses.newkeys->recv.algo_mac->etm) {
+        ses.newkeys->recv.algo_mac = &dropbear_nohash_etm;
+    } else {
+        ses.newkeys->recv.algo_mac = &dropbear_nohash;
+    }
 }
 
 void fuzz_get_socket_address(int UNUSED(fd), char **local_host, char **local_port,
@@ -196,6 +196,31 @@ static int sha256_compress(hash_state * md, unsigned char *buf)
 }
 #endif
 
+#ifdef LTC_SHA2_HOOK
+/* Dropbear: the application may install a faster compression function.
+   It is handed every run of whole blocks at once. */
+void (*sha256_compress_hook)(ulong32 *state, const unsigned char *in, unsigned long blocks) = NULL;
+
+static int sha256_compress_blocks(hash_state * md, const unsigned char *buf, unsigned long blocks)
+{
+    int err;
+
+    if (sha256_compress_hook != NULL) {
+        sha256_compress_hook(md->sha256.state, buf, blocks);
+        return CRYPT_OK;
+    }
+    for (; blocks > 0; blocks--, buf += 64) {
+        if ((err = sha256_compress(md, (unsigned char *)buf)) != CRYPT_OK) {
+            return err;
+        }
+    }
+    return CRYPT_OK;
+}
+#define SHA256_COMPRESS(md, buf) sha256_compress_blocks((md), (buf), 1)
+#else
+#define SHA256_COMPRESS(md, buf) sha256_compress((md), (buf))
+#endif
+
 /**
    Initialize the hash state
    @param md   The hash state you wish to initialize
@@ -225,7 +250,48 @@ int sha256_init(hash_state * md)
    @param inlen  The length of the data (octets)
    @return CRYPT_OK if successful
 */
+#ifdef LTC_SHA2_HOOK
+int sha256_process(hash_state * md, const unsigned char *in, unsigned long inlen)
+{
+    unsigned long n;
+    int           err;
+    LTC_ARGCHK(md != NULL);
+    LTC_ARGCHK(in != NULL);
+    if (md->sha256.curlen > sizeof(md->sha256.buf)) {
+       return CRYPT_INVALID_ARG;
+    }
+    if ((md->sha256.length + inlen) < md->sha256.length) {
+      return CRYPT_HASH_OVERFLOW;
+    }
+    while (inlen > 0) {
+        if (md->sha256.curlen == 0 && inlen >= 64) {
+           n = inlen / 64;
+           if ((err = sha256_compress_blocks(md, in, n)) != CRYPT_OK) {
+              return err;
+           }
+           md->sha256.length += n * 64 * 8;
+           in             += n * 64;
+           inlen          -= n * 64;
+        } else {
+           n = MIN(inlen, (64 - md->sha256.curlen));
+           XMEMCPY(md->sha256.buf + md->sha256.curlen, in, (size_t)n);
+           md->sha256.curlen += n;
+           in             += n;
+           inlen          -= n;
+           if (md->sha256.curlen == 64) {
+              if ((err = SHA256_COMPRESS(md, md->sha256.buf)) != CRYPT_OK) {
+                 return err;
+              }
+              md->sha256.length += 8*64;
+              md->sha256.curlen = 0;
+           }
+       }
+    }
+    return CRYPT_OK;
+}
+#else
 HASH_PROCESS(sha256_process, sha256_compress, sha256, 64)
+#endif
 
 /**
    Terminate the hash to get the digest
@@ -259,7 +325,7 @@ int sha256_done(hash_state * md, unsigned char *out)
         while (md->sha256.curlen < 64) {
             md->sha256.buf[md->sha256.curlen++] = (unsigned char)0;
         }
-        sha256_compress(md, md->sha256.buf);
+        SHA256_COMPRESS(md, md->sha256.buf);
         md->sha256.curlen = 0;
     }
 
@@ -270,7 +336,7 @@ int sha256_done(hash_state * md, unsigned char *out)
 
     /* store length */
     STORE64H(md->sha256.length, md->sha256.buf+56);
-    sha256_compress(md, md->sha256.buf);
+    SHA256_COMPRESS(md, md->sha256.buf);
 
     /* copy output */
     for (i = 0; i < 8; i++) {
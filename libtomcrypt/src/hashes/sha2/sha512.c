@@ -165,6 +165,31 @@ static int sha512_compress(hash_state * md, unsigned char *buf)
 }
 #endif
 
+#ifdef LTC_SHA2_HOOK
+/* Dropbear: the application may install a faster compression function.
+   It is handed every run of whole blocks at once. */
+void (*sha512_compress_hook)(ulong64 *state, const unsigned char *in, unsigned long blocks) = NULL;
+
+static int sha512_compress_blocks(hash_state * md, const unsigned char *buf, unsigned long blocks)
+{
+    int err;
+
+    if (sha512_compress_hook != NULL) {
+        sha512_compress_hook(md->sha512.state, buf, blocks);
+        return CRYPT_OK;
+    }
+    for (; blocks > 0; blocks--, buf += 128) {
+        if ((err = sha512_compress(md, (unsigned char *)buf)) != CRYPT_OK) {
+            return err;
+        }
+    }
+    return CRYPT_OK;
+}
+#define SHA512_COMPRESS(md, buf) sha512_compress_blocks((md), (buf), 1)
+#else
+#define SHA512_COMPRESS(md, buf) sha512_compress((md), (buf))
+#endif
+
 /**
    Initialize the hash state
    @param md   The hash state you wish to initialize
@@ -193,7 +218,48 @@ int sha512_init(hash_state * md)
    @param inlen  The length of the data (octets)
    @return CRYPT_OK if successful
 */
+#ifdef LTC_SHA2_HOOK
+int sha512_process(hash_state * md, const unsigned char *in, unsigned long inlen)
+{
+    unsigned long n;
+    int           err;
+    LTC_ARGCHK(md != NULL);
+    LTC_ARGCHK(in != NULL);
+    if (md->sha512.curlen > sizeof(md->sha512.buf)) {
+       return CRYPT_INVALID_ARG;
+    }
+    if ((md->sha512.length + inlen) < md->sha512.length) {
+      return CRYPT_HASH_OVERFLOW;
+    }
+    while (inlen > 0) {
+        if (md->sha512.curlen == 0 && inlen >= 128) {
+           n = inlen / 128;
+           if ((err = sha512_compress_blocks(md, in, n)) != CRYPT_OK) {
+              return err;
+           }
+           md->sha512.length += n * 128 * 8;
+           in             += n * 128;
+           inlen          -= n * 128;
+        } else {
+           n = MIN(inlen, (128 - md->sha512.curlen));
+           XMEMCPY(md->sha512.buf + md->sha512.curlen, in, (size_t)n);
+           md->sha512.curlen += n;
+           in             += n;
+           inlen          -= n;
+           if (md->sha512.curlen == 128) {
+              if ((err = SHA512_COMPRESS(md, md->sha512.buf)) != CRYPT_OK) {
+                 return err;
+              }
+              md->sha512.length += 8*128;
+              md->sha512.curlen = 0;
+           }
+       }
+    }
+    return CRYPT_OK;
+}
+#else
 HASH_PROCESS(sha512_process, sha512_compress, sha512, 128)
+#endif
 
 /**
    Terminate the hash to get the digest
@@ -226,7 +292,7 @@ int sha512_done(hash_state * md, unsigned char *out)
         while (md->sha512.curlen < 128) {
             md->sha512.buf[md->sha512.curlen++] = (unsigned char)0;
         }
-        sha512_compress(md, md->sha512.buf);
+        SHA512_COMPRESS(md, md->sha512.buf);
         md->sha512.curlen = 0;
     }
 
@@ -240,7 +306,7 @@ int sha512_done(hash_state * md, unsigned char *out)
 
     /* store length */
     STORE64H(md->sha512.length, md->sha512.buf+120);
-    sha512_compress(md, md->sha512.buf);
+    SHA512_COMPRESS(md, md->sha512.buf);
 
     /* copy output */
     for (i = 0; i < 8; i++) {
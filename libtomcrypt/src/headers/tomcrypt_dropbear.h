@@ -29,12 +29,10 @@
 #define LTC_CTR_MODE
 #endif
 
-#if DROPBEAR_ENABLE_GCM_MODE
-#define LTC_GCM_MODE
-#endif
+/* ChaCha20 is also the output function of dbrandom.c */
+#define LTC_CHACHA
 
 #if DROPBEAR_CHACHA20POLY1305
-#define LTC_CHACHA
 #define LTC_POLY1305
 #endif
 
@@ -54,6 +52,11 @@
 #define LTC_SHA1
 #endif
 
+/* lets src/sha2-accel.c install SHA-NI/AVX2 compression functions */
+#if DROPBEAR_SHA2_ACCEL
+#define LTC_SHA2_HOOK
+#endif
+
 /* ECC */
 #if DROPBEAR_ECC
 #define LTC_MECC
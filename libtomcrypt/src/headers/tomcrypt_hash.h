@@ -293,6 +293,9 @@ int sha512_process(hash_state * md, const unsigned char *in, unsigned long inlen
 int sha512_done(hash_state * md, unsigned char *hash);
 int sha512_test(void);
 extern const struct ltc_hash_descriptor sha512_desc;
+#ifdef LTC_SHA2_HOOK
+extern void (*sha512_compress_hook)(ulong64 *state, const unsigned char *in, unsigned long blocks);
+#endif
 #endif
 
 #ifdef LTC_SHA384
@@ -334,6 +337,9 @@ int sha256_process(hash_state * md, const unsigned char *in, unsigned long inlen
 int sha256_done(hash_state * md, unsigned char *hash);
 int sha256_test(void);
 extern const struct ltc_hash_descriptor sha256_desc;
+#ifdef LTC_SHA2_HOOK
+extern void (*sha256_compress_hook)(ulong32 *state, const unsigned char *in, unsigned long blocks);
+#endif
 
 #ifdef LTC_SHA224
 #ifndef LTC_SHA256
@@ -0,0 +1,566 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "cpufeatures.h"
+#include "aesni.h"
+
+#if DROPBEAR_AESNI
+
+#include <immintrin.h>
+
+#define AESNI_TARGET __attribute__((target("aes")))
+#define VAES_TARGET __attribute__((target("aes,avx2,vaes")))
+
+/* CTR keystream blocks encrypted together to hide the AESENC latency */
+#define AESNI_CTR_BLOCKS 8
+
+int dropbear_aesni_cipher = -1;
+static int aesni_use_vaes = 0;
+
+/* Expands the key with the portable code, then stores the round keys as
+ * the bytes AESENC/AESDEC expect. The decryption schedule from
+ * rijndael_setup() is already the equivalent inverse cipher's. */
+static int aesni_setup(const unsigned char *key, int keylen, int num_rounds,
+		symmetric_key *skey) {
+	unsigned int i;
+	int err;
+
+	if ((err = rijndael_setup(key, keylen, num_rounds, skey)) != CRYPT_OK) {
+		return err;
+	}
+	for (i = 0; i < 60; i++) {
+		unsigned char tmp[4];
+		STORE32H(skey->rijndael.eK[i], tmp);
+		memcpy(&skey->rijndael.eK[i], tmp, 4);
+		STORE32H(skey->rijndael.dK[i], tmp);
+		memcpy(&skey->rijndael.dK[i], tmp, 4);
+	}
+	return CRYPT_OK;
+}
+
+static AESNI_TARGET int aesni_ecb_encrypt(const unsigned char *pt,
+		unsigned char *ct, symmetric_key *skey) {
+	const __m128i *rk = (const __m128i *)skey->rijndael.eK;
+	int r, nr = skey->rijndael.Nr;
+	__m128i b;
+
+	b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)pt),
+			_mm_loadu_si128(&rk[0]));
+	for (r = 1; r < nr; r++) {
+		b = _mm_aesenc_si128(b, _mm_loadu_si128(&rk[r]));
+	}
+	b = _mm_aesenclast_si128(b, _mm_loadu_si128(&rk[nr]));
+	_mm_storeu_si128((__m128i *)ct, b);
+	return CRYPT_OK;
+}
+
+static AESNI_TARGET int aesni_ecb_decrypt(const unsigned char *ct,
+		unsigned char *pt, symmetric_key *skey) {
+	const __m128i *rk = (const __m128i *)skey->rijndael.dK;
+	int r, nr = skey->rijndael.Nr;
+	__m128i b;
+
+	b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)ct),
+			_mm_loadu_si128(&rk[0]));
+	for (r = 1; r < nr; r++) {
+		b = _mm_aesdec_si128(b, _mm_loadu_si128(&rk[r]));
+	}
+	b = _mm_aesdeclast_si128(b, _mm_loadu_si128(&rk[nr]));
+	_mm_storeu_si128((__m128i *)pt, b);
+	return CRYPT_OK;
+}
+
+/* The counter block after incrementing the 128-bit counter hi:lo */
+static inline __attribute__((always_inline)) __m128i aesni_ctr_next(
+		ulong64 *hi, ulong64 *lo, int mode) {
+	if (++*lo == 0) {
+		++*hi;
+	}
+	if (mode == CTR_COUNTER_BIG_ENDIAN) {
+		return _mm_set_epi64x((long long)__builtin_bswap64(*lo),
+				(long long)__builtin_bswap64(*hi));
+	}
+	return _mm_set_epi64x((long long)*hi, (long long)*lo);
+}
+
+/* Applies f(x, k) to the eight interleaved blocks. Spelt out rather than
+ * looped so they stay in registers at -Os. */
+#define AESNI_ALL8(f, k) do { \
+	b0 = f(b0, k); b1 = f(b1, k); b2 = f(b2, k); b3 = f(b3, k); \
+	b4 = f(b4, k); b5 = f(b5, k); b6 = f(b6, k); b7 = f(b7, k); \
+} while (0)
+
+/* Whole multiples of 16 blocks, two per 256-bit register with VAES.
+ * Returns the number of blocks done. */
+static VAES_TARGET unsigned long vaes_ctr_encrypt(const unsigned char *pt,
+		unsigned char *ct, unsigned long blocks, ulong64 *hi, ulong64 *lo,
+		int mode, const __m128i *rkp, int nr) {
+	__m256i b0, b1, b2, b3, b4, b5, b6, b7, k;
+	unsigned long done;
+	int r;
+
+#define VAES_CTR2(bx) do { \
+	__m128i c0 = aesni_ctr_next(hi, lo, mode); \
+	__m128i c1 = aesni_ctr_next(hi, lo, mode); \
+	bx = _mm256_xor_si256(k, _mm256_set_m128i(c1, c0)); \
+} while (0)
+#define VAES_XOR_OUT(bx, i) \
+	_mm256_storeu_si256((__m256i *)ct + (i), _mm256_xor_si256(bx, \
+				_mm256_loadu_si256((const __m256i *)pt + (i))))
+
+	for (done = 0; blocks - done >= 16; done += 16) {
+		k = _mm256_broadcastsi128_si256(_mm_loadu_si128(&rkp[0]));
+		VAES_CTR2(b0);
+		VAES_CTR2(b1);
+		VAES_CTR2(b2);
+		VAES_CTR2(b3);
+		VAES_CTR2(b4);
+		VAES_CTR2(b5);
+		VAES_CTR2(b6);
+		VAES_CTR2(b7);
+		for (r = 1; r < nr; r++) {
+			k = _mm256_broadcastsi128_si256(_mm_loadu_si128(&rkp[r]));
+			AESNI_ALL8(_mm256_aesenc_epi128, k);
+		}
+		k = _mm256_broadcastsi128_si256(_mm_loadu_si128(&rkp[nr]));
+		AESNI_ALL8(_mm256_aesenclast_epi128, k);
+		VAES_XOR_OUT(b0, 0);
+		VAES_XOR_OUT(b1, 1);
+		VAES_XOR_OUT(b2, 2);
+		VAES_XOR_OUT(b3, 3);
+		VAES_XOR_OUT(b4, 4);
+		VAES_XOR_OUT(b5, 5);
+		VAES_XOR_OUT(b6, 6);
+		VAES_XOR_OUT(b7, 7);
+		pt += 256;
+		ct += 256;
+	}
+#undef VAES_CTR2
+#undef VAES_XOR_OUT
+	_mm256_zeroupper();
+	return done;
+}
+
+/* libtomcrypt's accelerated CTR hook, called by ctr_encrypt() for whole
+ * blocks. IV holds the last counter used; each block increments it first.
+ * Only full width counters reach here, as in dropbear's ctr_start(). */
+static AESNI_TARGET int aesni_ctr_encrypt(const unsigned char *pt,
+		unsigned char *ct, unsigned long blocks, unsigned char *IV,
+		int mode, symmetric_key *skey) {
+	const __m128i *rkp = (const __m128i *)skey->rijndael.eK;
+	__m128i b0, b1, b2, b3, b4, b5, b6, b7, k;
+	ulong64 hi, lo;
+	int r, nr = skey->rijndael.Nr;
+
+	if (mode == CTR_COUNTER_BIG_ENDIAN) {
+		LOAD64H(hi, IV);
+		LOAD64H(lo, IV + 8);
+	} else {
+		LOAD64L(lo, IV);
+		LOAD64L(hi, IV + 8);
+	}
+
+	if (aesni_use_vaes && blocks >= 16) {
+		unsigned long done = vaes_ctr_encrypt(pt, ct, blocks, &hi, &lo,
+				mode, rkp, nr);
+		pt += 16 * done;
+		ct += 16 * done;
+		blocks -= done;
+	}
+
+#define AESNI_XOR_OUT(bx, i) \
+	_mm_storeu_si128((__m128i *)ct + (i), _mm_xor_si128(bx, \
+				_mm_loadu_si128((const __m128i *)pt + (i))))
+
+	for (; blocks >= AESNI_CTR_BLOCKS; blocks -= AESNI_CTR_BLOCKS) {
+		k = _mm_loadu_si128(&rkp[0]);
+		b0 = _mm_xor_si128(aesni_ctr_next(&hi, &lo, mode), k);
+		b1 = _mm_xor_si128(aesni_ctr_next(&hi, &lo, mode), k);
+		b2 = _mm_xor_si128(aesni_ctr_next(&hi, &lo, mode), k);
+		b3 = _mm_xor_si128(aesni_ctr_next(&hi, &lo, mode), k);
+		b4 = _mm_xor_si128(aesni_ctr_next(&hi, &lo, mode), k);
+		b5 = _mm_xor_si128(aesni_ctr_next(&hi, &lo, mode), k);
+		b6 = _mm_xor_si128(aesni_ctr_next(&hi, &lo, mode), k);
+		b7 = _mm_xor_si128(aesni_ctr_next(&hi, &lo, mode), k);
+		for (r = 1; r < nr; r++) {
+			k = _mm_loadu_si128(&rkp[r]);
+			AESNI_ALL8(_mm_aesenc_si128, k);
+		}
+		k = _mm_loadu_si128(&rkp[nr]);
+		AESNI_ALL8(_mm_aesenclast_si128, k);
+		AESNI_XOR_OUT(b0, 0);
+		AESNI_XOR_OUT(b1, 1);
+		AESNI_XOR_OUT(b2, 2);
+		AESNI_XOR_OUT(b3, 3);
+		AESNI_XOR_OUT(b4, 4);
+		AESNI_XOR_OUT(b5, 5);
+		AESNI_XOR_OUT(b6, 6);
+		AESNI_XOR_OUT(b7, 7);
+		pt += 16 * AESNI_CTR_BLOCKS;
+		ct += 16 * AESNI_CTR_BLOCKS;
+	}
+
+	for (; blocks > 0; blocks--) {
+		b0 = _mm_xor_si128(aesni_ctr_next(&hi, &lo, mode),
+				_mm_loadu_si128(&rkp[0]));
+		for (r = 1; r < nr; r++) {
+			b0 = _mm_aesenc_si128(b0, _mm_loadu_si128(&rkp[r]));
+		}
+		b0 = _mm_aesenclast_si128(b0, _mm_loadu_si128(&rkp[nr]));
+		AESNI_XOR_OUT(b0, 0);
+		pt += 16;
+		ct += 16;
+	}
+#undef AESNI_XOR_OUT
+
+	if (mode == CTR_COUNTER_BIG_ENDIAN) {
+		STORE64H(hi, IV);
+		STORE64H(lo, IV + 8);
+	} else {
+		STORE64L(lo, IV);
+		STORE64L(hi, IV + 8);
+	}
+	return CRYPT_OK;
+}
+
+#if DROPBEAR_ENABLE_GCM_MODE
+
+#define CLMUL_TARGET __attribute__((target("pclmul,ssse3")))
+#define AESNI_CLMUL_TARGET __attribute__((target("aes,pclmul,ssse3")))
+#define CLMUL_INLINE static inline __attribute__((always_inline)) CLMUL_TARGET
+
+/* GHASH values are bit reflected. Byte swapping a block puts it in the
+ * order PCLMULQDQ wants, the product then needs shifting left by one
+ * before reduction; see Intel's "Carry-Less Multiplication Instruction
+ * and its Usage for Computing the GCM Mode", algorithm 5. */
+CLMUL_INLINE __m128i clmul_bswap(__m128i x) {
+	return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+				8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+/* Adds the unreduced product a*b to lo, mid and hi */
+CLMUL_INLINE void clmul_acc(__m128i a, __m128i b,
+		__m128i *lo, __m128i *mid, __m128i *hi) {
+	*lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+	*hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+}
+
+/* Reduces a sum of products modulo x^128 + x^7 + x^2 + x + 1. Reduction
+ * is linear so several products can share one. */
+CLMUL_INLINE __m128i clmul_reduce(__m128i lo, __m128i mid, __m128i hi) {
+	__m128i t, u, v;
+
+	lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+	/* shift hi:lo left by one bit */
+	t = _mm_srli_epi32(lo, 31);
+	u = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	v = _mm_srli_si128(t, 12);
+	u = _mm_slli_si128(u, 4);
+	t = _mm_slli_si128(t, 4);
+	lo = _mm_or_si128(lo, t);
+	hi = _mm_or_si128(hi, u);
+	hi = _mm_or_si128(hi, v);
+
+	/* fold the low half into the high */
+	t = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31),
+				_mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+	u = _mm_srli_si128(t, 4);
+	lo = _mm_xor_si128(lo, _mm_slli_si128(t, 12));
+	v = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1),
+				_mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+	lo = _mm_xor_si128(lo, _mm_xor_si128(v, u));
+	return _mm_xor_si128(hi, lo);
+}
+
+/* (x + c) * H */
+CLMUL_INLINE __m128i clmul_ghash1(__m128i x, const unsigned char *in,
+		const __m128i *hp) {
+	__m128i lo = _mm_setzero_si128(), mid = lo, hi = lo;
+
+	x = _mm_xor_si128(x, clmul_bswap(_mm_loadu_si128((const __m128i *)in)));
+	clmul_acc(x, _mm_loadu_si128(&hp[0]), &lo, &mid, &hi);
+	return clmul_reduce(lo, mid, hi);
+}
+
+/* Eight blocks with one reduction, (x + c0) * H^8 + c1 * H^7 ... + c7 * H */
+CLMUL_INLINE __m128i clmul_ghash8(__m128i x, const unsigned char *in,
+		const __m128i *hp) {
+	__m128i lo = _mm_setzero_si128(), mid = lo, hi = lo;
+	int i;
+
+	x = _mm_xor_si128(x, clmul_bswap(_mm_loadu_si128((const __m128i *)in)));
+	clmul_acc(x, _mm_loadu_si128(&hp[7]), &lo, &mid, &hi);
+	for (i = 1; i < 8; i++) {
+		clmul_acc(clmul_bswap(_mm_loadu_si128((const __m128i *)in + i)),
+				_mm_loadu_si128(&hp[7 - i]), &lo, &mid, &hi);
+	}
+	return clmul_reduce(lo, mid, hi);
+}
+
+CLMUL_TARGET void dropbear_aesni_ghash_init(const unsigned char *H,
+		unsigned char *hpow) {
+	__m128i h, p, lo, mid, hi;
+	int i;
+
+	h = clmul_bswap(_mm_loadu_si128((const __m128i *)H));
+	p = h;
+	_mm_storeu_si128((__m128i *)hpow, p);
+	for (i = 1; i < AESNI_GHASH_POWERS; i++) {
+		lo = mid = hi = _mm_setzero_si128();
+		clmul_acc(p, h, &lo, &mid, &hi);
+		p = clmul_reduce(lo, mid, hi);
+		_mm_storeu_si128((__m128i *)hpow + i, p);
+	}
+}
+
+CLMUL_TARGET void dropbear_aesni_ghash(unsigned char *X,
+		const unsigned char *hpow, const unsigned char *in,
+		unsigned long blocks) {
+	const __m128i *hp = (const __m128i *)hpow;
+	__m128i x = clmul_bswap(_mm_loadu_si128((const __m128i *)X));
+
+	for (; blocks >= 8; blocks -= 8, in += 128) {
+		x = clmul_ghash8(x, in, hp);
+	}
+	for (; blocks > 0; blocks--, in += 16) {
+		x = clmul_ghash1(x, in, hp);
+	}
+	_mm_storeu_si128((__m128i *)X, clmul_bswap(x));
+}
+
+/* Counter block i after the one in c, only the low 32 bits count */
+#define GCM_CTR(i) _mm_or_si128(iv, \
+		_mm_slli_si128(_mm_cvtsi32_si128((int)__builtin_bswap32(c + (i))), 12))
+
+/* The AES rounds of a batch and the GHASH multiplies are independent, so
+ * the CPU overlaps them. Decryption hashes the batch's input, encryption
+ * the previous batch's output. */
+AESNI_CLMUL_TARGET void dropbear_aesni_gcm(symmetric_key *skey,
+		const unsigned char *hpow, unsigned char *ctr, unsigned char *X,
+		const unsigned char *in, unsigned char *out, unsigned long blocks,
+		int direction) {
+	const __m128i *rkp = (const __m128i *)skey->rijndael.eK;
+	const __m128i *hp = (const __m128i *)hpow;
+	const unsigned char *prev = NULL;
+	unsigned char ivblock[16];
+	__m128i b0, b1, b2, b3, b4, b5, b6, b7, k, iv, x;
+	ulong32 c;
+	int r, nr = skey->rijndael.Nr;
+
+	memcpy(ivblock, ctr, 12);
+	memset(&ivblock[12], 0, 4);
+	iv = _mm_loadu_si128((const __m128i *)ivblock);
+	LOAD32H(c, &ctr[12]);
+	x = clmul_bswap(_mm_loadu_si128((const __m128i *)X));
+
+#define AESNI_XOR_OUT(bx, i) \
+	_mm_storeu_si128((__m128i *)out + (i), _mm_xor_si128(bx, \
+				_mm_loadu_si128((const __m128i *)in + (i))))
+
+	for (; blocks >= 8; blocks -= 8) {
+		k = _mm_loadu_si128(&rkp[0]);
+		b0 = _mm_xor_si128(GCM_CTR(1), k);
+		b1 = _mm_xor_si128(GCM_CTR(2), k);
+		b2 = _mm_xor_si128(GCM_CTR(3), k);
+		b3 = _mm_xor_si128(GCM_CTR(4), k);
+		b4 = _mm_xor_si128(GCM_CTR(5), k);
+		b5 = _mm_xor_si128(GCM_CTR(6), k);
+		b6 = _mm_xor_si128(GCM_CTR(7), k);
+		b7 = _mm_xor_si128(GCM_CTR(8), k);
+		c += 8;
+		if (direction == LTC_DECRYPT) {
+			x = clmul_ghash8(x, in, hp);
+		} else if (prev) {
+			x = clmul_ghash8(x, prev, hp);
+		}
+		for (r = 1; r < nr; r++) {
+			k = _mm_loadu_si128(&rkp[r]);
+			AESNI_ALL8(_mm_aesenc_si128, k);
+		}
+		k = _mm_loadu_si128(&rkp[nr]);
+		AESNI_ALL8(_mm_aesenclast_si128, k);
+		AESNI_XOR_OUT(b0, 0);
+		AESNI_XOR_OUT(b1, 1);
+		AESNI_XOR_OUT(b2, 2);
+		AESNI_XOR_OUT(b3, 3);
+		AESNI_XOR_OUT(b4, 4);
+		AESNI_XOR_OUT(b5, 5);
+		AESNI_XOR_OUT(b6, 6);
+		AESNI_XOR_OUT(b7, 7);
+		prev = out;
+		in += 128;
+		out += 128;
+	}
+	if (prev && direction == LTC_ENCRYPT) {
+		x = clmul_ghash8(x, prev, hp);
+	}
+
+	for (; blocks > 0; blocks--) {
+		if (direction == LTC_DECRYPT) {
+			x = clmul_ghash1(x, in, hp);
+		}
+		b0 = _mm_xor_si128(GCM_CTR(1), _mm_loadu_si128(&rkp[0]));
+		c++;
+		for (r = 1; r < nr; r++) {
+			b0 = _mm_aesenc_si128(b0, _mm_loadu_si128(&rkp[r]));
+		}
+		b0 = _mm_aesenclast_si128(b0, _mm_loadu_si128(&rkp[nr]));
+		AESNI_XOR_OUT(b0, 0);
+		if (direction == LTC_ENCRYPT) {
+			x = clmul_ghash1(x, out, hp);
+		}
+		in += 16;
+		out += 16;
+	}
+#undef AESNI_XOR_OUT
+
+	STORE32H(c, &ctr[12]);
+	_mm_storeu_si128((__m128i *)X, clmul_bswap(x));
+}
+#undef GCM_CTR
+
+#endif /* DROPBEAR_ENABLE_GCM_MODE */
+
+/* FIPS-197 appendix C known answers, then CTR against the portable AES
+ * across a carry out of the low 64 counter bits. Long enough to run the
+ * VAES, AES-NI and single block loops. */
+static int aesni_test(void) {
+	static const unsigned char pt[16] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+		0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+	static const unsigned char kat[3][16] = {
+		{ 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+		  0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a },
+		{ 0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0,
+		  0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91 },
+		{ 0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
+		  0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89 } };
+	unsigned char key[32], ctr[16], ref_ctr[16];
+	unsigned char buf[16 * (AESNI_CTR_BLOCKS * 3 + 3)];
+	unsigned char out[sizeof(buf)], ref[sizeof(buf)];
+	symmetric_key skey, ref_skey;
+	unsigned int i, k;
+
+	for (i = 0; i < sizeof(key); i++) {
+		key[i] = i;
+	}
+	for (k = 0; k < 3; k++) {
+		if (aesni_setup(key, 16 + 8*k, 0, &skey) != CRYPT_OK) {
+			return CRYPT_FAIL_TESTVECTOR;
+		}
+		aesni_ecb_encrypt(pt, out, &skey);
+		if (memcmp(out, kat[k], 16) != 0) {
+			return CRYPT_FAIL_TESTVECTOR;
+		}
+		aesni_ecb_decrypt(out, out, &skey);
+		if (memcmp(out, pt, 16) != 0) {
+			return CRYPT_FAIL_TESTVECTOR;
+		}
+	}
+
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = i * 7;
+	}
+	memset(ctr, 0xa5, 8);
+	memset(&ctr[8], 0xff, 8);
+	ctr[15] = 0xf8;
+	memcpy(ref_ctr, ctr, sizeof(ctr));
+	if (aesni_setup(key, 32, 0, &skey) != CRYPT_OK
+			|| rijndael_setup(key, 32, 0, &ref_skey) != CRYPT_OK) {
+		return CRYPT_FAIL_TESTVECTOR;
+	}
+	aesni_ctr_encrypt(buf, out, sizeof(buf) / 16, ctr,
+			CTR_COUNTER_BIG_ENDIAN, &skey);
+	for (i = 0; i < sizeof(buf); i += 16) {
+		for (k = 16; k-- > 0 && ++ref_ctr[k] == 0;) {
+			/* carry */
+		}
+		rijndael_ecb_encrypt(ref_ctr, &ref[i], &ref_skey);
+		for (k = 0; k < 16; k++) {
+			ref[i + k] ^= buf[i + k];
+		}
+	}
+	if (memcmp(out, ref, sizeof(ref)) != 0
+			|| memcmp(ctr, ref_ctr, sizeof(ctr)) != 0) {
+		return CRYPT_FAIL_TESTVECTOR;
+	}
+	return CRYPT_OK;
+}
+
+static void aesni_done(symmetric_key *UNUSED(skey)) {
+}
+
+const struct ltc_cipher_descriptor dropbear_aesni_desc = {
+	.name = "aes-ni",
+	.ID = 0xa5,
+	.min_key_length = 16,
+	.max_key_length = 32,
+	.block_length = 16,
+	.default_rounds = 10,
+	.setup = aesni_setup,
+	.ecb_encrypt = aesni_ecb_encrypt,
+	.ecb_decrypt = aesni_ecb_decrypt,
+	.test = aesni_test,
+	.done = aesni_done,
+	.keysize = rijndael_keysize,
+	.accel_ctr_encrypt = aesni_ctr_encrypt,
+};
+
+/* Registers the AES-NI cipher if the CPU has it and it passes the known
+ * answer tests, otherwise the portable AES stays in use */
+void dropbear_aesni_init() {
+	if (!(dropbear_cpu_features() & DROPBEAR_CPU_AESNI)) {
+		return;
+	}
+	if (aesni_test() != CRYPT_OK) {
+		dropbear_log(LOG_WARNING, "AES-NI self test failed, not using it");
+		return;
+	}
+	if (dropbear_cpu_features() & DROPBEAR_CPU_VAES) {
+		aesni_use_vaes = 1;
+		if (aesni_test() != CRYPT_OK) {
+			aesni_use_vaes = 0;
+		}
+	}
+	dropbear_aesni_cipher = register_cipher(&dropbear_aesni_desc);
+	TRACE(("using AES-NI, cipher %d vaes %d", dropbear_aesni_cipher, aesni_use_vaes))
+}
+
+int dropbear_aesni_select(int cipher) {
+	if (dropbear_aesni_cipher >= 0
+			&& cipher_descriptor[cipher].ID == aes_desc.ID) {
+		return dropbear_aesni_cipher;
+	}
+	return cipher;
+}
+
+#endif /* DROPBEAR_AESNI */
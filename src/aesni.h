@@ -0,0 +1,63 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_AESNI_H_
+#define DROPBEAR_AESNI_H_
+
+#include "includes.h"
+
+#if DROPBEAR_AESNI
+
+/* AES using the AES-NI instructions, with an accelerated CTR mode. The key
+ * schedule is kept in the libtomcrypt rijndael_key layout. */
+extern const struct ltc_cipher_descriptor dropbear_aesni_desc;
+
+/* cipher index of dropbear_aesni_desc, or -1 if the CPU lacks AES-NI */
+extern int dropbear_aesni_cipher;
+
+void dropbear_aesni_init(void);
+
+/* cipher to use in place of cipher, the AES-NI one for AES if available */
+int dropbear_aesni_select(int cipher);
+
+#if DROPBEAR_ENABLE_GCM_MODE
+/* powers of H kept for the carry-less multiply GHASH */
+#define AESNI_GHASH_POWERS 8
+
+/* Stores H^1 to H^AESNI_GHASH_POWERS in hpow */
+void dropbear_aesni_ghash_init(const unsigned char *H, unsigned char *hpow);
+/* Updates the GHASH X with whole blocks of input */
+void dropbear_aesni_ghash(unsigned char *X, const unsigned char *hpow,
+		const unsigned char *in, unsigned long blocks);
+/* GCM encryption or decryption of whole blocks with a dropbear_aesni_desc
+ * key, hashing the ciphertext into X. ctr is the last counter block used
+ * and is updated. */
+void dropbear_aesni_gcm(symmetric_key *skey, const unsigned char *hpow,
+		unsigned char *ctr, unsigned char *X, const unsigned char *in,
+		unsigned char *out, unsigned long blocks, int direction);
+#endif /* DROPBEAR_ENABLE_GCM_MODE */
+
+#endif /* DROPBEAR_AESNI */
+
+#endif /* DROPBEAR_AESNI_H_ */
@@ -88,6 +88,11 @@ struct dropbear_hash {
 	/* hashsize may be truncated from the size returned by hash_desc,
 	   eg sha1-96 */
 	const unsigned char hashsize;
+	/* umac-*@openssh.com, hash_desc is unused */
+	const unsigned char umac;
+	/* encrypt-then-MAC, the packet length is sent in the clear and the
+	   MAC covers the ciphertext */
+	const unsigned char etm;
 };
 
 enum dropbear_kex_mode {
@@ -50,14 +50,65 @@ buffer* buf_new(unsigned int size) {
 	return buf;
 }
 
+/* As buf_new(), but the contents aren't zeroed. Only for buffers that
+ * are always written before being read */
+buffer* buf_new_uninit(unsigned int size) {
+	buffer* buf;
+	if (size > BUF_MAX_SIZE) {
+		dropbear_exit("buf->size too big");
+	}
+
+	buf = m_malloc_uninit(sizeof(buffer)+size);
+	buf->data = (unsigned char*)buf + sizeof(buffer);
+	buf->size = size;
+	buf->len = 0;
+	buf->pos = 0;
+	buf->tailroom = 0;
+	return buf;
+}
+
+/* Reserve headroom bytes in front of and tailroom bytes after the
+ * contents of an empty buffer. The reserved room becomes part of the
+ * buffer again with buf_expand() */
+void buf_reserve(buffer* buf, unsigned int headroom, unsigned int tailroom) {
+	if (buf->len != 0 
+		|| buf->data != (unsigned char*)buf + sizeof(buffer)
+		|| headroom > BUF_MAX_INCR || tailroom > BUF_MAX_INCR
+		|| headroom + tailroom > buf->size) {
+		dropbear_exit("Bad buf_reserve");
+	}
+	buf->data += headroom;
+	buf->size -= headroom + tailroom;
+	buf->tailroom = tailroom;
+	buf->pos = 0;
+}
+
+/* Make the room reserved by buf_reserve() part of the buffer,
+ * the same headroom and tailroom must be passed. The contents
+ * are kept in place, positioned after the headroom, and pos is reset */
+void buf_expand(buffer* buf, unsigned int headroom, unsigned int tailroom) {
+	if (buf->data - headroom != (unsigned char*)buf + sizeof(buffer)
+		|| tailroom != buf->tailroom) {
+		dropbear_exit("Bad buf_expand");
+	}
+	buf->data -= headroom;
+	buf->size += headroom + tailroom;
+	buf->tailroom = 0;
+	buf->len += headroom;
+	buf->pos = 0;
+}
+
 /* free the buffer's data and the buffer itself */
 void buf_free(buffer* buf) {
 	m_free(buf);
 }
 
-/* overwrite the contents of the buffer then free it */
+/* overwrite the whole allocation, including any room reserved with
+ * buf_reserve(), then free it */
 void buf_burn_free(buffer* buf) {
-	m_burn(buf->data, buf->size);
+	unsigned char *start = (unsigned char*)buf + sizeof(buffer);
+
+	m_burn(start, (buf->data - start) + buf->size + buf->tailroom);
 	m_free(buf);
 }
 
@@ -72,6 +123,7 @@ buffer* buf_resize(buffer *buf, unsigned int newsize) {
 	buf = m_realloc(buf, sizeof(buffer)+newsize);
 	buf->data = (unsigned char*)buf + sizeof(buffer);
 	buf->size = newsize;
+	buf->tailroom = 0;
 	buf->len = MIN(newsize, buf->len);
 	buf->pos = MIN(newsize, buf->pos);
 	return buf;
@@ -35,6 +35,7 @@ struct buf {
 	unsigned int len; /* the used size */
 	unsigned int pos;
 	unsigned int size; /* the memory size */
+	unsigned int tailroom; /* held back after size by buf_reserve() */
 
 };
 
@@ -43,6 +44,9 @@ typedef struct buf buffer;
 buffer * buf_new(unsigned int size);
 /* Possibly returns a new buffer*, like realloc() */
 buffer * buf_resize(buffer *buf, unsigned int newsize);
+buffer* buf_new_uninit(unsigned int size);
+void buf_reserve(buffer* buf, unsigned int headroom, unsigned int tailroom);
+void buf_expand(buffer* buf, unsigned int headroom, unsigned int tailroom);
 void buf_free(buffer* buf);
 void buf_burn_free(buffer* buf);
 buffer* buf_newcopy(const buffer* buf);
@@ -0,0 +1,568 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+/* Faster ChaCha20 and Poly1305 for chacha20-poly1305@openssh.com.
+ * ChaCha20 runs four (SSE2) or eight (AVX2) blocks at once with each
+ * vector holding the same state word of every block. Poly1305 uses
+ * 64-bit limbs so a block needs nine multiplies rather than 25. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "cpufeatures.h"
+#include "chachapoly-accel.h"
+
+#if DROPBEAR_CHACHA20POLY1305
+
+#if DROPBEAR_POLY1305_64
+
+#define POLY_MASK44 CONST64(0xfffffffffff)
+#define POLY_MASK42 CONST64(0x3ffffffffff)
+
+typedef unsigned __int128 poly_u128;
+
+void dropbear_poly1305_init(dropbear_poly1305_state *st,
+		const unsigned char *key) {
+	ulong64 t0, t1;
+
+	/* r is clamped as the RFC requires */
+	LOAD64L(t0, key);
+	LOAD64L(t1, key + 8);
+	st->r[0] = t0 & CONST64(0xffc0fffffff);
+	st->r[1] = ((t0 >> 44) | (t1 << 20)) & CONST64(0xfffffc0ffff);
+	st->r[2] = (t1 >> 24) & CONST64(0x00ffffffc0f);
+	st->h[0] = st->h[1] = st->h[2] = 0;
+	LOAD64L(st->pad[0], key + 16);
+	LOAD64L(st->pad[1], key + 24);
+	st->leftover = 0;
+}
+
+/* h = (h + m) * r for each 16 byte block, hibit is 2^128 except for a
+ * padded final block. Inlined so the ChaCha20 kernels can interleave it. */
+static inline __attribute__((always_inline)) void poly1305_blocks(dropbear_poly1305_state *st,
+		const unsigned char *m, unsigned long len, ulong64 hibit) {
+	ulong64 r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+	ulong64 h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+	ulong64 s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+	ulong64 t0, t1, c;
+	poly_u128 d0, d1, d2;
+
+	for (; len >= 16; len -= 16, m += 16) {
+		LOAD64L(t0, m);
+		LOAD64L(t1, m + 8);
+		h0 += t0 & POLY_MASK44;
+		h1 += ((t0 >> 44) | (t1 << 20)) & POLY_MASK44;
+		h2 += ((t1 >> 24) & POLY_MASK42) | hibit;
+
+		d0 = (poly_u128)h0 * r0 + (poly_u128)h1 * s2 + (poly_u128)h2 * s1;
+		d1 = (poly_u128)h0 * r1 + (poly_u128)h1 * r0 + (poly_u128)h2 * s2;
+		d2 = (poly_u128)h0 * r2 + (poly_u128)h1 * r1 + (poly_u128)h2 * r0;
+
+		c = (ulong64)(d0 >> 44);
+		h0 = (ulong64)d0 & POLY_MASK44;
+		d1 += c;
+		c = (ulong64)(d1 >> 44);
+		h1 = (ulong64)d1 & POLY_MASK44;
+		d2 += c;
+		c = (ulong64)(d2 >> 42);
+		h2 = (ulong64)d2 & POLY_MASK42;
+		h0 += c * 5;
+		c = h0 >> 44;
+		h0 &= POLY_MASK44;
+		h1 += c;
+	}
+
+	st->h[0] = h0;
+	st->h[1] = h1;
+	st->h[2] = h2;
+}
+
+void dropbear_poly1305_process(dropbear_poly1305_state *st,
+		const unsigned char *in, unsigned long inlen) {
+	unsigned long n;
+
+	if (st->leftover > 0) {
+		n = MIN(inlen, sizeof(st->buf) - st->leftover);
+		memcpy(st->buf + st->leftover, in, n);
+		st->leftover += n;
+		in += n;
+		inlen -= n;
+		if (st->leftover < sizeof(st->buf)) {
+			return;
+		}
+		poly1305_blocks(st, st->buf, sizeof(st->buf), CONST64(1) << 40);
+		st->leftover = 0;
+	}
+	n = inlen & ~15UL;
+	poly1305_blocks(st, in, n, CONST64(1) << 40);
+	memcpy(st->buf, in + n, inlen - n);
+	st->leftover = inlen - n;
+}
+
+void dropbear_poly1305_done(dropbear_poly1305_state *st,
+		unsigned char *tag) {
+	ulong64 h0, h1, h2, g0, g1, g2, t0, t1, c;
+
+	if (st->leftover > 0) {
+		st->buf[st->leftover] = 1;
+		memset(st->buf + st->leftover + 1, 0,
+				sizeof(st->buf) - st->leftover - 1);
+		poly1305_blocks(st, st->buf, sizeof(st->buf), 0);
+	}
+
+	/* fully carry h */
+	h0 = st->h[0];
+	h1 = st->h[1];
+	h2 = st->h[2];
+	c = h1 >> 44; h1 &= POLY_MASK44;
+	h2 += c; c = h2 >> 42; h2 &= POLY_MASK42;
+	h0 += c * 5; c = h0 >> 44; h0 &= POLY_MASK44;
+	h1 += c; c = h1 >> 44; h1 &= POLY_MASK44;
+	h2 += c; c = h2 >> 42; h2 &= POLY_MASK42;
+	h0 += c * 5; c = h0 >> 44; h0 &= POLY_MASK44;
+	h1 += c;
+
+	/* g = h - p, used if it doesn't borrow */
+	g0 = h0 + 5; c = g0 >> 44; g0 &= POLY_MASK44;
+	g1 = h1 + c; c = g1 >> 44; g1 &= POLY_MASK44;
+	g2 = h2 + c - (CONST64(1) << 42);
+	c = (g2 >> 63) - 1;
+	h0 = (h0 & ~c) | (g0 & c);
+	h1 = (h1 & ~c) | (g1 & c);
+	h2 = (h2 & ~c) | (g2 & c);
+
+	/* tag = h + s mod 2^128 */
+	t0 = st->pad[0];
+	t1 = st->pad[1];
+	h0 += t0 & POLY_MASK44;
+	c = h0 >> 44; h0 &= POLY_MASK44;
+	h1 += (((t0 >> 44) | (t1 << 20)) & POLY_MASK44) + c;
+	c = h1 >> 44; h1 &= POLY_MASK44;
+	h2 += ((t1 >> 24) & POLY_MASK42) + c;
+	h2 &= POLY_MASK42;
+	STORE64L(h0 | (h1 << 44), tag);
+	STORE64L((h1 >> 20) | (h2 << 24), tag + 8);
+
+	m_burn(st, sizeof(*st));
+}
+
+#endif /* DROPBEAR_POLY1305_64 */
+
+#if DROPBEAR_CHACHA_SIMD
+
+#include <immintrin.h>
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+#define CHACHA_SCALAR 0
+#define CHACHA_SSE2 1
+#define CHACHA_AVX2 2
+
+static int chacha_simd = CHACHA_SCALAR;
+
+#define CHACHA_QR(a, b, c, d, ADD, XOR, ROTL) \
+	a = ADD(a, b); d = ROTL(XOR(d, a), 16); \
+	c = ADD(c, d); b = ROTL(XOR(b, c), 12); \
+	a = ADD(a, b); d = ROTL(XOR(d, a), 8); \
+	c = ADD(c, d); b = ROTL(XOR(b, c), 7);
+
+#define CHACHA_DOUBLEROUND(ADD, XOR, ROTL) \
+	CHACHA_QR(x[0], x[4], x[8], x[12], ADD, XOR, ROTL) \
+	CHACHA_QR(x[1], x[5], x[9], x[13], ADD, XOR, ROTL) \
+	CHACHA_QR(x[2], x[6], x[10], x[14], ADD, XOR, ROTL) \
+	CHACHA_QR(x[3], x[7], x[11], x[15], ADD, XOR, ROTL) \
+	CHACHA_QR(x[0], x[5], x[10], x[15], ADD, XOR, ROTL) \
+	CHACHA_QR(x[1], x[6], x[11], x[12], ADD, XOR, ROTL) \
+	CHACHA_QR(x[2], x[7], x[8], x[13], ADD, XOR, ROTL) \
+	CHACHA_QR(x[3], x[4], x[9], x[14], ADD, XOR, ROTL)
+
+/* Every index is a constant so the compiler can keep x[] in registers */
+/* Poly1305 of up to CHACHA_MAC_STEP bytes of maclen after each double
+ * round. The multiplies use the scalar units while the rounds use the
+ * vector ones, so they overlap. */
+#define CHACHA_MAC_STEP 48
+#if DROPBEAR_POLY1305_64
+#define CHACHA_MAC(step) do { \
+	if (maclen > 0) { \
+		unsigned long n_ = MIN(maclen, (step)); \
+		poly1305_blocks(poly, mac, n_, CONST64(1) << 40); \
+		mac += n_; \
+		maclen -= n_; \
+	} \
+} while (0)
+#else
+#define CHACHA_MAC(step)
+#endif
+
+#define CHACHA_ALL16(stmt) do { \
+	stmt(0); stmt(1); stmt(2); stmt(3); stmt(4); stmt(5); stmt(6); stmt(7); \
+	stmt(8); stmt(9); stmt(10); stmt(11); stmt(12); stmt(13); stmt(14); stmt(15); \
+} while (0)
+
+#define SSE2_ROTL(v, n) ((n) == 16 \
+	? _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1) \
+	: _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n))))
+
+/* Transposes words 4g to 4g+3 back into the four blocks and XORs them
+ * with the input */
+#define SSE2_OUT4(g) do { \
+	__m128i t0 = _mm_unpacklo_epi32(x[4*(g)], x[4*(g)+1]); \
+	__m128i t1 = _mm_unpacklo_epi32(x[4*(g)+2], x[4*(g)+3]); \
+	__m128i t2 = _mm_unpackhi_epi32(x[4*(g)], x[4*(g)+1]); \
+	__m128i t3 = _mm_unpackhi_epi32(x[4*(g)+2], x[4*(g)+3]); \
+	SSE2_XOR_OUT(_mm_unpacklo_epi64(t0, t1), 16*(g)); \
+	SSE2_XOR_OUT(_mm_unpackhi_epi64(t0, t1), 64 + 16*(g)); \
+	SSE2_XOR_OUT(_mm_unpacklo_epi64(t2, t3), 128 + 16*(g)); \
+	SSE2_XOR_OUT(_mm_unpackhi_epi64(t2, t3), 192 + 16*(g)); \
+} while (0)
+
+#define SSE2_XOR_OUT(v, off) \
+	_mm_storeu_si128((__m128i *)(out + (off)), _mm_xor_si128(v, \
+				_mm_loadu_si128((const __m128i *)(in + (off)))))
+
+/* Four blocks from the 64-bit block counter ctr, and Poly1305 of maclen
+ * bytes at mac, a multiple of 16 */
+static void chacha_sse2(const ulong32 *input, int rounds, ulong64 ctr,
+		const unsigned char *in, unsigned char *out,
+		dropbear_poly1305_state *poly, const unsigned char *mac,
+		unsigned long maclen) {
+	__m128i x[16], s[16];
+	int r;
+
+#define SSE2_INIT(i) s[i] = _mm_set1_epi32((int)input[i])
+	CHACHA_ALL16(SSE2_INIT);
+#undef SSE2_INIT
+	s[12] = _mm_set_epi32((int)(ctr + 3), (int)(ctr + 2),
+			(int)(ctr + 1), (int)ctr);
+	s[13] = _mm_set_epi32((int)((ctr + 3) >> 32), (int)((ctr + 2) >> 32),
+			(int)((ctr + 1) >> 32), (int)(ctr >> 32));
+#define SSE2_COPY(i) x[i] = s[i]
+	CHACHA_ALL16(SSE2_COPY);
+#undef SSE2_COPY
+
+	for (r = rounds; r > 0; r -= 2) {
+		CHACHA_DOUBLEROUND(_mm_add_epi32, _mm_xor_si128, SSE2_ROTL)
+		CHACHA_MAC(CHACHA_MAC_STEP);
+	}
+	CHACHA_MAC(maclen);
+
+#define SSE2_FINAL(i) x[i] = _mm_add_epi32(x[i], s[i])
+	CHACHA_ALL16(SSE2_FINAL);
+#undef SSE2_FINAL
+	SSE2_OUT4(0);
+	SSE2_OUT4(1);
+	SSE2_OUT4(2);
+	SSE2_OUT4(3);
+}
+
+#define AVX2_ROTL(v, n) ((n) == 16 \
+	? _mm256_shuffle_epi8(v, _mm256_set_epi8( \
+		13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2, \
+		13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2)) \
+	: (n) == 8 \
+	? _mm256_shuffle_epi8(v, _mm256_set_epi8( \
+		14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3, \
+		14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3)) \
+	: _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n))))
+
+/* As SSE2_OUT4, the upper 128-bit lane holds blocks four to seven */
+#define AVX2_OUT8(g) do { \
+	__m256i t0 = _mm256_unpacklo_epi32(x[4*(g)], x[4*(g)+1]); \
+	__m256i t1 = _mm256_unpacklo_epi32(x[4*(g)+2], x[4*(g)+3]); \
+	__m256i t2 = _mm256_unpackhi_epi32(x[4*(g)], x[4*(g)+1]); \
+	__m256i t3 = _mm256_unpackhi_epi32(x[4*(g)+2], x[4*(g)+3]); \
+	AVX2_XOR_OUT(_mm256_unpacklo_epi64(t0, t1), 16*(g)); \
+	AVX2_XOR_OUT(_mm256_unpackhi_epi64(t0, t1), 64 + 16*(g)); \
+	AVX2_XOR_OUT(_mm256_unpacklo_epi64(t2, t3), 128 + 16*(g)); \
+	AVX2_XOR_OUT(_mm256_unpackhi_epi64(t2, t3), 192 + 16*(g)); \
+} while (0)
+
+#define AVX2_XOR_OUT(v, off) do { \
+	__m256i v_ = (v); \
+	SSE2_XOR_OUT(_mm256_castsi256_si128(v_), off); \
+	SSE2_XOR_OUT(_mm256_extracti128_si256(v_, 1), 256 + (off)); \
+} while (0)
+
+/* As chacha_sse2() with eight blocks */
+static AVX2_TARGET void chacha_avx2(const ulong32 *input, int rounds,
+		ulong64 ctr, const unsigned char *in, unsigned char *out,
+		dropbear_poly1305_state *poly, const unsigned char *mac,
+		unsigned long maclen) {
+	__m256i x[16], s[16];
+	int r;
+
+#define AVX2_INIT(i) s[i] = _mm256_set1_epi32((int)input[i])
+	CHACHA_ALL16(AVX2_INIT);
+#undef AVX2_INIT
+	s[12] = _mm256_set_epi32((int)(ctr + 7), (int)(ctr + 6),
+			(int)(ctr + 5), (int)(ctr + 4), (int)(ctr + 3),
+			(int)(ctr + 2), (int)(ctr + 1), (int)ctr);
+	s[13] = _mm256_set_epi32((int)((ctr + 7) >> 32), (int)((ctr + 6) >> 32),
+			(int)((ctr + 5) >> 32), (int)((ctr + 4) >> 32),
+			(int)((ctr + 3) >> 32), (int)((ctr + 2) >> 32),
+			(int)((ctr + 1) >> 32), (int)(ctr >> 32));
+#define AVX2_COPY(i) x[i] = s[i]
+	CHACHA_ALL16(AVX2_COPY);
+#undef AVX2_COPY
+
+	for (r = rounds; r > 0; r -= 2) {
+		CHACHA_DOUBLEROUND(_mm256_add_epi32, _mm256_xor_si256, AVX2_ROTL)
+		CHACHA_MAC(CHACHA_MAC_STEP);
+	}
+	CHACHA_MAC(maclen);
+
+#define AVX2_FINAL(i) x[i] = _mm256_add_epi32(x[i], s[i])
+	CHACHA_ALL16(AVX2_FINAL);
+#undef AVX2_FINAL
+	AVX2_OUT8(0);
+	AVX2_OUT8(1);
+	AVX2_OUT8(2);
+	AVX2_OUT8(3);
+	_mm256_zeroupper();
+}
+
+#endif /* DROPBEAR_CHACHA_SIMD */
+
+int dropbear_chacha_crypt(chacha_state *st, const unsigned char *in,
+		unsigned long inlen, unsigned char *out) {
+#if DROPBEAR_CHACHA_SIMD
+	ulong64 ctr;
+
+	if (chacha_simd != CHACHA_SCALAR && st->ksleft == 0 && st->ivlen == 8
+			&& inlen >= 256) {
+		ctr = ((ulong64)st->input[13] << 32) | st->input[12];
+		if (chacha_simd == CHACHA_AVX2) {
+			for (; inlen >= 512; inlen -= 512, in += 512, out += 512) {
+				chacha_avx2(st->input, st->rounds, ctr, in, out,
+						NULL, NULL, 0);
+				ctr += 8;
+			}
+		}
+		for (; inlen >= 256; inlen -= 256, in += 256, out += 256) {
+			chacha_sse2(st->input, st->rounds, ctr, in, out,
+					NULL, NULL, 0);
+			ctr += 4;
+		}
+		st->input[12] = (ulong32)ctr;
+		st->input[13] = (ulong32)(ctr >> 32);
+	}
+#endif
+	/* the rest, and anything the kernels don't handle */
+	return chacha_crypt(st, in, inlen, out);
+}
+
+
+/* Payload bytes each pass covers before the other one reads them, small
+ * enough to stay in L1 */
+#define CHACHAPOLY_CHUNK 1024
+/* keystream blocks generated at once with the Poly1305 key block */
+#define CHACHAPOLY_FIRST_BLOCKS 8
+
+static void xor_bytes(unsigned char *out, const unsigned char *in,
+		const unsigned char *ks, unsigned long len) {
+	ulong64 a, b;
+
+	for (; len >= 8; len -= 8, in += 8, out += 8, ks += 8) {
+		memcpy(&a, in, 8);
+		memcpy(&b, ks, 8);
+		a ^= b;
+		memcpy(out, &a, 8);
+	}
+	for (; len > 0; len--) {
+		*out++ = *in++ ^ *ks++;
+	}
+}
+
+/* How far the MAC input must be authenticated before the payload up to
+ * end is written. Decryption may be in place so has to be ahead,
+ * encryption can only cover what is already written. Whole blocks apart
+ * from the end of the input. */
+static unsigned long chachapoly_mac_target(int direction, unsigned long aadlen,
+		unsigned long done, unsigned long end, unsigned long maclen) {
+	if (direction == LTC_DECRYPT) {
+		return MIN(maclen, (aadlen + end + 15) & ~15UL);
+	}
+	return (aadlen + done) & ~15UL;
+}
+
+#define CHACHAPOLY_MAC_UPTO(target) do { \
+	dropbear_poly1305_process(&poly, mac + macdone, (target) - macdone); \
+	macdone = (target); \
+} while (0)
+
+int dropbear_chachapoly_fused(chacha_state *st, const unsigned char *aad,
+		unsigned long aadlen, const unsigned char *in, unsigned char *out,
+		unsigned long len, unsigned char *tag, int direction) {
+	unsigned char ks[64 * CHACHAPOLY_FIRST_BLOCKS];
+	dropbear_poly1305_state poly;
+	const unsigned char *mac = aad;
+	unsigned long maclen = aadlen + len, macdone = 0, done, n;
+	int err;
+
+	/* Block 0 is the Poly1305 key. It comes from the same kernel pass as
+	 * the first payload blocks rather than a block of its own. */
+	n = MIN(sizeof(ks), 64 + ((len + 63) & ~63UL));
+	memset(ks, 0, n);
+	if ((err = dropbear_chacha_crypt(st, ks, n, ks)) != CRYPT_OK) {
+		return err;
+	}
+	dropbear_poly1305_init(&poly, ks);
+
+	n = MIN(len, n - 64);
+	CHACHAPOLY_MAC_UPTO(chachapoly_mac_target(direction, aadlen, 0, n, maclen));
+	xor_bytes(out, in, ks + 64, n);
+	done = n;
+
+#if DROPBEAR_CHACHA_SIMD && DROPBEAR_POLY1305_64
+	/* the kernels run Poly1305 alongside the rounds */
+	if (chacha_simd != CHACHA_SCALAR) {
+		ulong64 ctr = ((ulong64)st->input[13] << 32) | st->input[12];
+		unsigned long bs = chacha_simd == CHACHA_AVX2 ? 512 : 256, target;
+
+		for (; len - done >= bs; done += bs, ctr += bs / 64) {
+			target = chachapoly_mac_target(direction, aadlen, done,
+					done + bs, maclen);
+			if (target % 16 != 0) {
+				/* the partial last block of a decryption */
+				CHACHAPOLY_MAC_UPTO(target);
+			}
+			n = target - macdone;
+			if (chacha_simd == CHACHA_AVX2) {
+				chacha_avx2(st->input, st->rounds, ctr, in + done,
+						out + done, &poly, mac + macdone, n);
+			} else {
+				chacha_sse2(st->input, st->rounds, ctr, in + done,
+						out + done, &poly, mac + macdone, n);
+			}
+			macdone += n;
+		}
+		st->input[12] = (ulong32)ctr;
+		st->input[13] = (ulong32)(ctr >> 32);
+	}
+#endif
+
+	/* otherwise MAC then decrypt, or encrypt then MAC, a chunk at a time */
+	for (; done < len; done += n) {
+		n = MIN(len - done, CHACHAPOLY_CHUNK);
+		if (direction == LTC_DECRYPT) {
+			CHACHAPOLY_MAC_UPTO(aadlen + done + n);
+		}
+		if ((err = dropbear_chacha_crypt(st, in + done, n,
+					out + done)) != CRYPT_OK) {
+			break;
+		}
+		if (direction == LTC_ENCRYPT) {
+			CHACHAPOLY_MAC_UPTO(aadlen + done + n);
+		}
+	}
+
+	CHACHAPOLY_MAC_UPTO(maclen);
+	dropbear_poly1305_done(&poly, tag);
+	m_burn(ks, sizeof(ks));
+	return err;
+}
+
+/* RFC 8439 section 2.5.2 for Poly1305. ChaCha20 with the vector kernels
+ * must match libtomcrypt across a carry into the high counter word and
+ * through the AVX2, SSE2 and scalar stages. */
+static int chachapoly_accel_test(void) {
+	static const unsigned char poly_key[32] = {
+		0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33,
+		0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+		0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd,
+		0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b };
+	static const unsigned char poly_msg[] = "Cryptographic Forum Research Group";
+	static const unsigned char poly_tag[16] = {
+		0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6,
+		0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9 };
+	dropbear_poly1305_state poly;
+	unsigned char tag[16];
+#if DROPBEAR_CHACHA_SIMD
+	unsigned char key[32], iv[8], buf[2][512 + 256 + 64 + 23];
+	chacha_state st[2];
+	int i;
+#endif
+
+	/* split to go through the partial block path */
+	dropbear_poly1305_init(&poly, poly_key);
+	dropbear_poly1305_process(&poly, poly_msg, 5);
+	dropbear_poly1305_process(&poly, poly_msg + 5, sizeof(poly_msg) - 1 - 5);
+	dropbear_poly1305_done(&poly, tag);
+	if (memcmp(tag, poly_tag, sizeof(tag)) != 0) {
+		return CRYPT_FAIL_TESTVECTOR;
+	}
+
+#if DROPBEAR_CHACHA_SIMD
+	for (i = 0; i < (int)sizeof(key); i++) {
+		key[i] = i;
+	}
+	memset(iv, 0x5a, sizeof(iv));
+	for (i = 0; i < 2; i++) {
+		memset(buf[i], 0x3c, sizeof(buf[i]));
+		if (chacha_setup(&st[i], key, sizeof(key), 20) != CRYPT_OK
+				|| chacha_ivctr64(&st[i], iv, sizeof(iv),
+					CONST64(0xfffffffa)) != CRYPT_OK) {
+			return CRYPT_FAIL_TESTVECTOR;
+		}
+	}
+	if (chacha_crypt(&st[0], buf[0], sizeof(buf[0]), buf[0]) != CRYPT_OK
+			|| dropbear_chacha_crypt(&st[1], buf[1], sizeof(buf[1]),
+				buf[1]) != CRYPT_OK
+			|| memcmp(buf[0], buf[1], sizeof(buf[0])) != 0
+			|| memcmp(st[0].input, st[1].input, sizeof(st[0].input)) != 0) {
+		return CRYPT_FAIL_TESTVECTOR;
+	}
+#endif
+	return CRYPT_OK;
+}
+
+void dropbear_chachapoly_accel_init() {
+	static int done = 0;
+
+	if (done) {
+		return;
+	}
+	done = 1;
+
+#if DROPBEAR_CHACHA_SIMD
+	/* SSE2 is part of x86-64 */
+	chacha_simd = CHACHA_SSE2;
+	if (dropbear_cpu_features() & DROPBEAR_CPU_AVX2) {
+		chacha_simd = CHACHA_AVX2;
+	}
+	while (chachapoly_accel_test() != CRYPT_OK) {
+		if (chacha_simd == CHACHA_SCALAR) {
+			dropbear_exit("Poly1305 self test failed");
+		}
+		dropbear_log(LOG_WARNING, "ChaCha20 self test failed, trying slower code");
+		chacha_simd--;
+	}
+	TRACE(("chacha20 kernel %d", chacha_simd))
+#else
+	if (chachapoly_accel_test() != CRYPT_OK) {
+		dropbear_exit("Poly1305 self test failed");
+	}
+#endif
+}
+
+#endif /* DROPBEAR_CHACHA20POLY1305 */
@@ -0,0 +1,85 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_CHACHAPOLY_ACCEL_H_
+#define DROPBEAR_CHACHAPOLY_ACCEL_H_
+
+#include "includes.h"
+
+#if DROPBEAR_CHACHA20POLY1305
+
+/* Picks the fastest implementations that pass their self tests, called
+ * before first use */
+void dropbear_chachapoly_accel_init(void);
+
+/* chacha_crypt() for states set up with chacha_ivctr64(). Whole blocks
+ * go through the SSE2 or AVX2 kernels when the CPU has them. */
+int dropbear_chacha_crypt(chacha_state *st, const unsigned char *in,
+		unsigned long inlen, unsigned char *out);
+
+#if defined(__SIZEOF_INT128__)
+#define DROPBEAR_POLY1305_64 1
+#else
+#define DROPBEAR_POLY1305_64 0
+#endif
+
+#if DROPBEAR_POLY1305_64
+/* Poly1305 with three 44/44/42 bit limbs and 128-bit products */
+typedef struct {
+	ulong64 r[3];
+	ulong64 h[3];
+	ulong64 pad[2];
+	unsigned char buf[16];
+	unsigned long leftover;
+} dropbear_poly1305_state;
+
+void dropbear_poly1305_init(dropbear_poly1305_state *st,
+		const unsigned char *key);
+void dropbear_poly1305_process(dropbear_poly1305_state *st,
+		const unsigned char *in, unsigned long inlen);
+void dropbear_poly1305_done(dropbear_poly1305_state *st, unsigned char *tag);
+#else
+/* libtomcrypt's 26-bit limb code where there is no 128-bit type */
+typedef poly1305_state dropbear_poly1305_state;
+#define dropbear_poly1305_init(st, key) poly1305_init((st), (key), 32)
+#define dropbear_poly1305_process(st, in, inlen) \
+	poly1305_process((st), (in), (inlen))
+#define dropbear_poly1305_done(st, tag) do { \
+	unsigned long taglen_ = 16; \
+	poly1305_done((st), (tag), &taglen_); \
+} while (0)
+#endif /* DROPBEAR_POLY1305_64 */
+
+/* ChaCha20 of len bytes from block 1 of st, which has the IV set at block
+ * 0, and the Poly1305 tag keyed by block 0 over aad then the ciphertext.
+ * aad must directly precede the ciphertext, in for decryption and out for
+ * encryption. Authentication runs alongside the cipher rather than as a
+ * second pass over the packet. */
+int dropbear_chachapoly_fused(chacha_state *st, const unsigned char *aad,
+		unsigned long aadlen, const unsigned char *in, unsigned char *out,
+		unsigned long len, unsigned char *tag, int direction);
+
+#endif /* DROPBEAR_CHACHA20POLY1305 */
+
+#endif /* DROPBEAR_CHACHAPOLY_ACCEL_H_ */
@@ -27,6 +27,7 @@
 #include "algo.h"
 #include "dbutil.h"
 #include "chachapoly.h"
+#include "chachapoly-accel.h"
 
 #if DROPBEAR_CHACHA20POLY1305
 
@@ -38,7 +39,7 @@
 static const struct ltc_cipher_descriptor dummy = {.name = NULL};
 
 static const struct dropbear_hash dropbear_chachapoly_mac =
-	{NULL, POLY1305_KEY_LEN, POLY1305_TAG_LEN};
+	{NULL, POLY1305_KEY_LEN, POLY1305_TAG_LEN, 0, 0};
 
 const struct dropbear_cipher dropbear_chachapoly =
 	{&dummy, CHACHA20_KEY_LEN*2, CHACHA20_BLOCKSIZE};
@@ -54,6 +55,8 @@ static int dropbear_chachapoly_start(int UNUSED(cipher), const unsigned char* UN
 		return CRYPT_ERROR;
 	}
 
+	dropbear_chachapoly_accel_init();
+
 	if ((err = chacha_setup(&state->chacha, key,
 				CHACHA20_KEY_LEN, 20)) != CRYPT_OK) {
 		return err;
@@ -72,8 +75,7 @@ static int dropbear_chachapoly_crypt(unsigned int seq,
 			const unsigned char *in, unsigned char *out,
 			unsigned long len, unsigned long taglen,
 			dropbear_chachapoly_state *state, int direction) {
-	poly1305_state poly;
-	unsigned char seqbuf[8], key[POLY1305_KEY_LEN], tag[POLY1305_TAG_LEN];
+	unsigned char seqbuf[8], tag[POLY1305_TAG_LEN];
 	int err;
 
 	TRACE2(("enter dropbear_chachapoly_crypt"))
@@ -83,33 +85,31 @@ static int dropbear_chachapoly_crypt(unsigned int seq,
 	}
 
 	STORE64H((uint64_t)seq, seqbuf);
+	chacha_ivctr64(&state->header, seqbuf, sizeof(seqbuf), 0);
 	chacha_ivctr64(&state->chacha, seqbuf, sizeof(seqbuf), 0);
-	if ((err = chacha_keystream(&state->chacha, key, sizeof(key))) != CRYPT_OK) {
-		return err;
-	}
 
-	poly1305_init(&poly, key, sizeof(key));
+	/* the MAC covers the encrypted length, then the payload ciphertext */
 	if (direction == LTC_DECRYPT) {
-		poly1305_process(&poly, in, len);
-		poly1305_done(&poly, tag, &taglen);
+		if ((err = dropbear_chachapoly_fused(&state->chacha, in, 4,
+					in + 4, out + 4, len - 4, tag, direction)) != CRYPT_OK) {
+			return err;
+		}
 		if (constant_time_memcmp(in + len, tag, taglen) != 0) {
+			/* don't leave unauthenticated plaintext around */
+			m_burn(out + 4, len - 4);
 			return CRYPT_ERROR;
 		}
-	}
-
-	chacha_ivctr64(&state->header, seqbuf, sizeof(seqbuf), 0);
-	if ((err = chacha_crypt(&state->header, in, 4, out)) != CRYPT_OK) {
-		return err;
-	}
-
-	chacha_ivctr64(&state->chacha, seqbuf, sizeof(seqbuf), 1);
-	if ((err = chacha_crypt(&state->chacha, in + 4, len - 4, out + 4)) != CRYPT_OK) {
-		return err;
-	}
-
-	if (direction == LTC_ENCRYPT) {
-		poly1305_process(&poly, out, len);
-		poly1305_done(&poly, out + len, &taglen);
+		if ((err = chacha_crypt(&state->header, in, 4, out)) != CRYPT_OK) {
+			return err;
+		}
+	} else {
+		if ((err = chacha_crypt(&state->header, in, 4, out)) != CRYPT_OK) {
+			return err;
+		}
+		if ((err = dropbear_chachapoly_fused(&state->chacha, out, 4,
+					in + 4, out + 4, len - 4, out + len, direction)) != CRYPT_OK) {
+			return err;
+		}
 	}
 
 	TRACE2(("leave dropbear_chachapoly_crypt"))
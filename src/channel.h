@@ -40,6 +40,15 @@
 
 #define CHAN_EXTEND_SIZE 3 /* how many extra slots to add when we need more */
 
+/* channelio() serves channel reads by class, pty sessions ahead of bulk */
+#define CHAN_SCHED_INTERACTIVE 0
+#define CHAN_SCHED_BULK 1
+#define CHAN_SCHED_CLASSES 2
+
+/* sched_ready flags */
+#define CHAN_SCHED_READFD 1
+#define CHAN_SCHED_ERRFD 2
+
 struct ChanType;
 
 struct Channel {
@@ -80,6 +89,39 @@ struct Channel {
 	const struct ChanType* type;
 
 	enum dropbear_prio prio;
+
+	/* fds registered for readiness by setchannelfds() */
+	int pollfds[3];
+	unsigned int npollfds;
+
+	/* Read scheduling, see channelio(). While sched_ready is set the
+	channel is on the class's list and deficit is the byte allowance it
+	has left */
+	struct Channel *sched_prev, *sched_next;
+	unsigned int sched_class;
+	unsigned int sched_ready;
+	/* sched_ready flags for fds reported readable this wakeup, others
+	may be found empty */
+	unsigned int sched_polled;
+	int deficit;
+
+	/* The window to keep granted, opts.recv_window unless auto-tuned. The
+	buffers are at least this size, bigger while a larger window that
+	was granted earlier is still outstanding */
+	unsigned int recvmaxwindow;
+	/* Bytes written to the local side per round trip, the window is
+	extended early when what's left is less than this */
+	unsigned int recvbdp;
+	struct timespec tune_start;
+	unsigned int tune_bytes;
+	time_t tune_last;
+};
+
+/* A run of bulk channel data on the write queue, ending once the session
+ * has queued "end" bytes in total */
+struct ChanQueued {
+	unsigned int end;
+	unsigned int len;
 };
 
 struct ChanType {
@@ -103,8 +145,11 @@ void channel_connect_done(int result, int sock, void* user_data, const char* err
 
 void chaninitialise(const struct ChanType *chantypes[]);
 void chancleanup(void);
-void setchannelfds(fd_set *readfds, fd_set *writefds, int allow_reads);
-void channelio(const fd_set *readfd, const fd_set *writefd);
+void setchannelfds(int allow_reads);
+void channelio(void);
+#if DROPBEAR_RECV_WINDOW_AUTOTUNE
+void channel_idle_windows(time_t now);
+#endif
 struct Channel* getchannel(void);
 /* Returns an arbitrary channel that is in a ready state - not
 being initialised and no EOF in either direction. NULL if none. */
@@ -130,4 +130,58 @@ void cbuf_incrread(circbuffer *cbuf, unsigned int len) {
 	dropbear_assert(cbuf->used >= len);
 	cbuf->used -= len;
 	cbuf->readpos = (cbuf->readpos + len) % cbuf->size;
+	if (cbuf->used == 0) {
+		/* start over so the next write gets the whole buffer linearly */
+		cbuf->readpos = cbuf->writepos = 0;
+	}
+}
+
+void cbuf_resize(circbuffer *cbuf, unsigned int size) {
+	unsigned char *p1, *p2;
+	unsigned int len1, len2;
+	unsigned char *data = NULL;
+
+	if (size > MAX_CBUF_SIZE || size < cbuf->used) {
+		dropbear_exit("Bad cbuf size");
+	}
+
+	if (cbuf->used > 0) {
+		data = m_malloc(size);
+		cbuf_readptrs(cbuf, &p1, &len1, &p2, &len2);
+		memcpy(data, p1, len1);
+		if (len2 > 0) {
+			memcpy(&data[len1], p2, len2);
+		}
+	}
+	if (cbuf->data) {
+		m_burn(cbuf->data, cbuf->size);
+		m_free(cbuf->data);
+	}
+	cbuf->data = data;
+	cbuf->size = size;
+	cbuf->readpos = 0;
+	cbuf->writepos = cbuf->used % size;
+}
+
+/* Returns the whole of the buffer's storage, eg to register it with the
+ * kernel */
+unsigned char* cbuf_storage(circbuffer *cbuf) {
+	if (!cbuf->data) {
+		cbuf->data = m_malloc(cbuf->size);
+	}
+	return cbuf->data;
+}
+
+/* Like cbuf_incrwrite(), for len bytes written at ptr, which was
+ * cbuf_writeptr() when the write started. If the buffer emptied in the
+ * meantime cbuf_incrread() will have moved the positions back to the
+ * start, the data is still where it was written */
+void cbuf_incrwrite_at(circbuffer *cbuf, const unsigned char *ptr, unsigned int len) {
+	unsigned int pos = ptr - cbuf->data;
+
+	if (pos != cbuf->writepos) {
+		dropbear_assert(cbuf->used == 0 && pos < cbuf->size);
+		cbuf->readpos = cbuf->writepos = pos;
+	}
+	cbuf_incrwrite(cbuf, len);
 }
@@ -49,4 +49,12 @@ void cbuf_readptrs(const circbuffer *cbuf,
 unsigned char* cbuf_writeptr(circbuffer *cbuf, unsigned int len);
 void cbuf_incrwrite(circbuffer *cbuf, unsigned int len);
 void cbuf_incrread(circbuffer *cbuf, unsigned int len);
+/* Changes the size, keeping the contents. An empty buffer's storage is
+ * freed, to be allocated again on the next write */
+void cbuf_resize(circbuffer *cbuf, unsigned int size);
+
+/* For writes that complete after the caller has moved on, see
+ * cbuf_incrwrite_at() */
+unsigned char* cbuf_storage(circbuffer *cbuf);
+void cbuf_incrwrite_at(circbuffer *cbuf, const unsigned char *ptr, unsigned int len);
 #endif
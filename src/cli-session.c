@@ -50,8 +50,8 @@ static void cli_recv_msg_channel_failure(void);
 
 struct clientsession cli_ses; /* GLOBAL */
 
-/* Sorted in decreasing frequency will be more efficient - data and window
- * should be first */
+/* Loaded into a direct lookup table by set_packet_handlers(), so the
+ * order here doesn't matter */
 static const packettype cli_packettypes[] = {
 	/* TYPE, FUNCTION */
 	{SSH_MSG_CHANNEL_DATA, recv_msg_channel_data},
@@ -177,7 +177,7 @@ static void cli_session_init(pid_t proxy_cmd_pid) {
 	ses.extra_session_cleanup = cli_session_cleanup;
 
 	/* packet handlers */
-	ses.packettypes = cli_packettypes;
+	set_packet_handlers(cli_packettypes);
 
 	ses.isserver = 0;
 
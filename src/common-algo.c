@@ -32,6 +32,8 @@
 #include "ecc.h"
 #include "gcm.h"
 #include "chachapoly.h"
+#include "umac.h"
+#include "aesni.h"
 #include "ssh.h"
 
 /* This file (algo.c) organises the ciphers which can be used, and is used to
@@ -84,11 +86,15 @@ const struct dropbear_cipher_mode dropbear_mode_none =
 	{void_start, void_cipher, void_cipher, NULL, NULL, NULL};
 
 #if DROPBEAR_ENABLE_CTR_MODE
-/* a wrapper to make ctr_start and cbc_start look the same */
+/* a wrapper to make ctr_start and cbc_start look the same. AES switches
+ * to the AES-NI cipher when the CPU has it. */
 static int dropbear_big_endian_ctr_start(int cipher, 
 		const unsigned char *IV, 
 		const unsigned char *key, int keylen, 
 		int num_rounds, symmetric_CTR *ctr) {
+#if DROPBEAR_AESNI
+	cipher = dropbear_aesni_select(cipher);
+#endif
 	return ctr_start(cipher, IV, key, keylen, num_rounds, CTR_COUNTER_BIG_ENDIAN, ctr);
 }
 const struct dropbear_cipher_mode dropbear_mode_ctr =
@@ -96,27 +102,49 @@ const struct dropbear_cipher_mode dropbear_mode_ctr =
 #endif /* DROPBEAR_ENABLE_CTR_MODE */
 
 /* Mapping of ssh hashes to libtomcrypt hashes, including keysize etc.
-   {&hash_desc, keysize, hashsize} */
+   {&hash_desc, keysize, hashsize, umac, etm} */
 
 #if DROPBEAR_SHA1_HMAC
 static const struct dropbear_hash dropbear_sha1 = 
-	{&sha1_desc, 20, 20};
+	{&sha1_desc, 20, 20, 0, 0};
 #endif
 #if DROPBEAR_SHA1_96_HMAC
 static const struct dropbear_hash dropbear_sha1_96 = 
-	{&sha1_desc, 20, 12};
+	{&sha1_desc, 20, 12, 0, 0};
 #endif
 #if DROPBEAR_SHA2_256_HMAC
 static const struct dropbear_hash dropbear_sha2_256 = 
-	{&sha256_desc, 32, 32};
+	{&sha256_desc, 32, 32, 0, 0};
 #endif
 #if DROPBEAR_SHA2_512_HMAC
 static const struct dropbear_hash dropbear_sha2_512 =
-	{&sha512_desc, 64, 64};
+	{&sha512_desc, 64, 64, 0, 0};
+#endif
+#if DROPBEAR_UMAC
+static const struct dropbear_hash dropbear_umac64 =
+	{NULL, UMAC_KEY_LEN, 8, 1, 0};
+static const struct dropbear_hash dropbear_umac128 =
+	{NULL, UMAC_KEY_LEN, 16, 1, 0};
+#endif
+#if DROPBEAR_ETM_MAC
+#if DROPBEAR_UMAC
+static const struct dropbear_hash dropbear_umac64_etm =
+	{NULL, UMAC_KEY_LEN, 8, 1, 1};
+static const struct dropbear_hash dropbear_umac128_etm =
+	{NULL, UMAC_KEY_LEN, 16, 1, 1};
+#endif
+#if DROPBEAR_SHA2_256_HMAC
+static const struct dropbear_hash dropbear_sha2_256_etm =
+	{&sha256_desc, 32, 32, 0, 1};
+#endif
+#if DROPBEAR_SHA2_512_HMAC
+static const struct dropbear_hash dropbear_sha2_512_etm =
+	{&sha512_desc, 64, 64, 0, 1};
 #endif
+#endif /* DROPBEAR_ETM_MAC */
 
 const struct dropbear_hash dropbear_nohash =
-	{NULL, 16, 0}; /* used initially */
+	{NULL, 16, 0, 0, 0}; /* used initially */
 	
 
 /* The following map ssh names to internal values.
@@ -170,6 +198,22 @@ algo_type sshciphers[] = {
 };
 
 algo_type sshhashes[] = {
+#if DROPBEAR_ETM_MAC
+#if DROPBEAR_UMAC
+	{"umac-64-etm@openssh.com", 0, &dropbear_umac64_etm, 1, NULL},
+	{"umac-128-etm@openssh.com", 0, &dropbear_umac128_etm, 1, NULL},
+#endif
+#if DROPBEAR_SHA2_256_HMAC
+	{"hmac-sha2-256-etm@openssh.com", 0, &dropbear_sha2_256_etm, 1, NULL},
+#endif
+#if DROPBEAR_SHA2_512_HMAC
+	{"hmac-sha2-512-etm@openssh.com", 0, &dropbear_sha2_512_etm, 1, NULL},
+#endif
+#endif /* DROPBEAR_ETM_MAC */
+#if DROPBEAR_UMAC
+	{"umac-64@openssh.com", 0, &dropbear_umac64, 1, NULL},
+	{"umac-128@openssh.com", 0, &dropbear_umac128, 1, NULL},
+#endif
 #if DROPBEAR_SHA1_96_HMAC
 	{"hmac-sha1-96", 0, &dropbear_sha1_96, 1, NULL},
 #endif
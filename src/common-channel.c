@@ -35,6 +35,7 @@
 #include "listener.h"
 #include "runopts.h"
 #include "netio.h"
+#include "dbpoll.h"
 
 static void send_msg_channel_open_failure(unsigned int remotechan, int reason,
 		const char *text, const char *lang);
@@ -45,13 +46,33 @@ static int writechannel(struct Channel* channel, int fd, circbuffer *cbuf,
 	const unsigned char *moredata, unsigned int *morelen);
 static void send_msg_channel_window_adjust(const struct Channel *channel,
 		unsigned int incr);
-static void send_msg_channel_data(struct Channel *channel, int isextended);
+static int send_msg_channel_data(struct Channel *channel, int isextended,
+		int draining, int *filled);
+static unsigned int drain_channel_fd(struct Channel *channel, int isextended,
+		int draining, unsigned int limit, int *more);
 static void send_msg_channel_eof(struct Channel *channel);
 static void send_msg_channel_close(struct Channel *channel);
 static void remove_channel(struct Channel *channel);
 static unsigned int write_pending(const struct Channel * channel);
 static void check_close(struct Channel *channel);
 static void close_chan_fd(struct Channel *channel, int fd, int how);
+static void mark_channel_fds(const struct Channel *channel);
+static void update_channel_fds(struct Channel *channel);
+static void unregister_channel_fds(struct Channel *channel);
+static void sched_channel_read(struct Channel *channel, unsigned int which);
+static void sched_push(struct Channel *channel);
+static void sched_unlink(struct Channel *channel);
+static unsigned int sched_class_room(unsigned int class);
+static void schedule_channel_reads(void);
+static unsigned int channel_sched_class(const struct Channel *channel);
+static void channel_queue_add(unsigned int len);
+static void channel_queue_written(void);
+static void check_recv_window(struct Channel *channel);
+static void send_recv_window(struct Channel *channel);
+static void shrink_recv_buffers(struct Channel *channel);
+#if DROPBEAR_RECV_WINDOW_AUTOTUNE
+static void tune_recv_window(struct Channel *channel, unsigned int drained);
+#endif
 
 #define FD_UNINIT (-2)
 #define FD_CLOSED (-1)
@@ -75,6 +96,18 @@ void chaninitialise(const struct ChanType *chantypes[]) {
 	ses.channels[0] = NULL;
 	ses.chancount = 0;
 
+	ses.chandirtylist = m_malloc(sizeof(unsigned int));
+	ses.chandirty = m_malloc(1);
+	ses.chandirty[0] = 0;
+	ses.chandirtycount = 0;
+
+	memset(ses.chanschedhead, 0, sizeof(ses.chanschedhead));
+	memset(ses.chanschedtail, 0, sizeof(ses.chanschedtail));
+	ses.chanqueued = NULL;
+	ses.chanqueuedsize = ses.chanqueuedhead = ses.chanqueuedcount = 0;
+	ses.chanbulkqueued = 0;
+	ses.chaninteractive = 1;
+
 	ses.chantypes = chantypes;
 
 #if DROPBEAR_LISTENERS
@@ -96,6 +129,9 @@ void chancleanup() {
 		}
 	}
 	m_free(ses.channels);
+	m_free(ses.chandirtylist);
+	m_free(ses.chandirty);
+	m_free(ses.chanqueued);
 	TRACE(("leave chancleanup"))
 }
 
@@ -129,12 +165,17 @@ static struct Channel* newchannel(unsigned int remotechan,
 		/* extend the channels */
 		ses.channels = (struct Channel**)m_realloc(ses.channels,
 				(ses.chansize+CHAN_EXTEND_SIZE)*sizeof(struct Channel*));
+		ses.chandirtylist = m_realloc(ses.chandirtylist,
+				(ses.chansize+CHAN_EXTEND_SIZE)*sizeof(unsigned int));
+		ses.chandirty = m_realloc(ses.chandirty,
+				ses.chansize+CHAN_EXTEND_SIZE);
 
 		ses.chansize += CHAN_EXTEND_SIZE;
 
 		/* set the new channels to null */
 		for (j = i; j < ses.chansize; j++) {
 			ses.channels[j] = NULL;
+			ses.chandirty[j] = 0;
 		}
 
 	}
@@ -161,12 +202,26 @@ static struct Channel* newchannel(unsigned int remotechan,
 	newchan->extrabuf = NULL; /* The user code can set it up */
 	newchan->recvdonelen = 0;
 	newchan->recvmaxpacket = RECV_MAX_CHANNEL_DATA_LEN;
+	newchan->recvmaxwindow = opts.recv_window;
+	newchan->recvbdp = 0;
+	newchan->tune_bytes = 0;
+	newchan->tune_last = 0;
 
 	newchan->prio = DROPBEAR_PRIO_NORMAL;
 
+	newchan->npollfds = 0;
+
+	newchan->sched_prev = newchan->sched_next = NULL;
+	newchan->sched_class = CHAN_SCHED_BULK;
+	newchan->sched_ready = newchan->sched_polled = 0;
+	newchan->deficit = 0;
+
 	ses.channels[i] = newchan;
 	ses.chancount++;
 
+	/* fds are filled out by the caller */
+	mark_channel_fds(newchan);
+
 	TRACE(("leave newchannel"))
 
 	return newchan;
@@ -188,6 +243,8 @@ static struct Channel* getchannel_msg(const char* kind) {
 			dropbear_exit("Unknown channel %d", chan);
 		}
 	}
+	/* Handlers may change the channel's fds, buffers or window */
+	mark_channel_fds(ses.channels[chan]);
 	return ses.channels[chan];
 }
 
@@ -195,65 +252,78 @@ struct Channel* getchannel() {
 	return getchannel_msg(NULL);
 }
 
-/* Iterate through the channels, performing IO if available */
-void channelio(const fd_set *readfds, const fd_set *writefds) {
+/* Perform IO for one of a channel's fds which is ready */
+static void channel_fd_io(struct Channel *channel, int fd, unsigned int ready) {
+
+	/* data to send over the wire, read by schedule_channel_reads() */
+	if ((ready & DBPOLL_READ) && fd == channel->readfd) {
+		TRACE(("send normal readfd"))
+		sched_channel_read(channel, CHAN_SCHED_READFD);
+	}
+
+	if ((ready & DBPOLL_READ) && ERRFD_IS_READ(channel)
+		&& fd == channel->errfd) {
+			TRACE(("send normal errfd"))
+			sched_channel_read(channel, CHAN_SCHED_ERRFD);
+	}
+
+	/* write to program/pipe stdin */
+	if ((ready & DBPOLL_WRITE) && fd == channel->writefd) {
+		writechannel(channel, channel->writefd, channel->writebuf, NULL, NULL);
+	}
+	
+	/* stderr for client mode */
+	if ((ready & DBPOLL_WRITE) && ERRFD_IS_WRITE(channel)
+			&& fd == channel->errfd) {
+		writechannel(channel, channel->errfd, channel->extrabuf, NULL, NULL);
+	}
+}
+
+/* Perform IO for the channels with ready fds. Writes to the channels are
+ * done straight away, reads are then scheduled between channels by
+ * schedule_channel_reads() */
+void channelio() {
 
 	/* Listeners such as TCP, X11, agent-auth */
 	struct Channel *channel;
 	unsigned int i;
+	int fd;
 
-	/* foreach channel */
-	for (i = 0; i < ses.chansize; i++) {
-		/* Close checking only needs to occur for channels that had IO events */
-		int do_check_close = 0;
+	/* Credit the channels with what the socket has sent */
+	channel_queue_written();
 
-		channel = ses.channels[i];
+	/* Only channels with IO events need visiting */
+	for (i = 0; i < dbpoll_nready(); i++) {
+		fd = dbpoll_ready_fd(i);
+		channel = dbpoll_data(fd);
 		if (channel == NULL) {
-			/* only process in-use channels */
+			/* not a channel fd, or the channel has gone */
 			continue;
 		}
 
-		/* read data and send it over the wire */
-		if (channel->readfd >= 0 && FD_ISSET(channel->readfd, readfds)) {
-			TRACE(("send normal readfd"))
-			send_msg_channel_data(channel, 0);
-			do_check_close = 1;
-		}
+		channel_fd_io(channel, fd, dbpoll_ready(fd));
+		mark_channel_fds(channel);
 
-		/* read stderr data and send it over the wire */
-		if (ERRFD_IS_READ(channel) && channel->errfd >= 0 
-			&& FD_ISSET(channel->errfd, readfds)) {
-				TRACE(("send normal errfd"))
-				send_msg_channel_data(channel, 1);
-			do_check_close = 1;
-		}
+		/* handle any channel closing etc */
+		check_close(channel);
+	}
 
-		/* write to program/pipe stdin */
-		if (channel->writefd >= 0 && FD_ISSET(channel->writefd, writefds)) {
-			writechannel(channel, channel->writefd, channel->writebuf, NULL, NULL);
-			do_check_close = 1;
-		}
-		
-		/* stderr for client mode */
-		if (ERRFD_IS_WRITE(channel)
-				&& channel->errfd >= 0 && FD_ISSET(channel->errfd, writefds)) {
-			writechannel(channel, channel->errfd, channel->extrabuf, NULL, NULL);
-			do_check_close = 1;
-		}
+	schedule_channel_reads();
 
-		if (ses.channel_signal_pending) {
-			/* SIGCHLD can change channel state for server sessions */
-			do_check_close = 1;
-		}
-	
-		/* handle any channel closing etc */
-		if (do_check_close) {
+	if (ses.channel_signal_pending) {
+		/* SIGCHLD can change channel state for server sessions */
+		for (i = 0; i < ses.chansize; i++) {
+			channel = ses.channels[i];
+			if (channel == NULL) {
+				continue;
+			}
+			mark_channel_fds(channel);
 			check_close(channel);
 		}
 	}
 
 #if DROPBEAR_LISTENERS
-	handle_listeners(readfds);
+	handle_listeners();
 #endif
 }
 
@@ -341,6 +411,7 @@ void channel_connect_done(int result, int sock, void* user_data, const char* err
 		channel->readfd = channel->writefd = sock;
 		channel->bidir_fd = 1;
 		channel->conn_pending = NULL;
+		mark_channel_fds(channel);
 		send_msg_channel_open_confirmation(channel, channel->recvwindow,
 				channel->recvmaxpacket);
 		TRACE(("leave channel_connect_done: success"))
@@ -499,6 +570,7 @@ static int writechannel_writev(struct Channel* channel, int fd, circbuffer *cbuf
 static int writechannel(struct Channel* channel, int fd, circbuffer *cbuf,
 	const unsigned char *moredata, unsigned int *morelen) {
 	int ret = DROPBEAR_SUCCESS;
+	unsigned int donebefore = channel->recvdonelen;
 	TRACE(("enter writechannel fd %d", fd))
 #ifdef HAVE_WRITEV
 	ret = writechannel_writev(channel, fd, cbuf, moredata, morelen);
@@ -506,14 +578,17 @@ static int writechannel(struct Channel* channel, int fd, circbuffer *cbuf,
 	ret = writechannel_fallback(channel, fd, cbuf, moredata, morelen);
 #endif
 
-	/* Window adjust handling */
-	if (channel->recvdonelen >= RECV_WINDOWEXTEND) {
-		send_msg_channel_window_adjust(channel, channel->recvdonelen);
-		channel->recvwindow += channel->recvdonelen;
-		channel->recvdonelen = 0;
+#if DROPBEAR_RECV_WINDOW_AUTOTUNE
+	tune_recv_window(channel, channel->recvdonelen - donebefore);
+#else
+	(void)donebefore;
+#endif
+	check_recv_window(channel);
+	if (morelen == NULL) {
+		shrink_recv_buffers(channel);
 	}
 
-	dropbear_assert(channel->recvwindow <= opts.recv_window);
+	dropbear_assert(channel->recvwindow <= MAX_RECV_WINDOW);
 	dropbear_assert(channel->recvwindow <= cbuf_getavail(channel->writebuf));
 	dropbear_assert(channel->extrabuf == NULL ||
 			channel->recvwindow <= cbuf_getavail(channel->extrabuf));
@@ -522,54 +597,319 @@ static int writechannel(struct Channel* channel, int fd, circbuffer *cbuf,
 	return ret;
 }
 
+/* Extends the remote side's window by what has been written out locally.
+ * That is batched up to a third of the window, but sent sooner when the
+ * sender could otherwise run out of window within a round trip */
+static void check_recv_window(struct Channel *channel) {
+	if (channel->recvdonelen < RECV_WINDOWEXTEND(channel)
+			&& !(channel->recvwindow < channel->recvbdp
+				&& channel->recvdonelen >= channel->recvmaxpacket)) {
+		return;
+	}
+	send_recv_window(channel);
+}
 
-/* Set the file descriptors for the main select in session.c
- * This avoid channels which don't have any window available, are closed, etc*/
-void setchannelfds(fd_set *readfds, fd_set *writefds, int allow_reads) {
-	
+static void send_recv_window(struct Channel *channel) {
+	unsigned int incr = 0;
+
+	/* A window that has been shrunk isn't topped up past its new size */
+	if (channel->recvwindow < channel->recvmaxwindow) {
+		incr = MIN(channel->recvdonelen,
+				channel->recvmaxwindow - channel->recvwindow);
+	}
+	if (incr > 0) {
+		send_msg_channel_window_adjust(channel, incr);
+		channel->recvwindow += incr;
+	}
+	channel->recvdonelen = 0;
+}
+
+/* Drops the channel's buffers back to the size of its window once a
+ * larger window is no longer outstanding, freeing their storage while
+ * they are empty. Not for use while a received packet is still being
+ * copied in */
+static void shrink_recv_buffers(struct Channel *channel) {
+	unsigned int size;
+
+	if (channel->writebuf == NULL
+			|| channel->writebuf->size <= channel->recvmaxwindow
+			|| channel->recvdonelen > 0) {
+		return;
+	}
+	if (cbuf_getused(channel->writebuf) > 0
+			|| (channel->extrabuf && cbuf_getused(channel->extrabuf) > 0)) {
+		return;
+	}
+
+	size = MAX(channel->recvmaxwindow, channel->recvwindow);
+	TRACE(("shrink_recv_buffers channel %d to %d", channel->index, size))
+	cbuf_resize(channel->writebuf, size);
+	if (channel->extrabuf) {
+		cbuf_resize(channel->extrabuf, size);
+	}
+}
+
+#if DROPBEAR_RECV_WINDOW_AUTOTUNE
+/* The session socket's smoothed round trip time in microseconds, or 0 if
+ * unknown. Sampled at most once a second */
+static unsigned int session_rtt() {
+	time_t now = monotonic_now();
+
+	if (now != ses.sock_rtt_time) {
+		ses.sock_rtt = get_sock_rtt(ses.sock_in);
+		ses.sock_rtt_time = now;
+	}
+	return ses.sock_rtt;
+}
+
+/* The buffers grow by as much as the window, they can be larger than
+ * recvmaxwindow still from an earlier window that was shrunk while idle.
+ * shrink_recv_buffers() trims that once they are empty */
+static void grow_recv_window(struct Channel *channel, unsigned int window) {
+	unsigned int incr = window - channel->recvmaxwindow;
+
+	TRACE(("grow_recv_window channel %d from %d to %d", channel->index,
+		channel->recvmaxwindow, window))
+	if (channel->recvmaxwindow <= opts.recv_window) {
+		ses.chantuned++;
+	}
+	ses.chantunedbytes += incr;
+	cbuf_resize(channel->writebuf, channel->writebuf->size + incr);
+	if (channel->extrabuf) {
+		cbuf_resize(channel->extrabuf, channel->extrabuf->size + incr);
+	}
+	channel->recvmaxwindow = window;
+	/* Granted with the next window adjust */
+	channel->recvdonelen += incr;
+}
+
+/* Measures how fast the local side takes the channel's data. When half
+ * the window or more is written out each round trip the sender is left
+ * waiting on window adjusts, so the window is doubled, up to
+ * MAX_RECV_WINDOW and what's left of RECV_WINDOW_TUNED_MAX */
+static void tune_recv_window(struct Channel *channel, unsigned int drained) {
+	struct timespec now;
+	unsigned long long us, per_rtt;
+	unsigned int rtt, window, room;
+
+	if (drained == 0 || channel->writebuf == NULL) {
+		return;
+	}
+
+	gettime_wrapper(&now);
+	channel->tune_last = now.tv_sec;
+	if (channel->tune_bytes == 0) {
+		channel->tune_start = now;
+	}
+	channel->tune_bytes += drained;
+
+	rtt = session_rtt();
+	if (rtt == 0) {
+		/* Not TCP, eg a proxy command */
+		channel->tune_bytes = 0;
+		return;
+	}
+
+	us = (unsigned long long)(now.tv_sec - channel->tune_start.tv_sec) * 1000000
+		+ now.tv_nsec / 1000 - channel->tune_start.tv_nsec / 1000;
+	if (us < MAX(rtt, RECV_WINDOW_TUNE_MIN_US)) {
+		return;
+	}
+
+	per_rtt = (unsigned long long)channel->tune_bytes * rtt / us;
+	channel->recvbdp = MIN(per_rtt, MAX_RECV_WINDOW);
+	channel->tune_bytes = 0;
+
+	if (per_rtt * 2 >= channel->recvmaxwindow
+			&& channel->recvmaxwindow < MAX_RECV_WINDOW) {
+		window = MIN(2 * MAX(channel->recvmaxwindow, channel->recvbdp),
+				MAX_RECV_WINDOW);
+		room = RECV_WINDOW_TUNED_MAX - ses.chantunedbytes;
+		if (window - channel->recvmaxwindow > room) {
+			TRACE(("tune_recv_window channel %d limited, %d tuned in total",
+				channel->index, ses.chantunedbytes))
+			window = channel->recvmaxwindow + room;
+		}
+		if (window > channel->recvmaxwindow) {
+			grow_recv_window(channel, window);
+		}
+	}
+}
+
+/* Puts the windows of channels that have had no data for
+ * RECV_WINDOW_IDLE_SECS back to opts.recv_window, freeing their buffers */
+void channel_idle_windows(time_t now) {
+	struct Channel *channel;
 	unsigned int i;
-	struct Channel * channel;
-	
-	for (i = 0; i < ses.chansize; i++) {
 
+	for (i = 0; i < ses.chansize && ses.chantuned > 0; i++) {
 		channel = ses.channels[i];
-		if (channel == NULL) {
+		if (channel == NULL
+				|| channel->recvmaxwindow <= opts.recv_window
+				|| now - channel->tune_last < RECV_WINDOW_IDLE_SECS) {
 			continue;
 		}
 
-		/* Stuff to put over the wire. 
-		Avoid queueing data to send if we're in the middle of a 
-		key re-exchange (!dataallowed), but still read from the 
-		FD if there's the possibility of "~."" to kill an 
-		interactive session (the read_mangler) */
-		if (channel->transwindow > 0
-		   && ((ses.dataallowed && allow_reads) || channel->read_mangler)) {
+		TRACE(("channel %d idle, window back to %d", channel->index,
+			opts.recv_window))
+		ses.chantunedbytes -= channel->recvmaxwindow - opts.recv_window;
+		channel->recvmaxwindow = opts.recv_window;
+		channel->recvbdp = 0;
+		channel->tune_bytes = 0;
+		ses.chantuned--;
+		if (!channel->sent_close) {
+			send_recv_window(channel);
+		}
+		shrink_recv_buffers(channel);
+	}
+}
+#endif /* DROPBEAR_RECV_WINDOW_AUTOTUNE */
 
-			if (channel->readfd >= 0) {
-				FD_SET(channel->readfd, readfds);
-			}
-			
-			if (ERRFD_IS_READ(channel) && channel->errfd >= 0) {
-					FD_SET(channel->errfd, readfds);
-			}
+
+/* Have setchannelfds() update the channel's fd interest, after its fds,
+ * buffers or window may have changed */
+static void mark_channel_fds(const struct Channel *channel) {
+	unsigned int i = channel->index;
+
+	if (!ses.chandirty[i]) {
+		ses.chandirty[i] = 1;
+		ses.chandirtylist[ses.chandirtycount] = i;
+		ses.chandirtycount++;
+	}
+}
+
+static void add_channel_fd(int *fds, unsigned int *want, unsigned int *nfds,
+		int fd, unsigned int fdwant) {
+	unsigned int i;
+
+	if (fd < 0) {
+		return;
+	}
+	/* readfd, writefd and errfd may be the same fd */
+	for (i = 0; i < *nfds; i++) {
+		if (fds[i] == fd) {
+			want[i] |= fdwant;
+			return;
+		}
+	}
+	fds[*nfds] = fd;
+	want[*nfds] = fdwant;
+	(*nfds)++;
+}
+
+/* Register what the channel's fds should be waited on for. This avoids
+ * channels which don't have any window available, are closed, etc */
+static void update_channel_fds(struct Channel *channel) {
+	int fds[3];
+	unsigned int want[3];
+	unsigned int nfds = 0, i, j;
+	unsigned int readwant;
+
+	/* Stuff to put over the wire. 
+	Avoid queueing data to send if we're in the middle of a 
+	key re-exchange (!dataallowed), but still read from the 
+	FD if there's the possibility of "~."" to kill an 
+	interactive session (the read_mangler). setchannelfds()
+	gates bulk channels as a group, and works out whether
+	interactive ones may be read. */
+	readwant = DBPOLL_READ_GATED;
+	if (channel_sched_class(channel) == CHAN_SCHED_INTERACTIVE) {
+		readwant = (channel->read_mangler || ses.chaninteractive)
+			? DBPOLL_READ : 0;
+	}
+	if (channel->transwindow > 0 && readwant) {
+		add_channel_fd(fds, want, &nfds, channel->readfd, readwant);
+		if (ERRFD_IS_READ(channel)) {
+			add_channel_fd(fds, want, &nfds, channel->errfd, readwant);
 		}
+	}
+
+	/* Stuff from the wire */
+	if (channel->writefd >= 0 && cbuf_getused(channel->writebuf) > 0) {
+		add_channel_fd(fds, want, &nfds, channel->writefd, DBPOLL_WRITE);
+	}
+
+	if (ERRFD_IS_WRITE(channel) && channel->errfd >= 0 
+			&& cbuf_getused(channel->extrabuf) > 0) {
+		add_channel_fd(fds, want, &nfds, channel->errfd, DBPOLL_WRITE);
+	}
 
-		/* Stuff from the wire */
-		if (channel->writefd >= 0 && cbuf_getused(channel->writebuf) > 0) {
-				FD_SET(channel->writefd, writefds);
+	/* Stop waiting on fds that are no longer wanted. The number may
+	 * have been closed and reused by something else */
+	for (i = 0; i < channel->npollfds; i++) {
+		int fd = channel->pollfds[i];
+		for (j = 0; j < nfds; j++) {
+			if (fds[j] == fd) {
+				break;
+			}
+		}
+		if (j == nfds && dbpoll_data(fd) == channel) {
+			dbpoll_set(fd, 0, NULL);
 		}
+	}
+
+	for (i = 0; i < nfds; i++) {
+		dbpoll_set(fds[i], want[i], channel);
+		channel->pollfds[i] = fds[i];
+	}
+	channel->npollfds = nfds;
+}
+
+static void unregister_channel_fds(struct Channel *channel) {
+	unsigned int i;
 
-		if (ERRFD_IS_WRITE(channel) && channel->errfd >= 0 
-				&& cbuf_getused(channel->extrabuf) > 0) {
-				FD_SET(channel->errfd, writefds);
+	for (i = 0; i < channel->npollfds; i++) {
+		if (dbpoll_data(channel->pollfds[i]) == channel) {
+			dbpoll_set(channel->pollfds[i], 0, NULL);
 		}
+	}
+	channel->npollfds = 0;
+}
 
-	} /* foreach channel */
+/* Update fd interest for channels which have changed since the last
+ * call. Only those channels are visited, so this is cheap with many
+ * idle channels */
+void setchannelfds(int allow_reads) {
+	
+	unsigned int i;
+	struct Channel * channel;
+	int interactive;
+
+	/* The socket may have written bulk data since channelio(), that
+	 * must be credited before the gate is worked out */
+	channel_queue_written();
+
+	/* Bulk channels are only read while their data on the write queue
+	 * is under CHANNEL_QUEUE_BULK_BYTES, so keystrokes don't wait behind
+	 * more than that */
+	dbpoll_gate(ses.dataallowed && allow_reads
+		&& ses.chanbulkqueued < CHANNEL_QUEUE_BULK_BYTES);
+
+	/* Interactive channels may go past that, up to the whole queue.
+	 * They aren't gated, so their fds are registered again when that
+	 * changes */
+	interactive = ses.dataallowed && allow_reads;
+	if (interactive != ses.chaninteractive) {
+		ses.chaninteractive = interactive;
+		for (i = 0; i < ses.chansize; i++) {
+			channel = ses.channels[i];
+			if (channel != NULL && channel_sched_class(channel)
+					== CHAN_SCHED_INTERACTIVE) {
+				mark_channel_fds(channel);
+			}
+		}
+	}
 
-#if DROPBEAR_LISTENERS
-	set_listener_fds(readfds);
-#endif
+	for (i = 0; i < ses.chandirtycount; i++) {
+		unsigned int index = ses.chandirtylist[i];
 
+		ses.chandirty[index] = 0;
+		channel = ses.channels[index];
+		if (channel != NULL) {
+			update_channel_fds(channel);
+		}
+	}
+	ses.chandirtycount = 0;
 }
 
 /* handle the channel EOF event, by closing the channel filedescriptor. The
@@ -613,6 +953,16 @@ static void remove_channel(struct Channel * channel) {
 	TRACE(("enter remove_channel"))
 	TRACE(("channel index is %d", channel->index))
 
+	/* Some fds (the client's stdout) aren't closed below */
+	unregister_channel_fds(channel);
+	if (channel->sched_ready) {
+		sched_unlink(channel);
+	}
+	if (channel->recvmaxwindow > opts.recv_window) {
+		ses.chantuned--;
+		ses.chantunedbytes -= channel->recvmaxwindow - opts.recv_window;
+	}
+
 	cbuf_free(channel->writebuf);
 	channel->writebuf = NULL;
 
@@ -675,12 +1025,277 @@ void recv_msg_channel_request() {
 
 }
 
+/* Which class a channel's reads are scheduled in. Bulk channels share
+ * CHANNEL_QUEUE_BULK_BYTES of the write queue, interactive ones are only
+ * limited by the queue as a whole */
+static unsigned int channel_sched_class(const struct Channel *channel) {
+	if (channel->prio == DROPBEAR_PRIO_LOWDELAY || channel->read_mangler) {
+		return CHAN_SCHED_INTERACTIVE;
+	}
+	return CHAN_SCHED_BULK;
+}
+
+/* Notes a readable channel fd for schedule_channel_reads(). The
+ * read_mangler's fd is waited on during key exchange and with the write
+ * queue full, it is read straight away then so the wait doesn't keep
+ * returning for it */
+static void sched_channel_read(struct Channel *channel, unsigned int which) {
+	int filled;
+
+	if (!ses.dataallowed || (channel->read_mangler
+			&& ses.writequeue_len >= TRANS_QUEUE_MAX_BYTES)) {
+		send_msg_channel_data(channel, which == CHAN_SCHED_ERRFD, 0, &filled);
+		return;
+	}
+	if (!channel->sched_ready) {
+		channel->sched_class = channel_sched_class(channel);
+		channel->deficit = 0;
+		sched_push(channel);
+	}
+	channel->sched_ready |= which;
+	channel->sched_polled |= which;
+}
+
+/* Appends a channel to its class's schedule */
+static void sched_push(struct Channel *channel) {
+	unsigned int class = channel->sched_class;
+
+	channel->sched_next = NULL;
+	channel->sched_prev = ses.chanschedtail[class];
+	if (ses.chanschedtail[class]) {
+		ses.chanschedtail[class]->sched_next = channel;
+	} else {
+		ses.chanschedhead[class] = channel;
+	}
+	ses.chanschedtail[class] = channel;
+}
+
+static void sched_unlink(struct Channel *channel) {
+	unsigned int class = channel->sched_class;
+
+	if (channel->sched_prev) {
+		channel->sched_prev->sched_next = channel->sched_next;
+	} else {
+		ses.chanschedhead[class] = channel->sched_next;
+	}
+	if (channel->sched_next) {
+		channel->sched_next->sched_prev = channel->sched_prev;
+	} else {
+		ses.chanschedtail[class] = channel->sched_prev;
+	}
+	channel->sched_prev = channel->sched_next = NULL;
+}
+
+/* Gives a scheduled channel its turn to read, topping up its deficit.
+ * It goes to the back of the schedule if it may have more to send, and
+ * keeps whatever deficit it didn't use. Returns the bytes queued, the
+ * channel may have been closed on return */
+static unsigned int serve_channel(struct Channel *channel) {
+	unsigned int before = ses.writequeue_len;
+	unsigned int limit, sent = 0;
+	int more;
+
+	sched_unlink(channel);
+
+	channel->deficit += channel->sched_class == CHAN_SCHED_INTERACTIVE
+		? 4*CHANNEL_QUANTUM_BYTES : CHANNEL_QUANTUM_BYTES;
+	limit = channel->deficit > 0 ? (unsigned int)channel->deficit : 0;
+	limit = MIN(limit, sched_class_room(channel->sched_class));
+
+	if (channel->sent_close) {
+		channel->sched_ready = 0;
+	}
+
+	if (channel->sched_ready & CHAN_SCHED_ERRFD) {
+		more = 0;
+		if (limit > 0 && ERRFD_IS_READ(channel) && channel->errfd >= 0) {
+			sent += drain_channel_fd(channel, 1,
+					!(channel->sched_polled & CHAN_SCHED_ERRFD), limit, &more);
+		}
+		if (!more && limit > 0) {
+			channel->sched_ready &= ~CHAN_SCHED_ERRFD;
+		}
+	}
+	if ((channel->sched_ready & CHAN_SCHED_READFD) && sent < limit) {
+		more = 0;
+		if (channel->readfd >= 0) {
+			sent += drain_channel_fd(channel, 0,
+					!(channel->sched_polled & CHAN_SCHED_READFD),
+					limit - sent, &more);
+		}
+		if (!more) {
+			channel->sched_ready &= ~CHAN_SCHED_READFD;
+		}
+	}
+
+	channel->sched_polled = 0;
+	channel->deficit -= sent;
+	if (channel->sched_class == CHAN_SCHED_BULK) {
+		channel_queue_add(ses.writequeue_len - before);
+	}
+
+	if (channel->sched_ready) {
+		/* More to read, possibly once the queue has room */
+		sched_push(channel);
+	} else {
+		channel->deficit = 0;
+	}
+
+	mark_channel_fds(channel);
+	check_close(channel);
+	return ses.writequeue_len - before;
+}
+
+/* Bytes the class may still add to the write queue */
+static unsigned int sched_class_room(unsigned int class) {
+	unsigned int room = 0;
+
+	if (ses.writequeue_len < TRANS_QUEUE_MAX_BYTES) {
+		room = TRANS_QUEUE_MAX_BYTES - ses.writequeue_len;
+	}
+	if (class == CHAN_SCHED_BULK) {
+		room = MIN(room, ses.chanbulkqueued < CHANNEL_QUEUE_BULK_BYTES
+			? CHANNEL_QUEUE_BULK_BYTES - ses.chanbulkqueued : 0);
+	}
+	return room;
+}
+
+/* Reads from the scheduled channels, deficit round robin, until they're
+ * drained or the write queue has no room for them. Each round serves the
+ * interactive class before the bulk class, so keystrokes don't wait
+ * behind a bulk channel that happens to have a lower index or fd */
+static void schedule_channel_reads() {
+	struct Channel *channel, *last;
+	unsigned int class;
+	int progress, end;
+
+	if (!ses.dataallowed) {
+		return;
+	}
+
+	do {
+		progress = 0;
+		for (class = 0; class < CHAN_SCHED_CLASSES; class++) {
+			/* one turn each for the channels listed at the start of
+			 * the round, those served go to the back */
+			last = ses.chanschedtail[class];
+			end = (last == NULL);
+			while (!end && sched_class_room(class) > 0) {
+				channel = ses.chanschedhead[class];
+				if (channel == NULL) {
+					break;
+				}
+				end = (channel == last);
+				if (serve_channel(channel) > 0) {
+					progress = 1;
+				}
+			}
+		}
+	} while (progress && ses.writequeue_len < TRANS_QUEUE_MAX_BYTES);
+}
+
+/* Records len bytes of bulk channel data just added to the write queue */
+static void channel_queue_add(unsigned int len) {
+	struct ChanQueued *ent;
+	unsigned int i;
+
+	if (len == 0) {
+		return;
+	}
+	ses.chanbulkqueued += len;
+
+	if (ses.chanqueuedcount > 0) {
+		ent = &ses.chanqueued[(ses.chanqueuedhead + ses.chanqueuedcount - 1)
+			% ses.chanqueuedsize];
+		if (ent->end == ses.transqueued - len) {
+			/* nothing else was queued in between */
+			ent->end = ses.transqueued;
+			ent->len += len;
+			return;
+		}
+	}
+
+	if (ses.chanqueuedcount == ses.chanqueuedsize) {
+		/* grow, unwrapping the ring */
+		struct ChanQueued *ring = m_malloc(
+				(ses.chanqueuedsize + CHAN_EXTEND_SIZE) * sizeof(*ring));
+		for (i = 0; i < ses.chanqueuedcount; i++) {
+			ring[i] = ses.chanqueued[(ses.chanqueuedhead + i)
+				% ses.chanqueuedsize];
+		}
+		m_free(ses.chanqueued);
+		ses.chanqueued = ring;
+		ses.chanqueuedsize += CHAN_EXTEND_SIZE;
+		ses.chanqueuedhead = 0;
+	}
+
+	ent = &ses.chanqueued[(ses.chanqueuedhead + ses.chanqueuedcount)
+		% ses.chanqueuedsize];
+	ent->end = ses.transqueued;
+	ent->len = len;
+	ses.chanqueuedcount++;
+}
+
+/* Takes runs that the socket has finished writing off the bulk total,
+ * setchannelfds() opens the gate again once it is under
+ * CHANNEL_QUEUE_BULK_BYTES */
+static void channel_queue_written() {
+	const unsigned int written = ses.transqueued - ses.writequeue_len;
+	struct ChanQueued *ent;
+
+	while (ses.chanqueuedcount > 0) {
+		ent = &ses.chanqueued[ses.chanqueuedhead];
+		if ((int)(written - ent->end) < 0) {
+			break;
+		}
+		ses.chanbulkqueued -= ent->len;
+		ses.chanqueuedhead = (ses.chanqueuedhead + 1) % ses.chanqueuedsize;
+		ses.chanqueuedcount--;
+	}
+}
+
+/* Sends packets from a readable channel fd until it would block, the
+ * window closes, or limit bytes have been sent. A fast producer then
+ * gets several packets per loop wakeup rather than one. draining is set
+ * if even the first read may find the fd empty. more is set if it
+ * stopped at the limit with the fd possibly not empty. Returns the bytes
+ * sent */
+static unsigned int drain_channel_fd(struct Channel *channel, int isextended,
+		int draining, unsigned int limit, int *more) {
+
+	unsigned int total = 0;
+	int filled = 0;
+	int len;
+
+	*more = 0;
+	len = send_msg_channel_data(channel, isextended, draining, &filled);
+	while (len > 0) {
+		total += len;
+		/* a short read means the fd is probably empty, saving the
+		 * read() that would return EAGAIN */
+		if (!filled) {
+			break;
+		}
+		if (total >= limit) {
+			*more = 1;
+			break;
+		}
+		len = send_msg_channel_data(channel, isextended, 1, &filled);
+	}
+	TRACE(("drain_channel_fd: %u bytes", total))
+	return total;
+}
+
 /* Reads data from the server's program/shell/etc, and puts it in a
  * channel_data packet to send.
  * chan is the remote channel, isextended is 0 if it is normal data, 1
  * if it is extended data. if it is extended, then the type is in
- * exttype */
-static void send_msg_channel_data(struct Channel *channel, int isextended) {
+ * exttype. draining is set for reads which may find the fd empty, rather
+ * than just reported readable. filled is set if the read used all the space
+ * in the packet.
+ * Returns the number of bytes sent, 0 if nothing was */
+static int send_msg_channel_data(struct Channel *channel, int isextended,
+		int draining, int *filled) {
 
 	int len;
 	size_t maxlen, size_pos;
@@ -707,7 +1322,7 @@ static void send_msg_channel_data(struct Channel *channel, int isextended) {
 	TRACE(("maxlen %zd", maxlen))
 	if (maxlen == 0) {
 		TRACE(("leave send_msg_channel_data: no window"))
-		return;
+		return 0;
 	}
 
 	buf_putbyte(ses.writepayload, 
@@ -724,17 +1339,19 @@ static void send_msg_channel_data(struct Channel *channel, int isextended) {
 	len = read(fd, buf_getwriteptr(ses.writepayload, maxlen), maxlen);
 
 	if (len <= 0) {
-		if (len == 0 || errno != EINTR) {
+		if (len == 0 || (errno != EINTR
+				&& !(draining && (errno == EAGAIN || errno == EWOULDBLOCK)))) {
 			/* This will also get hit in the case of EAGAIN. The only
-			time we expect to receive EAGAIN is when we're flushing a FD,
-			in which case it can be treated the same as EOF */
+			time we expect to receive EAGAIN for a readable fd is when
+			we're flushing a FD, in which case it can be treated the same
+			as EOF */
 			close_chan_fd(channel, fd, SHUT_RD);
 		}
 		buf_setpos(ses.writepayload, 0);
 		buf_setlen(ses.writepayload, 0);
 		TRACE(("leave send_msg_channel_data: len %d read err %d or EOF for fd %d", 
 					len, errno, fd))
-		return;
+		return 0;
 	}
 
 	if (channel->read_mangler) {
@@ -742,11 +1359,12 @@ static void send_msg_channel_data(struct Channel *channel, int isextended) {
 		if (len == 0) {
 			buf_setpos(ses.writepayload, 0);
 			buf_setlen(ses.writepayload, 0);
-			return;
+			return 0;
 		}
 	}
 
 	TRACE(("send_msg_channel_data: len %d fd %d", len, fd))
+	*filled = ((size_t)len == maxlen);
 	buf_incrwritepos(ses.writepayload, len);
 	/* ... real size here */
 	buf_setpos(ses.writepayload, size_pos);
@@ -756,6 +1374,7 @@ static void send_msg_channel_data(struct Channel *channel, int isextended) {
 
 	encrypt_packet();
 	TRACE(("leave send_msg_channel_data"))
+	return len;
 }
 
 /* We receive channel data */
@@ -807,7 +1426,7 @@ void common_recv_msg_channel_data(struct Channel *channel, int fd,
 
 	dropbear_assert(channel->recvwindow >= datalen);
 	channel->recvwindow -= datalen;
-	dropbear_assert(channel->recvwindow <= opts.recv_window);
+	dropbear_assert(channel->recvwindow <= MAX_RECV_WINDOW);
 
 	/* Attempt to write the data immediately without having to put it in the circular buffer */
 	consumed = datalen;
@@ -833,6 +1452,7 @@ void common_recv_msg_channel_data(struct Channel *channel, int fd,
 			buf_incrpos(ses.payload, buflen);
 			len -= buflen;
 		}
+		shrink_recv_buffers(channel);
 	}
 
 	TRACE(("leave recv_msg_channel_data"))
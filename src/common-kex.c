@@ -49,6 +49,7 @@ static void read_kex_algos(void);
 /* helper function for gen_new_keys */
 static void hashkeys(unsigned char *out, unsigned int outlen, 
 		const hash_state * hs, const unsigned char X);
+static void mac_precompute(struct key_context_directional *key);
 
 
 /* Send our list of algorithms we can use */
@@ -132,6 +133,9 @@ static void switch_keys() {
 	}
 	if (ses.kexstate.recvnewkeys && ses.newkeys->recv.valid) {
 		TRACE(("switch_keys recv"))
+#if DROPBEAR_CRYPTO_THREADS
+		packet_crypt_switch_recv();
+#endif
 #ifndef DISABLE_ZLIB
 		gen_new_zstream_recv();
 #endif
@@ -141,6 +145,9 @@ static void switch_keys() {
 	}
 	if (ses.kexstate.sentnewkeys && ses.newkeys->trans.valid) {
 		TRACE(("switch_keys trans"))
+#if DROPBEAR_CRYPTO_THREADS
+		packet_crypt_switch_trans();
+#endif
 #ifndef DISABLE_ZLIB
 		gen_new_zstream_trans();
 #endif
@@ -278,6 +285,58 @@ static void hashkeys(unsigned char *out, unsigned int outlen,
 	m_burn(&hs2, sizeof(hash_state));
 }
 
+/* Hash the HMAC ipad and opad blocks of the directional MAC key once, the
+ * resulting states are copied for each packet by make_mac(). UMAC derives
+ * all of its subkeys here instead. */
+static void mac_precompute(struct key_context_directional *key) {
+
+	const struct ltc_hash_descriptor *hash_desc = key->algo_mac->hash_desc;
+	unsigned char keyblock[MAXBLOCKSIZE];
+	unsigned char pad[MAXBLOCKSIZE];
+	unsigned long keylen, i;
+
+#if DROPBEAR_UMAC
+	if (key->algo_mac->umac) {
+		if (dropbear_umac_setup(&key->umac, key->mackey,
+					key->algo_mac->hashsize) != DROPBEAR_SUCCESS) {
+			dropbear_exit("Crypto error");
+		}
+		return;
+	}
+#endif
+
+	if (hash_desc->blocksize > sizeof(keyblock)) {
+		dropbear_exit("Crypto error");
+	}
+
+	memset(keyblock, 0x0, sizeof(keyblock));
+	keylen = key->algo_mac->keysize;
+	if (keylen > hash_desc->blocksize) {
+		hash_state hs;
+		hash_desc->init(&hs);
+		hash_desc->process(&hs, key->mackey, keylen);
+		hash_desc->done(&hs, keyblock);
+		m_burn(&hs, sizeof(hs));
+	} else {
+		memcpy(keyblock, key->mackey, keylen);
+	}
+
+	for (i = 0; i < hash_desc->blocksize; i++) {
+		pad[i] = keyblock[i] ^ 0x36;
+	}
+	hash_desc->init(&key->mac_inner);
+	hash_desc->process(&key->mac_inner, pad, hash_desc->blocksize);
+
+	for (i = 0; i < hash_desc->blocksize; i++) {
+		pad[i] = keyblock[i] ^ 0x5c;
+	}
+	hash_desc->init(&key->mac_outer);
+	hash_desc->process(&key->mac_outer, pad, hash_desc->blocksize);
+
+	m_burn(keyblock, sizeof(keyblock));
+	m_burn(pad, sizeof(pad));
+}
+
 /* Generate the actual encryption/integrity keys, using the results of the
  * key exchange, as specified in section 7.2 of the transport rfc 4253.
  * This occurs after the DH key-exchange.
@@ -363,16 +422,18 @@ static void gen_new_keys() {
 		}
 	}
 
-	if (ses.newkeys->trans.algo_mac->hash_desc != NULL) {
+	if (ses.newkeys->trans.algo_mac->hash_desc != NULL
+			|| ses.newkeys->trans.algo_mac->umac) {
 		hashkeys(ses.newkeys->trans.mackey, 
 				ses.newkeys->trans.algo_mac->keysize, &hs, mactransletter);
-		ses.newkeys->trans.hash_index = find_hash(ses.newkeys->trans.algo_mac->hash_desc->name);
+		mac_precompute(&ses.newkeys->trans);
 	}
 
-	if (ses.newkeys->recv.algo_mac->hash_desc != NULL) {
+	if (ses.newkeys->recv.algo_mac->hash_desc != NULL
+			|| ses.newkeys->recv.algo_mac->umac) {
 		hashkeys(ses.newkeys->recv.mackey, 
 				ses.newkeys->recv.algo_mac->keysize, &hs, macrecvletter);
-		ses.newkeys->recv.hash_index = find_hash(ses.newkeys->recv.algo_mac->hash_desc->name);
+		mac_precompute(&ses.newkeys->recv);
 	}
 
 	/* Ready to switch over */
@@ -555,10 +616,59 @@ void recv_msg_kexinit() {
 }
 
 #if DROPBEAR_NORMAL_DH
-static void load_dh_p(mp_int * dh_p)
+/* Parsed DH primes with q = (p-1)/2. Groups that share a prime, such as
+ * group14 with sha1 and sha256, share an entry */
+struct dh_group_cache {
+	const unsigned char *p_bytes;
+	mp_int p;
+	mp_int q;
+};
+static struct dh_group_cache dh_groups[3];
+
+static const struct dh_group_cache * load_dh_group(const struct dropbear_kex *kex)
 {
-	bytes_to_mp(dh_p, ses.newkeys->algo_kex->dh_p_bytes, 
-		ses.newkeys->algo_kex->dh_p_len);
+	struct dh_group_cache *group = NULL;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(dh_groups)/sizeof(dh_groups[0]); i++) {
+		group = &dh_groups[i];
+		if (group->p_bytes == kex->dh_p_bytes) {
+			return group;
+		}
+		if (group->p_bytes == NULL) {
+			break;
+		}
+	}
+	if (group->p_bytes != NULL) {
+		dropbear_exit("Diffie-Hellman error");
+	}
+
+	m_mp_init_multi(&group->p, &group->q, NULL);
+	bytes_to_mp(&group->p, kex->dh_p_bytes, kex->dh_p_len);
+	/* calculate q = (p-1)/2 */
+	if (mp_sub_d(&group->p, 1, &group->q) != MP_OKAY) { 
+		dropbear_exit("Diffie-Hellman error");
+	}
+	if (mp_div_2(&group->q, &group->q) != MP_OKAY) {
+		dropbear_exit("Diffie-Hellman error");
+	}
+	group->p_bytes = kex->dh_p_bytes;
+	return group;
+}
+
+/* Parses the primes of all enabled DH groups up front, so that forked
+ * sessions share them rather than each parsing their own */
+void kexdh_load_groups(void)
+{
+	unsigned int i;
+	const struct dropbear_kex *kex = NULL;
+
+	for (i = 0; sshkex[i].name != NULL; i++) {
+		kex = (const struct dropbear_kex*)sshkex[i].data;
+		if (sshkex[i].usable && kex && kex->mode == DROPBEAR_KEX_NORMAL_DH) {
+			load_dh_group(kex);
+		}
+	}
 }
 
 /* Initialises and generate one side of the diffie-hellman key exchange values.
@@ -566,38 +676,28 @@ static void load_dh_p(mp_int * dh_p)
 /* dh_pub and dh_priv MUST be already initialised */
 struct kex_dh_param *gen_kexdh_param() {
 	struct kex_dh_param *param = NULL;
+	const struct dh_group_cache *group = NULL;
 
-	DEF_MP_INT(dh_p);
-	DEF_MP_INT(dh_q);
 	DEF_MP_INT(dh_g);
 
 	TRACE(("enter gen_kexdh_vals"))
 
 	param = m_malloc(sizeof(*param));
-	m_mp_init_multi(&param->pub, &param->priv, &dh_g, &dh_p, &dh_q, NULL);
+	m_mp_init_multi(&param->pub, &param->priv, &dh_g, NULL);
 
-	/* read the prime and generator*/
-	load_dh_p(&dh_p);
+	/* the prime and generator*/
+	group = load_dh_group(ses.newkeys->algo_kex);
 	
 	mp_set_ul(&dh_g, DH_G_VAL);
 
-	/* calculate q = (p-1)/2 */
-	/* dh_priv is just a temp var here */
-	if (mp_sub_d(&dh_p, 1, &param->priv) != MP_OKAY) { 
-		dropbear_exit("Diffie-Hellman error");
-	}
-	if (mp_div_2(&param->priv, &dh_q) != MP_OKAY) {
-		dropbear_exit("Diffie-Hellman error");
-	}
-
 	/* Generate a private portion 0 < dh_priv < dh_q */
-	gen_random_mpint(&dh_q, &param->priv);
+	gen_random_mpint(&group->q, &param->priv);
 
 	/* f = g^y mod p */
-	if (mp_exptmod(&dh_g, &param->priv, &dh_p, &param->pub) != MP_OKAY) {
+	if (mp_exptmod(&dh_g, &param->priv, &group->p, &param->pub) != MP_OKAY) {
 		dropbear_exit("Diffie-Hellman error");
 	}
-	mp_clear_multi(&dh_g, &dh_p, &dh_q, NULL);
+	mp_clear(&dh_g);
 	return param;
 }
 
@@ -614,14 +714,14 @@ void free_kexdh_param(struct kex_dh_param *param)
 void kexdh_comb_key(struct kex_dh_param *param, mp_int *dh_pub_them,
 		sign_key *hostkey) {
 
-	DEF_MP_INT(dh_p);
+	const struct dh_group_cache *group = NULL;
 	DEF_MP_INT(dh_p_min1);
 	mp_int *dh_e = NULL, *dh_f = NULL;
 
-	m_mp_init_multi(&dh_p, &dh_p_min1, NULL);
-	load_dh_p(&dh_p);
+	m_mp_init(&dh_p_min1);
+	group = load_dh_group(ses.newkeys->algo_kex);
 
-	if (mp_sub_d(&dh_p, 1, &dh_p_min1) != MP_OKAY) { 
+	if (mp_sub_d(&group->p, 1, &dh_p_min1) != MP_OKAY) { 
 		dropbear_exit("Diffie-Hellman error");
 	}
 
@@ -633,12 +733,12 @@ void kexdh_comb_key(struct kex_dh_param *param, mp_int *dh_pub_them,
 	
 	/* K = e^y mod p = f^x mod p */
 	m_mp_alloc_init_multi(&ses.dh_K, NULL);
-	if (mp_exptmod(dh_pub_them, &param->priv, &dh_p, ses.dh_K) != MP_OKAY) {
+	if (mp_exptmod(dh_pub_them, &param->priv, &group->p, ses.dh_K) != MP_OKAY) {
 		dropbear_exit("Diffie-Hellman error");
 	}
 
 	/* clear no longer needed vars */
-	mp_clear_multi(&dh_p, &dh_p_min1, NULL);
+	mp_clear(&dh_p_min1);
 
 	/* From here on, the code needs to work with the _same_ vars on each side,
 	 * not vice-versaing for client/server */
@@ -668,10 +768,7 @@ void kexdh_comb_key(struct kex_dh_param *param, mp_int *dh_pub_them,
 #if DROPBEAR_ECDH
 struct kex_ecdh_param *gen_kexecdh_param() {
 	struct kex_ecdh_param *param = m_malloc(sizeof(*param));
-	if (ecc_make_key_ex(NULL, dropbear_ltc_prng, 
-		&param->key, ses.newkeys->algo_kex->ecc_curve->dp) != CRYPT_OK) {
-		dropbear_exit("ECC error");
-	}
+	dropbear_ecc_make_key(ses.newkeys->algo_kex->ecc_curve, &param->key);
 	return param;
 }
 
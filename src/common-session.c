@@ -35,6 +35,7 @@
 #include "channel.h"
 #include "runopts.h"
 #include "netio.h"
+#include "dbpoll.h"
 
 static void checktimeouts(void);
 static long select_timeout(void);
@@ -57,6 +58,9 @@ void common_session_init(int sock_in, int sock_out) {
 	ses.sock_out = sock_out;
 	ses.maxfd = MAX(sock_in, sock_out);
 
+	/* Discards any state inherited from the listener */
+	dbpoll_init();
+
 	if (sock_in >= 0) {
 		setnonblocking(sock_in);
 	}
@@ -96,14 +100,36 @@ void common_session_init(int sock_in, int sock_out) {
 	setnonblocking(ses.signal_pipe[1]);
 	ses.maxfd = MAX(ses.maxfd, ses.signal_pipe[0]);
 	ses.maxfd = MAX(ses.maxfd, ses.signal_pipe[1]);
+
+	/* We get woken up when signal handlers write to this pipe.
+	   SIGCHLD in svr-chansession is the only one currently. */
+	dbpoll_set(ses.signal_pipe[0], DBPOLL_READ, NULL);
 	}
 	
-	ses.writepayload = buf_new(TRANS_MAX_PAYLOAD_LEN);
+	memset(&ses.pktpool, 0x0, sizeof(ses.pktpool));
+	ses.writepayload = writepayload_new();
 	ses.transseq = 0;
 
+	ses.readahead = cbuf_new(RECV_READAHEAD_LEN);
+#if DROPBEAR_IO_URING
+	ses.sockio_async = dbpoll_io_available();
+	ses.readahead_bufindex = -1;
+	if (ses.sockio_async) {
+		/* lets the kernel skip mapping the ring for each read */
+		ses.readahead_bufindex = dbpoll_io_register(
+			cbuf_storage(ses.readahead), RECV_READAHEAD_LEN);
+	}
+	ses.read_inflight = ses.write_inflight = 0;
+	ses.read_eof = ses.read_error = 0;
+	ses.write_eof = ses.write_error = 0;
+#endif
 	ses.readbuf = NULL;
 	ses.payload = NULL;
 	ses.recvseq = 0;
+#if DROPBEAR_CRYPTO_THREADS
+	ses.transpipe = ses.recvpipe = NULL;
+	ses.recvframe = NULL;
+#endif
 
 	initqueue(&ses.writequeue);
 
@@ -156,35 +182,48 @@ void common_session_init(int sock_in, int sock_out) {
 
 void session_loop(void(*loophandler)(void)) {
 
-	fd_set readfd, writefd;
-	struct timeval timeout;
+	int timeout;
 	int val;
+	int sock_in_ready;
+	unsigned int sock_in_want, sock_out_want;
+	unsigned int chancount;
+	int chanclosed = 0;
+#if DROPBEAR_IO_URING
+	int sock_in_async;
+#endif
 
-	/* main loop, select()s for all sockets in use */
+	/* main loop, waits for all sockets in use */
 	for(;;) {
-		const int writequeue_has_space = (ses.writequeue_len <= 2*TRANS_MAX_PAYLOAD_LEN);
+		/* channelio() limits the bulk channels' share of the queue, so
+		this only caps the total */
+		const int writequeue_has_space = (ses.writequeue_len < TRANS_QUEUE_MAX_BYTES);
+		int readahead_pending = 0;
 
-		timeout.tv_sec = select_timeout();
-		timeout.tv_usec = 0;
-		DROPBEAR_FD_ZERO(&writefd);
-		DROPBEAR_FD_ZERO(&readfd);
+		timeout = select_timeout() * 1000;
+		sock_in_want = sock_out_want = 0;
+
+		/* no waiting before the loop handler sees a closed channel */
+		if (chanclosed) {
+			timeout = 0;
+		}
+#if DROPBEAR_IO_URING
+		sock_in_async = 0;
+#endif
 
 		dropbear_assert(ses.payload == NULL);
 
-		/* We get woken up when signal handlers write to this pipe.
-		   SIGCHLD in svr-chansession is the only one currently. */
-#if DROPBEAR_FUZZ
-		if (!fuzz.fuzzing) 
+#if DROPBEAR_CRYPTO_THREADS
+		/* Packets the crypto threads finish after this wake the wait,
+		those already finished are picked up in this iteration */
+		cryptpipe_arm();
+		packet_crypt_collect();
 #endif
-		{
-		FD_SET(ses.signal_pipe[0], &readfd);
-		}
 
 		/* set up for channels which can be read/written */
-		setchannelfds(&readfd, &writefd, writequeue_has_space);
+		setchannelfds(writequeue_has_space);
 
 		/* Pending connections to test */
-		set_connect_fds(&writefd);
+		set_connect_fds();
 
 		/* We delay reading from the input socket during initial setup until
 		after we have written out our initial KEXINIT packet (empty writequeue). 
@@ -195,39 +234,81 @@ void session_loop(void(*loophandler)(void)) {
 		if (ses.sock_in != -1 
 			&& (ses.remoteident || isempty(&ses.writequeue)) 
 			&& writequeue_has_space) {
-			FD_SET(ses.sock_in, &readfd);
+			sock_in_want = DBPOLL_READ;
+			/* Packets already sitting in the read-ahead ring
+			shouldn't wait for the socket to become readable again */
+			if (read_packet_pending()) {
+				timeout = 0;
+				readahead_pending = 1;
+			}
+#if DROPBEAR_IO_URING
+			/* Reads complete straight into the read-ahead ring rather
+			than waiting for the socket to be readable. The identification
+			string is read synchronously */
+			if (ses.sockio_async && ses.remoteident) {
+				read_packet_submit();
+				sock_in_want = 0;
+				sock_in_async = 1;
+			}
+#endif
 		}
 
 		/* Ordering is important, this test must occur after any other function
 		might have queued packets (such as connection handlers) */
 		if (ses.sock_out != -1 && !isempty(&ses.writequeue)) {
-			FD_SET(ses.sock_out, &writefd);
+			sock_out_want = DBPOLL_WRITE;
+#if DROPBEAR_IO_URING
+			if (ses.sockio_async) {
+				/* Submitted with the wait, the write itself waits for
+				the socket to have space */
+				write_packet();
+				sock_out_want = 0;
+			}
+#endif
+		}
+
+		/* The client may use a single socket for both */
+		if (ses.sock_in == ses.sock_out) {
+			dbpoll_set(ses.sock_in, sock_in_want | sock_out_want, NULL);
+		} else {
+			dbpoll_set(ses.sock_in, sock_in_want, NULL);
+			dbpoll_set(ses.sock_out, sock_out_want, NULL);
 		}
 
-		val = select(ses.maxfd+1, &readfd, &writefd, NULL, &timeout);
+		val = dbpoll_wait(timeout);
 
 		if (ses.exitflag) {
 			dropbear_exit("Terminated by signal");
 		}
 		
 		if (val < 0 && errno != EINTR) {
-			dropbear_exit("Error in select");
+			dropbear_exit("Error in %s", dbpoll_name());
 		}
 
-		if (val <= 0) {
-			/* If we were interrupted or the select timed out, we still
-			 * want to iterate over channels etc for reading, to handle
-			 * server processes exiting etc. 
-			 * We don't want to read/write FDs. */
-			DROPBEAR_FD_ZERO(&writefd);
-			DROPBEAR_FD_ZERO(&readfd);
+		/* If we were interrupted or the wait timed out, no fds are
+		 * ready but we still want to iterate over channels etc, to
+		 * handle server processes exiting etc. */
+
+		sock_in_ready = readahead_pending
+			|| (ses.sock_in != -1 && (dbpoll_ready(ses.sock_in) & DBPOLL_READ));
+#if DROPBEAR_IO_URING
+		if (sock_in_async) {
+			sock_in_ready = read_packet_pending()
+				|| ses.read_eof || ses.read_error;
 		}
+#endif
 		
 		/* We'll just empty out the pipe if required. We don't do
 		any thing with the data, since the pipe's purpose is purely to
-		wake up the select() above. */
+		wake up the wait above. */
 		ses.channel_signal_pending = 0;
-		if (FD_ISSET(ses.signal_pipe[0], &readfd)) {
+#if DROPBEAR_CRYPTO_THREADS
+		cryptpipe_notified();
+#endif
+#if DROPBEAR_FUZZ
+		if (!fuzz.fuzzing)
+#endif
+		if (dbpoll_ready(ses.signal_pipe[0]) & DBPOLL_READ) {
 			char x;
 			TRACE(("signal pipe set"))
 			while (read(ses.signal_pipe[0], &x, 1) > 0) {}
@@ -239,7 +320,7 @@ void session_loop(void(*loophandler)(void)) {
 
 		/* process session socket's incoming data */
 		if (ses.sock_in != -1) {
-			if (FD_ISSET(ses.sock_in, &readfd)) {
+			if (sock_in_ready) {
 				if (!ses.remoteident) {
 					/* blocking read of the version string */
 					read_session_identification();
@@ -248,10 +329,11 @@ void session_loop(void(*loophandler)(void)) {
 				}
 			}
 			
-			/* Process the decrypted packet. After this, the read buffer
-			 * will be ready for a new packet */
+			/* Process the decrypted packet, along with any others
+			 * already waiting in the read-ahead ring. After this, the read
+			 * buffer will be ready for a new packet */
 			if (ses.payload != NULL) {
-				process_packet();
+				process_packet_batch();
 			}
 		}
 
@@ -259,18 +341,28 @@ void session_loop(void(*loophandler)(void)) {
 		were being held up during a KEX */
 		maybe_flush_reply_queue();
 
-		handle_connect_fds(&writefd);
+		handle_connect_fds();
 
 		/* loop handler prior to channelio, in case the server loophandler closes
 		channels on process exit */
 		loophandler();
+		chancount = ses.chancount;
 
 		/* process pipes etc for the channels, ses.dataallowed == 0
 		 * during rekeying ) */
-		channelio(&readfd, &writefd);
+		channelio();
+
+		/* Channels that channelio() closed while serving reads are gone
+		after the loop handler ran. It might be waiting for that (the
+		client exits once the last channel is gone), nothing else would
+		wake the wait */
+		chanclosed = (ses.chancount < chancount);
 
 		/* process session socket's outgoing data */
 		if (ses.sock_out != -1) {
+#if DROPBEAR_CRYPTO_THREADS
+			packet_crypt_collect();
+#endif
 			if (!isempty(&ses.writequeue)) {
 				write_packet();
 			}
@@ -302,6 +394,15 @@ void session_cleanup() {
 
 	/* BEWARE of changing order of functions here. */
 
+#if DROPBEAR_IO_URING
+	/* Reads and writes in flight use the buffers freed below */
+	dbpoll_io_drain();
+#endif
+#if DROPBEAR_CRYPTO_THREADS
+	/* As do the crypto threads, along with the keys */
+	packet_crypt_cleanup();
+#endif
+
 	/* Must be before extra_session_cleanup() */
 	chancleanup();
 
@@ -318,8 +419,9 @@ void session_cleanup() {
 	remove_connect_pending();
 
 	while (!isempty(&ses.writequeue)) {
-		buf_free(dequeue(&ses.writequeue));
+		pktbuf_free(dequeue(&ses.writequeue));
 	}
+	freequeuelinks(&ses.writequeue);
 
 	m_free(ses.newkeys);
 #ifndef DISABLE_ZLIB
@@ -343,6 +445,10 @@ void session_cleanup() {
 	cleanup_buf(&ses.hash);
 	cleanup_buf(&ses.payload);
 	cleanup_buf(&ses.readbuf);
+	if (ses.readahead) {
+		cbuf_free(ses.readahead);
+		ses.readahead = NULL;
+	}
 	cleanup_buf(&ses.writepayload);
 	cleanup_buf(&ses.kexhashbuf);
 	cleanup_buf(&ses.transkexinit);
@@ -353,6 +459,11 @@ void session_cleanup() {
 		m_free(ses.dh_K);
 	}
 
+#if DROPBEAR_CLEANUP
+	pktbuf_pool_cleanup();
+	dbpoll_cleanup();
+#endif
+
 	m_burn(ses.keys, sizeof(struct key_context));
 	m_free(ses.keys);
 
@@ -585,6 +696,13 @@ static void checktimeouts() {
 			&& elapsed(now, ses.last_packet_time_idle) >= opts.idle_timeout_secs) {
 		dropbear_close("Idle timeout");
 	}
+
+#if DROPBEAR_RECV_WINDOW_AUTOTUNE
+	if (ses.chantuned > 0 && now != ses.chantunecheck) {
+		channel_idle_windows(now);
+		ses.chantunecheck = now;
+	}
+#endif
 }
 
 static void update_timeout(long limit, time_t now, time_t last_event, long * timeout) {
@@ -627,6 +745,13 @@ static long select_timeout() {
 	update_timeout(opts.idle_timeout_secs, now, ses.last_packet_time_idle,
 		&timeout);
 
+#if DROPBEAR_RECV_WINDOW_AUTOTUNE
+	if (ses.chantuned > 0) {
+		/* wake to shrink the windows of idle channels */
+		timeout = MIN(timeout, RECV_WINDOW_IDLE_SECS);
+	}
+#endif
+
 	/* clamp negative timeouts to zero - event has already triggered */
 	return MAX(timeout, 0);
 }
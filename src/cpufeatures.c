@@ -0,0 +1,99 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "cpufeatures.h"
+
+#if DROPBEAR_X86_64_ACCEL
+
+#include <cpuid.h>
+
+/* missing from older compilers' cpuid.h */
+#ifndef bit_SHA
+#define bit_SHA (1 << 29)
+#endif
+#ifndef bit_VAES
+#define bit_VAES (1 << 9)
+#endif
+
+static unsigned int cpu_probe(void) {
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int features = 0;
+	int ymm = 0;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return 0;
+	}
+	if (ecx & bit_SSSE3) {
+		features |= DROPBEAR_CPU_SSSE3;
+	}
+	if (ecx & bit_SSE4_1) {
+		features |= DROPBEAR_CPU_SSE41;
+	}
+	if (ecx & bit_AES) {
+		features |= DROPBEAR_CPU_AESNI;
+	}
+	if (ecx & bit_PCLMUL) {
+		features |= DROPBEAR_CPU_PCLMUL;
+	}
+	if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+		unsigned int xcr0, xcr0_hi;
+		__asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+		/* XMM and YMM state enabled by the OS */
+		ymm = (xcr0 & 0x6) == 0x6;
+	}
+
+	if (__get_cpuid_max(0, NULL) >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		if ((ebx & bit_AVX2) && ymm) {
+			features |= DROPBEAR_CPU_AVX2;
+		}
+		if (ebx & bit_BMI2) {
+			features |= DROPBEAR_CPU_BMI2;
+		}
+		if (ebx & bit_SHA) {
+			features |= DROPBEAR_CPU_SHA;
+		}
+		if ((ecx & bit_VAES) && ymm) {
+			features |= DROPBEAR_CPU_VAES;
+		}
+	}
+
+	TRACE(("cpu features 0x%x", features))
+	return features;
+}
+
+unsigned int dropbear_cpu_features() {
+	static int probed = 0;
+	static unsigned int features = 0;
+
+	if (!probed) {
+		features = cpu_probe();
+		probed = 1;
+	}
+	return features;
+}
+
+#endif /* DROPBEAR_X86_64_ACCEL */
@@ -0,0 +1,47 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_CPUFEATURES_H_
+#define DROPBEAR_CPUFEATURES_H_
+
+#include "includes.h"
+
+#if DROPBEAR_X86_64_ACCEL
+
+#define DROPBEAR_CPU_SSSE3	(1 << 0)
+#define DROPBEAR_CPU_SSE41	(1 << 1)
+#define DROPBEAR_CPU_AESNI	(1 << 2)
+#define DROPBEAR_CPU_PCLMUL	(1 << 3)
+#define DROPBEAR_CPU_AVX2	(1 << 4)
+#define DROPBEAR_CPU_SHA	(1 << 5)
+#define DROPBEAR_CPU_VAES	(1 << 6)
+#define DROPBEAR_CPU_BMI2	(1 << 7)
+
+/* Instruction set extensions usable on this CPU, probed with CPUID on the
+ * first call. AVX2 and VAES also need the OS to save the YMM registers. */
+unsigned int dropbear_cpu_features(void);
+
+#endif /* DROPBEAR_X86_64_ACCEL */
+
+#endif /* DROPBEAR_CPUFEATURES_H_ */
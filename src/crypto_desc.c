@@ -4,6 +4,8 @@
 #include "ltc_prng.h"
 #include "ecc.h"
 #include "dbrandom.h"
+#include "aesni.h"
+#include "sha2-accel.h"
 
 #if DROPBEAR_LTC_PRNG
 	int dropbear_ltc_prng = -1;
@@ -53,12 +55,20 @@ void crypto_init() {
 		}
 	}
 
+#if DROPBEAR_AESNI
+	dropbear_aesni_init();
+#endif
+
 	for (i = 0; reghashes[i] != NULL; i++) {
 		if (register_hash(reghashes[i]) == -1) {
 			dropbear_exit("Error registering crypto");
 		}
 	}
 
+#if DROPBEAR_SHA2_ACCEL
+	dropbear_sha2_accel_init();
+#endif
+
 #if DROPBEAR_LTC_PRNG
 	dropbear_ltc_prng = register_prng(&dropbear_prng_desc);
 	if (dropbear_ltc_prng == -1) {
@@ -0,0 +1,386 @@
+/*
+ * Dropbear - a SSH2 server
+ * 
+ * Copyright (c) 2002-2006 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+/* Worker threads for packet encryption and decryption, so that a single
+ * session's bulk transfer can use more than one CPU. packet.c has a pipe
+ * for each direction, each with its own thread.
+ *
+ * A pipe is a ring of jobs with three counters. The main thread adds jobs
+ * at "submitted", the worker finishes them in order and advances
+ * "completed", and the main thread takes finished jobs at "collected".
+ * Each counter has a single writer, so the ring itself needs no lock. The
+ * mutex is only taken for the worker to sleep when it has nothing to do,
+ * or for the main thread to wait for it. Jobs are done in submission
+ * order, so sequence numbers and cipher state (CTR or GCM counters) are
+ * used in the same order as without threads.
+ *
+ * The main thread owns a job's buffer except between submission and
+ * completion, and the keys except while jobs are pending. The worker
+ * never allocates, frees or exits.
+ *
+ * After finishing a job the worker writes to a pipe that the session loop
+ * waits on, but only if the loop has armed it since it last woke. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "cryptpipe.h"
+#include "pktbuf.h"
+#include "dbpoll.h"
+
+#if DROPBEAR_CRYPTO_THREADS
+
+struct cryptpipe_job {
+	buffer *buf;
+	unsigned int seq;
+	const char *err;
+};
+
+struct cryptpipe {
+	struct cryptpipe_job jobs[CRYPTO_THREAD_DEPTH];
+	/* These count up and wrap, a job's slot is its count modulo
+	 * CRYPTO_THREAD_DEPTH. submitted and collected are only written by
+	 * the main thread, completed by the worker */
+	unsigned int submitted;
+	unsigned int completed;
+	unsigned int collected;
+
+	cryptpipe_work work;
+	struct key_context_directional *keys;
+
+	pthread_t thread;
+	int running;
+	/* pthread_create() failed, jobs are done by the main thread */
+	int nothread;
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake; /* the worker waits for jobs */
+	pthread_cond_t done; /* the main thread waits for the worker */
+	int sleeping;
+	int waiting;
+	int quit;
+
+	struct cryptpipe *next;
+};
+
+static void* cryptpipe_thread(void *arg);
+static int cryptpipe_start(struct cryptpipe *cp);
+static void cryptpipe_wait_for(struct cryptpipe *cp, unsigned int count);
+static void cryptpipe_init_sync(struct cryptpipe *cp);
+static void cryptpipe_prefork(void);
+static void cryptpipe_postfork_child(void);
+
+static struct cryptpipe *pipes = NULL;
+static int notify_fds[2] = {-1, -1};
+static int notify_armed = 0;
+static int atfork_done = 0;
+/* -1 until checked */
+static int threads_usable = -1;
+
+/* Returns a new pipe whose jobs are done by work() with keys, or NULL if
+ * threads aren't worth using here. The thread is started with the first
+ * job */
+struct cryptpipe* cryptpipe_new(cryptpipe_work work,
+		struct key_context_directional *keys) {
+
+	struct cryptpipe *cp = NULL;
+
+	if (threads_usable < 0) {
+		threads_usable = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+		TRACE(("crypto threads %s", threads_usable ? "usable" : "not used, single CPU"))
+	}
+	if (!threads_usable) {
+		return NULL;
+	}
+
+	if (notify_fds[0] < 0) {
+		if (pipe(notify_fds) < 0) {
+			TRACE(("crypto thread notify pipe failed"))
+			threads_usable = 0;
+			return NULL;
+		}
+		setnonblocking(notify_fds[0]);
+		setnonblocking(notify_fds[1]);
+		fcntl(notify_fds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(notify_fds[1], F_SETFD, FD_CLOEXEC);
+		dbpoll_set(notify_fds[0], DBPOLL_READ, NULL);
+	}
+	if (!atfork_done) {
+		pthread_atfork(cryptpipe_prefork, NULL, cryptpipe_postfork_child);
+		atfork_done = 1;
+	}
+
+	cp = m_malloc(sizeof(*cp));
+	cp->work = work;
+	cp->keys = keys;
+	cryptpipe_init_sync(cp);
+	cp->next = pipes;
+	pipes = cp;
+	return cp;
+}
+
+/* Stops the thread, and frees any packets that weren't collected */
+void cryptpipe_free(struct cryptpipe *cp) {
+
+	struct cryptpipe **p = NULL;
+
+	if (cp == NULL) {
+		return;
+	}
+
+	if (cp->running) {
+		/* the worker only looks at quit once it has finished all jobs */
+		pthread_mutex_lock(&cp->lock);
+		cp->quit = 1;
+		pthread_cond_signal(&cp->wake);
+		pthread_mutex_unlock(&cp->lock);
+		pthread_join(cp->thread, NULL);
+		cp->running = 0;
+	}
+
+	while (cp->collected != cp->submitted) {
+		pktbuf_free(cp->jobs[cp->collected % CRYPTO_THREAD_DEPTH].buf);
+		cp->collected++;
+	}
+
+	for (p = &pipes; *p != NULL; p = &(*p)->next) {
+		if (*p == cp) {
+			*p = cp->next;
+			break;
+		}
+	}
+
+	pthread_cond_destroy(&cp->done);
+	pthread_cond_destroy(&cp->wake);
+	pthread_mutex_destroy(&cp->lock);
+	m_free(cp);
+}
+
+/* Hands buf to the worker. Returns DROPBEAR_FAILURE if the ring is full,
+ * the caller can cryptpipe_wait() and collect first */
+int cryptpipe_submit(struct cryptpipe *cp, buffer *buf, unsigned int seq) {
+
+	unsigned int count = cp->submitted;
+	struct cryptpipe_job *job = NULL;
+
+	if (count - cp->collected >= CRYPTO_THREAD_DEPTH) {
+		return DROPBEAR_FAILURE;
+	}
+
+	job = &cp->jobs[count % CRYPTO_THREAD_DEPTH];
+	job->buf = buf;
+	job->seq = seq;
+	job->err = NULL;
+
+	if (!cp->running && !cp->nothread
+			&& cryptpipe_start(cp) == DROPBEAR_FAILURE) {
+		cp->nothread = 1;
+	}
+	if (cp->nothread) {
+		job->err = cp->work(cp->keys, buf, seq);
+		cp->submitted = count + 1;
+		cp->completed = count + 1;
+		return DROPBEAR_SUCCESS;
+	}
+
+	/* Pairs with the worker setting sleeping then checking submitted, one
+	 * of the two sees the other's store */
+	__atomic_store_n(&cp->submitted, count + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&cp->sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&cp->lock);
+		pthread_cond_signal(&cp->wake);
+		pthread_mutex_unlock(&cp->lock);
+	}
+	return DROPBEAR_SUCCESS;
+}
+
+/* Returns the oldest finished buffer, in submission order, or NULL if the
+ * worker hasn't finished it yet. *err is set to the work's result */
+buffer* cryptpipe_collect(struct cryptpipe *cp, const char **err) {
+
+	struct cryptpipe_job *job = NULL;
+
+	if (!cryptpipe_ready(cp)) {
+		return NULL;
+	}
+	job = &cp->jobs[cp->collected % CRYPTO_THREAD_DEPTH];
+	cp->collected++;
+	*err = job->err;
+	return job->buf;
+}
+
+/* Jobs submitted but not yet collected */
+unsigned int cryptpipe_pending(const struct cryptpipe *cp) {
+	return cp->submitted - cp->collected;
+}
+
+/* Whether cryptpipe_collect() has a buffer */
+int cryptpipe_ready(const struct cryptpipe *cp) {
+	/* sequentially consistent to pair with cryptpipe_arm() */
+	return __atomic_load_n(&cp->completed, __ATOMIC_SEQ_CST) != cp->collected;
+}
+
+/* Waits until the oldest pending job is finished */
+void cryptpipe_wait(struct cryptpipe *cp) {
+	if (cryptpipe_pending(cp) > 0) {
+		cryptpipe_wait_for(cp, cp->collected + 1);
+	}
+}
+
+/* Waits until all submitted jobs are finished */
+void cryptpipe_drain(struct cryptpipe *cp) {
+	cryptpipe_wait_for(cp, cp->submitted);
+}
+
+/* Called before the session loop checks for finished jobs and waits.
+ * A job finished after this wakes the wait */
+void cryptpipe_arm() {
+	if (pipes != NULL) {
+		__atomic_store_n(&notify_armed, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/* Empties the notify pipe after the wait */
+void cryptpipe_notified() {
+
+	char buf[16];
+
+	if (notify_fds[0] >= 0 && (dbpoll_ready(notify_fds[0]) & DBPOLL_READ)) {
+		while (read(notify_fds[0], buf, sizeof(buf)) > 0) {}
+	}
+}
+
+static void cryptpipe_wait_for(struct cryptpipe *cp, unsigned int count) {
+
+	if (!cp->running) {
+		/* jobs done by the main thread are already complete */
+		return;
+	}
+
+	pthread_mutex_lock(&cp->lock);
+	/* Pairs with the worker storing completed then checking waiting */
+	__atomic_store_n(&cp->waiting, 1, __ATOMIC_SEQ_CST);
+	while ((int)(count - __atomic_load_n(&cp->completed, __ATOMIC_SEQ_CST)) > 0) {
+		pthread_cond_wait(&cp->done, &cp->lock);
+	}
+	__atomic_store_n(&cp->waiting, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&cp->lock);
+}
+
+static void* cryptpipe_thread(void *arg) {
+
+	struct cryptpipe *cp = arg;
+	struct cryptpipe_job *job = NULL;
+	unsigned int count;
+	int quit;
+
+	for (;;) {
+		count = cp->completed;
+
+		if (__atomic_load_n(&cp->submitted, __ATOMIC_SEQ_CST) == count) {
+			pthread_mutex_lock(&cp->lock);
+			__atomic_store_n(&cp->sleeping, 1, __ATOMIC_SEQ_CST);
+			while (!cp->quit
+				&& __atomic_load_n(&cp->submitted, __ATOMIC_SEQ_CST) == count) {
+				pthread_cond_wait(&cp->wake, &cp->lock);
+			}
+			__atomic_store_n(&cp->sleeping, 0, __ATOMIC_SEQ_CST);
+			quit = cp->quit;
+			pthread_mutex_unlock(&cp->lock);
+			if (quit) {
+				break;
+			}
+			continue;
+		}
+
+		job = &cp->jobs[count % CRYPTO_THREAD_DEPTH];
+		job->err = cp->work(cp->keys, job->buf, job->seq);
+		__atomic_store_n(&cp->completed, count + 1, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&cp->waiting, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_lock(&cp->lock);
+			pthread_cond_signal(&cp->done);
+			pthread_mutex_unlock(&cp->lock);
+		}
+		if (__atomic_exchange_n(&notify_armed, 0, __ATOMIC_SEQ_CST)) {
+			char x = 0;
+			/* if the pipe is full the loop will wake anyway */
+			if (write(notify_fds[1], &x, 1) < 0) {}
+		}
+	}
+	return NULL;
+}
+
+static int cryptpipe_start(struct cryptpipe *cp) {
+
+	pthread_attr_t attr;
+	sigset_t all, old;
+	int err;
+
+	if (pthread_attr_init(&attr) != 0) {
+		return DROPBEAR_FAILURE;
+	}
+	pthread_attr_setstacksize(&attr, CRYPTO_THREAD_STACK);
+
+	/* Signals are left to the main thread, the worker inherits the mask */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&cp->thread, &attr, cryptpipe_thread, cp);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+
+	if (err != 0) {
+		TRACE(("crypto thread create failed: %d", err))
+		return DROPBEAR_FAILURE;
+	}
+	cp->running = 1;
+	return DROPBEAR_SUCCESS;
+}
+
+static void cryptpipe_init_sync(struct cryptpipe *cp) {
+	pthread_mutex_init(&cp->lock, NULL);
+	pthread_cond_init(&cp->wake, NULL);
+	pthread_cond_init(&cp->done, NULL);
+	cp->sleeping = cp->waiting = cp->quit = 0;
+}
+
+/* The workers are finished with all jobs before a fork(), so a child that
+ * carries on with the session (dbclient -f) can start new ones */
+static void cryptpipe_prefork() {
+	struct cryptpipe *cp;
+	for (cp = pipes; cp != NULL; cp = cp->next) {
+		cryptpipe_drain(cp);
+	}
+}
+
+static void cryptpipe_postfork_child() {
+	struct cryptpipe *cp;
+	for (cp = pipes; cp != NULL; cp = cp->next) {
+		/* the worker doesn't exist in the child, and may have held the
+		 * lock when the parent forked */
+		cp->running = 0;
+		cryptpipe_init_sync(cp);
+	}
+}
+
+#endif /* DROPBEAR_CRYPTO_THREADS */
@@ -0,0 +1,59 @@
+/*
+ * Dropbear - a SSH2 server
+ * 
+ * Copyright (c) 2002-2006 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_CRYPTPIPE_H_
+#define DROPBEAR_CRYPTPIPE_H_
+
+#include "includes.h"
+#include "buffer.h"
+
+#if DROPBEAR_CRYPTO_THREADS
+
+struct key_context_directional;
+struct cryptpipe;
+
+/* Encrypts or decrypts buf in place, returning NULL or the message for
+ * the main thread to exit with. Runs in the worker thread, so it must not
+ * allocate, free or exit */
+typedef const char* (*cryptpipe_work)(struct key_context_directional *keys,
+		buffer *buf, unsigned int seq);
+
+struct cryptpipe* cryptpipe_new(cryptpipe_work work,
+		struct key_context_directional *keys);
+void cryptpipe_free(struct cryptpipe *cp);
+
+int cryptpipe_submit(struct cryptpipe *cp, buffer *buf, unsigned int seq);
+buffer* cryptpipe_collect(struct cryptpipe *cp, const char **err);
+unsigned int cryptpipe_pending(const struct cryptpipe *cp);
+int cryptpipe_ready(const struct cryptpipe *cp);
+void cryptpipe_wait(struct cryptpipe *cp);
+void cryptpipe_drain(struct cryptpipe *cp);
+
+/* Around the session loop's wait */
+void cryptpipe_arm(void);
+void cryptpipe_notified(void);
+
+#endif /* DROPBEAR_CRYPTO_THREADS */
+
+#endif /* DROPBEAR_CRYPTPIPE_H_ */
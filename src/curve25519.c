@@ -40,11 +40,11 @@ typedef unsigned long long u64;
 typedef long long i64;
 typedef i64 gf[16];
 
-#if DROPBEAR_CURVE25519
+#if DROPBEAR_CURVE25519 && !DROPBEAR_CURVE25519_64
 static const gf
   _121665 = {0xDB41,1};
-#endif /* DROPBEAR_CURVE25519 */
-#if DROPBEAR_ED25519
+#endif /* DROPBEAR_CURVE25519 && !DROPBEAR_CURVE25519_64 */
+#if DROPBEAR_ED25519 && !DROPBEAR_CURVE25519_64
 static const gf
   gf0,
   gf1 = {1},
@@ -56,7 +56,7 @@ static const gf
   D = {0x78a3, 0x1359, 0x4dca, 0x75eb, 0xd8ab, 0x4141, 0x0a4d, 0x0070, 0xe898, 0x7779, 0x4079, 0x8cc7, 0xfe73, 0x2b6f, 0x6cee, 0x5203},
   I = {0xa0b0, 0x4a0e, 0x1b27, 0xc4ee, 0xe478, 0xad2f, 0x1806, 0x2f43, 0xd7a7, 0x3dfb, 0x0099, 0x2b4d, 0xdf0b, 0x4fc1, 0x2480, 0x2b83};
 #endif /* DROPBEAR_SIGNKEY_VERIFY */
-#endif /* DROPBEAR_ED25519 */
+#endif /* DROPBEAR_ED25519 && !DROPBEAR_CURVE25519_64 */
 
 #if DROPBEAR_ED25519
 #if DROPBEAR_SIGNKEY_VERIFY
@@ -72,7 +72,10 @@ static int crypto_verify_32(const u8 *x,const u8 *y)
   return vn(x,y,32);
 }
 #endif /* DROPBEAR_SIGNKEY_VERIFY */
+#endif /* DROPBEAR_ED25519 */
 
+#if !DROPBEAR_CURVE25519_64
+#if DROPBEAR_ED25519
 sv set25519(gf r, const gf a)
 {
   int i;
@@ -258,6 +261,750 @@ void dropbear_curve25519_scalarmult(u8 *q,const u8 *n,const u8 *p)
   pack25519(q,x+16);
 }
 #endif /* DROPBEAR_CURVE25519 */
+#endif /* !DROPBEAR_CURVE25519_64 */
+
+#if DROPBEAR_CURVE25519_64
+/* Field elements as five 51-bit limbs, after curve25519-donna-64 and ref10.
+ * Limbs may grow a few bits past 51 between reductions, the 128-bit
+ * products leave room for that. */
+
+typedef unsigned __int128 u128;
+typedef u64 fe51[5];
+
+#define MASK51 ((((u64)1) << 51) - 1)
+
+sv fe51_frombytes(fe51 h,const u8 *s)
+{
+  u64 t[4];
+  int i;
+  FOR(i,4) LOAD64L(t[i],s + 8*i);
+  h[0] = t[0] & MASK51;
+  h[1] = ((t[0] >> 51) | (t[1] << 13)) & MASK51;
+  h[2] = ((t[1] >> 38) | (t[2] << 26)) & MASK51;
+  h[3] = ((t[2] >> 25) | (t[3] << 39)) & MASK51;
+  /* the top bit is ignored */
+  h[4] = (t[3] >> 12) & MASK51;
+}
+
+/* Fully reduces mod 2^255-19 */
+sv fe51_tobytes(u8 *s,const fe51 f)
+{
+  u64 h[5],q;
+  int i;
+  FOR(i,5) h[i] = f[i];
+  /* two passes leave every limb below 2^51 + 2^13 */
+  FOR(i,2) {
+    h[1] += h[0] >> 51; h[0] &= MASK51;
+    h[2] += h[1] >> 51; h[1] &= MASK51;
+    h[3] += h[2] >> 51; h[2] &= MASK51;
+    h[4] += h[3] >> 51; h[3] &= MASK51;
+    h[0] += 19*(h[4] >> 51); h[4] &= MASK51;
+  }
+  /* q is 1 if h >= p, then h + 19q - 2^255q is h mod p */
+  q = (h[0] + 19) >> 51;
+  q = (h[1] + q) >> 51;
+  q = (h[2] + q) >> 51;
+  q = (h[3] + q) >> 51;
+  q = (h[4] + q) >> 51;
+  h[0] += 19*q;
+  h[1] += h[0] >> 51; h[0] &= MASK51;
+  h[2] += h[1] >> 51; h[1] &= MASK51;
+  h[3] += h[2] >> 51; h[2] &= MASK51;
+  h[4] += h[3] >> 51; h[3] &= MASK51;
+  h[4] &= MASK51;
+  STORE64L(h[0] | (h[1] << 51),s);
+  STORE64L((h[1] >> 13) | (h[2] << 38),s + 8);
+  STORE64L((h[2] >> 26) | (h[3] << 25),s + 16);
+  STORE64L((h[3] >> 39) | (h[4] << 12),s + 24);
+}
+
+sv fe51_add(fe51 h,const fe51 f,const fe51 g)
+{
+  int i;
+  FOR(i,5) h[i] = f[i] + g[i];
+}
+
+/* f + 4p - g, with g carried first so its limbs are below 4p's */
+sv fe51_sub(fe51 h,const fe51 f,const fe51 g)
+{
+  u64 t[5];
+  t[1] = g[1] + (g[0] >> 51);
+  t[2] = g[2] + (t[1] >> 51);
+  t[3] = g[3] + (t[2] >> 51);
+  t[4] = g[4] + (t[3] >> 51);
+  t[0] = (g[0] & MASK51) + 19*(t[4] >> 51);
+  h[0] = (f[0] + 0x1fffffffffffb4ULL) - t[0];
+  h[1] = (f[1] + 0x1ffffffffffffcULL) - (t[1] & MASK51);
+  h[2] = (f[2] + 0x1ffffffffffffcULL) - (t[2] & MASK51);
+  h[3] = (f[3] + 0x1ffffffffffffcULL) - (t[3] & MASK51);
+  h[4] = (f[4] + 0x1ffffffffffffcULL) - (t[4] & MASK51);
+}
+
+/* Carries the 128-bit column sums r into h. Inputs to the multiplies are
+ * below 2^54 so each column is below 2^115 */
+sv fe51_carry(fe51 h,u128 r[5])
+{
+  u128 t;
+  r[1] += (u64)(r[0] >> 51);
+  r[2] += (u64)(r[1] >> 51);
+  r[3] += (u64)(r[2] >> 51);
+  r[4] += (u64)(r[3] >> 51);
+  t = (u128)((u64)r[0] & MASK51) + (u128)(u64)(r[4] >> 51) * 19;
+  h[0] = (u64)t & MASK51;
+  h[1] = ((u64)r[1] & MASK51) + (u64)(t >> 51);
+  h[2] = (u64)r[2] & MASK51;
+  h[3] = (u64)r[3] & MASK51;
+  h[4] = (u64)r[4] & MASK51;
+}
+
+sv fe51_mul(fe51 h,const fe51 f,const fe51 g)
+{
+  u128 r[5];
+  u64 g1_19 = 19*g[1], g2_19 = 19*g[2], g3_19 = 19*g[3], g4_19 = 19*g[4];
+
+  r[0] = (u128)f[0]*g[0] + (u128)f[1]*g4_19 + (u128)f[2]*g3_19
+    + (u128)f[3]*g2_19 + (u128)f[4]*g1_19;
+  r[1] = (u128)f[0]*g[1] + (u128)f[1]*g[0] + (u128)f[2]*g4_19
+    + (u128)f[3]*g3_19 + (u128)f[4]*g2_19;
+  r[2] = (u128)f[0]*g[2] + (u128)f[1]*g[1] + (u128)f[2]*g[0]
+    + (u128)f[3]*g4_19 + (u128)f[4]*g3_19;
+  r[3] = (u128)f[0]*g[3] + (u128)f[1]*g[2] + (u128)f[2]*g[1]
+    + (u128)f[3]*g[0] + (u128)f[4]*g4_19;
+  r[4] = (u128)f[0]*g[4] + (u128)f[1]*g[3] + (u128)f[2]*g[2]
+    + (u128)f[3]*g[1] + (u128)f[4]*g[0];
+  fe51_carry(h,r);
+}
+
+sv fe51_sq(fe51 h,const fe51 f)
+{
+  u128 r[5];
+  u64 f0_2 = 2*f[0], f1_2 = 2*f[1];
+  u64 f1_38 = 38*f[1], f2_38 = 38*f[2], f3_38 = 38*f[3];
+  u64 f3_19 = 19*f[3], f4_19 = 19*f[4];
+
+  r[0] = (u128)f[0]*f[0] + (u128)f1_38*f[4] + (u128)f2_38*f[3];
+  r[1] = (u128)f0_2*f[1] + (u128)f2_38*f[4] + (u128)f3_19*f[3];
+  r[2] = (u128)f0_2*f[2] + (u128)f[1]*f[1] + (u128)f3_38*f[4];
+  r[3] = (u128)f0_2*f[3] + (u128)f1_2*f[2] + (u128)f4_19*f[4];
+  r[4] = (u128)f0_2*f[4] + (u128)f1_2*f[3] + (u128)f[2]*f[2];
+  fe51_carry(h,r);
+}
+
+sv fe51_sqn(fe51 h,const fe51 f,int n)
+{
+  fe51_sq(h,f);
+  while (--n > 0) fe51_sq(h,h);
+}
+
+/* z^(p-2), the chain from ref10 */
+sv fe51_invert(fe51 out,const fe51 z)
+{
+  fe51 t0,t1,t2,t3;
+  fe51_sq(t0,z);
+  fe51_sqn(t1,t0,2);
+  fe51_mul(t1,z,t1);
+  fe51_mul(t0,t0,t1);
+  fe51_sq(t2,t0);
+  fe51_mul(t1,t1,t2);
+  fe51_sqn(t2,t1,5);
+  fe51_mul(t1,t2,t1);
+  fe51_sqn(t2,t1,10);
+  fe51_mul(t2,t2,t1);
+  fe51_sqn(t3,t2,20);
+  fe51_mul(t2,t3,t2);
+  fe51_sqn(t2,t2,10);
+  fe51_mul(t1,t2,t1);
+  fe51_sqn(t2,t1,50);
+  fe51_mul(t2,t2,t1);
+  fe51_sqn(t3,t2,100);
+  fe51_mul(t2,t3,t2);
+  fe51_sqn(t2,t2,50);
+  fe51_mul(t1,t2,t1);
+  fe51_sqn(t1,t1,5);
+  fe51_mul(out,t1,t0);
+}
+
+#if DROPBEAR_CURVE25519
+/* (A - 2)/4 for curve25519 */
+sv fe51_mul121665(fe51 h,const fe51 f)
+{
+  u128 r[5];
+  int i;
+  FOR(i,5) r[i] = (u128)f[i]*121665;
+  fe51_carry(h,r);
+}
+
+/* Swaps f and g when b is 1, in constant time */
+sv fe51_cswap(fe51 f,fe51 g,u64 b)
+{
+  u64 t,c = 0 - b;
+  int i;
+  FOR(i,5) {
+    t = c & (f[i] ^ g[i]);
+    f[i] ^= t;
+    g[i] ^= t;
+  }
+}
+
+void dropbear_curve25519_scalarmult(u8 *q,const u8 *n,const u8 *p)
+{
+  u8 z[32];
+  fe51 x1,x2,z2,x3,z3,a,b,c,d,e;
+  u64 swap = 0,bit;
+  int i;
+  FOR(i,31) z[i]=n[i];
+  z[31]=(n[31]&127)|64;
+  z[0]&=248;
+  fe51_frombytes(x1,p);
+  FOR(i,5) {
+    x2[i] = z2[i] = z3[i] = 0;
+    x3[i] = x1[i];
+  }
+  x2[0] = z3[0] = 1;
+  for (i = 254;i >= 0;--i) {
+    bit = (z[i>>3]>>(i&7))&1;
+    swap ^= bit;
+    fe51_cswap(x2,x3,swap);
+    fe51_cswap(z2,z3,swap);
+    swap = bit;
+
+    fe51_add(a,x2,z2);
+    fe51_sub(b,x2,z2);
+    fe51_add(c,x3,z3);
+    fe51_sub(d,x3,z3);
+    fe51_mul(d,d,a);
+    fe51_mul(c,c,b);
+    fe51_sq(a,a);
+    fe51_sq(b,b);
+    fe51_sub(e,a,b);
+    fe51_add(x3,d,c);
+    fe51_sq(x3,x3);
+    fe51_sub(z3,d,c);
+    fe51_sq(z3,z3);
+    fe51_mul(z3,z3,x1);
+    fe51_mul(x2,a,b);
+    fe51_mul121665(z2,e);
+    fe51_add(z2,z2,a);
+    fe51_mul(z2,z2,e);
+  }
+  fe51_cswap(x2,x3,swap);
+  fe51_cswap(z2,z3,swap);
+  fe51_invert(z2,z2);
+  fe51_mul(x2,x2,z2);
+  fe51_tobytes(q,x2);
+  m_burn(z,sizeof(z));
+}
+#endif /* DROPBEAR_CURVE25519 */
+
+#if DROPBEAR_ED25519
+/* Ed25519 group operations after ref10. Points are extended coordinates
+ * (X:Y:Z:T) with x = X/Z, y = Y/Z, xy = T/Z. The other point of an addition
+ * is either cached (Y+X, Y-X, Z, 2dT) or, from the base point tables,
+ * affine (y+x, y-x, 2dxy). */
+
+static const fe51
+  ed_d2 = {0x69b9426b2f159ULL, 0x35050762add7aULL, 0x3cf44c0038052ULL, 0x6738cc7407977ULL, 0x2406d9dc56dffULL},
+  ed_bx = {0x62d608f25d51aULL, 0x412a4b4f6592aULL, 0x75b7171a4b31dULL, 0x1ff60527118feULL, 0x216936d3cd6e5ULL},
+  ed_by = {0x6666666666658ULL, 0x4ccccccccccccULL, 0x1999999999999ULL, 0x3333333333333ULL, 0x6666666666666ULL};
+#if DROPBEAR_SIGNKEY_VERIFY
+static const fe51
+  ed_d = {0x34dca135978a3ULL, 0x1a8283b156ebdULL, 0x5e7a26001c029ULL, 0x739c663a03cbbULL, 0x52036cee2b6ffULL},
+  ed_sqrtm1 = {0x61b274a0ea0b0ULL, 0x0d5a5fc8f189dULL, 0x7ef5e9cbd0c60ULL, 0x78595a6804c9eULL, 0x2b8324804fc1dULL};
+#endif /* DROPBEAR_SIGNKEY_VERIFY */
+
+typedef struct { fe51 X,Y,Z; } ge_p2;
+typedef struct { fe51 X,Y,Z,T; } ge_p3;
+/* x = X/Z, y = Y/T */
+typedef struct { fe51 X,Y,Z,T; } ge_p1p1;
+typedef struct { fe51 YplusX,YminusX,Z,T2d; } ge_cached;
+typedef struct { fe51 yplusx,yminusx,xy2d; } ge_precomp;
+
+/* base[i][j] is (j+1)*256^i*B for fixed base multiplication, bi[j] is
+ * (2j+1)*B for the sliding window in verification. Built on first use */
+static ge_precomp ed_base[32][8];
+#if DROPBEAR_SIGNKEY_VERIFY
+static ge_precomp ed_bi[32];
+#endif
+static int ed_tables_done;
+
+sv fe51_copy(fe51 h,const fe51 f)
+{
+  int i;
+  FOR(i,5) h[i] = f[i];
+}
+
+sv fe51_set1(fe51 h,u64 v)
+{
+  h[0] = v;
+  h[1] = h[2] = h[3] = h[4] = 0;
+}
+
+/* Sets f to g when b is 1, in constant time */
+sv fe51_cmov(fe51 f,const fe51 g,u64 b)
+{
+  u64 c = 0 - b;
+  int i;
+  FOR(i,5) f[i] ^= c & (f[i] ^ g[i]);
+}
+
+static int fe51_isnegative(const fe51 f)
+{
+  u8 s[32];
+  fe51_tobytes(s,f);
+  return s[0] & 1;
+}
+
+sv ge_p3_0(ge_p3 *h)
+{
+  fe51_set1(h->X,0);
+  fe51_set1(h->Y,1);
+  fe51_set1(h->Z,1);
+  fe51_set1(h->T,0);
+}
+
+sv ge_p1p1_to_p2(ge_p2 *r,const ge_p1p1 *p)
+{
+  fe51_mul(r->X,p->X,p->T);
+  fe51_mul(r->Y,p->Y,p->Z);
+  fe51_mul(r->Z,p->Z,p->T);
+}
+
+sv ge_p1p1_to_p3(ge_p3 *r,const ge_p1p1 *p)
+{
+  fe51_mul(r->X,p->X,p->T);
+  fe51_mul(r->Y,p->Y,p->Z);
+  fe51_mul(r->Z,p->Z,p->T);
+  fe51_mul(r->T,p->X,p->Y);
+}
+
+sv ge_p3_to_cached(ge_cached *r,const ge_p3 *p)
+{
+  fe51_add(r->YplusX,p->Y,p->X);
+  fe51_sub(r->YminusX,p->Y,p->X);
+  fe51_copy(r->Z,p->Z);
+  fe51_mul(r->T2d,p->T,ed_d2);
+}
+
+sv ge_p2_dbl(ge_p1p1 *r,const ge_p2 *p)
+{
+  fe51 t0;
+  fe51_sq(r->X,p->X);
+  fe51_sq(r->Z,p->Y);
+  fe51_sq(r->T,p->Z);
+  fe51_add(r->T,r->T,r->T);
+  fe51_add(r->Y,p->X,p->Y);
+  fe51_sq(t0,r->Y);
+  fe51_add(r->Y,r->Z,r->X);
+  fe51_sub(r->Z,r->Z,r->X);
+  fe51_sub(r->X,t0,r->Y);
+  fe51_sub(r->T,r->T,r->Z);
+}
+
+sv ge_p3_dbl(ge_p1p1 *r,const ge_p3 *p)
+{
+  ge_p2 q;
+  fe51_copy(q.X,p->X);
+  fe51_copy(q.Y,p->Y);
+  fe51_copy(q.Z,p->Z);
+  ge_p2_dbl(r,&q);
+}
+
+/* p + q, or p - q when neg is 1 */
+sv ge_add(ge_p1p1 *r,const ge_p3 *p,const ge_cached *q,int neg)
+{
+  fe51 t0;
+  fe51_add(r->X,p->Y,p->X);
+  fe51_sub(r->Y,p->Y,p->X);
+  fe51_mul(r->Z,r->X,neg ? q->YminusX : q->YplusX);
+  fe51_mul(r->Y,r->Y,neg ? q->YplusX : q->YminusX);
+  fe51_mul(r->T,q->T2d,p->T);
+  fe51_mul(r->X,p->Z,q->Z);
+  fe51_add(t0,r->X,r->X);
+  fe51_sub(r->X,r->Z,r->Y);
+  fe51_add(r->Y,r->Z,r->Y);
+  if (neg) {
+    fe51_sub(r->Z,t0,r->T);
+    fe51_add(r->T,t0,r->T);
+  } else {
+    fe51_add(r->Z,t0,r->T);
+    fe51_sub(r->T,t0,r->T);
+  }
+}
+
+/* p + q for an affine q, or p - q when neg is 1 */
+sv ge_madd(ge_p1p1 *r,const ge_p3 *p,const ge_precomp *q,int neg)
+{
+  fe51 t0;
+  fe51_add(r->X,p->Y,p->X);
+  fe51_sub(r->Y,p->Y,p->X);
+  fe51_mul(r->Z,r->X,neg ? q->yminusx : q->yplusx);
+  fe51_mul(r->Y,r->Y,neg ? q->yplusx : q->yminusx);
+  fe51_mul(r->T,q->xy2d,p->T);
+  fe51_add(t0,p->Z,p->Z);
+  fe51_sub(r->X,r->Z,r->Y);
+  fe51_add(r->Y,r->Z,r->Y);
+  if (neg) {
+    fe51_sub(r->Z,t0,r->T);
+    fe51_add(r->T,t0,r->T);
+  } else {
+    fe51_add(r->Z,t0,r->T);
+    fe51_sub(r->T,t0,r->T);
+  }
+}
+
+sv ge_pack(u8 *s,const fe51 X,const fe51 Y,const fe51 Z)
+{
+  fe51 recip,x,y;
+  fe51_invert(recip,Z);
+  fe51_mul(x,X,recip);
+  fe51_mul(y,Y,recip);
+  fe51_tobytes(s,y);
+  s[31] ^= fe51_isnegative(x) << 7;
+}
+
+/* Makes n table entries affine. Their X, Y and Z are passed in yplusx,
+ * yminusx and xy2d, the Z values are inverted together */
+sv ge_precomp_normalize(ge_precomp *t,int n)
+{
+  fe51 *acc,inv,zinv,x,y;
+  int i;
+  acc = m_malloc(n * sizeof(fe51));
+  fe51_copy(acc[0],t[0].xy2d);
+  for (i = 1;i < n;i++) fe51_mul(acc[i],acc[i-1],t[i].xy2d);
+  fe51_invert(inv,acc[n-1]);
+  for (i = n - 1;i >= 0;i--) {
+    if (i > 0) {
+      fe51_mul(zinv,inv,acc[i-1]);
+      fe51_mul(inv,inv,t[i].xy2d);
+    } else {
+      fe51_copy(zinv,inv);
+    }
+    fe51_mul(x,t[i].yplusx,zinv);
+    fe51_mul(y,t[i].yminusx,zinv);
+    fe51_add(t[i].yplusx,y,x);
+    fe51_sub(t[i].yminusx,y,x);
+    fe51_mul(t[i].xy2d,x,y);
+    fe51_mul(t[i].xy2d,t[i].xy2d,ed_d2);
+  }
+  m_free(acc);
+}
+
+sv ge_p3_to_raw(ge_precomp *r,const ge_p3 *p)
+{
+  fe51_copy(r->yplusx,p->X);
+  fe51_copy(r->yminusx,p->Y);
+  fe51_copy(r->xy2d,p->Z);
+}
+
+/* Builds the base point tables, about as much work as one signature */
+sv ge_init_tables(void)
+{
+  ge_p3 row,p;
+  ge_cached c;
+  ge_p1p1 t;
+  int i,j;
+
+  if (ed_tables_done) return;
+
+  fe51_copy(row.X,ed_bx);
+  fe51_copy(row.Y,ed_by);
+  fe51_set1(row.Z,1);
+  fe51_mul(row.T,ed_bx,ed_by);
+  FOR(i,32) {
+    ge_p3_to_cached(&c,&row);
+    p = row;
+    ge_p3_to_raw(&ed_base[i][0],&p);
+    for (j = 1;j < 8;j++) {
+      ge_add(&t,&p,&c,0);
+      ge_p1p1_to_p3(&p,&t);
+      ge_p3_to_raw(&ed_base[i][j],&p);
+    }
+    /* 256 times the row */
+    FOR(j,8) {
+      ge_p3_dbl(&t,&row);
+      ge_p1p1_to_p3(&row,&t);
+    }
+  }
+  ge_precomp_normalize(&ed_base[0][0],32*8);
+
+#if DROPBEAR_SIGNKEY_VERIFY
+  /* B from the first row, then add 2B */
+  fe51_copy(row.X,ed_bx);
+  fe51_copy(row.Y,ed_by);
+  fe51_set1(row.Z,1);
+  fe51_mul(row.T,ed_bx,ed_by);
+  ge_p3_dbl(&t,&row);
+  ge_p1p1_to_p3(&p,&t);
+  ge_p3_to_cached(&c,&p);
+  ge_p3_to_raw(&ed_bi[0],&row);
+  for (i = 1;i < 32;i++) {
+    ge_add(&t,&row,&c,0);
+    ge_p1p1_to_p3(&row,&t);
+    ge_p3_to_raw(&ed_bi[i],&row);
+  }
+  ge_precomp_normalize(ed_bi,32);
+#endif
+
+  ed_tables_done = 1;
+}
+
+/* 1 if a == b, for small values */
+static u64 ge_equal(u64 a,u64 b)
+{
+  return ((a ^ b) - 1) >> 63;
+}
+
+/* Sets t to b*256^pos*B for -8 <= b <= 8, reading the whole table row so
+ * the secret b doesn't affect the memory accessed */
+sv ge_select(ge_precomp *t,int pos,signed char b)
+{
+  ge_precomp minust;
+  u64 bnegative = (u8)b >> 7;
+  u64 babs = (u8)(((u8)b ^ (u8)(0 - bnegative)) + bnegative);
+  int i;
+
+  fe51_set1(t->yplusx,1);
+  fe51_set1(t->yminusx,1);
+  fe51_set1(t->xy2d,0);
+  FOR(i,8) {
+    fe51_cmov(t->yplusx,ed_base[pos][i].yplusx,ge_equal(babs,i + 1));
+    fe51_cmov(t->yminusx,ed_base[pos][i].yminusx,ge_equal(babs,i + 1));
+    fe51_cmov(t->xy2d,ed_base[pos][i].xy2d,ge_equal(babs,i + 1));
+  }
+  fe51_copy(minust.yplusx,t->yminusx);
+  fe51_copy(minust.yminusx,t->yplusx);
+  fe51_set1(minust.xy2d,0);
+  fe51_sub(minust.xy2d,minust.xy2d,t->xy2d);
+  fe51_cmov(t->yplusx,minust.yplusx,bnegative);
+  fe51_cmov(t->yminusx,minust.yminusx,bnegative);
+  fe51_cmov(t->xy2d,minust.xy2d,bnegative);
+}
+
+/* [a]B for a secret a below 2^255, in constant time. a is written as 64
+ * signed radix 16 digits, the odd ones are added, the sum multiplied by 16,
+ * then the even ones are added */
+sv ge_scalarmult_base(ge_p3 *h,const u8 *a)
+{
+  signed char e[64],carry;
+  ge_p1p1 r;
+  ge_p2 s;
+  ge_precomp t;
+  int i;
+
+  FOR(i,32) {
+    e[2*i] = a[i] & 15;
+    e[2*i+1] = (a[i] >> 4) & 15;
+  }
+  carry = 0;
+  FOR(i,63) {
+    e[i] += carry;
+    carry = (e[i] + 8) >> 4;
+    e[i] -= carry * 16;
+  }
+  e[63] += carry;
+
+  ge_p3_0(h);
+  for (i = 1;i < 64;i += 2) {
+    ge_select(&t,i/2,e[i]);
+    ge_madd(&r,h,&t,0);
+    ge_p1p1_to_p3(h,&r);
+  }
+
+  ge_p3_dbl(&r,h);
+  ge_p1p1_to_p2(&s,&r);
+  ge_p2_dbl(&r,&s);
+  ge_p1p1_to_p2(&s,&r);
+  ge_p2_dbl(&r,&s);
+  ge_p1p1_to_p2(&s,&r);
+  ge_p2_dbl(&r,&s);
+  ge_p1p1_to_p3(h,&r);
+
+  for (i = 0;i < 64;i += 2) {
+    ge_select(&t,i/2,e[i]);
+    ge_madd(&r,h,&t,0);
+    ge_p1p1_to_p3(h,&r);
+  }
+  m_burn(e,sizeof(e));
+  m_burn(&t,sizeof(t));
+}
+
+/* [s]B, encoded */
+sv scalarbase_pack(u8 *r,const u8 *s)
+{
+  ge_p3 p;
+  ge_init_tables();
+  ge_scalarmult_base(&p,s);
+  ge_pack(r,p.X,p.Y,p.Z);
+  m_burn(&p,sizeof(p));
+}
+
+#if DROPBEAR_SIGNKEY_VERIFY
+static int fe51_iszero(const fe51 f)
+{
+  static const u8 zero[32];
+  u8 s[32];
+  fe51_tobytes(s,f);
+  return crypto_verify_32(s,zero) == 0;
+}
+
+/* z^((p-5)/8) */
+sv fe51_pow22523(fe51 out,const fe51 z)
+{
+  fe51 t0,t1,t2;
+  fe51_sq(t0,z);
+  fe51_sqn(t1,t0,2);
+  fe51_mul(t1,z,t1);
+  fe51_mul(t0,t0,t1);
+  fe51_sq(t0,t0);
+  fe51_mul(t0,t1,t0);
+  fe51_sqn(t1,t0,5);
+  fe51_mul(t0,t1,t0);
+  fe51_sqn(t1,t0,10);
+  fe51_mul(t1,t1,t0);
+  fe51_sqn(t2,t1,20);
+  fe51_mul(t1,t2,t1);
+  fe51_sqn(t1,t1,10);
+  fe51_mul(t0,t1,t0);
+  fe51_sqn(t1,t0,50);
+  fe51_mul(t1,t1,t0);
+  fe51_sqn(t2,t1,100);
+  fe51_mul(t1,t2,t1);
+  fe51_sqn(t1,t1,50);
+  fe51_mul(t0,t1,t0);
+  fe51_sqn(t0,t0,2);
+  fe51_mul(out,t0,z);
+}
+
+/* Decodes -A from an encoded point, as TweetNaCl's unpackneg().
+ * Returns -1 if it isn't on the curve */
+static int ge_frombytes_negate(ge_p3 *h,const u8 *s)
+{
+  fe51 u,v,v3,vxx,check;
+
+  fe51_frombytes(h->Y,s);
+  fe51_set1(h->Z,1);
+  fe51_sq(u,h->Y);
+  fe51_mul(v,u,ed_d);
+  fe51_sub(u,u,h->Z);
+  fe51_add(v,v,h->Z);
+
+  /* x = uv^3 (uv^7)^((p-5)/8) */
+  fe51_sq(v3,v);
+  fe51_mul(v3,v3,v);
+  fe51_sq(h->X,v3);
+  fe51_mul(h->X,h->X,v);
+  fe51_mul(h->X,h->X,u);
+  fe51_pow22523(h->X,h->X);
+  fe51_mul(h->X,h->X,v3);
+  fe51_mul(h->X,h->X,u);
+
+  fe51_sq(vxx,h->X);
+  fe51_mul(vxx,vxx,v);
+  fe51_sub(check,vxx,u);
+  if (!fe51_iszero(check)) {
+    fe51_add(check,vxx,u);
+    if (!fe51_iszero(check)) return -1;
+    fe51_mul(h->X,h->X,ed_sqrtm1);
+  }
+
+  if (fe51_isnegative(h->X) == (s[31] >> 7)) {
+    fe51_set1(check,0);
+    fe51_sub(h->X,check,h->X);
+  }
+  fe51_mul(h->T,h->X,h->Y);
+  return 0;
+}
+
+/* Writes a, below 2^253, as 256 signed digits that are zero or odd with an
+ * absolute value below 2^(w-1), each nonzero digit followed by at least w-1
+ * zeros */
+sv slide(signed char *r,const u8 *a,int w)
+{
+  int i,b,k,m = (1 << (w - 1)) - 1;
+
+  FOR(i,256) r[i] = 1 & (a[i >> 3] >> (i & 7));
+  FOR(i,256) {
+    if (!r[i]) continue;
+    for (b = 1;b <= w && i + b < 256;++b) {
+      if (!r[i + b]) continue;
+      if (r[i] + (r[i + b] << b) <= m) {
+        r[i] += r[i + b] << b;
+        r[i + b] = 0;
+      } else if (r[i] - (r[i + b] << b) >= -m) {
+        r[i] -= r[i + b] << b;
+        for (k = i + b;k < 256;++k) {
+          if (!r[k]) {
+            r[k] = 1;
+            break;
+          }
+          r[k] = 0;
+        }
+      } else {
+        break;
+      }
+    }
+  }
+}
+
+/* [h]A + [s]B as Straus' method, A's odd multiples up to 15A are made here
+ * and B's up to 63B are in a table. Not constant time, all the inputs are
+ * public */
+sv ge_double_scalarmult(ge_p2 *r,const u8 *h,const ge_p3 *A,const u8 *s)
+{
+  signed char hslide[256],sslide[256];
+  ge_cached Ai[8];
+  ge_p1p1 t;
+  ge_p3 u,A2;
+  int i;
+
+  slide(hslide,h,5);
+  slide(sslide,s,7);
+
+  ge_p3_to_cached(&Ai[0],A);
+  ge_p3_dbl(&t,A);
+  ge_p1p1_to_p3(&A2,&t);
+  for (i = 1;i < 8;i++) {
+    ge_add(&t,&A2,&Ai[i-1],0);
+    ge_p1p1_to_p3(&u,&t);
+    ge_p3_to_cached(&Ai[i],&u);
+  }
+
+  fe51_set1(r->X,0);
+  fe51_set1(r->Y,1);
+  fe51_set1(r->Z,1);
+
+  for (i = 255;i >= 0;--i) {
+    if (hslide[i] || sslide[i]) break;
+  }
+
+  for (;i >= 0;--i) {
+    ge_p2_dbl(&t,r);
+    if (hslide[i]) {
+      ge_p1p1_to_p3(&u,&t);
+      ge_add(&t,&u,&Ai[(hslide[i] < 0 ? -hslide[i] : hslide[i])/2],hslide[i] < 0);
+    }
+    if (sslide[i]) {
+      ge_p1p1_to_p3(&u,&t);
+      ge_madd(&t,&u,&ed_bi[(sslide[i] < 0 ? -sslide[i] : sslide[i])/2],sslide[i] < 0);
+    }
+    ge_p1p1_to_p2(r,&t);
+  }
+}
+
+/* [s]B - [h]A encoded, or -1 if pk isn't a point. h and s are reduced */
+static int double_scalarmult_pack(u8 *r,const u8 *pk,const u8 *h,const u8 *s)
+{
+  ge_p3 A;
+  ge_p2 R;
+  if (ge_frombytes_negate(&A,pk)) return -1;
+  ge_init_tables();
+  ge_double_scalarmult(&R,h,&A,s);
+  ge_pack(r,R.X,R.Y,R.Z);
+  return 0;
+}
+#endif /* DROPBEAR_SIGNKEY_VERIFY */
+#endif /* DROPBEAR_ED25519 */
+#endif /* DROPBEAR_CURVE25519_64 */
 
 #if DROPBEAR_ED25519
 static int crypto_hash(u8 *out,const u8 *m,u64 n)
@@ -269,6 +1016,7 @@ static int crypto_hash(u8 *out,const u8 *m,u64 n)
   return sha512_done(&hs, out);
 }
 
+#if !DROPBEAR_CURVE25519_64
 sv add(gf p[4],gf q[4])
 {
   gf a,b,c,d,t,e,f,g,h;
@@ -337,22 +1085,66 @@ sv scalarbase(gf p[4],const u8 *s)
   scalarmult(p,q,s);
 }
 
-void dropbear_ed25519_make_key(u8 *pk,u8 *sk)
+/* [s]B, encoded */
+sv scalarbase_pack(u8 *r,const u8 *s)
 {
-  u8 d[64];
   gf p[4];
+  scalarbase(p,s);
+  pack(r,p);
+}
 
-  genrandom(sk, 32);
+#if DROPBEAR_SIGNKEY_VERIFY
+static int unpackneg(gf r[4],const u8 p[32])
+{
+  gf t, chk, num, den, den2, den4, den6;
+  set25519(r[2],gf1);
+  unpack25519(r[1],p);
+  S(num,r[1]);
+  M(den,num,D);
+  Z(num,num,r[2]);
+  A(den,r[2],den);
 
-  crypto_hash(d, sk, 32);
-  d[0] &= 248;
-  d[31] &= 127;
-  d[31] |= 64;
+  S(den2,den);
+  S(den4,den2);
+  M(den6,den4,den2);
+  M(t,den6,num);
+  M(t,t,den);
+
+  pow2523(t,t);
+  M(t,t,num);
+  M(t,t,den);
+  M(t,t,den);
+  M(r[0],t,den);
 
-  scalarbase(p,d);
-  pack(pk,p);
+  S(chk,r[0]);
+  M(chk,chk,den);
+  if (neq25519(chk, num)) M(r[0],r[0],I);
+
+  S(chk,r[0]);
+  M(chk,chk,den);
+  if (neq25519(chk, num)) return -1;
+
+  if (par25519(r[0]) == (p[31]>>7)) Z(r[0],gf0,r[0]);
+
+  M(r[3],r[0],r[1]);
+  return 0;
 }
 
+/* [s]B - [h]A encoded, or -1 if pk isn't a point */
+static int double_scalarmult_pack(u8 *r,const u8 *pk,const u8 *h,const u8 *s)
+{
+  gf p[4],q[4];
+
+  if (unpackneg(q,pk)) return -1;
+  scalarmult(p,q,h);
+  scalarbase(q,s);
+  add(p,q);
+  pack(r,p);
+  return 0;
+}
+#endif /* DROPBEAR_SIGNKEY_VERIFY */
+#endif /* !DROPBEAR_CURVE25519_64 */
+
 static const u64 L[32] = {0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10};
 
 sv modL(u8 *r,i64 x[64])
@@ -389,28 +1181,45 @@ sv reduce(u8 *r)
   modL(r,x);
 }
 
-void dropbear_ed25519_sign(const u8 *m,u32 mlen,u8 *s,u32 *slen,const u8 *sk, const u8 *pk)
+/* The clamped secret scalar and the nonce prefix from a private key. With
+ * the 64-bit code this also builds the base point tables, so a server has
+ * them before it forks */
+void dropbear_ed25519_expand(u8 *esk,const u8 *sk)
+{
+  crypto_hash(esk, sk, 32);
+  esk[0] &= 248;
+  esk[31] &= 127;
+  esk[31] |= 64;
+#if DROPBEAR_CURVE25519_64
+  ge_init_tables();
+#endif
+}
+
+void dropbear_ed25519_make_key(u8 *pk,u8 *sk)
+{
+  u8 d[64];
+
+  genrandom(sk, 32);
+  dropbear_ed25519_expand(d, sk);
+  scalarbase_pack(pk,d);
+  m_burn(d, sizeof(d));
+}
+
+void dropbear_ed25519_sign(const u8 *m,u32 mlen,u8 *s,u32 *slen,const u8 *esk, const u8 *pk)
 {
   hash_state hs;
-  u8 d[64],h[64],r[64];
+  u8 h[64],r[64];
   i64 x[64];
-  gf p[4];
   u32 i,j;
 
-  crypto_hash(d, sk, 32);
-  d[0] &= 248;
-  d[31] &= 127;
-  d[31] |= 64;
-
   *slen = 64;
 
   sha512_init(&hs);
-  sha512_process(&hs,d + 32,32);
+  sha512_process(&hs,esk + 32,32);
   sha512_process(&hs,m,mlen);
   sha512_done(&hs,r);
   reduce(r);
-  scalarbase(p,r);
-  pack(s,p);
+  scalarbase_pack(s,r);
 
   sha512_init(&hs);
   sha512_process(&hs,s,32);
@@ -421,69 +1230,34 @@ void dropbear_ed25519_sign(const u8 *m,u32 mlen,u8 *s,u32 *slen,const u8 *sk, co
 
   FOR(i,64) x[i] = 0;
   FOR(i,32) x[i] = (u64) r[i];
-  FOR(i,32) FOR(j,32) x[i+j] += h[i] * (u64) d[j];
+  FOR(i,32) FOR(j,32) x[i+j] += h[i] * (u64) esk[j];
   modL(s + 32,x);
+  m_burn(r, sizeof(r));
+  m_burn(x, sizeof(x));
 }
 
 #if DROPBEAR_SIGNKEY_VERIFY
-static int unpackneg(gf r[4],const u8 p[32])
-{
-  gf t, chk, num, den, den2, den4, den6;
-  set25519(r[2],gf1);
-  unpack25519(r[1],p);
-  S(num,r[1]);
-  M(den,num,D);
-  Z(num,num,r[2]);
-  A(den,r[2],den);
-
-  S(den2,den);
-  S(den4,den2);
-  M(den6,den4,den2);
-  M(t,den6,num);
-  M(t,t,den);
-
-  pow2523(t,t);
-  M(t,t,num);
-  M(t,t,den);
-  M(t,t,den);
-  M(r[0],t,den);
-
-  S(chk,r[0]);
-  M(chk,chk,den);
-  if (neq25519(chk, num)) M(r[0],r[0],I);
-
-  S(chk,r[0]);
-  M(chk,chk,den);
-  if (neq25519(chk, num)) return -1;
-
-  if (par25519(r[0]) == (p[31]>>7)) Z(r[0],gf0,r[0]);
-
-  M(r[3],r[0],r[1]);
-  return 0;
-}
-
 int dropbear_ed25519_verify(const u8 *m,u32 mlen,const u8 *s,u32 slen,const u8 *pk)
 {
   hash_state hs;
-  u8 t[32],h[64];
-  gf p[4],q[4];
+  u8 t[32],h[64],sr[64];
+  u32 i;
 
   if (slen < 64) return -1;
 
-  if (unpackneg(q,pk)) return -1;
-
   sha512_init(&hs);
   sha512_process(&hs,s,32);
   sha512_process(&hs,pk,32);
   sha512_process(&hs,m,mlen);
   sha512_done(&hs,h);
-
   reduce(h);
-  scalarmult(p,q,h);
 
-  scalarbase(q,s + 32);
-  add(p,q);
-  pack(t,p);
+  /* B has order L, so reducing S doesn't change [S]B */
+  FOR(i,32) sr[i] = s[i + 32];
+  FOR(i,32) sr[i + 32] = 0;
+  reduce(sr);
+
+  if (double_scalarmult_pack(t,pk,h,sr)) return -1;
 
   if (crypto_verify_32(s, t))
     return -1;
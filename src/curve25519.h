@@ -25,11 +25,21 @@
 #ifndef DROPBEAR_CURVE25519_H
 #define DROPBEAR_CURVE25519_H
 
+/* X25519 and Ed25519 with five 51-bit limbs and 128-bit products where the
+ * compiler has them, otherwise the compact TweetNaCl code */
+#if defined(__SIZEOF_INT128__)
+#define DROPBEAR_CURVE25519_64 1
+#else
+#define DROPBEAR_CURVE25519_64 0
+#endif
+
 void dropbear_curve25519_scalarmult(unsigned char *q, const unsigned char *n, const unsigned char *p);
 void dropbear_ed25519_make_key(unsigned char *pk, unsigned char  *sk);
+/* esk is the 64 byte expansion of sk used to sign */
+void dropbear_ed25519_expand(unsigned char *esk, const unsigned char *sk);
 void dropbear_ed25519_sign(const unsigned char *m, unsigned long mlen,
 			  unsigned char *s, unsigned long *slen,
-			  const unsigned char *sk, const unsigned char *pk);
+			  const unsigned char *esk, const unsigned char *pk);
 int dropbear_ed25519_verify(const unsigned char *m, unsigned long mlen,
 			    const unsigned char *s, unsigned long slen,
 			    const unsigned char *pk);
@@ -65,6 +65,23 @@ void * m_malloc(size_t size) {
 
 }
 
+/* As m_malloc() without zeroing, for memory that is always written
+ * before it is read */
+void * m_malloc_uninit(size_t size) {
+
+	void* ret;
+
+	if (size == 0) {
+		dropbear_exit("m_malloc failed");
+	}
+	ret = malloc(size);
+	if (ret == NULL) {
+		dropbear_exit("m_malloc failed");
+	}
+	return ret;
+
+}
+
 void * m_realloc(void* ptr, size_t size) {
 
 	void *ret;
@@ -173,6 +190,11 @@ void * m_malloc(size_t size) {
     return &mem[sizeof(struct dbmalloc_header)];
 }
 
+/* keep allocations deterministic when fuzzing */
+void * m_malloc_uninit(size_t size) {
+    return m_malloc(size);
+}
+
 void * m_realloc(void* ptr, size_t size) {
     char* mem = NULL;
     struct dbmalloc_header* header = NULL;
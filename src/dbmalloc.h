@@ -7,6 +7,7 @@
 #include <stdlib.h>
 
 void * m_malloc(size_t size);
+void * m_malloc_uninit(size_t size);
 void * m_calloc(size_t nmemb, size_t size);
 void * m_strdup(const char * str);
 void * m_realloc(void* ptr, size_t size);
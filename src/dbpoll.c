@@ -0,0 +1,996 @@
+/*
+ * Dropbear - a SSH2 server
+ * 
+ * Copyright (c) 2002-2006 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+/* Readiness backends for the session and listener loops.
+ *
+ * Interest is registered per fd when it changes, and kept between waits.
+ * The epoll backend only touches the kernel when an fd's interest changes,
+ * and its results are proportional to the number of ready fds rather than
+ * the number registered. select() is the portable fallback, and is also
+ * used if epoll isn't available at runtime.
+ *
+ * DBPOLL_READ_GATED fds are kept in a second epoll set which is itself
+ * registered with the main set only while the gate is open. Channel reads
+ * can then be paused during key exchange or when the write queue is full
+ * without visiting every channel.
+ *
+ * The io_uring backend arms a one-shot poll for each wanted fd, re-arming
+ * it after each completion while the fd is still wanted, which gives the
+ * same level-triggered behaviour. Interest changes are queued and
+ * submitted along with the wait, so they don't cost a system call each.
+ * It can also run reads and writes (dbpoll_io_*()), with their
+ * completions reaped by dbpoll_wait(). Gated fds aren't re-armed while
+ * the gate is closed, they are kept on a list and armed when it opens.
+ * io_uring can't poll some fds, such as ttys, those are moved to an epoll
+ * set which is itself polled through the ring. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "dbpoll.h"
+#include "dburing.h"
+
+#define DBPOLL_BACKEND_SELECT 0
+#define DBPOLL_BACKEND_EPOLL 1
+#define DBPOLL_BACKEND_URING 2
+
+#define DBPOLL_EXTEND_SIZE 32
+#define DBPOLL_MAX_EVENTS 64
+
+struct dbpoll_fd {
+	/* DBPOLL_* interest */
+	unsigned int want;
+	/* DBPOLL_READ/DBPOLL_WRITE from the last wait */
+	unsigned int ready;
+#if DROPBEAR_EPOLL
+	/* events registered with the main and gated epoll sets */
+	unsigned int kmain;
+	unsigned int kgated;
+	/* epoll refuses regular files and some devices, select() always
+	 * reports them as ready so we do the same */
+	int always;
+#endif
+#if DROPBEAR_IO_URING
+	/* DBPOLL_READ/DBPOLL_WRITE of the armed poll, 0 if none */
+	unsigned int armed;
+	/* tags the armed poll's completion, stale ones are ignored */
+	unsigned int gen;
+	/* on uring_dirty or uring_parked */
+	unsigned char dirty;
+	unsigned char parked;
+	/* waited on with epoll_fd instead, using kmain */
+	unsigned char aux;
+#endif
+	void *data;
+};
+
+static struct dbpoll_fd *pollfds = NULL;
+static int pollsize = 0;
+static int *readylist = NULL;
+static unsigned int nready = 0;
+static unsigned int readysize = 0;
+static int gate_open = 1;
+static int backend = DBPOLL_BACKEND_SELECT;
+/* the process that owns the epoll sets, see dbpoll_forget() */
+static pid_t owner_pid = 0;
+
+static fd_set sel_read, sel_write, sel_gated;
+static int sel_maxfd = -1;
+
+#if DROPBEAR_EPOLL
+static int epoll_fd = -1;
+static int epoll_gated_fd = -1;
+static unsigned int always_count = 0;
+#endif
+
+#if DROPBEAR_IO_URING
+#define DBPOLL_URING_ENTRIES 256
+#define DBPOLL_IO_SLOTS 4
+#define DBPOLL_IO_IOV 64
+
+/* Completion user_data is the kind in the top bits, a generation count
+ * and an fd or IO slot */
+#define URING_KIND_POLL 0ULL
+#define URING_KIND_IO 1ULL
+#define URING_KIND_IGNORE 2ULL
+#define URING_GEN_MASK 0x3fffffffU
+#define URING_DATA(kind, gen, n) (((kind) << 62) \
+		| ((uint64_t)((gen) & URING_GEN_MASK) << 32) | (uint32_t)(n))
+#define URING_DATA_KIND(d) ((d) >> 62)
+#define URING_DATA_GEN(d) ((unsigned int)((d) >> 32) & URING_GEN_MASK)
+#define URING_DATA_N(d) ((unsigned int)((d) & 0xffffffffU))
+
+struct dbpoll_io {
+	/* NULL for a free slot */
+	dbpoll_io_done done;
+	void *arg;
+	struct iovec iov[DBPOLL_IO_IOV];
+};
+
+static struct dburing uring;
+/* fds whose armed poll may not match what is wanted */
+static int *uring_dirty = NULL;
+static unsigned int uring_ndirty = 0;
+static unsigned int uring_dirtysize = 0;
+/* gated fds waiting for the gate to open */
+static int *uring_parked = NULL;
+static unsigned int uring_nparked = 0;
+static unsigned int uring_parkedsize = 0;
+static struct dbpoll_io io_slots[DBPOLL_IO_SLOTS];
+static unsigned int io_inflight = 0;
+static int io_registered = 0;
+#endif
+
+static struct dbpoll_fd* getpollfd(int fd) {
+	if (fd >= pollsize) {
+		int newsize = fd + DBPOLL_EXTEND_SIZE;
+		pollfds = m_realloc(pollfds, newsize * sizeof(*pollfds));
+		memset(&pollfds[pollsize], 0x0,
+				(newsize - pollsize) * sizeof(*pollfds));
+		pollsize = newsize;
+	}
+	return &pollfds[fd];
+}
+
+/* Interest that can currently be satisfied */
+static unsigned int effective_want(unsigned int want) {
+	unsigned int ret = want & (DBPOLL_READ | DBPOLL_WRITE);
+	if (gate_open && (want & DBPOLL_READ_GATED)) {
+		ret |= DBPOLL_READ;
+	}
+	return ret;
+}
+
+static void add_ready(int fd, unsigned int ready) {
+	struct dbpoll_fd *p;
+
+	if (fd < 0 || fd >= pollsize) {
+		return;
+	}
+	p = &pollfds[fd];
+	ready &= effective_want(p->want);
+	if (!ready) {
+		return;
+	}
+	if (!p->ready) {
+		if (nready == readysize) {
+			readysize += DBPOLL_EXTEND_SIZE;
+			readylist = m_realloc(readylist, readysize * sizeof(int));
+		}
+		readylist[nready] = fd;
+		nready++;
+	}
+	p->ready |= ready;
+}
+
+static void select_set(int fd, unsigned int want) {
+	if (fd >= FD_SETSIZE) {
+		dropbear_exit("fd %d too large for select()", fd);
+	}
+
+	FD_CLR(fd, &sel_read);
+	FD_CLR(fd, &sel_write);
+	FD_CLR(fd, &sel_gated);
+	if (want & DBPOLL_READ) {
+		FD_SET(fd, &sel_read);
+	}
+	if (want & DBPOLL_WRITE) {
+		FD_SET(fd, &sel_write);
+	}
+	if (want & DBPOLL_READ_GATED) {
+		FD_SET(fd, &sel_gated);
+	}
+	if (want) {
+		sel_maxfd = MAX(sel_maxfd, fd);
+	}
+}
+
+static int select_wait(int timeout_ms) {
+	fd_set readfds, writefds;
+	struct timeval tv, *tvp = NULL;
+	int fd, ret;
+
+	memcpy(&readfds, &sel_read, sizeof(readfds));
+	memcpy(&writefds, &sel_write, sizeof(writefds));
+	if (gate_open) {
+		for (fd = 0; fd <= sel_maxfd; fd++) {
+			if (FD_ISSET(fd, &sel_gated)) {
+				FD_SET(fd, &readfds);
+			}
+		}
+	}
+
+	if (timeout_ms >= 0) {
+		tv.tv_sec = timeout_ms / 1000;
+		tv.tv_usec = (timeout_ms % 1000) * 1000;
+		tvp = &tv;
+	}
+
+	ret = select(sel_maxfd+1, &readfds, &writefds, NULL, tvp);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	for (fd = 0; fd <= sel_maxfd; fd++) {
+		unsigned int ready = 0;
+		if (FD_ISSET(fd, &readfds)) {
+			ready |= DBPOLL_READ;
+		}
+		if (FD_ISSET(fd, &writefds)) {
+			ready |= DBPOLL_WRITE;
+		}
+		if (ready) {
+			add_ready(fd, ready);
+		}
+	}
+	return ret;
+}
+
+#if DROPBEAR_EPOLL
+/* Changes the events registered for fd in one epoll set, *cur tracks
+ * what is registered */
+static int epoll_update(int epfd, int fd, unsigned int *cur, unsigned int events) {
+	struct epoll_event ev;
+	int op;
+
+	if (*cur == events) {
+		return DROPBEAR_SUCCESS;
+	}
+
+	if (events == 0) {
+		op = EPOLL_CTL_DEL;
+	} else if (*cur == 0) {
+		op = EPOLL_CTL_ADD;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	memset(&ev, 0x0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, op, fd, &ev) < 0) {
+		if (op == EPOLL_CTL_DEL) {
+			/* already gone, eg closed elsewhere */
+		} else if (op == EPOLL_CTL_ADD && errno == EEXIST) {
+			if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+				return DROPBEAR_FAILURE;
+			}
+		} else if (op == EPOLL_CTL_MOD && errno == ENOENT) {
+			if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+				return DROPBEAR_FAILURE;
+			}
+		} else {
+			return DROPBEAR_FAILURE;
+		}
+	}
+	*cur = events;
+	return DROPBEAR_SUCCESS;
+}
+
+static void epoll_set(int fd, struct dbpoll_fd *p) {
+	unsigned int mainev = 0, gatedev = 0;
+
+	if (p->always) {
+		if (p->want) {
+			return;
+		}
+		p->always = 0;
+		always_count--;
+	}
+
+	if (p->want & DBPOLL_READ) {
+		mainev |= EPOLLIN;
+	}
+	if (p->want & DBPOLL_WRITE) {
+		mainev |= EPOLLOUT;
+	}
+	if (p->want & DBPOLL_READ_GATED) {
+		gatedev |= EPOLLIN;
+	}
+
+	if (epoll_update(epoll_fd, fd, &p->kmain, mainev) == DROPBEAR_FAILURE
+		|| epoll_update(epoll_gated_fd, fd, &p->kgated, gatedev) == DROPBEAR_FAILURE) {
+		if (errno != EPERM) {
+			dropbear_exit("epoll_ctl fd %d:", fd);
+		}
+		TRACE(("fd %d can't be used with epoll, treating as always ready", fd))
+		epoll_update(epoll_fd, fd, &p->kmain, 0);
+		epoll_update(epoll_gated_fd, fd, &p->kgated, 0);
+		p->always = 1;
+		always_count++;
+	}
+}
+
+static unsigned int from_epoll(uint32_t events) {
+	unsigned int ret = 0;
+
+	/* errors and hangups are readable and writable for select() */
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		ret |= DBPOLL_READ;
+	}
+	if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+		ret |= DBPOLL_WRITE;
+	}
+	return ret;
+}
+
+static int epoll_wait_fds(int timeout_ms) {
+	struct epoll_event events[DBPOLL_MAX_EVENTS];
+	int n, i, j, ngated;
+
+	n = epoll_wait(epoll_fd, events, DBPOLL_MAX_EVENTS, timeout_ms);
+	if (n < 0) {
+		return n;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (events[i].data.fd == epoll_gated_fd) {
+			struct epoll_event gated[DBPOLL_MAX_EVENTS];
+			ngated = epoll_wait(epoll_gated_fd, gated, DBPOLL_MAX_EVENTS, 0);
+			for (j = 0; j < ngated; j++) {
+				add_ready(gated[j].data.fd, from_epoll(gated[j].events));
+			}
+		} else {
+			add_ready(events[i].data.fd, from_epoll(events[i].events));
+		}
+	}
+	return n;
+}
+
+/* Returns 1 if any always-ready fd currently has interest */
+static int always_pending(void) {
+	int fd;
+
+	if (always_count == 0) {
+		return 0;
+	}
+	for (fd = 0; fd < pollsize; fd++) {
+		if (pollfds[fd].always && effective_want(pollfds[fd].want)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void add_always_ready(void) {
+	int fd;
+
+	if (always_count == 0) {
+		return;
+	}
+	for (fd = 0; fd < pollsize; fd++) {
+		if (pollfds[fd].always) {
+			add_ready(fd, DBPOLL_READ | DBPOLL_WRITE);
+		}
+	}
+}
+#endif /* DROPBEAR_EPOLL */
+
+#if DROPBEAR_IO_URING
+static void uring_push(int **list, unsigned int *n, unsigned int *size, int fd) {
+	if (*n == *size) {
+		*size += DBPOLL_EXTEND_SIZE;
+		*list = m_realloc(*list, *size * sizeof(int));
+	}
+	(*list)[*n] = fd;
+	(*n)++;
+}
+
+static void uring_mark(int fd, struct dbpoll_fd *p) {
+	if (!p->dirty) {
+		p->dirty = 1;
+		uring_push(&uring_dirty, &uring_ndirty, &uring_dirtysize, fd);
+	}
+}
+
+static struct io_uring_sqe* uring_sqe(void) {
+	struct io_uring_sqe *sqe = dburing_get_sqe(&uring);
+	if (sqe == NULL) {
+		dropbear_exit("io_uring submission failed:");
+	}
+	return sqe;
+}
+
+static void uring_aux_set(int fd, struct dbpoll_fd *p, unsigned int want) {
+	unsigned int events = 0;
+
+	if (want & DBPOLL_READ) {
+		events |= EPOLLIN;
+	}
+	if (want & DBPOLL_WRITE) {
+		events |= EPOLLOUT;
+	}
+	if (epoll_update(epoll_fd, fd, &p->kmain, events) == DROPBEAR_FAILURE) {
+		dropbear_exit("epoll_ctl fd %d:", fd);
+	}
+	if (p->want == 0) {
+		/* the fd number may be reused for something io_uring can poll */
+		p->aux = 0;
+	}
+}
+
+/* Moves fd to the epoll set, after io_uring failed to poll it */
+static int uring_aux_add(int fd) {
+	if (epoll_fd < 0) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			return DROPBEAR_FAILURE;
+		}
+		/* uring_poll_done() handles it, it is never reported itself */
+		dbpoll_set(epoll_fd, DBPOLL_READ, NULL);
+	}
+	TRACE(("fd %d can't be polled by io_uring, using epoll", fd))
+	pollfds[fd].aux = 1;
+	pollfds[fd].kmain = 0;
+	return DROPBEAR_SUCCESS;
+}
+
+static void uring_aux_ready(void) {
+	struct epoll_event events[DBPOLL_MAX_EVENTS];
+	int n, i, fd;
+
+	n = epoll_wait(epoll_fd, events, DBPOLL_MAX_EVENTS, 0);
+	for (i = 0; i < n; i++) {
+		fd = events[i].data.fd;
+		add_ready(fd, from_epoll(events[i].events));
+		/* have uring_flush() look again, eg if the gate closed */
+		uring_mark(fd, &pollfds[fd]);
+	}
+}
+
+/* Bring the armed polls into line with what is wanted */
+static void uring_flush(void) {
+	struct io_uring_sqe *sqe;
+	struct dbpoll_fd *p;
+	unsigned int i, want;
+	int fd;
+
+	for (i = 0; i < uring_ndirty; i++) {
+		fd = uring_dirty[i];
+		p = &pollfds[fd];
+		p->dirty = 0;
+
+		want = effective_want(p->want);
+		if ((p->want & DBPOLL_READ_GATED) && !gate_open && !p->parked) {
+			p->parked = 1;
+			uring_push(&uring_parked, &uring_nparked, &uring_parkedsize, fd);
+		}
+		if (p->aux) {
+			uring_aux_set(fd, p, want);
+			continue;
+		}
+		if (want == p->armed) {
+			continue;
+		}
+
+		if (p->armed) {
+			sqe = uring_sqe();
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = URING_DATA(URING_KIND_POLL, p->gen, fd);
+			sqe->user_data = URING_DATA(URING_KIND_IGNORE, 0, fd);
+			p->armed = 0;
+			p->gen++;
+		}
+
+		if (want) {
+			sqe = uring_sqe();
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = fd;
+			if (want & DBPOLL_READ) {
+				sqe->poll32_events |= POLLIN;
+			}
+			if (want & DBPOLL_WRITE) {
+				sqe->poll32_events |= POLLOUT;
+			}
+			sqe->user_data = URING_DATA(URING_KIND_POLL, p->gen, fd);
+			p->armed = want;
+		}
+	}
+	uring_ndirty = 0;
+}
+
+static void uring_poll_done(int fd, unsigned int gen, int res) {
+	struct dbpoll_fd *p;
+	unsigned int ready = 0;
+
+	if (fd >= pollsize) {
+		return;
+	}
+	p = &pollfds[fd];
+	if (!p->armed || gen != (p->gen & URING_GEN_MASK)) {
+		/* removed or replaced since */
+		return;
+	}
+
+	/* one-shot, re-armed by the next uring_flush() if still wanted */
+	p->armed = 0;
+	uring_mark(fd, p);
+
+	if (res < 0) {
+		if (res == -ECANCELED) {
+			return;
+		}
+		/* ttys, for example, use more wait queues than io_uring
+		 * supports */
+		if (fd != epoll_fd && uring_aux_add(fd) == DROPBEAR_SUCCESS) {
+			return;
+		}
+		errno = -res;
+		dropbear_exit("io_uring poll fd %d:", fd);
+	}
+
+	if (fd == epoll_fd) {
+		uring_aux_ready();
+		return;
+	}
+
+	/* errors and hangups are readable and writable for select() */
+	if (res & (POLLIN | POLLHUP | POLLERR)) {
+		ready |= DBPOLL_READ;
+	}
+	if (res & (POLLOUT | POLLHUP | POLLERR)) {
+		ready |= DBPOLL_WRITE;
+	}
+	add_ready(fd, ready);
+}
+
+static void uring_io_done(unsigned int slot, int res) {
+	struct dbpoll_io *io;
+	dbpoll_io_done done;
+	void *arg;
+
+	if (slot >= DBPOLL_IO_SLOTS || io_slots[slot].done == NULL) {
+		return;
+	}
+	io = &io_slots[slot];
+	done = io->done;
+	arg = io->arg;
+	io->done = NULL;
+	io->arg = NULL;
+	io_inflight--;
+	done(res, arg);
+}
+
+static void uring_reap(void) {
+	struct io_uring_cqe *cqe;
+	uint64_t data;
+	int res;
+
+	while ((cqe = dburing_peek_cqe(&uring)) != NULL) {
+		data = cqe->user_data;
+		res = cqe->res;
+		dburing_cqe_seen(&uring);
+
+		switch (URING_DATA_KIND(data)) {
+			case URING_KIND_POLL:
+				uring_poll_done(URING_DATA_N(data), URING_DATA_GEN(data), res);
+				break;
+			case URING_KIND_IO:
+				uring_io_done(URING_DATA_N(data), res);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+static int uring_wait(int timeout_ms) {
+	int ret;
+
+	uring_flush();
+	ret = dburing_enter(&uring, 1, timeout_ms);
+	/* completions are handled even if the wait was interrupted */
+	uring_reap();
+	return ret;
+}
+
+static void uring_gate_open(void) {
+	unsigned int i;
+	int fd;
+
+	for (i = 0; i < uring_nparked; i++) {
+		fd = uring_parked[i];
+		pollfds[fd].parked = 0;
+		uring_mark(fd, &pollfds[fd]);
+	}
+	uring_nparked = 0;
+}
+
+static struct dbpoll_io* io_slot(unsigned int *slot) {
+	unsigned int i;
+
+	if (backend != DBPOLL_BACKEND_URING) {
+		return NULL;
+	}
+	for (i = 0; i < DBPOLL_IO_SLOTS; i++) {
+		if (io_slots[i].done == NULL) {
+			*slot = i;
+			return &io_slots[i];
+		}
+	}
+	return NULL;
+}
+
+int dbpoll_io_available() {
+	return backend == DBPOLL_BACKEND_URING;
+}
+
+int dbpoll_io_register(void *buf, unsigned int len) {
+	if (backend != DBPOLL_BACKEND_URING || io_registered) {
+		return -1;
+	}
+	if (dburing_register_buffer(&uring, buf, len) == DROPBEAR_FAILURE) {
+		return -1;
+	}
+	io_registered = 1;
+	return 0;
+}
+
+int dbpoll_io_read(int fd, void *buf, unsigned int len, int bufindex,
+		dbpoll_io_done done, void *arg) {
+	struct io_uring_sqe *sqe;
+	struct dbpoll_io *io;
+	unsigned int slot;
+
+	io = io_slot(&slot);
+	if (io == NULL) {
+		return DROPBEAR_FAILURE;
+	}
+
+	sqe = uring_sqe();
+	sqe->opcode = bufindex >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	/* not seekable, use the current position */
+	sqe->off = (uint64_t)-1;
+	if (bufindex >= 0) {
+		sqe->buf_index = bufindex;
+	}
+	sqe->user_data = URING_DATA(URING_KIND_IO, 0, slot);
+
+	io->done = done;
+	io->arg = arg;
+	io_inflight++;
+	return DROPBEAR_SUCCESS;
+}
+
+int dbpoll_io_writev(int fd, const struct iovec *iov, unsigned int iovcnt,
+		dbpoll_io_done done, void *arg) {
+	struct io_uring_sqe *sqe;
+	struct dbpoll_io *io;
+	unsigned int slot;
+
+	io = io_slot(&slot);
+	if (io == NULL) {
+		return DROPBEAR_FAILURE;
+	}
+
+	/* the kernel may read the iovecs after this returns */
+	iovcnt = MIN(iovcnt, DBPOLL_IO_IOV);
+	memcpy(io->iov, iov, iovcnt * sizeof(struct iovec));
+
+	sqe = uring_sqe();
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)io->iov;
+	sqe->len = iovcnt;
+	sqe->off = (uint64_t)-1;
+	sqe->user_data = URING_DATA(URING_KIND_IO, 0, slot);
+
+	io->done = done;
+	io->arg = arg;
+	io_inflight++;
+	return DROPBEAR_SUCCESS;
+}
+
+/* Before the buffers used by reads and writes are freed: submits
+ * anything queued, cancels what can't complete straight away and waits
+ * for the completions */
+void dbpoll_io_drain() {
+	struct io_uring_sqe *sqe;
+	unsigned int i;
+
+	if (backend != DBPOLL_BACKEND_URING || getpid() != owner_pid
+			|| io_inflight == 0) {
+		return;
+	}
+
+	TRACE(("dbpoll_io_drain: %d in flight", io_inflight))
+	if (dburing_enter(&uring, 0, 0) < 0) {
+		return;
+	}
+	uring_reap();
+
+	for (i = 0; i < DBPOLL_IO_SLOTS; i++) {
+		if (io_slots[i].done) {
+			sqe = uring_sqe();
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = URING_DATA(URING_KIND_IO, 0, i);
+			sqe->user_data = URING_DATA(URING_KIND_IGNORE, 0, i);
+		}
+	}
+
+	while (io_inflight > 0) {
+		if (dburing_enter(&uring, 1, 1000) < 0 && errno != EINTR) {
+			break;
+		}
+		i = io_inflight;
+		uring_reap();
+		if (io_inflight == i) {
+			/* timed out */
+			break;
+		}
+	}
+}
+
+static void uring_cleanup(void) {
+	/* uring isn't set up until the backend is chosen */
+	if (backend == DBPOLL_BACKEND_URING) {
+		dburing_free(&uring);
+	}
+	m_free(uring_dirty);
+	uring_dirty = NULL;
+	uring_ndirty = uring_dirtysize = 0;
+	m_free(uring_parked);
+	uring_parked = NULL;
+	uring_nparked = uring_parkedsize = 0;
+	memset(io_slots, 0x0, sizeof(io_slots));
+	io_inflight = 0;
+	io_registered = 0;
+}
+#endif /* DROPBEAR_IO_URING */
+
+/* Set up a fresh state, discarding anything inherited from a parent
+ * process */
+void dbpoll_init() {
+	dbpoll_cleanup();
+
+	owner_pid = getpid();
+	gate_open = 1;
+	DROPBEAR_FD_ZERO(&sel_read);
+	DROPBEAR_FD_ZERO(&sel_write);
+	DROPBEAR_FD_ZERO(&sel_gated);
+	sel_maxfd = -1;
+	backend = DBPOLL_BACKEND_SELECT;
+
+#if DROPBEAR_IO_URING
+	if (dburing_init(&uring, DBPOLL_URING_ENTRIES) == DROPBEAR_SUCCESS) {
+		backend = DBPOLL_BACKEND_URING;
+		TRACE(("dbpoll_init: %s", dbpoll_name()))
+		return;
+	}
+	TRACE(("io_uring unavailable"))
+#endif
+
+#if DROPBEAR_EPOLL
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd >= 0) {
+		epoll_gated_fd = epoll_create1(EPOLL_CLOEXEC);
+	}
+	if (epoll_gated_fd >= 0) {
+		struct epoll_event ev;
+		memset(&ev, 0x0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = epoll_gated_fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, epoll_gated_fd, &ev) == 0) {
+			backend = DBPOLL_BACKEND_EPOLL;
+		}
+	}
+	if (backend != DBPOLL_BACKEND_EPOLL) {
+		TRACE(("epoll unavailable, using select"))
+		m_close(epoll_fd);
+		m_close(epoll_gated_fd);
+		epoll_fd = epoll_gated_fd = -1;
+	}
+#endif
+	TRACE(("dbpoll_init: %s", dbpoll_name()))
+}
+
+void dbpoll_cleanup() {
+	m_free(pollfds);
+	pollfds = NULL;
+	pollsize = 0;
+	m_free(readylist);
+	readylist = NULL;
+	nready = readysize = 0;
+#if DROPBEAR_EPOLL
+	always_count = 0;
+	m_close(epoll_fd);
+	m_close(epoll_gated_fd);
+	epoll_fd = epoll_gated_fd = -1;
+#endif
+#if DROPBEAR_IO_URING
+	uring_cleanup();
+#endif
+}
+
+const char* dbpoll_name() {
+	if (backend == DBPOLL_BACKEND_URING) {
+		return "io_uring";
+	}
+	if (backend == DBPOLL_BACKEND_EPOLL) {
+		return "epoll";
+	}
+	return "select";
+}
+
+void dbpoll_set(int fd, unsigned int want, void *data) {
+	struct dbpoll_fd *p;
+
+	if (fd < 0) {
+		return;
+	}
+
+	p = getpollfd(fd);
+	p->data = data;
+	if (p->want == want) {
+		return;
+	}
+	p->want = want;
+
+#if DROPBEAR_IO_URING
+	if (backend == DBPOLL_BACKEND_URING) {
+		uring_mark(fd, p);
+		return;
+	}
+#endif
+#if DROPBEAR_EPOLL
+	if (backend == DBPOLL_BACKEND_EPOLL) {
+		epoll_set(fd, p);
+		return;
+	}
+#endif
+	select_set(fd, want);
+}
+
+void dbpoll_forget(int fd) {
+	struct dbpoll_fd *p;
+
+	if (fd < 0 || fd >= pollsize) {
+		return;
+	}
+	p = &pollfds[fd];
+	if (!p->want && !p->ready && !p->data
+#if DROPBEAR_IO_URING
+			&& !p->armed
+#endif
+			) {
+		return;
+	}
+
+	/* A forked child shares its parent's epoll sets until it calls
+	 * dbpoll_init(), closing inherited fds mustn't remove them */
+	if (getpid() != owner_pid) {
+		return;
+	}
+
+	dbpoll_set(fd, 0, NULL);
+	p->ready = 0;
+
+#if DROPBEAR_IO_URING
+	if (backend == DBPOLL_BACKEND_URING) {
+		uring_mark(fd, p);
+	}
+	/* An armed poll holds a reference to the file, remove it now so
+	 * that close() takes effect (eg sending a FIN) straight away */
+	if (backend == DBPOLL_BACKEND_URING && p->armed) {
+		uring_flush();
+		if (dburing_enter(&uring, 0, 0) < 0) {
+			dropbear_exit("io_uring submission failed:");
+		}
+	}
+#endif
+}
+
+void dbpoll_gate(int open) {
+	open = open ? 1 : 0;
+	if (open == gate_open) {
+		return;
+	}
+	gate_open = open;
+
+#if DROPBEAR_IO_URING
+	if (backend == DBPOLL_BACKEND_URING) {
+		if (open) {
+			uring_gate_open();
+		}
+		return;
+	}
+#endif
+#if DROPBEAR_EPOLL
+	if (backend == DBPOLL_BACKEND_EPOLL) {
+		struct epoll_event ev;
+		memset(&ev, 0x0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = epoll_gated_fd;
+		if (epoll_ctl(epoll_fd, open ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+				epoll_gated_fd, &ev) < 0) {
+			dropbear_exit("epoll_ctl gate:");
+		}
+	}
+#endif
+}
+
+int dbpoll_wait(int timeout_ms) {
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < nready; i++) {
+		pollfds[readylist[i]].ready = 0;
+	}
+	nready = 0;
+
+#if DROPBEAR_IO_URING
+	if (backend == DBPOLL_BACKEND_URING) {
+		ret = uring_wait(timeout_ms);
+		if (ret < 0) {
+			return ret;
+		}
+		return nready;
+	}
+#endif
+#if DROPBEAR_EPOLL
+	if (backend == DBPOLL_BACKEND_EPOLL) {
+		if (always_pending()) {
+			timeout_ms = 0;
+		}
+		ret = epoll_wait_fds(timeout_ms);
+		if (ret < 0) {
+			return ret;
+		}
+		add_always_ready();
+		return nready;
+	}
+#endif
+
+	ret = select_wait(timeout_ms);
+	if (ret < 0) {
+		return ret;
+	}
+	return nready;
+}
+
+unsigned int dbpoll_ready(int fd) {
+	if (fd < 0 || fd >= pollsize) {
+		return 0;
+	}
+	return pollfds[fd].ready;
+}
+
+unsigned int dbpoll_nready() {
+	return nready;
+}
+
+int dbpoll_ready_fd(unsigned int i) {
+	return readylist[i];
+}
+
+void* dbpoll_data(int fd) {
+	if (fd < 0 || fd >= pollsize) {
+		return NULL;
+	}
+	return pollfds[fd].data;
+}
@@ -0,0 +1,82 @@
+/*
+ * Dropbear - a SSH2 server
+ * 
+ * Copyright (c) 2002-2006 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_DBPOLL_H_
+#define DROPBEAR_DBPOLL_H_
+
+#include "includes.h"
+
+/* Waits for fd readiness for the session and listener loops. Callers
+ * register interest when it changes rather than rebuilding fd_sets for
+ * every wait. Uses io_uring or epoll() where available, select()
+ * otherwise. */
+
+/* Interest and readiness */
+#define DBPOLL_READ 1
+#define DBPOLL_WRITE 2
+/* Interest only: read, but only while the gate is open (see dbpoll_gate()).
+ * Readiness is reported as DBPOLL_READ */
+#define DBPOLL_READ_GATED 4
+
+void dbpoll_init(void);
+void dbpoll_cleanup(void);
+const char* dbpoll_name(void);
+
+/* Set the interest for fd, replacing any previous interest. want of 0
+ * stops waiting for the fd. data is an opaque owner pointer, returned
+ * by dbpoll_data() */
+void dbpoll_set(int fd, unsigned int want, void *data);
+/* Called from m_close(), drops all state for fd */
+void dbpoll_forget(int fd);
+/* Enable or disable all DBPOLL_READ_GATED interest at once */
+void dbpoll_gate(int open);
+
+/* Returns the number of ready fds, 0 on timeout or -1 on error.
+ * timeout_ms of -1 waits indefinitely */
+int dbpoll_wait(int timeout_ms);
+/* Results from the last dbpoll_wait() */
+unsigned int dbpoll_ready(int fd);
+unsigned int dbpoll_nready(void);
+int dbpoll_ready_fd(unsigned int i);
+void* dbpoll_data(int fd);
+
+#if DROPBEAR_IO_URING
+/* Reads and writes submitted with the io_uring backend. They are sent to
+ * the kernel with the next dbpoll_wait(), which also runs done() for
+ * completed ones with the byte count or -errno. Buffers must stay valid
+ * until then. These return DROPBEAR_FAILURE if the backend isn't in use
+ * or too many are in flight, the caller should do the IO itself */
+typedef void (*dbpoll_io_done)(int res, void *arg);
+int dbpoll_io_available(void);
+/* Returns a buffer index for dbpoll_io_read(), or -1. Only one buffer
+ * can be registered */
+int dbpoll_io_register(void *buf, unsigned int len);
+int dbpoll_io_read(int fd, void *buf, unsigned int len, int bufindex,
+		dbpoll_io_done done, void *arg);
+int dbpoll_io_writev(int fd, const struct iovec *iov, unsigned int iovcnt,
+		dbpoll_io_done done, void *arg);
+void dbpoll_io_drain(void);
+#endif
+
+#endif /* DROPBEAR_DBPOLL_H_ */
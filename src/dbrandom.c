@@ -29,24 +29,48 @@
 #include "dbrandom.h"
 #include "runopts.h"
 
-/* this is used to generate unique output from the same hashpool */
-static uint32_t counter = 0;
-/* the max value for the counter, so it won't integer overflow */
-#define MAX_COUNTER (1<<30)
-
 static unsigned char hashpool[SHA256_HASH_SIZE] = {0};
 static int donerandinit = 0;
 
 #define INIT_SEED_SIZE 32 /* 256 bits */
 
+/* Output is buffered this many bytes at a time */
+#define RANDBUF_SIZE 4096
+/* Reseed from the system after this many buffer refills (16GB) */
+#define MAX_REFILLS (1<<22)
+
+struct randbuf {
+	/* zero after a fork where the kernel wipes this page */
+	int keyed;
+	/* unread bytes, at the end of buf */
+	unsigned int avail;
+	unsigned char buf[RANDBUF_SIZE];
+};
+
+static struct randbuf randbuf_static;
+static struct randbuf *randbuf = &randbuf_static;
+/* set when randbuf is cleared in children by MADV_WIPEONFORK, otherwise
+ * a fork is noticed by the pid changing */
+static int randbuf_wipeonfork = 0;
+static pid_t randbuf_pid = 0;
+static unsigned int refills = 0;
+
+/* reseedrandom() only does a full seedrandom() this often, in seconds */
+#define FULL_SEED_INTERVAL 60
+static time_t last_full_seed = 0;
+
 /* The basic setup is we read some data from /dev/(u)random or prngd and hash it
- * into hashpool. To read data, we hash together current hashpool contents,
- * and a counter. We feed more data in by hashing the current pool and new
+ * into hashpool. We feed more data in by hashing the current pool and new
  * data into the pool.
  *
- * It is important to ensure that counter doesn't wrap around before we
- * feed in new entropy.
+ * Output is a "fast key erasure" ChaCha20 generator keyed by hashpool: a
+ * refill runs ChaCha20 over RANDBUF_SIZE bytes, the first 32 bytes replace
+ * hashpool and the rest are handed out by genrandom(), being wiped as they
+ * go. Earlier output can't be recovered from the state left in memory.
  *
+ * A forked child would otherwise repeat its parent's output, so it stirs
+ * its pid, the time and fresh kernel randomness into hashpool before its
+ * first use.
  */
 
 /* Pass wantlen=0 to hash an entire file */
@@ -109,6 +133,87 @@ out:
 	return ret;
 }
 
+/* Discards buffered output, the next genrandom() refills from hashpool */
+static void randbuf_reset(void) {
+#if defined(MADV_WIPEONFORK) && defined(MAP_ANONYMOUS)
+	static int tried_mmap = 0;
+
+	if (!tried_mmap) {
+		void *p;
+		tried_mmap = 1;
+		p = mmap(NULL, sizeof(struct randbuf), PROT_READ|PROT_WRITE,
+				MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (p != MAP_FAILED) {
+			if (madvise(p, sizeof(struct randbuf), MADV_WIPEONFORK) == 0) {
+				randbuf = p;
+				randbuf_wipeonfork = 1;
+			} else {
+				/* older kernel */
+				munmap(p, sizeof(struct randbuf));
+			}
+		}
+		TRACE(("randbuf wipeonfork %d", randbuf_wipeonfork))
+	}
+#endif
+
+	m_burn(randbuf->buf, sizeof(randbuf->buf));
+	randbuf->avail = 0;
+	randbuf->keyed = 1;
+	randbuf_pid = getpid();
+}
+
+/* ChaCha20 keyed by hashpool, which is then replaced by the first 32
+ * bytes of output */
+static void randbuf_refill(void) {
+	const unsigned char nonce[8] = {0};
+	chacha_state st;
+
+	if (chacha_setup(&st, hashpool, sizeof(hashpool), 20) != CRYPT_OK
+			|| chacha_ivctr64(&st, nonce, sizeof(nonce), 0) != CRYPT_OK
+			|| chacha_keystream(&st, randbuf->buf, sizeof(randbuf->buf)) != CRYPT_OK) {
+		dropbear_exit("PRNG failure");
+	}
+	m_burn(&st, sizeof(st));
+
+	memcpy(hashpool, randbuf->buf, sizeof(hashpool));
+	m_burn(randbuf->buf, sizeof(hashpool));
+	randbuf->avail = sizeof(randbuf->buf) - sizeof(hashpool);
+}
+
+/* Whether this is a forked child that hasn't made hashpool its own yet */
+static int randbuf_is_forked(void) {
+	return !randbuf->keyed || (!randbuf_wipeonfork && getpid() != randbuf_pid);
+}
+
+/* First use in a forked child. Parent and siblings share hashpool, so
+ * make it unique to this process before generating anything. */
+static void randbuf_forked(void) {
+	hash_state hs;
+	pid_t pid;
+	struct timeval tv;
+#ifdef HAVE_GETRANDOM
+	unsigned char buf[INIT_SEED_SIZE];
+#endif
+
+	sha256_init(&hs);
+	sha256_process(&hs, (void*)hashpool, sizeof(hashpool));
+	pid = getpid();
+	sha256_process(&hs, (void*)&pid, sizeof(pid));
+	memset(&tv, 0x0, sizeof(tv));
+	gettimeofday(&tv, NULL);
+	sha256_process(&hs, (void*)&tv, sizeof(tv));
+#ifdef HAVE_GETRANDOM
+	/* doesn't wait, the parent was already seeded */
+	if (getrandom(buf, sizeof(buf), GRND_NONBLOCK) == sizeof(buf)) {
+		sha256_process(&hs, (void*)buf, sizeof(buf));
+	}
+	m_burn(buf, sizeof(buf));
+#endif
+	sha256_done(&hs, hashpool);
+
+	randbuf_reset();
+}
+
 void addrandom(const unsigned char * buf, unsigned int len)
 {
 	hash_state hs;
@@ -119,6 +224,11 @@ void addrandom(const unsigned char * buf, unsigned int len)
 	}
 #endif
 
+	/* siblings may add the same data */
+	if (donerandinit && randbuf_is_forked()) {
+		randbuf_forked();
+	}
+
 	/* hash in the new seed data */
 	sha256_init(&hs);
 	/* existing state (zeroes on startup) */
@@ -127,6 +237,8 @@ void addrandom(const unsigned char * buf, unsigned int len)
 	/* new */
 	sha256_process(&hs, buf, len);
 	sha256_done(&hs, hashpool);
+
+	randbuf_reset();
 }
 
 static void write_urandom()
@@ -156,7 +268,7 @@ void fuzz_seed(const unsigned char* dat, unsigned int len) {
 	sha256_process(&hs, "fuzzfuzzfuzz", strlen("fuzzfuzzfuzz"));
 	sha256_process(&hs, dat, len);
 	sha256_done(&hs, hashpool);
-	counter = 0;
+	randbuf_reset();
 	donerandinit = 1;
 }
 #endif
@@ -304,7 +416,9 @@ void seedrandom() {
 
 	sha256_done(&hs, hashpool);
 
-	counter = 0;
+	randbuf_reset();
+	refills = 0;
+	last_full_seed = monotonic_now();
 	donerandinit = 1;
 
 	/* Feed it all back into /dev/urandom - this might help if Dropbear
@@ -312,34 +426,93 @@ void seedrandom() {
 	write_urandom();
 }
 
+/* A cheaper seedrandom() for the listener to call before each fork. The
+ * new pool is derived from generator output, so neither the parent nor
+ * the child can recover the other's, along with fresh kernel randomness,
+ * a count of calls and the time. Reading all the seedrandom() sources
+ * costs far more than the rest of handling a connection, so that is only
+ * done every FULL_SEED_INTERVAL seconds. */
+void reseedrandom() {
+	static unsigned int reseeds = 0;
+	hash_state hs;
+	unsigned char buf[INIT_SEED_SIZE];
+	struct timeval tv;
+	int fresh = 0;
+
+#if DROPBEAR_FUZZ
+	if (fuzz.fuzzing) {
+		return;
+	}
+#endif
+
+	if (!donerandinit
+			|| monotonic_now() - last_full_seed >= FULL_SEED_INTERVAL) {
+		seedrandom();
+		return;
+	}
+
+	sha256_init(&hs);
+	genrandom(buf, sizeof(buf));
+	sha256_process(&hs, (void*)buf, sizeof(buf));
+
+#ifdef HAVE_GETRANDOM
+	if (getrandom(buf, sizeof(buf), GRND_NONBLOCK) == sizeof(buf)) {
+		sha256_process(&hs, (void*)buf, sizeof(buf));
+		fresh = 1;
+	}
+#endif
+	m_burn(buf, sizeof(buf));
+	if (!fresh && process_file(&hs, DROPBEAR_URANDOM_DEV, INIT_SEED_SIZE, 0)
+			== DROPBEAR_SUCCESS) {
+		/* old kernel */
+		fresh = 1;
+	}
+	if (!fresh) {
+		seedrandom();
+		return;
+	}
+
+	reseeds++;
+	sha256_process(&hs, (void*)&reseeds, sizeof(reseeds));
+	memset(&tv, 0x0, sizeof(tv));
+	gettimeofday(&tv, NULL);
+	sha256_process(&hs, (void*)&tv, sizeof(tv));
+	sha256_done(&hs, hashpool);
+
+	randbuf_reset();
+}
+
 /* return len bytes of pseudo-random data */
 void genrandom(unsigned char* buf, unsigned int len) {
 
-	hash_state hs;
-	unsigned char hash[SHA256_HASH_SIZE];
+	unsigned char *src;
 	unsigned int copylen;
 
 	if (!donerandinit) {
 		dropbear_exit("seedrandom not done");
 	}
 
+	if (randbuf_is_forked()) {
+		randbuf_forked();
+	}
+
 	while (len > 0) {
-		sha256_init(&hs);
-		sha256_process(&hs, (void*)hashpool, sizeof(hashpool));
-		sha256_process(&hs, (void*)&counter, sizeof(counter));
-		sha256_done(&hs, hash);
-
-		counter++;
-		if (counter > MAX_COUNTER) {
-			seedrandom();
+		if (randbuf->avail == 0) {
+			refills++;
+			if (refills > MAX_REFILLS) {
+				seedrandom();
+			}
+			randbuf_refill();
 		}
 
-		copylen = MIN(len, SHA256_HASH_SIZE);
-		memcpy(buf, hash, copylen);
+		copylen = MIN(len, randbuf->avail);
+		src = &randbuf->buf[sizeof(randbuf->buf) - randbuf->avail];
+		memcpy(buf, src, copylen);
+		m_burn(src, copylen);
+		randbuf->avail -= copylen;
 		len -= copylen;
 		buf += copylen;
 	}
-	m_burn(hash, sizeof(hash));
 }
 
 /* Generates a random mp_int. 
@@ -349,29 +522,35 @@ void genrandom(unsigned char* buf, unsigned int len) {
  * */
 void gen_random_mpint(const mp_int *max, mp_int *rand) {
 
-	unsigned char *randbuf = NULL;
-	unsigned int len = 0;
-	const unsigned char masks[] = {0xff, 0x01, 0x03, 0x07, 0x0f, 0x1f, 0x3f, 0x7f};
-
 	const int size_bits = mp_count_bits(max);
-
-	len = size_bits / 8;
-	if ((size_bits % 8) != 0) {
-		len += 1;
+	/* Fill the digits directly, mp_from_ubin() shifts the whole number
+	 * for every byte which dominates the cost for RSA-sized numbers */
+	const int digits = (size_bits + MP_DIGIT_BIT - 1) / MP_DIGIT_BIT;
+	const int top_bits = size_bits % MP_DIGIT_BIT;
+	int i;
+
+	if (mp_grow(rand, digits) != MP_OKAY) {
+		dropbear_exit("Mem alloc error");
+	}
+	/* digits above used must be zero */
+	for (i = digits; i < rand->used; i++) {
+		rand->dp[i] = 0;
 	}
 
-	randbuf = m_malloc(len);
 	do {
-		genrandom(randbuf, len);
-		/* Mask out the unrequired bits - mp_read_unsigned_bin expects
-		 * MSB first.*/
-		randbuf[0] &= masks[size_bits % 8];
-
-		bytes_to_mp(rand, randbuf, len);
+		genrandom((unsigned char*)rand->dp, digits * sizeof(mp_digit));
+		for (i = 0; i < digits; i++) {
+			rand->dp[i] &= MP_MASK;
+		}
+		/* Mask out the unrequired bits */
+		if (top_bits != 0) {
+			rand->dp[digits-1] &= ((mp_digit)1 << top_bits) - 1;
+		}
+		rand->used = digits;
+		rand->sign = MP_ZPOS;
+		mp_clamp(rand);
 
 		/* keep regenerating until we get one satisfying
 		 * 0 < rand < max    */
 	} while (!(mp_cmp(rand, max) == MP_LT && mp_cmp_d(rand, 0) == MP_GT));
-	m_burn(randbuf, len);
-	m_free(randbuf);
 }
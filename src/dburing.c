@@ -0,0 +1,263 @@
+/*
+ * Dropbear - a SSH2 server
+ * 
+ * Copyright (c) 2002-2006 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+/* Raw io_uring setup and queue handling for the dbpoll io_uring backend.
+ * Only the parts dropbear uses are here: a single ring with no SQ
+ * polling, submitted and waited on from one thread. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "dburing.h"
+
+#if DROPBEAR_IO_URING
+
+/* The features we rely on arrived together in Linux 5.11, older headers
+ * build a ring that always fails to initialise */
+#ifdef IORING_FEAT_EXT_ARG
+
+#include <sys/syscall.h>
+
+#define DBURING_FEATURES (IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL \
+		| IORING_FEAT_EXT_ARG)
+
+static unsigned int load_acquire(const unsigned int *p) {
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(unsigned int *p, unsigned int v) {
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+int dburing_init(struct dburing *ring, unsigned int entries) {
+	struct io_uring_params params;
+	unsigned char *sq_ring = NULL, *cq_ring = NULL;
+	unsigned int i;
+
+	memset(ring, 0x0, sizeof(*ring));
+	ring->fd = -1;
+
+	memset(&params, 0x0, sizeof(params));
+	/* The kernel creates the fd close-on-exec */
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) {
+		TRACE(("io_uring_setup failed:"))
+		ring->fd = -1;
+		return DROPBEAR_FAILURE;
+	}
+	ring->features = params.features;
+	if ((ring->features & DBURING_FEATURES) != DBURING_FEATURES) {
+		TRACE(("io_uring lacks features, have 0x%x", ring->features))
+		goto fail;
+	}
+
+	ring->sq_ring_len = params.sq_off.array
+		+ params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_len = params.cq_off.cqes
+		+ params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		goto fail;
+	}
+	ring->sq_ring = sq_ring;
+	cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (cq_ring == MAP_FAILED) {
+		goto fail;
+	}
+	ring->cq_ring = cq_ring;
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto fail;
+	}
+
+	ring->sq_khead = (unsigned int*)(sq_ring + params.sq_off.head);
+	ring->sq_ktail = (unsigned int*)(sq_ring + params.sq_off.tail);
+	ring->sq_array = (unsigned int*)(sq_ring + params.sq_off.array);
+	ring->sq_mask = *(unsigned int*)(sq_ring + params.sq_off.ring_mask);
+	ring->sq_entries = params.sq_entries;
+	ring->sq_tail = ring->sq_submitted = *ring->sq_ktail;
+
+	ring->cq_khead = (unsigned int*)(cq_ring + params.cq_off.head);
+	ring->cq_ktail = (unsigned int*)(cq_ring + params.cq_off.tail);
+	ring->cq_mask = *(unsigned int*)(cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+
+	/* submission entries are always used in ring order */
+	for (i = 0; i < ring->sq_entries; i++) {
+		ring->sq_array[i] = i;
+	}
+
+	return DROPBEAR_SUCCESS;
+
+fail:
+	dburing_free(ring);
+	return DROPBEAR_FAILURE;
+}
+
+void dburing_free(struct dburing *ring) {
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_len);
+	}
+	if (ring->cq_ring) {
+		munmap(ring->cq_ring, ring->cq_ring_len);
+	}
+	if (ring->sq_ring) {
+		munmap(ring->sq_ring, ring->sq_ring_len);
+	}
+	m_close(ring->fd);
+	memset(ring, 0x0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+struct io_uring_sqe* dburing_get_sqe(struct dburing *ring) {
+	struct io_uring_sqe *sqe;
+
+	if (ring->sq_tail - load_acquire(ring->sq_khead) >= ring->sq_entries) {
+		if (dburing_enter(ring, 0, 0) < 0
+			|| ring->sq_tail - load_acquire(ring->sq_khead) >= ring->sq_entries) {
+			return NULL;
+		}
+	}
+
+	sqe = &ring->sqes[ring->sq_tail & ring->sq_mask];
+	memset(sqe, 0x0, sizeof(*sqe));
+	ring->sq_tail++;
+	return sqe;
+}
+
+int dburing_enter(struct dburing *ring, int wait, int timeout_ms) {
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int to_submit, flags = 0;
+	int ret;
+
+	to_submit = ring->sq_tail - ring->sq_submitted;
+	store_release(ring->sq_ktail, ring->sq_tail);
+
+	memset(&arg, 0x0, sizeof(arg));
+	if (wait) {
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		arg.sigmask_sz = _NSIG / 8;
+		if (timeout_ms >= 0) {
+			ts.tv_sec = timeout_ms / 1000;
+			ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+			arg.ts = (uintptr_t)&ts;
+		}
+	} else if (to_submit == 0) {
+		return 0;
+	}
+
+	ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait ? 1 : 0,
+			flags, wait ? &arg : NULL, sizeof(arg));
+	if (ret > 0) {
+		ring->sq_submitted += ret;
+	}
+	if (ret < 0) {
+		/* a timeout, or completions waiting in the overflow list */
+		if (errno == ETIME || errno == EBUSY) {
+			return 0;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+struct io_uring_cqe* dburing_peek_cqe(struct dburing *ring) {
+	unsigned int head = *ring->cq_khead;
+
+	if (head == load_acquire(ring->cq_ktail)) {
+		return NULL;
+	}
+	return &ring->cqes[head & ring->cq_mask];
+}
+
+void dburing_cqe_seen(struct dburing *ring) {
+	store_release(ring->cq_khead, *ring->cq_khead + 1);
+}
+
+int dburing_register_buffer(struct dburing *ring, void *buf, unsigned int len) {
+	struct iovec iov;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	if (syscall(__NR_io_uring_register, ring->fd,
+			IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+		TRACE(("io_uring buffer registration failed:"))
+		return DROPBEAR_FAILURE;
+	}
+	return DROPBEAR_SUCCESS;
+}
+
+#else /* IORING_FEAT_EXT_ARG */
+
+int dburing_init(struct dburing *ring, unsigned int entries) {
+	(void)entries;
+	memset(ring, 0x0, sizeof(*ring));
+	ring->fd = -1;
+	TRACE(("built with io_uring headers older than Linux 5.11"))
+	return DROPBEAR_FAILURE;
+}
+
+void dburing_free(struct dburing *ring) {
+	m_close(ring->fd);
+	ring->fd = -1;
+}
+
+struct io_uring_sqe* dburing_get_sqe(struct dburing *ring) {
+	(void)ring;
+	return NULL;
+}
+
+int dburing_enter(struct dburing *ring, int wait, int timeout_ms) {
+	(void)ring;
+	(void)wait;
+	(void)timeout_ms;
+	errno = ENOSYS;
+	return -1;
+}
+
+struct io_uring_cqe* dburing_peek_cqe(struct dburing *ring) {
+	(void)ring;
+	return NULL;
+}
+
+void dburing_cqe_seen(struct dburing *ring) {
+	(void)ring;
+}
+
+int dburing_register_buffer(struct dburing *ring, void *buf, unsigned int len) {
+	(void)ring;
+	(void)buf;
+	(void)len;
+	return DROPBEAR_FAILURE;
+}
+
+#endif /* IORING_FEAT_EXT_ARG */
+
+#endif /* DROPBEAR_IO_URING */
@@ -0,0 +1,81 @@
+/*
+ * Dropbear - a SSH2 server
+ * 
+ * Copyright (c) 2002-2006 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_DBURING_H_
+#define DROPBEAR_DBURING_H_
+
+#include "includes.h"
+
+#if DROPBEAR_IO_URING
+
+#include <linux/io_uring.h>
+
+/* Minimal io_uring plumbing using the raw system calls, so there is no
+ * dependency on liburing. Only used by dbpoll.c */
+struct dburing {
+	int fd;
+	unsigned int features;
+
+	/* submission queue, shared with the kernel */
+	unsigned int *sq_khead;
+	unsigned int *sq_ktail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	struct io_uring_sqe *sqes;
+	/* entries filled but not yet submitted */
+	unsigned int sq_tail;
+	unsigned int sq_submitted;
+
+	/* completion queue */
+	unsigned int *cq_khead;
+	unsigned int *cq_ktail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_len;
+	void *cq_ring;
+	size_t cq_ring_len;
+	size_t sqes_len;
+};
+
+int dburing_init(struct dburing *ring, unsigned int entries);
+void dburing_free(struct dburing *ring);
+/* Returns a zeroed submission entry, submitting what is queued first if
+ * the queue is full. Returns NULL if that fails */
+struct io_uring_sqe* dburing_get_sqe(struct dburing *ring);
+/* Submits queued entries. If wait is set, waits up to timeout_ms (-1 for
+ * no limit) for a completion. Returns 0, or -1 with errno set. A timeout
+ * isn't an error */
+int dburing_enter(struct dburing *ring, int wait, int timeout_ms);
+/* Returns the next completion or NULL, dburing_cqe_seen() releases it */
+struct io_uring_cqe* dburing_peek_cqe(struct dburing *ring);
+void dburing_cqe_seen(struct dburing *ring);
+/* Registers a single buffer for IORING_OP_READ_FIXED, as index 0 */
+int dburing_register_buffer(struct dburing *ring, void *buf, unsigned int len);
+
+#endif /* DROPBEAR_IO_URING */
+
+#endif /* DROPBEAR_DBURING_H_ */
@@ -38,6 +38,7 @@
 
 #include "includes.h"
 #include "dbutil.h"
+#include "dbpoll.h"
 #include "buffer.h"
 #include "session.h"
 #include "atomicio.h"
@@ -570,6 +571,9 @@ void m_close(int fd) {
 		return;
 	}
 
+	/* stop waiting on it before the fd number can be reused */
+	dbpoll_forget(fd);
+
 	do {
 		val = close(fd);
 	} while (val < 0 && errno == EINTR);
@@ -46,6 +46,34 @@ IMPORTANT: Some options will require "make clean" after changes */
    This option is ignored on non-Linux platforms at present */
 #define DROPBEAR_REEXEC 1
 
+/* Allow a pool of pre-forked session workers, enabled at runtime with -N.
+   Each worker has already been forked (and re-executed), set up crypto
+   and loaded hostkeys, so an accepted connection is handed straight to
+   it rather than waiting for that work. Idle workers use memory. */
+#define DROPBEAR_SVR_WORKER_POOL 1
+
+/* Use epoll() rather than select() to wait for the session socket, channels
+   and listeners. Interest is only updated when it changes, so sessions
+   with many forwarded connections don't pay for every channel on each
+   wakeup. Linux only, select() is used if epoll isn't available at runtime */
+#define DROPBEAR_EPOLL 1
+
+/* Use io_uring instead, falling back to epoll() or select() if the kernel
+   doesn't support it (Linux 5.11 or later is needed). As well as waiting,
+   the session socket reads and writes are submitted through the ring
+   alongside the wait. Some systems disable io_uring for security reasons,
+   so it is off by default */
+#define DROPBEAR_IO_URING 0
+
+/* Encrypt and decrypt bulk packets in a worker thread for each direction,
+   so a single session's transfer isn't limited by one CPU's cipher speed.
+   Only used when more than one CPU is online. Receive packets are only
+   decrypted ahead for AEAD (chacha20-poly1305, GCM) and encrypt-then-MAC
+   modes, where the length of the next packet doesn't depend on decrypting
+   this one. Needs POSIX threads, linked when configure is run with
+   --enable-crypto-threads */
+#define DROPBEAR_CRYPTO_THREADS 0
+
 /* Include verbose debug output, enabled with -v at runtime (repeat to increase).
  * define which level of debug output you compile in
  * TRACE1 - TRACE3 = approx 4 Kb (connection, remote identity, algos, auth type info)
@@ -113,10 +141,15 @@ IMPORTANT: Some options will require "make clean" after changes */
 
 /* Enable "Galois/Counter Mode" for ciphers. This authenticated
  * encryption mode is combination of CTR mode and GHASH. Recommended
- * for security and forwards compatibility, but slower than CTR on
- * CPU w/o dedicated AES/GHASH instructions.
+ * for security and forwards compatibility. It is the fastest cipher on
+ * x86-64 with AES-NI and PCLMULQDQ, elsewhere slower than CTR.
  * Compiling in will add ~6kB to binary size on x86-64 */
-#define DROPBEAR_ENABLE_GCM_MODE 0
+#define DROPBEAR_ENABLE_GCM_MODE 1
+
+/* Use x86-64 instruction set extensions such as AES-NI when the CPU
+ * supports them. This is detected at runtime, the portable code is used
+ * on other CPUs. */
+#define DROPBEAR_CPU_ACCEL 1
 
 /* Message integrity. sha2-256 is recommended as a default,
    sha1 for compatibility */
@@ -125,6 +158,14 @@ IMPORTANT: Some options will require "make clean" after changes */
 #define DROPBEAR_SHA2_512_HMAC 0
 #define DROPBEAR_SHA1_96_HMAC 0
 
+/* UMAC (umac-64@openssh.com and umac-128@openssh.com) is several times
+ * faster than HMAC on bulk transfers. Requires AES128 or AES256 */
+#define DROPBEAR_UMAC 1
+
+/* Encrypt-then-MAC variants (-etm@openssh.com) of the enabled UMAC and
+ * sha2 MACs. The MAC is checked before anything is decrypted, recommended */
+#define DROPBEAR_ETM_MAC 1
+
 /* Hostkey/public key algorithms - at least one required, these are used
  * for hostkey as well as for verifying signatures with pubkey auth.
  * RSA is recommended.
@@ -145,7 +186,8 @@ IMPORTANT: Some options will require "make clean" after changes */
 #define DROPBEAR_DSS 0
 /* ECDSA is significantly faster than RSA or DSS. Compiling in ECC
  * code (either ECDSA or ECDH) increases binary size - around 30kB
- * on x86-64.
+ * on x86-64, a further ~7kB for faster P-256 and P-384 code where the
+ * compiler has 128-bit integers.
  * See: ECDSA_PRIV_FILENAME  */
 #define DROPBEAR_ECDSA 1
 
@@ -187,7 +229,8 @@ IMPORTANT: Some options will require "make clean" after changes */
  * group14 is supported by most implementations.
  * group16 provides a greater strength level but is slower and increases binary size
  * curve25519 and ecdh algorithms are faster than non-elliptic curve methods
- * curve25519 increases binary size by ~2,5kB on x86-64
+ * curve25519 increases binary size by ~2,5kB on x86-64, a further ~2kB
+ *   where the compiler has 128-bit integers for its faster 64-bit code
  * including either ECDH or ECDSA increases binary size by ~30kB on x86-64
 
  * Small systems should generally include either curve25519 or ecdh for performance.
@@ -335,6 +378,10 @@ group1 in Dropbear server too */
    chosen for a 100mbit ethernet network. The value can be altered at
    runtime with the -W argument. */
 #define DEFAULT_RECV_WINDOW 24576
+/* Grow a channel's receive window past that, towards MAX_RECV_WINDOW,
+   when the window rather than the local program limits throughput, such
+   as over a long round trip. Idle channels go back to the -W size */
+#define DROPBEAR_RECV_WINDOW_AUTOTUNE 1
 /* Maximum size of a received SSH data packet - this _MUST_ be >= 32768
    in order to interoperate with other implementations */
 #define RECV_MAX_PAYLOAD_LEN 32768
@@ -0,0 +1,610 @@
+/*
+ * Dropbear - a SSH2 server
+ * 
+ * Copyright (c) 2002-2006 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "ecc.h"
+#include "ecc-nistp.h"
+#include "bignum.h"
+
+#if DROPBEAR_ECC_NISTP_64
+
+/* Field elements are little endian 64-bit limbs in Montgomery form,
+ * a*R mod p with R = 2^(64*limbs). P-256 uses 4 limbs and P-384 uses 6,
+ * the loops only depend on the (public) limb count so run in constant
+ * time. Points are projective (X:Y:Z) with x = X/Z and y = Y/Z, using the
+ * complete a = -3 formulas from Renes, Costello and Batina,
+ * "Complete addition formulas for prime order elliptic curves" (2016).
+ * Those need no special cases for doubling or the point at infinity */
+
+#define NISTP_MAX_LIMBS 6
+
+typedef unsigned __int128 u128;
+typedef uint64_t fe[NISTP_MAX_LIMBS];
+
+struct nistp_point {
+	fe X, Y, Z;
+};
+
+struct dropbear_nistp {
+	unsigned int limbs;
+	fe p;
+	uint64_t pinv; /* -p^-1 mod 2^64 */
+	fe rr; /* R^2 mod p */
+	fe one; /* R mod p */
+	fe b; /* curve b, Montgomery form */
+	/* i*G */
+	struct nistp_point g_window[16];
+	/* comb[i] is the sum of 2^(j*bits/4) G for each bit j set in i */
+	struct nistp_point comb[16];
+};
+
+#if DROPBEAR_ECC_256
+static struct dropbear_nistp nistp256;
+#endif
+#if DROPBEAR_ECC_384
+static struct dropbear_nistp nistp384;
+#endif
+
+/* r = (hi:t) mod p, where (hi:t) < 2p */
+static void fe_reduce(const struct dropbear_nistp *c, fe r,
+		const uint64_t *t, uint64_t hi) {
+	/* zeroed as the loops are bounded by c->limbs, not the array size */
+	fe d = {0};
+	uint64_t borrow = 0, keep;
+	unsigned int i;
+
+	for (i = 0; i < c->limbs; i++) {
+		u128 x = (u128)t[i] - c->p[i] - borrow;
+		d[i] = (uint64_t)x;
+		borrow = (uint64_t)(x >> 64) & 1;
+	}
+	/* (hi:t) < p only if t - p borrowed and hi is clear */
+	keep = 0 - (borrow & (hi ^ 1));
+	for (i = 0; i < c->limbs; i++) {
+		r[i] = (t[i] & keep) | (d[i] & ~keep);
+	}
+}
+
+static void fe_add(const struct dropbear_nistp *c, fe r, const fe a, const fe b) {
+	fe t = {0};
+	uint64_t carry = 0;
+	unsigned int i;
+
+	for (i = 0; i < c->limbs; i++) {
+		u128 x = (u128)a[i] + b[i] + carry;
+		t[i] = (uint64_t)x;
+		carry = (uint64_t)(x >> 64);
+	}
+	fe_reduce(c, r, t, carry);
+}
+
+static void fe_sub(const struct dropbear_nistp *c, fe r, const fe a, const fe b) {
+	uint64_t borrow = 0, carry = 0, mask;
+	unsigned int i;
+
+	for (i = 0; i < c->limbs; i++) {
+		u128 x = (u128)a[i] - b[i] - borrow;
+		r[i] = (uint64_t)x;
+		borrow = (uint64_t)(x >> 64) & 1;
+	}
+	/* add p back if it went negative */
+	mask = 0 - borrow;
+	for (i = 0; i < c->limbs; i++) {
+		u128 x = (u128)r[i] + (c->p[i] & mask) + carry;
+		r[i] = (uint64_t)x;
+		carry = (uint64_t)(x >> 64);
+	}
+}
+
+/* r = a*b/R mod p, word by word Montgomery multiplication. b < p */
+static void fe_mul(const struct dropbear_nistp *c, fe r, const fe a, const fe b) {
+	uint64_t t[NISTP_MAX_LIMBS + 2];
+	const unsigned int n = c->limbs;
+	unsigned int i, j;
+
+	for (i = 0; i < n + 2; i++) {
+		t[i] = 0;
+	}
+	for (i = 0; i < n; i++) {
+		u128 acc = 0;
+		uint64_t m;
+
+		/* t += a*b[i] */
+		for (j = 0; j < n; j++) {
+			acc += (u128)a[j] * b[i] + t[j];
+			t[j] = (uint64_t)acc;
+			acc >>= 64;
+		}
+		acc += t[n];
+		t[n] = (uint64_t)acc;
+		t[n+1] = (uint64_t)(acc >> 64);
+
+		/* t = (t + m*p) / 2^64, choosing m so the low word is zero */
+		m = t[0] * c->pinv;
+		acc = (u128)m * c->p[0] + t[0];
+		acc >>= 64;
+		for (j = 1; j < n; j++) {
+			acc += (u128)m * c->p[j] + t[j];
+			t[j-1] = (uint64_t)acc;
+			acc >>= 64;
+		}
+		acc += t[n];
+		t[n-1] = (uint64_t)acc;
+		t[n] = t[n+1] + (uint64_t)(acc >> 64);
+	}
+	fe_reduce(c, r, t, t[n]);
+}
+
+static void fe_copy(const struct dropbear_nistp *c, fe r, const fe a) {
+	unsigned int i;
+	for (i = 0; i < c->limbs; i++) {
+		r[i] = a[i];
+	}
+}
+
+/* r = a if mask is all ones, unchanged if mask is zero */
+static void fe_cmov(const struct dropbear_nistp *c, fe r, const fe a, uint64_t mask) {
+	unsigned int i;
+	for (i = 0; i < c->limbs; i++) {
+		r[i] ^= (r[i] ^ a[i]) & mask;
+	}
+}
+
+static int fe_iszero(const struct dropbear_nistp *c, const fe a) {
+	uint64_t x = 0;
+	unsigned int i;
+	for (i = 0; i < c->limbs; i++) {
+		x |= a[i];
+	}
+	return x == 0;
+}
+
+/* r = a^(p-2) = a^-1. The exponent is public so the square and multiply
+ * pattern doesn't depend on a */
+static void fe_invert(const struct dropbear_nistp *c, fe r, const fe a) {
+	fe x;
+	int i;
+
+	fe_copy(c, x, c->one);
+	for (i = 64 * c->limbs - 1; i >= 0; i--) {
+		uint64_t e = c->p[i / 64];
+		if (i < 64) {
+			/* p[0] is odd and greater than 2 for both curves */
+			e -= 2;
+		}
+		fe_mul(c, x, x, x);
+		if ((e >> (i % 64)) & 1) {
+			fe_mul(c, x, x, a);
+		}
+	}
+	fe_copy(c, r, x);
+	m_burn(x, sizeof(x));
+}
+
+/* Copies a into limbs without converting to Montgomery form. Works on the
+ * digits directly, the byte conversions in libtommath shift the whole
+ * number for every byte */
+static int limbs_from_mp(const struct dropbear_nistp *c, uint64_t *r, const mp_int *a) {
+	unsigned int i;
+
+	if (mp_isneg(a) || mp_count_bits(a) > 64 * (int)c->limbs) {
+		return DROPBEAR_FAILURE;
+	}
+	for (i = 0; i < c->limbs; i++) {
+		r[i] = 0;
+	}
+	for (i = 0; i < (unsigned int)a->used; i++) {
+		const unsigned int bit = i * MP_DIGIT_BIT;
+		const uint64_t d = a->dp[i];
+		r[bit / 64] |= d << (bit % 64);
+		if (bit % 64 + MP_DIGIT_BIT > 64 && bit / 64 + 1 < c->limbs) {
+			r[bit / 64 + 1] |= d >> (64 - bit % 64);
+		}
+	}
+	return DROPBEAR_SUCCESS;
+}
+
+static int fe_from_mp(const struct dropbear_nistp *c, fe r, const mp_int *a) {
+	if (limbs_from_mp(c, r, a) != DROPBEAR_SUCCESS) {
+		return DROPBEAR_FAILURE;
+	}
+	/* a*R^2/R. a may be up to 2^bits, the result is still reduced */
+	fe_mul(c, r, r, c->rr);
+	return DROPBEAR_SUCCESS;
+}
+
+static int fe_to_mp(const struct dropbear_nistp *c, mp_int *r, const fe a) {
+	const int digits = (64 * c->limbs + MP_DIGIT_BIT - 1) / MP_DIGIT_BIT;
+	fe t, one = {1};
+	int i;
+
+	/* a*1/R */
+	fe_mul(c, t, a, one);
+
+	if (mp_grow(r, digits) != MP_OKAY) {
+		return DROPBEAR_FAILURE;
+	}
+	for (i = digits; i < r->used; i++) {
+		r->dp[i] = 0;
+	}
+	for (i = 0; i < digits; i++) {
+		const unsigned int bit = i * MP_DIGIT_BIT;
+		uint64_t d = t[bit / 64] >> (bit % 64);
+		if (bit % 64 + MP_DIGIT_BIT > 64 && bit / 64 + 1 < c->limbs) {
+			d |= t[bit / 64 + 1] << (64 - bit % 64);
+		}
+		r->dp[i] = (mp_digit)d & MP_MASK;
+	}
+	r->used = digits;
+	r->sign = MP_ZPOS;
+	mp_clamp(r);
+	return DROPBEAR_SUCCESS;
+}
+
+static void point_set_infinity(const struct dropbear_nistp *c, struct nistp_point *r) {
+	memset(r, 0, sizeof(*r));
+	fe_copy(c, r->Y, c->one);
+}
+
+/* r = p + q, Algorithm 4 of Renes-Costello-Batina. r may alias either */
+static void point_add(const struct dropbear_nistp *c, struct nistp_point *r,
+		const struct nistp_point *p, const struct nistp_point *q) {
+	fe t0, t1, t2, t3, t4, X3, Y3, Z3;
+
+	fe_mul(c, t0, p->X, q->X);
+	fe_mul(c, t1, p->Y, q->Y);
+	fe_mul(c, t2, p->Z, q->Z);
+	fe_add(c, t3, p->X, p->Y);
+	fe_add(c, t4, q->X, q->Y);
+	fe_mul(c, t3, t3, t4);
+	fe_add(c, t4, t0, t1);
+	fe_sub(c, t3, t3, t4);
+	fe_add(c, t4, p->Y, p->Z);
+	fe_add(c, X3, q->Y, q->Z);
+	fe_mul(c, t4, t4, X3);
+	fe_add(c, X3, t1, t2);
+	fe_sub(c, t4, t4, X3);
+	fe_add(c, X3, p->X, p->Z);
+	fe_add(c, Y3, q->X, q->Z);
+	fe_mul(c, X3, X3, Y3);
+	fe_add(c, Y3, t0, t2);
+	fe_sub(c, Y3, X3, Y3);
+	fe_mul(c, Z3, c->b, t2);
+	fe_sub(c, X3, Y3, Z3);
+	fe_add(c, Z3, X3, X3);
+	fe_add(c, X3, X3, Z3);
+	fe_sub(c, Z3, t1, X3);
+	fe_add(c, X3, t1, X3);
+	fe_mul(c, Y3, c->b, Y3);
+	fe_add(c, t1, t2, t2);
+	fe_add(c, t2, t1, t2);
+	fe_sub(c, Y3, Y3, t2);
+	fe_sub(c, Y3, Y3, t0);
+	fe_add(c, t1, Y3, Y3);
+	fe_add(c, Y3, t1, Y3);
+	fe_add(c, t1, t0, t0);
+	fe_add(c, t0, t1, t0);
+	fe_sub(c, t0, t0, t2);
+	fe_mul(c, t1, t4, Y3);
+	fe_mul(c, t2, t0, Y3);
+	fe_mul(c, Y3, X3, Z3);
+	fe_add(c, Y3, Y3, t2);
+	fe_mul(c, X3, t3, X3);
+	fe_sub(c, X3, X3, t1);
+	fe_mul(c, Z3, t4, Z3);
+	fe_mul(c, t1, t3, t0);
+	fe_add(c, Z3, Z3, t1);
+
+	fe_copy(c, r->X, X3);
+	fe_copy(c, r->Y, Y3);
+	fe_copy(c, r->Z, Z3);
+}
+
+/* r = 2p, Algorithm 6 of Renes-Costello-Batina. r may alias p */
+static void point_double(const struct dropbear_nistp *c, struct nistp_point *r,
+		const struct nistp_point *p) {
+	fe t0, t1, t2, t3, X3, Y3, Z3;
+
+	fe_mul(c, t0, p->X, p->X);
+	fe_mul(c, t1, p->Y, p->Y);
+	fe_mul(c, t2, p->Z, p->Z);
+	fe_mul(c, t3, p->X, p->Y);
+	fe_add(c, t3, t3, t3);
+	fe_mul(c, Z3, p->X, p->Z);
+	fe_add(c, Z3, Z3, Z3);
+	fe_mul(c, Y3, c->b, t2);
+	fe_sub(c, Y3, Y3, Z3);
+	fe_add(c, X3, Y3, Y3);
+	fe_add(c, Y3, X3, Y3);
+	fe_sub(c, X3, t1, Y3);
+	fe_add(c, Y3, t1, Y3);
+	fe_mul(c, Y3, X3, Y3);
+	fe_mul(c, X3, X3, t3);
+	fe_add(c, t3, t2, t2);
+	fe_add(c, t2, t2, t3);
+	fe_mul(c, Z3, c->b, Z3);
+	fe_sub(c, Z3, Z3, t2);
+	fe_sub(c, Z3, Z3, t0);
+	fe_add(c, t3, Z3, Z3);
+	fe_add(c, Z3, Z3, t3);
+	fe_add(c, t3, t0, t0);
+	fe_add(c, t0, t3, t0);
+	fe_sub(c, t0, t0, t2);
+	fe_mul(c, t0, t0, Z3);
+	fe_add(c, Y3, Y3, t0);
+	fe_mul(c, t0, p->Y, p->Z);
+	fe_add(c, t0, t0, t0);
+	fe_mul(c, Z3, t0, Z3);
+	fe_sub(c, X3, X3, Z3);
+	fe_mul(c, Z3, t0, t1);
+	fe_add(c, Z3, Z3, Z3);
+	fe_add(c, Z3, Z3, Z3);
+
+	fe_copy(c, r->X, X3);
+	fe_copy(c, r->Y, Y3);
+	fe_copy(c, r->Z, Z3);
+}
+
+/* r = table[idx], reading every entry so the access pattern doesn't
+ * depend on idx */
+static void point_select(const struct dropbear_nistp *c, struct nistp_point *r,
+		const struct nistp_point table[16], unsigned int idx) {
+	unsigned int i;
+
+	memset(r, 0, sizeof(*r));
+	for (i = 0; i < 16; i++) {
+		uint64_t mask = 0 - (uint64_t)((((i ^ idx) - 1) >> 31) & 1);
+		fe_cmov(c, r->X, table[i].X, mask);
+		fe_cmov(c, r->Y, table[i].Y, mask);
+		fe_cmov(c, r->Z, table[i].Z, mask);
+	}
+}
+
+/* table[i] = i*p */
+static void point_window(const struct dropbear_nistp *c, struct nistp_point table[16],
+		const struct nistp_point *p) {
+	int i;
+
+	point_set_infinity(c, &table[0]);
+	table[1] = *p;
+	for (i = 2; i < 16; i++) {
+		if (i % 2 == 0) {
+			point_double(c, &table[i], &table[i/2]);
+		} else {
+			point_add(c, &table[i], &table[i-1], p);
+		}
+	}
+}
+
+static unsigned int scalar_nibble(const uint64_t *k, int i) {
+	return (k[i / 16] >> (4 * (i % 16))) & 0xf;
+}
+
+/* r = k*p with a fixed 4-bit window */
+static void point_mul(const struct dropbear_nistp *c, struct nistp_point *r,
+		const uint64_t *k, const struct nistp_point *p) {
+	struct nistp_point table[16], t;
+	int i;
+
+	point_window(c, table, p);
+
+	point_set_infinity(c, r);
+	for (i = 16 * c->limbs - 1; i >= 0; i--) {
+		point_double(c, r, r);
+		point_double(c, r, r);
+		point_double(c, r, r);
+		point_double(c, r, r);
+		point_select(c, &t, table, scalar_nibble(k, i));
+		point_add(c, r, r, &t);
+	}
+
+	m_burn(table, sizeof(table));
+	m_burn(&t, sizeof(t));
+}
+
+/* r = k*G with the comb table, a quarter of the doublings of point_mul() */
+static void point_mul_base(const struct dropbear_nistp *c, struct nistp_point *r,
+		const uint64_t *k) {
+	struct nistp_point t;
+	const int d = 16 * c->limbs;
+	int i, j;
+
+	point_set_infinity(c, r);
+	for (i = d - 1; i >= 0; i--) {
+		unsigned int idx = 0;
+		for (j = 0; j < 4; j++) {
+			const int bit = i + j * d;
+			idx |= ((k[bit / 64] >> (bit % 64)) & 1) << j;
+		}
+		point_double(c, r, r);
+		point_select(c, &t, c->comb, idx);
+		point_add(c, r, r, &t);
+	}
+
+	m_burn(&t, sizeof(t));
+}
+
+static int point_from_ecc(const struct dropbear_nistp *c, struct nistp_point *r,
+		const ecc_point *p) {
+	if (mp_cmp_d(p->z, 1) != MP_EQ
+		|| fe_from_mp(c, r->X, p->x) != DROPBEAR_SUCCESS
+		|| fe_from_mp(c, r->Y, p->y) != DROPBEAR_SUCCESS) {
+		return DROPBEAR_FAILURE;
+	}
+	fe_copy(c, r->Z, c->one);
+	return DROPBEAR_SUCCESS;
+}
+
+static int point_to_ecc(const struct dropbear_nistp *c, ecc_point *r,
+		const struct nistp_point *p) {
+	fe zinv, t;
+
+	if (fe_iszero(c, p->Z)) {
+		return DROPBEAR_FAILURE;
+	}
+	fe_invert(c, zinv, p->Z);
+	fe_mul(c, t, p->X, zinv);
+	if (fe_to_mp(c, r->x, t) != DROPBEAR_SUCCESS) {
+		return DROPBEAR_FAILURE;
+	}
+	fe_mul(c, t, p->Y, zinv);
+	if (fe_to_mp(c, r->y, t) != DROPBEAR_SUCCESS) {
+		return DROPBEAR_FAILURE;
+	}
+	mp_set(r->z, 1);
+	return DROPBEAR_SUCCESS;
+}
+
+const struct dropbear_nistp * dropbear_nistp_init(const struct dropbear_ecc_curve *curve) {
+	struct dropbear_nistp *c = NULL;
+	struct nistp_point base;
+	DEF_MP_INT(r);
+	uint64_t inv = 1;
+	int i, j;
+
+#if DROPBEAR_ECC_256
+	if (curve->ltc_size == 32) {
+		c = &nistp256;
+	}
+#endif
+#if DROPBEAR_ECC_384
+	if (curve->ltc_size == 48) {
+		c = &nistp384;
+	}
+#endif
+	if (c == NULL) {
+		return NULL;
+	}
+	if (c->limbs) {
+		/* already done */
+		return c;
+	}
+
+	c->limbs = curve->ltc_size / 8;
+	if (limbs_from_mp(c, c->p, curve->prime) != DROPBEAR_SUCCESS) {
+		dropbear_exit("ECC error");
+	}
+	/* Newton's iteration doubles the correct low bits each time,
+	 * p is odd so 1 is correct to 1 bit */
+	for (i = 0; i < 6; i++) {
+		inv *= 2 - c->p[0] * inv;
+	}
+	c->pinv = 0 - inv;
+
+	/* one = R mod p, rr = R^2 mod p */
+	m_mp_init(&r);
+	if (mp_2expt(&r, 64 * c->limbs) != MP_OKAY
+		|| mp_mod(&r, curve->prime, &r) != MP_OKAY
+		|| limbs_from_mp(c, c->one, &r) != DROPBEAR_SUCCESS
+		|| mp_2expt(&r, 128 * c->limbs) != MP_OKAY
+		|| mp_mod(&r, curve->prime, &r) != MP_OKAY
+		|| limbs_from_mp(c, c->rr, &r) != DROPBEAR_SUCCESS) {
+		dropbear_exit("ECC error");
+	}
+	mp_clear(&r);
+
+	if (fe_from_mp(c, c->b, curve->b) != DROPBEAR_SUCCESS
+		|| fe_from_mp(c, base.X, curve->Gx) != DROPBEAR_SUCCESS
+		|| fe_from_mp(c, base.Y, curve->Gy) != DROPBEAR_SUCCESS) {
+		dropbear_exit("ECC error");
+	}
+	fe_copy(c, base.Z, c->one);
+	point_window(c, c->g_window, &base);
+
+	/* comb[2^j] = 2^(j*d) G, the others are sums of those */
+	point_set_infinity(c, &c->comb[0]);
+	for (j = 0; j < 4; j++) {
+		if (j > 0) {
+			for (i = 0; i < 16 * (int)c->limbs; i++) {
+				point_double(c, &base, &base);
+			}
+		}
+		for (i = 0; i < (1 << j); i++) {
+			point_add(c, &c->comb[(1 << j) + i], &c->comb[i], &base);
+		}
+	}
+
+	return c;
+}
+
+int dropbear_nistp_mul_base(const struct dropbear_nistp *c,
+		const mp_int *k, ecc_point *R) {
+	struct nistp_point r;
+	uint64_t kl[NISTP_MAX_LIMBS];
+	int ret = DROPBEAR_FAILURE;
+
+	if (limbs_from_mp(c, kl, k) == DROPBEAR_SUCCESS) {
+		point_mul_base(c, &r, kl);
+		ret = point_to_ecc(c, R, &r);
+	}
+	m_burn(kl, sizeof(kl));
+	m_burn(&r, sizeof(r));
+	return ret;
+}
+
+int dropbear_nistp_mul(const struct dropbear_nistp *c,
+		const mp_int *k, const ecc_point *P, ecc_point *R) {
+	struct nistp_point p, r;
+	uint64_t kl[NISTP_MAX_LIMBS];
+	int ret = DROPBEAR_FAILURE;
+
+	if (limbs_from_mp(c, kl, k) == DROPBEAR_SUCCESS
+		&& point_from_ecc(c, &p, P) == DROPBEAR_SUCCESS) {
+		point_mul(c, &r, kl, &p);
+		ret = point_to_ecc(c, R, &r);
+	}
+	m_burn(kl, sizeof(kl));
+	m_burn(&r, sizeof(r));
+	return ret;
+}
+
+int dropbear_nistp_mul2add(const struct dropbear_nistp *c,
+		const mp_int *k1, const mp_int *k2, const ecc_point *Q, ecc_point *R) {
+	struct nistp_point q, table[16], r;
+	uint64_t kl1[NISTP_MAX_LIMBS], kl2[NISTP_MAX_LIMBS];
+	int i;
+
+	if (limbs_from_mp(c, kl1, k1) != DROPBEAR_SUCCESS
+		|| limbs_from_mp(c, kl2, k2) != DROPBEAR_SUCCESS
+		|| point_from_ecc(c, &q, Q) != DROPBEAR_SUCCESS) {
+		return DROPBEAR_FAILURE;
+	}
+
+	/* The scalars are public here, so both windows share the doublings
+	 * and the tables are indexed directly */
+	point_window(c, table, &q);
+	point_set_infinity(c, &r);
+	for (i = 16 * c->limbs - 1; i >= 0; i--) {
+		point_double(c, &r, &r);
+		point_double(c, &r, &r);
+		point_double(c, &r, &r);
+		point_double(c, &r, &r);
+		point_add(c, &r, &r, &c->g_window[scalar_nibble(kl1, i)]);
+		point_add(c, &r, &r, &table[scalar_nibble(kl2, i)]);
+	}
+	return point_to_ecc(c, R, &r);
+}
+
+#endif /* DROPBEAR_ECC_NISTP_64 */
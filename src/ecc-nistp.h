@@ -0,0 +1,64 @@
+/*
+ * Dropbear - a SSH2 server
+ * 
+ * Copyright (c) 2002-2006 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_ECC_NISTP_H
+#define DROPBEAR_ECC_NISTP_H
+
+#include "includes.h"
+
+/* P-256 and P-384 point arithmetic with fixed 64-bit limbs, used in place
+ * of libtomcrypt's generic ECC code. It needs 128-bit products, without
+ * them (and for P-521) libtomcrypt is used */
+#if DROPBEAR_ECC && (DROPBEAR_ECC_256 || DROPBEAR_ECC_384) \
+	&& defined(__SIZEOF_INT128__)
+#define DROPBEAR_ECC_NISTP_64 1
+#else
+#define DROPBEAR_ECC_NISTP_64 0
+#endif
+
+#if DROPBEAR_ECC_NISTP_64
+
+struct dropbear_ecc_curve;
+struct dropbear_nistp;
+
+/* Returns NULL for curves without a dedicated implementation. The curve's
+ * parsed domain parameters must already be filled */
+const struct dropbear_nistp * dropbear_nistp_init(const struct dropbear_ecc_curve *curve);
+
+/* Points are affine with z = 1, scalars must be less than 2^bits. All
+ * return DROPBEAR_SUCCESS, or DROPBEAR_FAILURE for bad input or if the
+ * result is the point at infinity */
+/* R = k*G, constant time */
+int dropbear_nistp_mul_base(const struct dropbear_nistp *c,
+	const mp_int *k, ecc_point *R);
+/* R = k*P, constant time */
+int dropbear_nistp_mul(const struct dropbear_nistp *c,
+	const mp_int *k, const ecc_point *P, ecc_point *R);
+/* R = k1*G + k2*Q, for verifying signatures */
+int dropbear_nistp_mul2add(const struct dropbear_nistp *c,
+	const mp_int *k1, const mp_int *k2, const ecc_point *Q, ecc_point *R);
+
+#endif /* DROPBEAR_ECC_NISTP_64 */
+
+#endif /* DROPBEAR_ECC_NISTP_H */
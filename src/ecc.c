@@ -2,16 +2,22 @@
 #include "ecc.h"
 #include "dbutil.h"
 #include "bignum.h"
+#include "dbrandom.h"
+#include "crypto_desc.h"
+#include "ecc-nistp.h"
 
 #if DROPBEAR_ECC
 
-/* .dp members are filled out by dropbear_ecc_fill_dp() at startup */
+/* .dp and the parsed domain parameters are filled out by
+   dropbear_ecc_fill_dp() at startup */
 #if DROPBEAR_ECC_256
 struct dropbear_ecc_curve ecc_curve_nistp256 = {
 	32,		/* .ltc_size	*/
 	NULL,		/* .dp		*/
 	&sha256_desc,	/* .hash_desc	*/
-	"nistp256"	/* .name	*/
+	"nistp256",	/* .name	*/
+	NULL, NULL, NULL, NULL, NULL,	/* parsed params */
+	NULL		/* .nistp	*/
 };
 #endif
 #if DROPBEAR_ECC_384
@@ -19,7 +25,9 @@ struct dropbear_ecc_curve ecc_curve_nistp384 = {
 	48,		/* .ltc_size	*/
 	NULL,		/* .dp		*/
 	&sha384_desc,	/* .hash_desc	*/
-	"nistp384"	/* .name	*/
+	"nistp384",	/* .name	*/
+	NULL, NULL, NULL, NULL, NULL,	/* parsed params */
+	NULL		/* .nistp	*/
 };
 #endif
 #if DROPBEAR_ECC_521
@@ -27,7 +35,9 @@ struct dropbear_ecc_curve ecc_curve_nistp521 = {
 	66,		/* .ltc_size	*/
 	NULL,		/* .dp		*/
 	&sha512_desc,	/* .hash_desc	*/
-	"nistp521"	/* .name	*/
+	"nistp521",	/* .name	*/
+	NULL, NULL, NULL, NULL, NULL,	/* parsed params */
+	NULL		/* .nistp	*/
 };
 #endif
 
@@ -58,6 +68,22 @@ void dropbear_ecc_fill_dp() {
 		if (!(*curve)->dp) {
 			dropbear_exit("Missing ECC params %s", (*curve)->name);
 		}
+		if (!(*curve)->prime) {
+			/* parsed once here rather than in each signature or
+			 * key exchange */
+			m_mp_alloc_init_multi(&(*curve)->prime, &(*curve)->order,
+				&(*curve)->b, &(*curve)->Gx, &(*curve)->Gy, NULL);
+			if (mp_read_radix((*curve)->prime, (*curve)->dp->prime, 16) != MP_OKAY
+				|| mp_read_radix((*curve)->order, (*curve)->dp->order, 16) != MP_OKAY
+				|| mp_read_radix((*curve)->b, (*curve)->dp->B, 16) != MP_OKAY
+				|| mp_read_radix((*curve)->Gx, (*curve)->dp->Gx, 16) != MP_OKAY
+				|| mp_read_radix((*curve)->Gy, (*curve)->dp->Gy, 16) != MP_OKAY) {
+				dropbear_exit("ECC error");
+			}
+		}
+#if DROPBEAR_ECC_NISTP_64
+		(*curve)->nistp = dropbear_nistp_init(*curve);
+#endif
 	}
 }
 
@@ -72,6 +98,32 @@ struct dropbear_ecc_curve* curve_for_dp(const ltc_ecc_set_type *dp) {
 	return *curve;
 }
 
+/* Like libtomcrypt's ecc_make_key_ex(), using the dedicated point
+ * arithmetic when the curve has it */
+void dropbear_ecc_make_key(const struct dropbear_ecc_curve *curve, ecc_key *key) {
+#if DROPBEAR_ECC_NISTP_64
+	if (curve->nistp) {
+		if (ltc_init_multi(&key->pubkey.x, &key->pubkey.y, &key->pubkey.z,
+			&key->k, NULL) != CRYPT_OK) {
+			dropbear_exit("ECC error");
+		}
+		key->type = PK_PRIVATE;
+		key->idx = -1;
+		key->dp = curve->dp;
+		/* 0 < k < order */
+		gen_random_mpint(curve->order, key->k);
+		if (dropbear_nistp_mul_base(curve->nistp, key->k, &key->pubkey)
+			!= DROPBEAR_SUCCESS) {
+			dropbear_exit("ECC error");
+		}
+		return;
+	}
+#endif
+	if (ecc_make_key_ex(NULL, dropbear_ltc_prng, key, curve->dp) != CRYPT_OK) {
+		dropbear_exit("ECC error");
+	}
+}
+
 ecc_key * new_ecc_key(void) {
 	ecc_key *key = m_malloc(sizeof(*key));
 	m_mp_alloc_init_multi((mp_int**)&key->pubkey.x, (mp_int**)&key->pubkey.y, 
@@ -83,14 +135,11 @@ ecc_key * new_ecc_key(void) {
    for different mp_int pointer without LTC_SOURCE */
 static int ecc_is_point(const ecc_key *key)
 {
-	mp_int *prime, *b, *t1, *t2;
+	const struct dropbear_ecc_curve *curve = curve_for_dp(key->dp);
+	mp_int *prime = curve->prime, *b = curve->b, *t1, *t2;
 	int err;
 	
-	m_mp_alloc_init_multi(&prime, &b, &t1, &t2, NULL);
-	
-   /* load prime and b */
-	if ((err = mp_read_radix(prime, key->dp->prime, 16)) != CRYPT_OK)                          { goto error; }
-	if ((err = mp_read_radix(b, key->dp->B, 16)) != CRYPT_OK)                                  { goto error; }
+	m_mp_alloc_init_multi(&t1, &t2, NULL);
 	
    /* compute y^2 */
 	if ((err = mp_sqr(key->pubkey.y, t1)) != CRYPT_OK)                                         { goto error; }
@@ -123,9 +172,7 @@ static int ecc_is_point(const ecc_key *key)
 	}
 	
 	error:
-	mp_clear_multi(prime, b, t1, t2, NULL);
-	m_free(prime);
-	m_free(b);
+	mp_clear_multi(t1, t2, NULL);
 	m_free(t1);
 	m_free(t2);
 	return err;
@@ -214,8 +261,9 @@ ecc_key * buf_get_ecc_raw_pubkey(buffer *buf, const struct dropbear_ecc_curve *c
    a mp_int instead. */
 mp_int * dropbear_ecc_shared_secret(ecc_key *public_key, const ecc_key *private_key)
 {
+	const struct dropbear_ecc_curve *curve = NULL;
 	ecc_point *result = NULL;
-	mp_int *prime = NULL, *shared_secret = NULL;
+	mp_int *shared_secret = NULL;
 	int err = DROPBEAR_FAILURE;
 
    /* type valid? */
@@ -233,13 +281,17 @@ mp_int * dropbear_ecc_shared_secret(ecc_key *public_key, const ecc_key *private_
 		goto out;
 	}
 
-	prime = m_malloc(sizeof(*prime));
-	m_mp_init(prime);
-
-	if (mp_read_radix(prime, (char *)private_key->dp->prime, 16) != CRYPT_OK) { 
-		goto out;
-	}
-	if (ltc_mp.ecc_ptmul(private_key->k, &public_key->pubkey, result, prime, 1) != CRYPT_OK) { 
+	curve = curve_for_dp(private_key->dp);
+#if DROPBEAR_ECC_NISTP_64
+	if (curve->nistp) {
+		if (dropbear_nistp_mul(curve->nistp, private_key->k, &public_key->pubkey,
+				result) != DROPBEAR_SUCCESS) {
+			goto out;
+		}
+	} else
+#endif
+	if (ltc_mp.ecc_ptmul(private_key->k, &public_key->pubkey, result,
+			curve->prime, 1) != CRYPT_OK) { 
 		goto out;
 	}
 
@@ -249,8 +301,6 @@ mp_int * dropbear_ecc_shared_secret(ecc_key *public_key, const ecc_key *private_
 		goto out;
 	}
 
-	mp_clear(prime);
-	m_free(prime);
 	ltc_ecc_del_point(result);
 
 	err = DROPBEAR_SUCCESS;
@@ -7,11 +7,21 @@
 
 #if DROPBEAR_ECC
 
+struct dropbear_nistp;
+
 struct dropbear_ecc_curve {
 	int ltc_size; /* to match the byte sizes in ltc_ecc_sets[] */
 	const ltc_ecc_set_type *dp; /* curve domain parameters */
 	const struct ltc_hash_descriptor *hash_desc;
 	const char *name;
+	/* dp values parsed by dropbear_ecc_fill_dp(), read only */
+	mp_int *prime;
+	mp_int *order;
+	mp_int *b;
+	mp_int *Gx;
+	mp_int *Gy;
+	/* dedicated point arithmetic, NULL to use libtomcrypt's */
+	const struct dropbear_nistp *nistp;
 };
 
 extern struct dropbear_ecc_curve ecc_curve_nistp256;
@@ -22,6 +32,9 @@ extern struct dropbear_ecc_curve *dropbear_ecc_curves[];
 void dropbear_ecc_fill_dp(void);
 struct dropbear_ecc_curve* curve_for_dp(const ltc_ecc_set_type *dp);
 
+/* Generates a new private key, exits on failure */
+void dropbear_ecc_make_key(const struct dropbear_ecc_curve *curve, ecc_key *key);
+
 /* "pubkey" refers to a point, but LTC uses ecc_key structure for both public
    and private keys */
 void buf_put_ecc_raw_pubkey_string(buffer *buf, ecc_key *key);
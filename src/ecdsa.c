@@ -2,6 +2,7 @@
 #include "dbutil.h"
 #include "crypto_desc.h"
 #include "ecc.h"
+#include "ecc-nistp.h"
 #include "ecdsa.h"
 #include "signkey.h"
 
@@ -68,9 +69,7 @@ ecc_key *gen_ecdsa_priv_key(unsigned int bit_size) {
 	}
 
 	new_key = m_malloc(sizeof(*new_key));
-	if (ecc_make_key_ex(NULL, dropbear_ltc_prng, new_key, dp) != CRYPT_OK) {
-		dropbear_exit("ECC error");
-	}
+	dropbear_ecc_make_key(curve_for_dp(dp), new_key);
 	return new_key;
 }
 
@@ -172,8 +171,9 @@ void buf_put_ecdsa_sign(buffer *buf, const ecc_key *key, const buffer *data_buf)
 
 	TRACE(("buf_put_ecdsa_sign"))
 	curve = curve_for_dp(key->dp);
+	p = curve->order;
 
-	if (ltc_init_multi(&r, &s, &p, &e, NULL) != CRYPT_OK) { 
+	if (ltc_init_multi(&r, &s, &e, NULL) != CRYPT_OK) { 
 		goto out;
 	}
 
@@ -185,15 +185,9 @@ void buf_put_ecdsa_sign(buffer *buf, const ecc_key *key, const buffer *data_buf)
 		goto out;
 	}
 
-	if (ltc_mp.read_radix(p, (char *)key->dp->order, 16) != CRYPT_OK) { 
-		goto out; 
-	}
-
 	for (;;) {
 		ecc_key R_key; /* ephemeral key */
-		if (ecc_make_key_ex(NULL, dropbear_ltc_prng, &R_key, key->dp) != CRYPT_OK) {
-			goto out;
-		}
+		dropbear_ecc_make_key(curve, &R_key);
 		if (ltc_mp.mpdiv(R_key.pubkey.x, p, NULL, r) != CRYPT_OK) {
 			goto out;
 		}
@@ -239,8 +233,8 @@ void buf_put_ecdsa_sign(buffer *buf, const ecc_key *key, const buffer *data_buf)
 	err = DROPBEAR_SUCCESS;
 
 out:
-	if (r && s && p && e) {
-		ltc_deinit_multi(r, s, p, e, NULL);
+	if (r && s && e) {
+		ltc_deinit_multi(r, s, e, NULL);
 	}
 
 	if (sigbuf) {
@@ -301,10 +295,13 @@ int buf_ecdsa_verify(buffer *buf, const ecc_key *key, const buffer *data_buf) {
 
 	TRACE(("buf_ecdsa_verify"))
 	curve = curve_for_dp(key->dp);
+	/* the order and the modulus */
+	p = curve->order;
+	m = curve->prime;
 
 	mG = ltc_ecc_new_point();
 	mQ = ltc_ecc_new_point();
-	if (ltc_init_multi(&r, &s, &v, &w, &u1, &u2, &p, &e, &m, NULL) != CRYPT_OK
+	if (ltc_init_multi(&r, &s, &v, &w, &u1, &u2, &e, NULL) != CRYPT_OK
 		|| !mG
 		|| !mQ) {
 		dropbear_exit("ECC error");
@@ -322,16 +319,6 @@ int buf_ecdsa_verify(buffer *buf, const ecc_key *key, const buffer *data_buf) {
 		goto out;
 	}
 
-   /* get the order */
-	if (ltc_mp.read_radix(p, (char *)key->dp->order, 16) != CRYPT_OK) { 
-		goto out; 
-	}
-
-   /* get the modulus */
-	if (ltc_mp.read_radix(m, (char *)key->dp->prime, 16) != CRYPT_OK) { 
-		goto out; 
-	}
-
    /* check for zero */
 	if (ltc_mp.compare_d(r, 0) == LTC_MP_EQ 
 		|| ltc_mp.compare_d(s, 0) == LTC_MP_EQ 
@@ -356,10 +343,8 @@ int buf_ecdsa_verify(buffer *buf, const ecc_key *key, const buffer *data_buf) {
 	}
 
    /* find mG and mQ */
-	if (ltc_mp.read_radix(mG->x, (char *)key->dp->Gx, 16) != CRYPT_OK) { 
-		goto out; 
-	}
-	if (ltc_mp.read_radix(mG->y, (char *)key->dp->Gy, 16) != CRYPT_OK) { 
+	if (ltc_mp.copy(curve->Gx, mG->x) != CRYPT_OK
+		|| ltc_mp.copy(curve->Gy, mG->y) != CRYPT_OK) { 
 		goto out; 
 	}
 	if (ltc_mp.set_int(mG->z, 1) != CRYPT_OK) { 
@@ -373,6 +358,13 @@ int buf_ecdsa_verify(buffer *buf, const ecc_key *key, const buffer *data_buf) {
 	}
 
    /* compute u1*mG + u2*mQ = mG */
+#if DROPBEAR_ECC_NISTP_64
+	if (curve->nistp) {
+		if (dropbear_nistp_mul2add(curve->nistp, u1, u2, mQ, mG) != DROPBEAR_SUCCESS) {
+			goto out;
+		}
+	} else
+#endif
 	if (ltc_mp.ecc_mul2add == NULL) {
 		if (ltc_mp.ecc_ptmul(u1, mG, mG, m, 0) != CRYPT_OK) { 
 			goto out; 
@@ -415,7 +407,7 @@ int buf_ecdsa_verify(buffer *buf, const ecc_key *key, const buffer *data_buf) {
 out:
 	ltc_ecc_del_point(mG);
 	ltc_ecc_del_point(mQ);
-	ltc_deinit_multi(r, s, v, w, u1, u2, p, e, m, NULL);
+	ltc_deinit_multi(r, s, v, w, u1, u2, e, NULL);
 	if (mp != NULL) { 
 		ltc_mp.montgomery_deinit(mp);
 	}
@@ -65,6 +65,7 @@ int buf_get_ed25519_pub_key(buffer *buf, dropbear_ed25519_key *key,
 	}
 
 	m_burn(key->priv, CURVE25519_LEN);
+	m_burn(key->expanded, sizeof(key->expanded));
 	memcpy(key->pub, buf_getptr(buf, CURVE25519_LEN), CURVE25519_LEN);
 	buf_incrpos(buf, CURVE25519_LEN);
 
@@ -94,6 +95,7 @@ int buf_get_ed25519_priv_key(buffer *buf, dropbear_ed25519_key *key) {
 	buf_incrpos(buf, CURVE25519_LEN);
 	memcpy(key->pub, buf_getptr(buf, CURVE25519_LEN), CURVE25519_LEN);
 	buf_incrpos(buf, CURVE25519_LEN);
+	dropbear_ed25519_expand(key->expanded, key->priv);
 
 	TRACE(("leave buf_get_ed25519_priv_key: success"))
 	return DROPBEAR_SUCCESS;
@@ -109,6 +111,7 @@ void ed25519_key_free(dropbear_ed25519_key *key) {
 		return;
 	}
 	m_burn(key->priv, CURVE25519_LEN);
+	m_burn(key->expanded, sizeof(key->expanded));
 	m_free(key);
 
 	TRACE2(("leave ed25519_key_free"))
@@ -150,7 +153,7 @@ void buf_put_ed25519_sign(buffer* buf, const dropbear_ed25519_key *key, const bu
 	TRACE(("enter buf_put_ed25519_sign"))
 	dropbear_assert(key != NULL);
 
-	dropbear_ed25519_sign(data_buf->data, data_buf->len, s, &slen, key->priv, key->pub);
+	dropbear_ed25519_sign(data_buf->data, data_buf->len, s, &slen, key->expanded, key->pub);
 	buf_putstring(buf, SSH_SIGNKEY_ED25519, SSH_SIGNKEY_ED25519_LEN);
 	buf_putstring(buf, s, slen);
 
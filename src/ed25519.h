@@ -37,6 +37,8 @@ typedef struct dropbear_ED25519_Key {
 
 	unsigned char priv[CURVE25519_LEN];
 	unsigned char pub[CURVE25519_LEN];
+	/* SHA-512 of priv as used for signing, set with priv */
+	unsigned char expanded[CURVE25519_LEN*2];
 
 } dropbear_ed25519_key;
 
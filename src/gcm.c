@@ -27,24 +27,177 @@
 #include "algo.h"
 #include "dbutil.h"
 #include "gcm.h"
+#include "cpufeatures.h"
 
 #if DROPBEAR_ENABLE_GCM_MODE
 
 #define GHASH_LEN 16
 
 static const struct dropbear_hash dropbear_ghash =
-	{NULL, 0, GHASH_LEN};
+	{NULL, 0, GHASH_LEN, 0, 0};
+
+#if DROPBEAR_AESNI
+static int gcm_use_clmul = -1;
+static void gcm_clmul_init(void);
+#endif
+
+/* Reduction of the four bits shifted out of a 4-bit table step */
+static const ulong64 gcm_last4[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0 };
+
+/* Shoup's 4-bit tables, H times every 4-bit value with bits reflected */
+static void gcm_table_init(dropbear_gcm_state *state,
+			const unsigned char *H) {
+	ulong64 vh, vl;
+	ulong32 t;
+	int i, j;
+
+	LOAD64H(vh, H);
+	LOAD64H(vl, H + 8);
+	state->HH[8] = vh;
+	state->HL[8] = vl;
+	state->HH[0] = 0;
+	state->HL[0] = 0;
+	for (i = 4; i > 0; i >>= 1) {
+		t = (ulong32)(vl & 1) * 0xe1000000UL;
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ ((ulong64)t << 32);
+		state->HH[i] = vh;
+		state->HL[i] = vl;
+	}
+	for (i = 2; i <= 8; i *= 2) {
+		for (j = 1; j < i; j++) {
+			state->HH[i + j] = state->HH[i] ^ state->HH[j];
+			state->HL[i + j] = state->HL[i] ^ state->HL[j];
+		}
+	}
+}
+
+/* X = X * H */
+static void gcm_table_mult(const dropbear_gcm_state *state,
+			unsigned char *X) {
+	ulong64 zh, zl;
+	unsigned int rem;
+	int i, lo, hi;
+
+	lo = X[15] & 0xf;
+	zh = state->HH[lo];
+	zl = state->HL[lo];
+	for (i = 15; i >= 0; i--) {
+		lo = X[i] & 0xf;
+		hi = X[i] >> 4;
+		if (i != 15) {
+			rem = zl & 0xf;
+			zl = (zh << 60) | (zl >> 4);
+			zh = (zh >> 4) ^ (gcm_last4[rem] << 48);
+			zh ^= state->HH[lo];
+			zl ^= state->HL[lo];
+		}
+		rem = zl & 0xf;
+		zl = (zh << 60) | (zl >> 4);
+		zh = (zh >> 4) ^ (gcm_last4[rem] << 48);
+		zh ^= state->HH[hi];
+		zl ^= state->HL[hi];
+	}
+	STORE64H(zh, X);
+	STORE64H(zl, X + 8);
+}
+
+/* Adds len bytes to the GHASH X, zero padding the last block */
+static void gcm_ghash(const dropbear_gcm_state *state, unsigned char *X,
+			const unsigned char *in, unsigned long len) {
+	unsigned long i, n;
+
+#if DROPBEAR_AESNI
+	if (state->clmul) {
+		unsigned char last[GHASH_LEN];
+
+		dropbear_aesni_ghash(X, state->hpow, in, len / GHASH_LEN);
+		in += len - len % GHASH_LEN;
+		len %= GHASH_LEN;
+		if (len > 0) {
+			memset(last, 0, sizeof(last));
+			memcpy(last, in, len);
+			dropbear_aesni_ghash(X, state->hpow, last, 1);
+		}
+		return;
+	}
+#endif
+
+	while (len > 0) {
+		n = MIN(len, GHASH_LEN);
+		for (i = 0; i < n; i++) {
+			X[i] ^= in[i];
+		}
+		gcm_table_mult(state, X);
+		in += n;
+		len -= n;
+	}
+}
+
+/* CTR from the 32-bit counter after the one in ctr, which is updated */
+static int gcm_ctr(dropbear_gcm_state *state, unsigned char *ctr,
+			const unsigned char *in, unsigned char *out,
+			unsigned long len) {
+	unsigned char ks[16];
+	unsigned long i, n;
+	ulong32 c;
+	int err;
+
+	LOAD32H(c, ctr + GCM_NONCE_LEN);
+	while (len > 0) {
+		c++;
+		STORE32H(c, ctr + GCM_NONCE_LEN);
+		if ((err = cipher_descriptor[state->cipher].ecb_encrypt(ctr, ks,
+					&state->key)) != CRYPT_OK) {
+			return err;
+		}
+		n = MIN(len, sizeof(ks));
+		for (i = 0; i < n; i++) {
+			out[i] = in[i] ^ ks[i];
+		}
+		in += n;
+		out += n;
+		len -= n;
+	}
+	m_burn(ks, sizeof(ks));
+	return CRYPT_OK;
+}
 
 static int dropbear_gcm_start(int cipher, const unsigned char *IV,
 			const unsigned char *key, int keylen,
 			int UNUSED(num_rounds), dropbear_gcm_state *state) {
+	unsigned char H[GHASH_LEN];
 	int err;
 
 	TRACE2(("enter dropbear_gcm_start"))
 
-	if ((err = gcm_init(&state->gcm, cipher, key, keylen)) != CRYPT_OK) {
+#if DROPBEAR_AESNI
+	if (gcm_use_clmul < 0) {
+		gcm_clmul_init();
+	}
+	cipher = dropbear_aesni_select(cipher);
+#endif
+	state->cipher = cipher;
+	if ((err = cipher_descriptor[cipher].setup(key, keylen, 0,
+				&state->key)) != CRYPT_OK) {
 		return err;
 	}
+
+	memset(H, 0, sizeof(H));
+	if ((err = cipher_descriptor[cipher].ecb_encrypt(H, H,
+				&state->key)) != CRYPT_OK) {
+		return err;
+	}
+	gcm_table_init(state, H);
+#if DROPBEAR_AESNI
+	state->clmul = gcm_use_clmul && cipher == dropbear_aesni_cipher;
+	if (state->clmul) {
+		dropbear_aesni_ghash_init(H, state->hpow);
+	}
+#endif
+	m_burn(H, sizeof(H));
 	memcpy(state->iv, IV, GCM_NONCE_LEN);
 
 	TRACE2(("leave dropbear_gcm_start"))
@@ -55,7 +208,8 @@ static int dropbear_gcm_crypt(unsigned int UNUSED(seq),
 			const unsigned char *in, unsigned char *out,
 			unsigned long len, unsigned long taglen,
 			dropbear_gcm_state *state, int direction) {
-	unsigned char *iv, tag[GHASH_LEN];
+	unsigned char *iv, ctr[16], X[GHASH_LEN], tag[GHASH_LEN];
+	unsigned long done = 0;
 	int i, err;
 
 	TRACE2(("enter dropbear_gcm_crypt"))
@@ -64,27 +218,51 @@ static int dropbear_gcm_crypt(unsigned int UNUSED(seq),
 		return CRYPT_ERROR;
 	}
 
-	gcm_reset(&state->gcm);
-
-	if ((err = gcm_add_iv(&state->gcm,
-				state->iv, GCM_NONCE_LEN)) != CRYPT_OK) {
+	/* the first counter block encrypts the tag */
+	memcpy(ctr, state->iv, GCM_NONCE_LEN);
+	STORE32H(1, ctr + GCM_NONCE_LEN);
+	if ((err = cipher_descriptor[state->cipher].ecb_encrypt(ctr, tag,
+				&state->key)) != CRYPT_OK) {
 		return err;
 	}
 
-	if ((err = gcm_add_aad(&state->gcm, in, 4)) != CRYPT_OK) {
+	/* the packet length is the additional data */
+	memset(X, 0, sizeof(X));
+	gcm_ghash(state, X, in, 4);
+	in += 4;
+	out += 4;
+	len -= 4;
+
+#if DROPBEAR_AESNI
+	if (state->clmul) {
+		done = len - len % GHASH_LEN;
+		dropbear_aesni_gcm(&state->key, state->hpow, ctr, X, in, out,
+				done / GHASH_LEN, direction);
+	}
+#endif
+	if (direction == LTC_DECRYPT) {
+		gcm_ghash(state, X, in + done, len - done);
+	}
+	if ((err = gcm_ctr(state, ctr, in + done, out + done,
+				len - done)) != CRYPT_OK) {
 		return err;
 	}
+	if (direction == LTC_ENCRYPT) {
+		gcm_ghash(state, X, out + done, len - done);
+	}
 
-	if ((err = gcm_process(&state->gcm, (unsigned char *) in + 4,
-				len - 4, out + 4, direction)) != CRYPT_OK) {
-		return err;
+	/* bit lengths of the additional data and ciphertext */
+	STORE64H((ulong64)4 * 8, ctr);
+	STORE64H((ulong64)len * 8, ctr + 8);
+	gcm_ghash(state, X, ctr, sizeof(ctr));
+	for (i = 0; i < GHASH_LEN; i++) {
+		tag[i] ^= X[i];
 	}
 
 	if (direction == LTC_ENCRYPT) {
-		gcm_done(&state->gcm, out + len, &taglen);
+		memcpy(out + len, tag, GHASH_LEN);
 	} else {
-		gcm_done(&state->gcm, tag, &taglen);
-		if (constant_time_memcmp(in + len, tag, taglen) != 0) {
+		if (constant_time_memcmp(in + len, tag, GHASH_LEN) != 0) {
 			return CRYPT_ERROR;
 		}
 	}
@@ -117,4 +295,91 @@ const struct dropbear_cipher_mode dropbear_mode_gcm =
 	 (void *)dropbear_gcm_crypt,
 	 (void *)dropbear_gcm_getlength, &dropbear_ghash};
 
+#if DROPBEAR_AESNI
+/* GHASH of the GCM specification's test case 2 with both implementations,
+ * then whole packets with and without PCLMULQDQ must match, long enough
+ * for the eight block loops */
+static int gcm_clmul_test(void) {
+	static const unsigned char H[GHASH_LEN] = {
+		0x66, 0xe9, 0x4b, 0xd4, 0xef, 0x8a, 0x2c, 0x3b,
+		0x88, 0x4c, 0xfa, 0x59, 0xca, 0x34, 0x2b, 0x2e };
+	static const unsigned char C[2 * GHASH_LEN] = {
+		0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92,
+		0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x80 };
+	static const unsigned char ghash[GHASH_LEN] = {
+		0xf3, 0x8c, 0xbb, 0x1a, 0xd6, 0x92, 0x23, 0xdc,
+		0xc3, 0x45, 0x7a, 0xe5, 0xb6, 0xb0, 0xf8, 0x85 };
+	unsigned char key[16], iv[GCM_NONCE_LEN], X[GHASH_LEN];
+	unsigned char buf[2][4 + 16 * 19 + GHASH_LEN];
+	dropbear_gcm_state state;
+	int i, j, dir, ret = CRYPT_FAIL_TESTVECTOR;
+
+	for (i = 0; i < 2; i++) {
+		state.clmul = i;
+		gcm_table_init(&state, H);
+		dropbear_aesni_ghash_init(H, state.hpow);
+		memset(X, 0, sizeof(X));
+		gcm_ghash(&state, X, C, sizeof(C));
+		if (memcmp(X, ghash, sizeof(X)) != 0) {
+			goto out;
+		}
+	}
+
+	for (i = 0; i < (int)sizeof(key); i++) {
+		key[i] = i;
+	}
+	memset(iv, 0xa5, sizeof(iv));
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < (int)sizeof(buf[i]); j++) {
+			buf[i][j] = j * 7;
+		}
+	}
+	for (dir = LTC_ENCRYPT; dir <= LTC_DECRYPT; dir++) {
+		for (i = 0; i < 2; i++) {
+			gcm_use_clmul = i;
+			if (dropbear_gcm_start(dropbear_aesni_cipher, iv, key,
+						sizeof(key), 0, &state) != CRYPT_OK
+					|| state.clmul != i
+					|| dropbear_gcm_crypt(0, buf[i], buf[i],
+						sizeof(buf[i]) - GHASH_LEN, GHASH_LEN,
+						&state, dir) != CRYPT_OK) {
+				goto out;
+			}
+		}
+		if (memcmp(buf[0], buf[1], sizeof(buf[0])) != 0) {
+			goto out;
+		}
+	}
+	for (j = 0; j < (int)sizeof(buf[0]) - GHASH_LEN; j++) {
+		if (buf[0][j] != (unsigned char)(j * 7)) {
+			goto out;
+		}
+	}
+	ret = CRYPT_OK;
+
+out:
+	gcm_use_clmul = 0;
+	m_burn(&state, sizeof(state));
+	return ret;
+}
+
+/* Decides on the first use whether GHASH can use PCLMULQDQ */
+static void gcm_clmul_init() {
+	unsigned int need = DROPBEAR_CPU_PCLMUL | DROPBEAR_CPU_SSSE3;
+
+	gcm_use_clmul = 0;
+	if (dropbear_aesni_cipher < 0
+			|| (dropbear_cpu_features() & need) != need) {
+		return;
+	}
+	if (gcm_clmul_test() != CRYPT_OK) {
+		dropbear_log(LOG_WARNING, "PCLMULQDQ GHASH self test failed, not using it");
+		return;
+	}
+	gcm_use_clmul = 1;
+	TRACE(("using PCLMULQDQ GHASH"))
+}
+#endif /* DROPBEAR_AESNI */
+
 #endif /* DROPBEAR_ENABLE_GCM_MODE */
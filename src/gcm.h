@@ -28,6 +28,7 @@
 
 #include "includes.h"
 #include "algo.h"
+#include "aesni.h"
 
 #if DROPBEAR_ENABLE_GCM_MODE
 
@@ -36,8 +37,16 @@
 #define GCM_NONCE_LEN (GCM_IVFIX_LEN + GCM_IVCTR_LEN)
 
 typedef struct {
-	gcm_state gcm;
+	int cipher;
+	symmetric_key key;
 	unsigned char iv[GCM_NONCE_LEN];
+	/* H times each 4-bit value, for the portable GHASH */
+	ulong64 HL[16], HH[16];
+#if DROPBEAR_AESNI
+	/* set when GHASH uses PCLMULQDQ and the hpow table */
+	int clmul;
+	unsigned char hpow[AESNI_GHASH_POWERS * 16];
+#endif
 } dropbear_gcm_state;
 
 extern const struct dropbear_cipher_mode dropbear_mode_gcm;
@@ -40,6 +40,7 @@ dropbear_ed25519_key * gen_ed25519_priv_key(unsigned int size) {
 
 	key = m_malloc(sizeof(*key));
 	dropbear_ed25519_make_key(key->pub, key->priv);
+	dropbear_ed25519_expand(key->expanded, key->priv);
 
 	return key;
 }
@@ -84,6 +84,8 @@ dropbear_rsa_key * gen_rsa_priv_key(unsigned int size) {
 
 	mp_clear_multi(&pminus, &qminus, &lcm, NULL);
 
+	rsa_precompute_crt(key);
+
 	return key;
 }	
 
@@ -37,6 +37,7 @@
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
 
 #include <stdio.h>
 #include <errno.h>
@@ -131,6 +132,18 @@
 #include <sys/prctl.h>
 #endif
 
+#if DROPBEAR_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#if DROPBEAR_IO_URING
+#include <poll.h>
+#endif
+
+#if DROPBEAR_CRYPTO_THREADS
+#include <pthread.h>
+#endif
+
 #ifdef BUNDLED_LIBTOM
 #include "../libtomcrypt/src/headers/tomcrypt.h"
 #include "../libtommath/tommath.h"
@@ -41,6 +41,7 @@ struct kex_dh_param *gen_kexdh_param(void);
 void free_kexdh_param(struct kex_dh_param *param);
 void kexdh_comb_key(struct kex_dh_param *param, mp_int *dh_pub_them,
 		sign_key *hostkey);
+void kexdh_load_groups(void);
 #endif
 
 #if DROPBEAR_ECDH
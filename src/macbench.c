@@ -0,0 +1,178 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+/* Compares per-packet HMAC cost of calling hmac_init() for each packet, as
+ * make_mac() used to, with copying the ipad/opad hash states precomputed
+ * at key generation. Built with "make macbench", it isn't installed. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "crypto_desc.h"
+
+#if DROPBEAR_SHA2_256_HMAC
+
+#define BENCH_SECONDS 0.3
+#define BENCH_KEYLEN 32
+
+struct bench_state {
+	const struct ltc_hash_descriptor *desc;
+	int hash_index;
+	unsigned char key[BENCH_KEYLEN];
+	hash_state inner;
+	hash_state outer;
+};
+
+static double bench_now(void) {
+	struct timespec ts;
+	gettime_wrapper(&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the same steps as hmac_precompute() in common-kex.c */
+static void bench_precompute(struct bench_state *st) {
+	unsigned char pad[MAXBLOCKSIZE];
+	unsigned long i;
+
+	memset(pad, 0x0, sizeof(pad));
+	for (i = 0; i < st->desc->blocksize; i++) {
+		pad[i] = (i < BENCH_KEYLEN ? st->key[i] : 0) ^ 0x36;
+	}
+	st->desc->init(&st->inner);
+	st->desc->process(&st->inner, pad, st->desc->blocksize);
+
+	for (i = 0; i < st->desc->blocksize; i++) {
+		pad[i] = (i < BENCH_KEYLEN ? st->key[i] : 0) ^ 0x5c;
+	}
+	st->desc->init(&st->outer);
+	st->desc->process(&st->outer, pad, st->desc->blocksize);
+	m_burn(pad, sizeof(pad));
+}
+
+/* the per-packet path before the states were precomputed */
+static void mac_hmac_init(const struct bench_state *st, unsigned int seqno,
+		const unsigned char *buf, unsigned long len, unsigned char *out) {
+	unsigned char seqbuf[4];
+	unsigned long outlen = MAXBLOCKSIZE;
+	hmac_state hmac;
+
+	if (hmac_init(&hmac, st->hash_index, st->key, BENCH_KEYLEN) != CRYPT_OK) {
+		dropbear_exit("HMAC error");
+	}
+	STORE32H(seqno, seqbuf);
+	if (hmac_process(&hmac, seqbuf, 4) != CRYPT_OK
+		|| hmac_process(&hmac, buf, len) != CRYPT_OK
+		|| hmac_done(&hmac, out, &outlen) != CRYPT_OK) {
+		dropbear_exit("HMAC error");
+	}
+}
+
+/* the per-packet path in make_mac() */
+static void mac_cloned(const struct bench_state *st, unsigned int seqno,
+		const unsigned char *buf, unsigned long len, unsigned char *out) {
+	unsigned char seqbuf[4];
+	unsigned char digest[MAXBLOCKSIZE];
+	hash_state hs;
+
+	memcpy(&hs, &st->inner, sizeof(hs));
+	STORE32H(seqno, seqbuf);
+	if (st->desc->process(&hs, seqbuf, 4) != CRYPT_OK
+		|| st->desc->process(&hs, buf, len) != CRYPT_OK
+		|| st->desc->done(&hs, digest) != CRYPT_OK) {
+		dropbear_exit("HMAC error");
+	}
+	memcpy(&hs, &st->outer, sizeof(hs));
+	if (st->desc->process(&hs, digest, st->desc->hashsize) != CRYPT_OK
+		|| st->desc->done(&hs, digest) != CRYPT_OK) {
+		dropbear_exit("HMAC error");
+	}
+	memcpy(out, digest, st->desc->hashsize);
+	m_burn(&hs, sizeof(hs));
+	m_burn(digest, sizeof(digest));
+}
+
+typedef void (*mac_fn)(const struct bench_state *st, unsigned int seqno,
+		const unsigned char *buf, unsigned long len, unsigned char *out);
+
+/* ns per packet of len bytes */
+static double bench_mac(const struct bench_state *st, mac_fn fn,
+		const unsigned char *buf, unsigned long len) {
+	unsigned char out[MAXBLOCKSIZE];
+	unsigned long count = 0, i;
+	double start, elapsed;
+
+	start = bench_now();
+	do {
+		for (i = 0; i < 64; i++) {
+			fn(st, count + i, buf, len, out);
+		}
+		count += 64;
+		elapsed = bench_now() - start;
+	} while (elapsed < BENCH_SECONDS);
+
+	return elapsed * 1e9 / count;
+}
+
+static void bench_hmac(const struct ltc_hash_descriptor *desc) {
+	const unsigned long lens[] = { 64, 256, 1024, 16384 };
+	unsigned char out1[MAXBLOCKSIZE], out2[MAXBLOCKSIZE];
+	struct bench_state st;
+	unsigned char *buf;
+	unsigned int i;
+
+	st.desc = desc;
+	st.hash_index = find_hash(desc->name);
+	memset(st.key, 0xa5, sizeof(st.key));
+	bench_precompute(&st);
+
+	buf = m_malloc(lens[3]);
+	memset(buf, 0x5a, lens[3]);
+
+	/* both paths must give the same MAC */
+	mac_hmac_init(&st, 7, buf, lens[3], out1);
+	mac_cloned(&st, 7, buf, lens[3], out2);
+	if (memcmp(out1, out2, desc->hashsize) != 0) {
+		dropbear_exit("MAC mismatch");
+	}
+
+	printf("hmac-%s\n", desc->name);
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		printf("%6lu bytes: hmac_init %8.0f ns, cloned %8.0f ns\n", lens[i],
+			bench_mac(&st, mac_hmac_init, buf, lens[i]),
+			bench_mac(&st, mac_cloned, buf, lens[i]));
+	}
+	m_burn(&st, sizeof(st));
+	m_free(buf);
+}
+
+#endif /* DROPBEAR_SHA2_256_HMAC */
+
+int main(int UNUSED(argc), char ** UNUSED(argv)) {
+	crypto_init();
+#if DROPBEAR_SHA2_256_HMAC
+	bench_hmac(&sha256_desc);
+#else
+	printf("built without DROPBEAR_SHA2_256_HMAC\n");
+#endif
+	return 0;
+}
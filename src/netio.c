@@ -1,6 +1,7 @@
 #include "netio.h"
 #include "list.h"
 #include "dbutil.h"
+#include "dbpoll.h"
 #include "session.h"
 #include "debug.h"
 #include "runopts.h"
@@ -234,7 +235,7 @@ void remove_connect_pending() {
 }
 
 
-void set_connect_fds(fd_set *writefd) {
+void set_connect_fds() {
 	m_list_elem *iter;
 	iter = ses.conn_pending.first;
 	while (iter) {
@@ -245,7 +246,7 @@ void set_connect_fds(fd_set *writefd) {
 			connect_try_next(c);
 		}
 		if (c->sock >= 0) {
-			FD_SET(c->sock, writefd);
+			dbpoll_set(c->sock, DBPOLL_WRITE, NULL);
 		} else {
 			/* Final failure */
 			if (!c->errstring) {
@@ -258,14 +259,14 @@ void set_connect_fds(fd_set *writefd) {
 	}
 }
 
-void handle_connect_fds(const fd_set *writefd) {
+void handle_connect_fds() {
 	m_list_elem *iter;
 	for (iter = ses.conn_pending.first; iter; iter = iter->next) {
 		int val;
 		socklen_t vallen = sizeof(val);
 		struct dropbear_progress_connection *c = iter->item;
 
-		if (c->sock < 0 || !FD_ISSET(c->sock, writefd)) {
+		if (c->sock < 0 || !(dbpoll_ready(c->sock) & DBPOLL_WRITE)) {
 			continue;
 		}
 
@@ -342,7 +343,7 @@ void packet_queue_consume(struct Queue *queue, ssize_t written) {
 		} else {
 			written -= len;
 			dequeue(queue);
-			buf_free(writebuf);
+			pktbuf_free(writebuf);
 		}
 	}
 }
@@ -355,6 +356,23 @@ void set_sock_nodelay(int sock) {
 	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void*)&val, sizeof(val));
 }
 
+/* The kernel's smoothed round trip time for a TCP socket in microseconds,
+ * or 0 if it isn't known */
+unsigned int get_sock_rtt(int sock) {
+#if defined(TCP_INFO) && (defined(__linux__) || defined(__FreeBSD__))
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	memset(&info, 0x0, sizeof(info));
+	if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, (void*)&info, &len) == 0) {
+		return info.tcpi_rtt;
+	}
+#else
+	(void)sock;
+#endif
+	return 0;
+}
+
 #if DROPBEAR_SERVER_TCP_FAST_OPEN
 void set_listen_fast_open(int sock) {
 	int qlen = MAX(MAX_UNAUTH_PER_IP, 5);
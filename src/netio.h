@@ -11,6 +11,7 @@ enum dropbear_prio {
 };
 
 void set_sock_nodelay(int sock);
+unsigned int get_sock_rtt(int sock);
 void set_sock_priority(int sock, enum dropbear_prio prio);
 
 void get_socket_address(int fd, char **local_host, int *local_port,
@@ -32,10 +33,10 @@ struct dropbear_progress_connection * connect_remote (const char* remotehost, co
 	connect_callback cb, void *cb_data, const char* bind_address, const char* bind_port,
 	enum dropbear_prio prio);
 
-/* Sets up for select() */
-void set_connect_fds(fd_set *writefd);
-/* Handles ready sockets after select() */
-void handle_connect_fds(const fd_set *writefd);
+/* Registers pending sockets with dbpoll */
+void set_connect_fds(void);
+/* Handles ready sockets after dbpoll_wait() */
+void handle_connect_fds(void);
 /* Cleanup */
 void remove_connect_pending(void);
 
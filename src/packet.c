@@ -36,19 +36,39 @@
 #include "channel.h"
 #include "netio.h"
 #include "runopts.h"
+#include "pktbuf.h"
+#include "dbpoll.h"
+#include "cryptpipe.h"
 
 static int read_packet_init(void);
-static void make_mac(unsigned int seqno, const struct key_context_directional * key_state,
+static void read_packet_fill(void);
+static void readahead_take(unsigned char *out, unsigned int len);
+static unsigned int writepayload_tailroom(void);
+#if DROPBEAR_IO_URING
+static int write_packet_async(void);
+static void write_packet_done(int res, void *arg);
+static void read_packet_done(int res, void *arg);
+#endif
+static const char* decrypt_packet_contents(struct key_context_directional *keys,
+		buffer *readbuf, unsigned int seq);
+static void decrypt_packet_finish(buffer *readbuf);
+static const char* encrypt_packet_contents(struct key_context_directional *keys,
+		buffer *writebuf, unsigned int seq);
+#if DROPBEAR_CRYPTO_THREADS
+static int read_packet_offload(void);
+static void read_packet_collect(void);
+static int encrypt_packet_offload(buffer *writebuf, unsigned int len);
+#endif
+static void make_mac(unsigned int seqno, struct key_context_directional * key_state,
 		buffer * clear_buf, unsigned int clear_len, 
 		unsigned char *output_mac);
-static int checkmac(void);
+static int checkmac(struct key_context_directional *keys, buffer *readbuf,
+		unsigned int seq);
 
-/* For exact details see http://www.zlib.net/zlib_tech.html
- * 5 bytes per 16kB block, plus 6 bytes for the stream.
- * We might allocate 5 unnecessary bytes here if it's an
- * exact multiple. */
-#define ZLIB_COMPRESS_EXPANSION (((RECV_MAX_PAYLOAD_LEN/16384)+1)*5 + 6)
 #define ZLIB_DECOMPRESS_INCR 1024
+
+#define WRITEPAYLOAD_ALLOC \
+	(PACKET_PAYLOAD_OFF + TRANS_MAX_PAYLOAD_LEN + PACKET_TRAILER_ROOM)
 #ifndef DISABLE_ZLIB
 static buffer* buf_decompress(const buffer* buf, unsigned int len);
 static void buf_compress(buffer * dest, buffer * src, unsigned int len);
@@ -70,6 +90,13 @@ void write_packet() {
 	TRACE2(("enter write_packet"))
 	dropbear_assert(!isempty(&ses.writequeue));
 
+#if DROPBEAR_IO_URING
+	if (ses.sockio_async && write_packet_async() == DROPBEAR_SUCCESS) {
+		TRACE2(("leave write_packet: submitted"))
+		return;
+	}
+#endif
+
 #if defined(HAVE_WRITEV) && (defined(IOV_MAX) || defined(UIO_MAXIOV))
 
 	packet_queue_to_iovec(&ses.writequeue, iov, &iov_count);
@@ -133,7 +160,7 @@ void write_packet() {
 	if (written == len) {
 		/* We've finished with the packet, free it */
 		dequeue(&ses.writequeue);
-		buf_free(writebuf);
+		pktbuf_free(writebuf);
 		writebuf = NULL;
 	} else {
 		/* More packet left to write, leave it in the queue for later */
@@ -144,135 +171,313 @@ void write_packet() {
 	TRACE2(("leave write_packet"))
 }
 
-/* Non-blocking function reading available portion of a packet into the
- * ses's buffer, decrypting the length if encrypted, decrypting the
- * full portion if possible */
-void read_packet() {
+#if DROPBEAR_IO_URING
+/* write_packet() for the io_uring backend. The write is sent to the kernel
+ * with the next dbpoll_wait(), and write_packet_done() takes what was
+ * written off the queue. Only one write is in flight at a time */
+static int write_packet_async() {
 
-	int len;
-	unsigned int maxlen;
-	unsigned char blocksize;
+	unsigned int iov_count = 50;
+	struct iovec iov[50];
 
-	TRACE2(("enter read_packet"))
-	blocksize = ses.keys->recv.algo_crypt->blocksize;
-	
-	if (ses.readbuf == NULL || ses.readbuf->len < blocksize) {
-		int ret;
-		/* In the first blocksize of a packet */
+	if (ses.write_error) {
+		errno = ses.write_error;
+		dropbear_exit("Error writing:");
+	}
+	if (ses.write_eof) {
+		ses.remoteclosed();
+	}
+	if (ses.write_inflight) {
+		return DROPBEAR_SUCCESS;
+	}
 
-		/* Read the first blocksize of the packet, so we can decrypt it and
-		 * find the length of the whole packet */
-		ret = read_packet_init();
+	packet_queue_to_iovec(&ses.writequeue, iov, &iov_count);
+	if (dbpoll_io_writev(ses.sock_out, iov, iov_count,
+			write_packet_done, NULL) == DROPBEAR_FAILURE) {
+		return DROPBEAR_FAILURE;
+	}
+	ses.write_inflight = 1;
+	return DROPBEAR_SUCCESS;
+}
 
-		if (ret == DROPBEAR_FAILURE) {
-			/* didn't read enough to determine the length */
-			TRACE2(("leave read_packet: packetinit done"))
-			return;
-		}
+static void write_packet_done(int res, void *arg) {
+
+	(void)arg;
+	ses.write_inflight = 0;
+	if (res > 0) {
+		packet_queue_consume(&ses.writequeue, res);
+		ses.writequeue_len -= res;
+	} else if (res == 0) {
+		ses.write_eof = 1;
+	} else if (res != -EINTR && res != -EAGAIN && res != -ECANCELED) {
+		ses.write_error = -res;
 	}
+}
+
+/* Starts a read into the read-ahead ring's free space for the io_uring
+ * backend, unless one is already in flight. read_packet_done() adds what
+ * arrived to the ring, read_packet() then uses it as usual */
+void read_packet_submit() {
+
+	unsigned int maxlen;
+	unsigned char *ptr;
 
-	/* Attempt to read the remainder of the packet, note that there
-	 * mightn't be any available (EAGAIN) */
-	maxlen = ses.readbuf->len - ses.readbuf->pos;
+	if (ses.read_inflight || ses.read_eof || ses.read_error) {
+		return;
+	}
+	maxlen = cbuf_writelen(ses.readahead);
 	if (maxlen == 0) {
-		/* Occurs when the packet is only a single block long and has all
-		 * been read in read_packet_init().  Usually means that MAC is disabled
-		 */
-		len = 0;
+		return;
+	}
+	ptr = cbuf_writeptr(ses.readahead, maxlen);
+	if (dbpoll_io_read(ses.sock_in, ptr, maxlen, ses.readahead_bufindex,
+			read_packet_done, ptr) == DROPBEAR_SUCCESS) {
+		ses.read_inflight = 1;
+	}
+}
+
+static void read_packet_done(int res, void *arg) {
+
+	ses.read_inflight = 0;
+	if (res > 0) {
+		cbuf_incrwrite_at(ses.readahead, arg, res);
+	} else if (res == 0) {
+		ses.read_eof = 1;
+	} else if (res != -EINTR && res != -EAGAIN && res != -ECANCELED) {
+		ses.read_error = -res;
+	}
+}
+#endif /* DROPBEAR_IO_URING */
+
+/* Non-blocking function reading what the socket has available into the
+ * read-ahead ring, then moving as much of the current packet as possible
+ * from the ring into the ses's buffer, decrypting the length if encrypted,
+ * decrypting the full portion if possible.
+ * At most one packet is decrypted per call - a following packet may need
+ * different keys after a SSH_MSG_NEWKEYS, so it's left in the ring until
+ * the current payload has been processed, see read_packet_pending().
+ * With DROPBEAR_CRYPTO_THREADS large packets are handed to the receive
+ * crypto thread instead, and following packets can be read meanwhile */
+void read_packet() {
+
+	unsigned int maxlen;
+
+	TRACE2(("enter read_packet"))
+
+	if (ses.readbuf == NULL) {
+		maxlen = ses.keys->recv.algo_crypt->blocksize;
 	} else {
-		len = read(ses.sock_in, buf_getptr(ses.readbuf, maxlen), maxlen);
+		maxlen = ses.readbuf->len - ses.readbuf->pos;
+	}
+	if (cbuf_getused(ses.readahead) < maxlen) {
+		read_packet_fill();
+	}
 
-		if (len == 0) {
-			ses.remoteclosed();
-		}
+	for (;;) {
+		if (ses.readbuf == NULL) {
+			/* In the first blocksize of a packet */
 
-		if (len < 0) {
-			if (errno == EINTR || errno == EAGAIN) {
-				TRACE2(("leave read_packet: EINTR or EAGAIN"))
-				return;
-			} else {
-				dropbear_exit("Error reading:");
+			/* Take the first blocksize of the packet, so we can decrypt it and
+			 * find the length of the whole packet */
+			if (read_packet_init() == DROPBEAR_FAILURE) {
+				/* didn't have enough to determine the length */
+				TRACE2(("read_packet: packetinit done"))
+				break;
 			}
 		}
 
-		buf_incrpos(ses.readbuf, len);
-	}
+		/* Attempt to take the remainder of the packet, note that there
+		 * mightn't be any available yet */
+		maxlen = ses.readbuf->len - ses.readbuf->pos;
+		maxlen = MIN(maxlen, cbuf_getused(ses.readahead));
+		readahead_take(buf_getptr(ses.readbuf, maxlen), maxlen);
+		buf_incrpos(ses.readbuf, maxlen);
+
+		if (ses.readbuf->pos != ses.readbuf->len) {
+			break;
+		}
 
-	if ((unsigned int)len == maxlen) {
 		/* The whole packet has been read */
+#if DROPBEAR_CRYPTO_THREADS
+		if (read_packet_offload() == DROPBEAR_SUCCESS) {
+			/* carry on with the next packet */
+			continue;
+		}
+		if (ses.recvpipe && cryptpipe_pending(ses.recvpipe) > 0) {
+			/* packets before this one must be processed first, they
+			 * are collected below */
+			break;
+		}
+#endif
 		decrypt_packet();
 		/* The main select() loop process_packet() to
 		 * handle the packet contents... */
+		break;
+	}
+
+#if DROPBEAR_CRYPTO_THREADS
+	if (ses.payload == NULL && ses.recvpipe) {
+		if (ses.readbuf && ses.readbuf->pos == ses.readbuf->len) {
+			/* A packet waiting for the thread to finish earlier ones
+			 * (a full ring, or a small packet). That won't be long */
+			cryptpipe_wait(ses.recvpipe);
+		}
+		read_packet_collect();
 	}
+#endif
 	TRACE2(("leave read_packet"))
 }
 
-/* Function used to read the initial portion of a packet, and determine the
- * length. Only called during the first BLOCKSIZE of a packet. */
-/* Returns DROPBEAR_SUCCESS if the length is determined, 
- * DROPBEAR_FAILURE otherwise */
-static int read_packet_init() {
+/* Returns 1 if the read-ahead ring already holds enough data for
+ * read_packet() to make progress without waiting for the socket */
+int read_packet_pending() {
+	unsigned int used;
 
-	unsigned int maxlen;
-	int slen;
-	unsigned int len, plen;
-	unsigned int blocksize;
-	unsigned int macsize;
+	if (ses.readahead == NULL || ses.payload != NULL) {
+		return 0;
+	}
+#if DROPBEAR_CRYPTO_THREADS
+	if (ses.recvpipe && cryptpipe_ready(ses.recvpipe)) {
+		return 1;
+	}
+	if (ses.readbuf && ses.readbuf->pos == ses.readbuf->len) {
+		/* read_packet() waits for the crypto thread */
+		return 1;
+	}
+#endif
+	used = cbuf_getused(ses.readahead);
+	if (ses.readbuf == NULL) {
+		return used >= ses.keys->recv.algo_crypt->blocksize;
+	}
+	return used > 0;
+}
 
+/* Reads as much as the socket has into the contiguous free space of the
+ * read-ahead ring, with a single read() */
+static void read_packet_fill() {
 
-	blocksize = ses.keys->recv.algo_crypt->blocksize;
-	macsize = ses.keys->recv.algo_mac->hashsize;
+	unsigned int maxlen;
+	int len;
 
-	if (ses.readbuf == NULL) {
-		/* start of a new packet */
-		ses.readbuf = buf_new(INIT_READBUF);
+#if DROPBEAR_IO_URING
+	if (ses.sockio_async && ses.remoteident) {
+		/* read_packet_done() has already put anything that arrived
+		 * in the ring */
+		if (ses.read_error) {
+			errno = ses.read_error;
+			dropbear_exit("Error reading:");
+		}
+		if (ses.read_eof) {
+			ses.remoteclosed();
+		}
+		return;
 	}
+#endif
 
-	maxlen = blocksize - ses.readbuf->pos;
-			
-	/* read the rest of the packet if possible */
-	slen = read(ses.sock_in, buf_getwriteptr(ses.readbuf, maxlen),
-			maxlen);
-	if (slen == 0) {
+	maxlen = cbuf_writelen(ses.readahead);
+	if (maxlen == 0) {
+		/* ring is full, drain it first */
+		return;
+	}
+
+	len = read(ses.sock_in, cbuf_writeptr(ses.readahead, maxlen), maxlen);
+	if (len == 0) {
 		ses.remoteclosed();
 	}
-	if (slen < 0) {
+	if (len < 0) {
 		if (errno == EINTR || errno == EAGAIN) {
-			TRACE2(("leave read_packet_init: EINTR"))
-			return DROPBEAR_FAILURE;
+			TRACE2(("leave read_packet_fill: EINTR or EAGAIN"))
+			return;
 		}
 		dropbear_exit("Error reading:");
 	}
 
-	buf_incrwritepos(ses.readbuf, slen);
+	cbuf_incrwrite(ses.readahead, len);
+}
+
+/* Copies len bytes out of the read-ahead ring, which must hold them */
+static void readahead_take(unsigned char *out, unsigned int len) {
+
+	unsigned char *p1 = NULL, *p2 = NULL;
+	unsigned int len1, len2;
+
+	cbuf_readptrs(ses.readahead, &p1, &len1, &p2, &len2);
+	dropbear_assert(len <= len1 + len2);
+	len1 = MIN(len1, len);
+	memcpy(out, p1, len1);
+	if (len > len1) {
+		memcpy(&out[len1], p2, len - len1);
+	}
+	cbuf_incrread(ses.readahead, len);
+}
+
+/* Function used to take the initial portion of a packet from the
+ * read-ahead ring, and determine the length. Only called at the start
+ * of a packet. The packet's readbuf is allocated at its full length here,
+ * so the rest of the packet can be copied straight into place. */
+/* Returns DROPBEAR_SUCCESS if the length is determined, 
+ * DROPBEAR_FAILURE otherwise */
+static int read_packet_init() {
+
+	unsigned char block[MAX_IV_LEN];
+	unsigned int len, plen;
+	unsigned int blocksize;
+	unsigned int macsize;
+#if DROPBEAR_AEAD_MODE
+	unsigned int seq = ses.recvseq;
+	void *state = &ses.keys->recv.cipher_state;
+#endif
+
+	blocksize = ses.keys->recv.algo_crypt->blocksize;
+	macsize = ses.keys->recv.algo_mac->hashsize;
 
-	if ((unsigned int)slen != maxlen) {
+	if (cbuf_getused(ses.readahead) < blocksize) {
 		/* don't have enough bytes to determine length, get next time */
 		return DROPBEAR_FAILURE;
 	}
+	readahead_take(block, blocksize);
 
 	/* now we have the first block, need to get packet length, so we decrypt
 	 * the first block (only need first 4 bytes) */
-	buf_setpos(ses.readbuf, 0);
 #if DROPBEAR_AEAD_MODE
 	if (ses.keys->recv.crypt_mode->aead_crypt) {
-		if (ses.keys->recv.crypt_mode->aead_getlength(ses.recvseq,
-					buf_getptr(ses.readbuf, blocksize), &plen,
-					blocksize,
-					&ses.keys->recv.cipher_state) != CRYPT_OK) {
+#if DROPBEAR_CRYPTO_THREADS
+		if (ses.recvpipe && cryptpipe_pending(ses.recvpipe) > 0) {
+			/* Packets before this one are with the crypto thread, which
+			 * may be using the cipher state */
+			seq += cryptpipe_pending(ses.recvpipe);
+			state = &ses.recvframe->cipher_state;
+		}
+#endif
+		if (ses.keys->recv.crypt_mode->aead_getlength(seq,
+					block, &plen, blocksize, state) != CRYPT_OK) {
 			dropbear_exit("Error decrypting");
 		}
+		if (plen > RECV_MAX_PACKET_LEN - 4 - macsize) {
+			dropbear_exit("Integrity error (bad packet size %u)", plen);
+		}
 		len = plen + 4 + macsize;
 	} else
 #endif
-	{
-		if (ses.keys->recv.crypt_mode->decrypt(buf_getptr(ses.readbuf, blocksize), 
-					buf_getwriteptr(ses.readbuf, blocksize),
-					blocksize,
+	if (ses.keys->recv.algo_mac->etm) {
+		/* encrypt-then-MAC leaves the length unencrypted, nothing is
+		 * decrypted until the MAC has been checked */
+		LOAD32H(plen, block);
+		/* checked before the sum so that it can't wrap */
+		if (plen > RECV_MAX_PACKET_LEN - 4 - macsize) {
+			dropbear_exit("Integrity error (bad packet size %u)", plen);
+		}
+		len = plen + 4 + macsize;
+	} else {
+		if (ses.keys->recv.crypt_mode->decrypt(block, block, blocksize,
 					&ses.keys->recv.cipher_state) != CRYPT_OK) {
 			dropbear_exit("Error decrypting");
 		}
-		plen = buf_getint(ses.readbuf) + 4;
+		LOAD32H(plen, block);
+		if (plen > RECV_MAX_PACKET_LEN - 4 - macsize) {
+			dropbear_exit("Integrity error (bad packet size %u)", plen);
+		}
+		plen += 4;
 		len = plen + macsize;
 	}
 
@@ -286,117 +491,221 @@ static int read_packet_init() {
 		dropbear_exit("Integrity error (bad packet size %u)", len);
 	}
 
-	if (len > ses.readbuf->size) {
-		ses.readbuf = buf_resize(ses.readbuf, len);		
-	}
+	ses.readbuf = pktbuf_new(len);
+	buf_putbytes(ses.readbuf, block, blocksize);
 	buf_setlen(ses.readbuf, len);
-	buf_setpos(ses.readbuf, blocksize);
+	m_burn(block, sizeof(block));
 	return DROPBEAR_SUCCESS;
 }
 
 /* handle the received packet */
 void decrypt_packet() {
 
+	const char *err = NULL;
+
+	TRACE2(("enter decrypt_packet"))
+
+	err = decrypt_packet_contents(&ses.keys->recv, ses.readbuf, ses.recvseq);
+	if (err) {
+		dropbear_exit("%s", err);
+	}
+	decrypt_packet_finish(ses.readbuf);
+	ses.readbuf = NULL;
+
+	TRACE2(("leave decrypt_packet"))
+}
+
+/* Decrypts a complete packet read by read_packet_init() in-place and
+ * checks the MAC. This may run in the receive crypto thread, see
+ * cryptpipe.h. Returns NULL or the error to exit with */
+static const char* decrypt_packet_contents(struct key_context_directional *keys,
+		buffer *readbuf, unsigned int seq) {
+
 	unsigned char blocksize;
 	unsigned char macsize;
-	unsigned int padlen;
 	unsigned int len;
 
-	TRACE2(("enter decrypt_packet"))
-	blocksize = ses.keys->recv.algo_crypt->blocksize;
-	macsize = ses.keys->recv.algo_mac->hashsize;
-
-	ses.kexstate.datarecv += ses.readbuf->len;
+	blocksize = keys->algo_crypt->blocksize;
+	macsize = keys->algo_mac->hashsize;
 
 #if DROPBEAR_AEAD_MODE
-	if (ses.keys->recv.crypt_mode->aead_crypt) {
+	if (keys->crypt_mode->aead_crypt) {
 		/* first blocksize is not decrypted yet */
-		buf_setpos(ses.readbuf, 0);
+		buf_setpos(readbuf, 0);
 
 		/* decrypt it in-place */
-		len = ses.readbuf->len - macsize - ses.readbuf->pos;
-		if (ses.keys->recv.crypt_mode->aead_crypt(ses.recvseq,
-					buf_getptr(ses.readbuf, len + macsize),
-					buf_getwriteptr(ses.readbuf, len),
+		len = readbuf->len - macsize - readbuf->pos;
+		if (keys->crypt_mode->aead_crypt(seq,
+					buf_getptr(readbuf, len + macsize),
+					buf_getwriteptr(readbuf, len),
 					len, macsize,
-					&ses.keys->recv.cipher_state, LTC_DECRYPT) != CRYPT_OK) {
-			dropbear_exit("Error decrypting");
+					&keys->cipher_state, LTC_DECRYPT) != CRYPT_OK) {
+			return "Error decrypting";
 		}
-		buf_incrpos(ses.readbuf, len);
+		buf_incrpos(readbuf, len);
 	} else
 #endif
-	{
+	if (keys->algo_mac->etm) {
+		/* the MAC covers the length and ciphertext, check it first */
+		if (checkmac(keys, readbuf, seq) != DROPBEAR_SUCCESS) {
+			return "Integrity error";
+		}
+
+		/* decrypt everything after the length in-place */
+		buf_setpos(readbuf, 4);
+		len = readbuf->len - macsize - readbuf->pos;
+		if (keys->crypt_mode->decrypt(
+					buf_getptr(readbuf, len), 
+					buf_getwriteptr(readbuf, len),
+					len,
+					&keys->cipher_state) != CRYPT_OK) {
+			return "Error decrypting";
+		}
+		buf_incrpos(readbuf, len);
+	} else {
 		/* we've already decrypted the first blocksize in read_packet_init */
-		buf_setpos(ses.readbuf, blocksize);
+		buf_setpos(readbuf, blocksize);
 
 		/* decrypt it in-place */
-		len = ses.readbuf->len - macsize - ses.readbuf->pos;
-		if (ses.keys->recv.crypt_mode->decrypt(
-					buf_getptr(ses.readbuf, len), 
-					buf_getwriteptr(ses.readbuf, len),
+		len = readbuf->len - macsize - readbuf->pos;
+		if (keys->crypt_mode->decrypt(
+					buf_getptr(readbuf, len), 
+					buf_getwriteptr(readbuf, len),
 					len,
-					&ses.keys->recv.cipher_state) != CRYPT_OK) {
-			dropbear_exit("Error decrypting");
+					&keys->cipher_state) != CRYPT_OK) {
+			return "Error decrypting";
 		}
-		buf_incrpos(ses.readbuf, len);
+		buf_incrpos(readbuf, len);
 
 		/* check the hmac */
-		if (checkmac() != DROPBEAR_SUCCESS) {
-			dropbear_exit("Integrity error");
+		if (checkmac(keys, readbuf, seq) != DROPBEAR_SUCCESS) {
+			return "Integrity error";
 		}
 
 	}
-	
+	return NULL;
+}
+
+/* Makes a decrypted packet the session's payload */
+static void decrypt_packet_finish(buffer *readbuf) {
+
+	unsigned char macsize;
+	unsigned int padlen;
+	unsigned int len;
+
+	macsize = ses.keys->recv.algo_mac->hashsize;
+	ses.kexstate.datarecv += readbuf->len;
+
 #if DROPBEAR_FUZZ
-	fuzz_dump(ses.readbuf->data, ses.readbuf->len);
+	fuzz_dump(readbuf->data, readbuf->len);
 #endif
 
 	/* get padding length */
-	buf_setpos(ses.readbuf, PACKET_PADDING_OFF);
-	padlen = buf_getbyte(ses.readbuf);
+	buf_setpos(readbuf, PACKET_PADDING_OFF);
+	padlen = buf_getbyte(readbuf);
 		
 	/* payload length */
 	/* - 4 - 1 is for LEN and PADLEN values */
-	len = ses.readbuf->len - padlen - 4 - 1 - macsize;
+	len = readbuf->len - padlen - 4 - 1 - macsize;
 	if ((len > RECV_MAX_PAYLOAD_LEN+ZLIB_COMPRESS_EXPANSION) || (len < 1)) {
 		dropbear_exit("Bad packet size %u", len);
 	}
 
-	buf_setpos(ses.readbuf, PACKET_PAYLOAD_OFF);
+	buf_setpos(readbuf, PACKET_PAYLOAD_OFF);
 
 #ifndef DISABLE_ZLIB
 	if (is_compress_recv()) {
 		/* decompress */
-		ses.payload = buf_decompress(ses.readbuf, len);
+		ses.payload = buf_decompress(readbuf, len);
 		buf_setpos(ses.payload, 0);
 		ses.payload_beginning = 0;
-		buf_free(ses.readbuf);
+		pktbuf_free(readbuf);
 	} else 
 #endif
 	{
-		ses.payload = ses.readbuf;
+		ses.payload = readbuf;
 		ses.payload_beginning = ses.payload->pos;
 		buf_setlen(ses.payload, ses.payload->pos + len);
 	}
-	ses.readbuf = NULL;
 
 	ses.recvseq++;
+}
 
-	TRACE2(("leave decrypt_packet"))
+#if DROPBEAR_CRYPTO_THREADS
+/* Hands the complete packet in ses.readbuf to the receive crypto thread.
+ * Only large packets are taken, SSH_MSG_NEWKEYS changes the keys for the
+ * packets after it so it must be processed before those are read. The
+ * mode must let the next packet's length be read while this one is with
+ * the thread. Returns DROPBEAR_SUCCESS if the packet was taken */
+static int read_packet_offload() {
+
+	struct key_context_directional *keys = &ses.keys->recv;
+	unsigned int pending;
+	int aead = 0;
+
+#if DROPBEAR_AEAD_MODE
+	aead = keys->crypt_mode->aead_crypt != NULL;
+#endif
+	if (ses.readbuf->len < CRYPTO_THREAD_MIN_PACKET
+			|| !(aead || keys->algo_mac->etm)) {
+		return DROPBEAR_FAILURE;
+	}
+
+	if (ses.recvpipe == NULL) {
+		ses.recvpipe = cryptpipe_new(decrypt_packet_contents, keys);
+		if (ses.recvpipe == NULL) {
+			return DROPBEAR_FAILURE;
+		}
+	}
+
+	pending = cryptpipe_pending(ses.recvpipe);
+	if (aead && ses.recvframe == NULL) {
+		/* read_packet_init() reads lengths with a copy of the keys while
+		 * the thread has packets. Made while it has none */
+		dropbear_assert(pending == 0);
+		ses.recvframe = m_malloc(sizeof(*ses.recvframe));
+		memcpy(ses.recvframe, keys, sizeof(*keys));
+	}
+
+	if (cryptpipe_submit(ses.recvpipe, ses.readbuf,
+				ses.recvseq + pending) == DROPBEAR_FAILURE) {
+		return DROPBEAR_FAILURE;
+	}
+	ses.readbuf = NULL;
+	return DROPBEAR_SUCCESS;
+}
+
+/* Takes the oldest packet the receive crypto thread has finished as the
+ * session's payload, if there is one */
+static void read_packet_collect() {
+
+	buffer *readbuf = NULL;
+	const char *err = NULL;
+
+	readbuf = cryptpipe_collect(ses.recvpipe, &err);
+	if (readbuf == NULL) {
+		return;
+	}
+	if (err) {
+		dropbear_exit("%s", err);
+	}
+	decrypt_packet_finish(readbuf);
 }
+#endif /* DROPBEAR_CRYPTO_THREADS */
 
 /* Checks the mac at the end of a decrypted readbuf.
  * Returns DROPBEAR_SUCCESS or DROPBEAR_FAILURE */
-static int checkmac() {
+static int checkmac(struct key_context_directional *keys, buffer *readbuf,
+		unsigned int seq) {
 
 	unsigned char mac_bytes[MAX_MAC_LEN];
 	unsigned int mac_size, contents_len;
 	
-	mac_size = ses.keys->recv.algo_mac->hashsize;
-	contents_len = ses.readbuf->len - mac_size;
+	mac_size = keys->algo_mac->hashsize;
+	contents_len = readbuf->len - mac_size;
 
-	buf_setpos(ses.readbuf, 0);
-	make_mac(ses.recvseq, &ses.keys->recv, ses.readbuf, contents_len, mac_bytes);
+	buf_setpos(readbuf, 0);
+	make_mac(seq, keys, readbuf, contents_len, mac_bytes);
 
 #if DROPBEAR_FUZZ
 	if (fuzz.fuzzing) {
@@ -413,8 +722,8 @@ static int checkmac() {
 #endif
 
 	/* compare the hash */
-	buf_setpos(ses.readbuf, contents_len);
-	if (constant_time_memcmp(mac_bytes, buf_getptr(ses.readbuf, mac_size), mac_size) != 0) {
+	buf_setpos(readbuf, contents_len);
+	if (constant_time_memcmp(mac_bytes, buf_getptr(readbuf, mac_size), mac_size) != 0) {
 		return DROPBEAR_FAILURE;
 	} else {
 		return DROPBEAR_SUCCESS;
@@ -480,7 +789,9 @@ static void enqueue_reply_packet() {
 	new_item = m_malloc(sizeof(struct packetlist));
 	new_item->next = NULL;
 	
-	new_item->payload = buf_newcopy(ses.writepayload);
+	new_item->payload = pktbuf_new(ses.writepayload->len);
+	buf_putbytes(new_item->payload, ses.writepayload->data,
+			ses.writepayload->len);
 	buf_setpos(ses.writepayload, 0);
 	buf_setlen(ses.writepayload, 0);
 	
@@ -505,7 +816,7 @@ void maybe_flush_reply_queue() {
 		buf_putbytes(ses.writepayload,
 			curr_item->payload->data, curr_item->payload->len);
 			
-		buf_free(curr_item->payload);
+		pktbuf_free(curr_item->payload);
 		tmp_item = curr_item;
 		curr_item = curr_item->next;
 		m_free(tmp_item);
@@ -524,7 +835,7 @@ void encrypt_packet() {
 	                      encrypted in-place. */
 	unsigned char packet_type;
 	unsigned int len, encrypt_buf_size;
-	unsigned char mac_bytes[MAX_MAC_LEN];
+	const char *err = NULL;
 
 	time_t now;
 	
@@ -562,17 +873,28 @@ void encrypt_packet() {
 	 * packet type */
 				+ 1;
 
-	writebuf = buf_new(encrypt_buf_size);
-	buf_setlen(writebuf, PACKET_PAYLOAD_OFF);
-	buf_setpos(writebuf, PACKET_PAYLOAD_OFF);
-
 #ifndef DISABLE_ZLIB
 	/* compression */
 	if (is_compress_trans()) {
+		writebuf = pktbuf_new(encrypt_buf_size);
+		buf_setlen(writebuf, PACKET_PAYLOAD_OFF);
+		buf_setpos(writebuf, PACKET_PAYLOAD_OFF);
 		buf_compress(writebuf, ses.writepayload, ses.writepayload->len);
 	} else
 #endif
-	{
+	if (ses.writepayload->len > TRANS_MAX_PAYLOAD_LEN/2) {
+		/* Large payloads (channel data) already sit where they'll go on
+		 * the wire, with room for the header and trailer around them.
+		 * Take the whole buffer rather than copying the payload, a fresh
+		 * one costs less than the copy */
+		writebuf = ses.writepayload;
+		buf_expand(writebuf, PACKET_PAYLOAD_OFF, writepayload_tailroom());
+		buf_setpos(writebuf, writebuf->len);
+		ses.writepayload = writepayload_new();
+	} else {
+		writebuf = pktbuf_new(encrypt_buf_size);
+		buf_setlen(writebuf, PACKET_PAYLOAD_OFF);
+		buf_setpos(writebuf, PACKET_PAYLOAD_OFF);
 		memcpy(buf_getwriteptr(writebuf, ses.writepayload->len),
 				buf_getptr(ses.writepayload, ses.writepayload->len),
 				ses.writepayload->len);
@@ -584,9 +906,12 @@ void encrypt_packet() {
 	buf_setlen(ses.writepayload, 0);
 
 	/* length of padding - packet length excluding the packetlength uint32
-	 * field in aead mode must be a multiple of blocksize, with a minimum of
-	 * 4 bytes of padding */
+	 * field in aead and encrypt-then-MAC modes must be a multiple of
+	 * blocksize, with a minimum of 4 bytes of padding */
 	len = writebuf->len;
+	if (ses.keys->trans.algo_mac->etm) {
+		len -= 4;
+	}
 #if DROPBEAR_AEAD_MODE
 	if (ses.keys->trans.crypt_mode->aead_crypt) {
 		len -= 4;
@@ -612,36 +937,95 @@ void encrypt_packet() {
 	buf_incrlen(writebuf, padlen);
 	genrandom(buf_getptr(writebuf, padlen), padlen);
 
+	/* the MAC is added after the padding */
+	len = writebuf->len + mac_size;
+#if DROPBEAR_CRYPTO_THREADS
+	if (encrypt_packet_offload(writebuf, len) != DROPBEAR_SUCCESS)
+#endif
+	{
+		err = encrypt_packet_contents(&ses.keys->trans, writebuf, ses.transseq);
+		if (err) {
+			dropbear_exit("%s", err);
+		}
+		writebuf_enqueue(writebuf);
+	}
+
+	/* Update counts */
+	ses.kexstate.datatrans += len;
+	ses.transseq++;
+
+	now = monotonic_now();
+	ses.last_packet_time_any_sent = now;
+	/* idle timeout shouldn't be affected by responses to keepalives.
+	send_msg_keepalive() itself also does tricks with 
+	ses.last_packet_idle_time - read that if modifying this code */
+	if (packet_type != SSH_MSG_REQUEST_FAILURE
+		&& packet_type != SSH_MSG_UNIMPLEMENTED
+		&& packet_type != SSH_MSG_IGNORE) {
+		ses.last_packet_time_idle = now;
+
+	}
+
+	TRACE2(("leave encrypt_packet()"))
+}
+
+/* Encrypts and MACs a padded packet in-place, leaving its position at 0.
+ * This may run in the transmit crypto thread, see cryptpipe.h. Returns
+ * NULL or the error to exit with */
+static const char* encrypt_packet_contents(struct key_context_directional *keys,
+		buffer *writebuf, unsigned int seq) {
+
+	unsigned char mac_size;
+	unsigned int len;
+	unsigned char mac_bytes[MAX_MAC_LEN];
+
+	mac_size = keys->algo_mac->hashsize;
+
 #if DROPBEAR_AEAD_MODE
-	if (ses.keys->trans.crypt_mode->aead_crypt) {
+	if (keys->crypt_mode->aead_crypt) {
 		/* do the actual encryption, in-place */
 		buf_setpos(writebuf, 0);
 		/* encrypt it in-place*/
 		len = writebuf->len;
 		buf_incrlen(writebuf, mac_size);
-		if (ses.keys->trans.crypt_mode->aead_crypt(ses.transseq,
+		if (keys->crypt_mode->aead_crypt(seq,
 					buf_getptr(writebuf, len),
 					buf_getwriteptr(writebuf, len + mac_size),
 					len, mac_size,
-					&ses.keys->trans.cipher_state, LTC_ENCRYPT) != CRYPT_OK) {
-			dropbear_exit("Error encrypting");
+					&keys->cipher_state, LTC_ENCRYPT) != CRYPT_OK) {
+			return "Error encrypting";
 		}
-		buf_incrpos(writebuf, len + mac_size);
 	} else
 #endif
-	{
-		make_mac(ses.transseq, &ses.keys->trans, writebuf, writebuf->len, mac_bytes);
+	if (keys->algo_mac->etm) {
+		/* encrypt everything after the length in-place */
+		buf_setpos(writebuf, 4);
+		len = writebuf->len - 4;
+		if (keys->crypt_mode->encrypt(
+					buf_getptr(writebuf, len),
+					buf_getwriteptr(writebuf, len),
+					len,
+					&keys->cipher_state) != CRYPT_OK) {
+			return "Error encrypting";
+		}
+
+		/* then MAC the length and ciphertext */
+		make_mac(seq, keys, writebuf, writebuf->len, mac_bytes);
+		buf_setpos(writebuf, writebuf->len);
+		buf_putbytes(writebuf, mac_bytes, mac_size);
+	} else {
+		make_mac(seq, keys, writebuf, writebuf->len, mac_bytes);
 
 		/* do the actual encryption, in-place */
 		buf_setpos(writebuf, 0);
 		/* encrypt it in-place*/
 		len = writebuf->len;
-		if (ses.keys->trans.crypt_mode->encrypt(
+		if (keys->crypt_mode->encrypt(
 					buf_getptr(writebuf, len),
 					buf_getwriteptr(writebuf, len),
 					len,
-					&ses.keys->trans.cipher_state) != CRYPT_OK) {
-			dropbear_exit("Error encrypting");
+					&keys->cipher_state) != CRYPT_OK) {
+			return "Error encrypting";
 		}
 		buf_incrpos(writebuf, len);
 
@@ -649,27 +1033,115 @@ void encrypt_packet() {
 		buf_putbytes(writebuf, mac_bytes, mac_size);
 	}
 
-	/* Update counts */
-	ses.kexstate.datatrans += writebuf->len;
+	buf_setpos(writebuf, 0);
+	return NULL;
+}
 
-	writebuf_enqueue(writebuf);
+#if DROPBEAR_CRYPTO_THREADS
+/* Hands a padded packet of len bytes (once MACed) to the transmit crypto
+ * thread. Once the thread has packets all following ones must go the same
+ * way to keep their order, otherwise small packets are done here.
+ * Returns DROPBEAR_SUCCESS if the packet was taken */
+static int encrypt_packet_offload(buffer *writebuf, unsigned int len) {
 
-	/* Update counts */
-	ses.transseq++;
+	if (ses.transpipe == NULL || cryptpipe_pending(ses.transpipe) == 0) {
+		if (writebuf->len < CRYPTO_THREAD_MIN_PACKET
+				|| ses.keys->trans.algo_crypt == &dropbear_nocipher) {
+			return DROPBEAR_FAILURE;
+		}
+		if (ses.transpipe == NULL) {
+			ses.transpipe = cryptpipe_new(encrypt_packet_contents,
+					&ses.keys->trans);
+			if (ses.transpipe == NULL) {
+				return DROPBEAR_FAILURE;
+			}
+		}
+	}
 
-	now = monotonic_now();
-	ses.last_packet_time_any_sent = now;
-	/* idle timeout shouldn't be affected by responses to keepalives.
-	send_msg_keepalive() itself also does tricks with 
-	ses.last_packet_idle_time - read that if modifying this code */
-	if (packet_type != SSH_MSG_REQUEST_FAILURE
-		&& packet_type != SSH_MSG_UNIMPLEMENTED
-		&& packet_type != SSH_MSG_IGNORE) {
-		ses.last_packet_time_idle = now;
+	while (cryptpipe_submit(ses.transpipe, writebuf, ses.transseq)
+			== DROPBEAR_FAILURE) {
+		/* the ring is full */
+		cryptpipe_wait(ses.transpipe);
+		packet_crypt_collect();
+	}
+
+	/* counted now, so the write queue limits include packets with the
+	 * thread. They are put on the queue by packet_crypt_collect() */
+	ses.writequeue_len += len;
+	ses.transqueued += len;
+	return DROPBEAR_SUCCESS;
+}
+
+/* Moves packets the transmit crypto thread has finished onto the write
+ * queue, in order */
+void packet_crypt_collect() {
+
+	buffer *writebuf = NULL;
+	const char *err = NULL;
 
+	if (ses.transpipe == NULL) {
+		return;
+	}
+	while ((writebuf = cryptpipe_collect(ses.transpipe, &err)) != NULL) {
+		if (err) {
+			dropbear_exit("%s", err);
+		}
+		enqueue(&ses.writequeue, (void*)writebuf);
 	}
+}
 
-	TRACE2(("leave encrypt_packet()"))
+/* Called by switch_keys() before the transmit keys are replaced, the
+ * thread finishes with the old ones first */
+void packet_crypt_switch_trans() {
+	if (ses.transpipe) {
+		cryptpipe_drain(ses.transpipe);
+		packet_crypt_collect();
+	}
+}
+
+/* Called by switch_keys() before the receive keys are replaced. Nothing
+ * after SSH_MSG_NEWKEYS can have been read with the old keys, unless the
+ * peer sent an oversized one */
+void packet_crypt_switch_recv() {
+	if (ses.recvpipe
+			&& (cryptpipe_pending(ses.recvpipe) > 0 || ses.readbuf != NULL)) {
+		dropbear_exit("Bad newkeys packet");
+	}
+	if (ses.recvframe) {
+		m_burn(ses.recvframe, sizeof(*ses.recvframe));
+		m_free(ses.recvframe);
+		ses.recvframe = NULL;
+	}
+}
+
+/* Stops the crypto threads, before the session's keys and buffers are
+ * freed */
+void packet_crypt_cleanup() {
+	cryptpipe_free(ses.transpipe);
+	ses.transpipe = NULL;
+	cryptpipe_free(ses.recvpipe);
+	ses.recvpipe = NULL;
+	if (ses.recvframe) {
+		m_burn(ses.recvframe, sizeof(*ses.recvframe));
+		m_free(ses.recvframe);
+		ses.recvframe = NULL;
+	}
+}
+#endif /* DROPBEAR_CRYPTO_THREADS */
+
+/* Allocate an empty writepayload, reserving room for the packet header
+ * and trailer so encrypt_packet() can use it in place */
+buffer* writepayload_new() {
+	buffer *buf = pktbuf_new(WRITEPAYLOAD_ALLOC);
+	buf_reserve(buf, PACKET_PAYLOAD_OFF, writepayload_tailroom());
+	return buf;
+}
+
+/* The pool may round the writepayload allocation up, all of the
+ * excess goes after the contents */
+static unsigned int writepayload_tailroom() {
+	return pktbuf_size(WRITEPAYLOAD_ALLOC)
+		- PACKET_PAYLOAD_OFF - TRANS_MAX_PAYLOAD_LEN;
 }
 
 void writebuf_enqueue(buffer * writebuf) {
@@ -677,45 +1149,63 @@ void writebuf_enqueue(buffer * writebuf) {
 	buf_setpos(writebuf, 0);
 	enqueue(&ses.writequeue, (void*)writebuf);
 	ses.writequeue_len += writebuf->len;
+	ses.transqueued += writebuf->len;
 }
 
 
 /* Create the packet mac, and append H(seqno|clearbuf) to the output */
 /* output_mac must have ses.keys->trans.algo_mac->hashsize bytes. */
-static void make_mac(unsigned int seqno, const struct key_context_directional * key_state,
+static void make_mac(unsigned int seqno, struct key_context_directional * key_state,
 		buffer * clear_buf, unsigned int clear_len, 
 		unsigned char *output_mac) {
 	unsigned char seqbuf[4];
-	unsigned long bufsize;
-	hmac_state hmac;
+	unsigned char digest[MAXBLOCKSIZE];
+	const struct ltc_hash_descriptor *hash_desc = key_state->algo_mac->hash_desc;
+	hash_state hs;
+
+#if DROPBEAR_UMAC
+	if (key_state->algo_mac->umac) {
+		/* the sequence number is the nonce rather than part of the
+		 * message */
+		buf_setpos(clear_buf, 0);
+		dropbear_umac(&key_state->umac, seqno,
+				buf_getptr(clear_buf, clear_len), clear_len, output_mac);
+		TRACE2(("leave writemac"))
+		return;
+	}
+#endif
 
 	if (key_state->algo_mac->hashsize > 0) {
-		/* calculate the mac */
-		if (hmac_init(&hmac, 
-					key_state->hash_index,
-					key_state->mackey,
-					key_state->algo_mac->keysize) != CRYPT_OK) {
-			dropbear_exit("HMAC error");
-		}
+		/* calculate the mac, starting from the keyed inner state
+		 * precomputed in gen_new_keys() */
+		memcpy(&hs, &key_state->mac_inner, sizeof(hs));
 	
 		/* sequence number */
 		STORE32H(seqno, seqbuf);
-		if (hmac_process(&hmac, seqbuf, 4) != CRYPT_OK) {
+		if (hash_desc->process(&hs, seqbuf, 4) != CRYPT_OK) {
 			dropbear_exit("HMAC error");
 		}
 	
 		/* the actual contents */
 		buf_setpos(clear_buf, 0);
-		if (hmac_process(&hmac, 
+		if (hash_desc->process(&hs, 
 					buf_getptr(clear_buf, clear_len),
 					clear_len) != CRYPT_OK) {
 			dropbear_exit("HMAC error");
 		}
-	
-		bufsize = MAX_MAC_LEN;
-		if (hmac_done(&hmac, output_mac, &bufsize) != CRYPT_OK) {
+		if (hash_desc->done(&hs, digest) != CRYPT_OK) {
+			dropbear_exit("HMAC error");
+		}
+
+		/* and the outer hash */
+		memcpy(&hs, &key_state->mac_outer, sizeof(hs));
+		if (hash_desc->process(&hs, digest, hash_desc->hashsize) != CRYPT_OK
+			|| hash_desc->done(&hs, digest) != CRYPT_OK) {
 			dropbear_exit("HMAC error");
 		}
+		memcpy(output_mac, digest, key_state->algo_mac->hashsize);
+		m_burn(&hs, sizeof(hs));
+		m_burn(digest, sizeof(digest));
 	}
 	TRACE2(("leave writemac"))
 }
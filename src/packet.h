@@ -32,12 +32,23 @@
 
 void write_packet(void);
 void read_packet(void);
+int read_packet_pending(void);
+#if DROPBEAR_IO_URING
+void read_packet_submit(void);
+#endif
 void decrypt_packet(void);
 void encrypt_packet(void);
 
 void writebuf_enqueue(buffer * writebuf);
+#if DROPBEAR_CRYPTO_THREADS
+void packet_crypt_collect(void);
+void packet_crypt_switch_trans(void);
+void packet_crypt_switch_recv(void);
+void packet_crypt_cleanup(void);
+#endif
 
 void process_packet(void);
+void process_packet_batch(void);
 
 void maybe_flush_reply_queue(void);
 typedef struct PacketType {
@@ -45,9 +56,24 @@ typedef struct PacketType {
 	void (*handler)(void);
 } packettype;
 
+void set_packet_handlers(const packettype *types);
+
 #define PACKET_PADDING_OFF 4
 #define PACKET_PAYLOAD_OFF 5
 
 #define INIT_READBUF 128
 
+/* For exact details see http://www.zlib.net/zlib_tech.html
+ * 5 bytes per 16kB block, plus 6 bytes for the stream.
+ * We might allocate 5 unnecessary bytes here if it's an
+ * exact multiple. */
+#define ZLIB_COMPRESS_EXPANSION (((RECV_MAX_PAYLOAD_LEN/16384)+1)*5 + 6)
+
+/* Room after a writepayload for the padding and MAC, so it can be
+ * encrypted in place, see encrypt_packet(). The extra byte matches the
+ * sizing of copied packets */
+#define PACKET_TRAILER_ROOM (MAX(MIN_PACKET_LEN, MAX_IV_LEN) + 3 + MAX_MAC_LEN + 1)
+
+buffer* writepayload_new(void);
+
 #endif /* DROPBEAR_PACKET_H_ */
@@ -0,0 +1,132 @@
+/*
+ * Dropbear SSH
+ * 
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+/* A per-session pool of buffers for packets on the wire, so the packet
+ * layer doesn't go through malloc/free for every packet. Buffers handed
+ * out are not zeroed, callers must only read what they have written. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "session.h"
+#include "pktbuf.h"
+
+static const unsigned int pktbuf_sizes[PKTBUF_CLASSES] = {
+	PKTBUF_SMALL, PKTBUF_MEDIUM, PKTBUF_LARGE
+};
+
+static unsigned int pktbuf_class(unsigned int size) {
+	unsigned int i;
+
+	for (i = 0; i < PKTBUF_CLASSES; i++) {
+		if (size <= pktbuf_sizes[i]) {
+			break;
+		}
+	}
+	return i;
+}
+
+/* The size of the buffer pktbuf_new(size) returns */
+unsigned int pktbuf_size(unsigned int size) {
+	unsigned int i = pktbuf_class(size);
+
+	if (i == PKTBUF_CLASSES) {
+		return size;
+	}
+	return pktbuf_sizes[i];
+}
+
+/* Returns a buffer with at least size bytes, len and pos are zero */
+buffer* pktbuf_new(unsigned int size) {
+
+	struct pktbuf_pool *pool = &ses.pktpool;
+	buffer *buf = NULL;
+	unsigned int i;
+
+	i = pktbuf_class(size);
+	if (i == PKTBUF_CLASSES) {
+		pool->oversize++;
+		return buf_new(size);
+	}
+
+	if (pool->count[i] > 0) {
+		pool->hits++;
+		pool->count[i]--;
+		buf = pool->spare[i][pool->count[i]];
+		pool->spare[i][pool->count[i]] = NULL;
+		buf_setlen(buf, 0);
+	} else {
+		pool->misses++;
+		buf = buf_new_uninit(pktbuf_sizes[i]);
+	}
+	return buf;
+}
+
+/* Returns a packet buffer to the pool, or frees it if it doesn't match
+ * a size class or the pool is full. Pooled buffers have their used
+ * length burnt, they may hold decrypted payload */
+void pktbuf_free(buffer *buf) {
+
+	struct pktbuf_pool *pool = &ses.pktpool;
+	unsigned int i;
+
+	if (buf == NULL) {
+		return;
+	}
+
+	for (i = 0; i < PKTBUF_CLASSES; i++) {
+		if (buf->size == pktbuf_sizes[i]) {
+			break;
+		}
+	}
+
+	/* a buffer that still has room reserved (buf_reserve()) isn't
+	 * the whole allocation */
+	if (i == PKTBUF_CLASSES
+		|| pool->count[i] == PKTBUF_POOL_DEPTH
+		|| buf->data != (unsigned char*)buf + sizeof(buffer)) {
+		buf_free(buf);
+		return;
+	}
+
+	m_burn(buf->data, buf->len);
+	pool->spare[i][pool->count[i]] = buf;
+	pool->count[i]++;
+}
+
+void pktbuf_pool_cleanup() {
+
+	struct pktbuf_pool *pool = &ses.pktpool;
+	unsigned int i;
+
+	TRACE(("pktbuf pool: %lu hits, %lu misses, %lu oversize",
+				pool->hits, pool->misses, pool->oversize))
+
+	for (i = 0; i < PKTBUF_CLASSES; i++) {
+		while (pool->count[i] > 0) {
+			pool->count[i]--;
+			buf_free(pool->spare[i][pool->count[i]]);
+			pool->spare[i][pool->count[i]] = NULL;
+		}
+	}
+}
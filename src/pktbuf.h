@@ -0,0 +1,55 @@
+/*
+ * Dropbear SSH
+ * 
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_PKTBUF_H_
+#define DROPBEAR_PKTBUF_H_
+
+#include "includes.h"
+#include "buffer.h"
+
+/* Size classes for packet buffers. Small fits control packets such as
+ * window adjusts and keepalives with encrypt_packet()'s padding and MAC
+ * allowance, large fits a full packet in either direction. */
+#define PKTBUF_SMALL 256
+#define PKTBUF_MEDIUM 2048
+#define PKTBUF_LARGE (MAX(RECV_MAX_PACKET_LEN, \
+		TRANS_MAX_PAYLOAD_LEN + PACKET_PAYLOAD_OFF + PACKET_TRAILER_ROOM \
+		+ ZLIB_COMPRESS_EXPANSION))
+#define PKTBUF_CLASSES 3
+
+struct pktbuf_pool {
+	buffer *spare[PKTBUF_CLASSES][PKTBUF_POOL_DEPTH];
+	unsigned int count[PKTBUF_CLASSES];
+	/* for tuning, printed with DEBUG_TRACE at session cleanup */
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long oversize;
+};
+
+buffer* pktbuf_new(unsigned int size);
+unsigned int pktbuf_size(unsigned int size);
+void pktbuf_free(buffer *buf);
+void pktbuf_pool_cleanup(void);
+
+#endif /* DROPBEAR_PKTBUF_H_ */
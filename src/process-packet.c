@@ -34,6 +34,7 @@
 #include "service.h"
 #include "auth.h"
 #include "channel.h"
+#include "pktbuf.h"
 
 #define MAX_UNAUTH_PACKET_TYPE SSH_MSG_USERAUTH_PK_OK
 
@@ -43,7 +44,6 @@ static void recv_unimplemented(void);
 void process_packet() {
 
 	unsigned char type;
-	unsigned int i;
 	time_t now;
 
 	TRACE2(("enter process_packet"))
@@ -136,16 +136,9 @@ void process_packet() {
 		dropbear_exit("Received message %d before userauth", type);
 	}
 
-	for (i = 0; ; i++) {
-		if (ses.packettypes[i].type == 0) {
-			/* end of list */
-			break;
-		}
-
-		if (ses.packettypes[i].type == type) {
-			ses.packettypes[i].handler();
-			goto out;
-		}
+	if (ses.packethandlers[type] != NULL) {
+		ses.packethandlers[type]();
+		goto out;
 	}
 
 	
@@ -155,13 +148,55 @@ void process_packet() {
 
 out:
 	ses.lastpacket = type;
-	buf_free(ses.payload);
+	pktbuf_free(ses.payload);
 	ses.payload = NULL;
 
 	TRACE2(("leave process_packet"))
 }
 
+/* Process the decrypted packet, then any further packets that are already
+ * complete in the read-ahead ring. Stops when the per-wakeup budget of
+ * packets or payload bytes is used up, or when the replies have filled
+ * the write queue, so that channels and the socket's outgoing data get
+ * serviced. Remaining packets are picked up on the next loop iteration.
+ * Only connection protocol packets are batched, the KEX and auth state
+ * machines in the loophandlers rely on ses.lastpacket after each packet. */
+void process_packet_batch() {
+
+	unsigned int count = 0, bytes = 0;
+
+	while (ses.payload != NULL) {
+		bytes += ses.payload->len;
+		process_packet();
+		count++;
+
+		if (!ses.dataallowed
+			|| !ses.authstate.authdone
+			|| ses.lastpacket < SSH_MSG_GLOBAL_REQUEST
+			|| ses.lastpacket == SSH_MSG_CHANNEL_CLOSE
+			|| count >= RECV_BATCH_PACKETS
+			|| bytes >= RECV_BATCH_BYTES
+			|| ses.writequeue_len > 2*TRANS_MAX_PAYLOAD_LEN
+			|| ses.sock_in == -1
+			|| !read_packet_pending()) {
+			break;
+		}
+		read_packet();
+	}
+	TRACE2(("process_packet_batch: %u packets, %u bytes", count, bytes))
+}
+
+/* Fill the session's direct packet handler table from a list terminated
+ * by a zero type */
+void set_packet_handlers(const packettype *types) {
 
+	unsigned int i;
+
+	memset(ses.packethandlers, 0x0, sizeof(ses.packethandlers));
+	for (i = 0; types[i].type != 0; i++) {
+		ses.packethandlers[types[i].type] = types[i].handler;
+	}
+}
 
 /* This must be called directly after receiving the unimplemented packet.
  * Isn't the most clean implementation, it relies on packet processing
@@ -31,6 +31,8 @@ void initqueue(struct Queue* queue) {
 	queue->head = NULL;
 	queue->tail = NULL;
 	queue->count = 0;
+	queue->spare = NULL;
+	queue->sparecount = 0;
 }
 
 int isempty(const struct Queue* queue) {
@@ -55,7 +57,13 @@ void* dequeue(struct Queue* queue) {
 		TRACE(("empty queue dequeing"))
 	}
 
-	m_free(oldhead);
+	if (queue->sparecount < QUEUE_SPARE_LINKS) {
+		oldhead->link = queue->spare;
+		queue->spare = oldhead;
+		queue->sparecount++;
+	} else {
+		m_free(oldhead);
+	}
 	queue->count--;
 	return ret;
 }
@@ -70,7 +78,13 @@ void enqueue(struct Queue* queue, void* item) {
 
 	struct Link* newlink;
 
-	newlink = m_malloc(sizeof(struct Link));
+	if (queue->spare != NULL) {
+		newlink = queue->spare;
+		queue->spare = newlink->link;
+		queue->sparecount--;
+	} else {
+		newlink = m_malloc(sizeof(struct Link));
+	}
 
 	newlink->item = item;
 	newlink->link = NULL;
@@ -85,3 +99,16 @@ void enqueue(struct Queue* queue, void* item) {
 	}
 	queue->count++;
 }
+
+/* free the spare links kept by dequeue() */
+void freequeuelinks(struct Queue* queue) {
+
+	struct Link* l;
+
+	while (queue->spare != NULL) {
+		l = queue->spare;
+		queue->spare = l->link;
+		m_free(l);
+	}
+	queue->sparecount = 0;
+}
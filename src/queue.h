@@ -38,6 +38,9 @@ struct Queue {
 	struct Link* tail;
 	unsigned int count;
 
+	struct Link* spare; /* freelist of unused links */
+	unsigned int sparecount;
+
 };
 
 void initqueue(struct Queue* queue);
@@ -45,5 +48,6 @@ int isempty(const struct Queue* queue);
 void* dequeue(struct Queue* queue);
 void *examine(const struct Queue* queue);
 void enqueue(struct Queue* queue, void* item);
+void freequeuelinks(struct Queue* queue);
 
 #endif
@@ -45,6 +45,7 @@
 
 static void rsa_pad_em(const dropbear_rsa_key * key,
 	const buffer *data_buf, mp_int * rsa_em, enum signature_type sigtype);
+static void rsa_exptmod_d(const dropbear_rsa_key *key, mp_int *in, mp_int *out);
 
 /* Load a public rsa key from a buffer, initialising the values.
  * The key will have the same format as buf_put_rsa_key.
@@ -59,6 +60,9 @@ int buf_get_rsa_pub_key(buffer* buf, dropbear_rsa_key *key) {
 	key->d = NULL;
 	key->p = NULL;
 	key->q = NULL;
+	key->dp = NULL;
+	key->dq = NULL;
+	key->qinv = NULL;
 
 	buf_incrpos(buf, 4+SSH_SIGNKEY_RSA_LEN); /* int + "ssh-rsa" */
 
@@ -128,10 +132,13 @@ int buf_get_rsa_priv_key(buffer* buf, dropbear_rsa_key *key) {
 		}
 	}
 
+	rsa_precompute_crt(key);
+
 	ret = DROPBEAR_SUCCESS;
 out:
 	if (ret == DROPBEAR_FAILURE) {
-		m_mp_free_multi(&key->d, &key->p, &key->q, NULL);
+		m_mp_free_multi(&key->d, &key->p, &key->q,
+			&key->dp, &key->dq, &key->qinv, NULL);
 	}
 	TRACE(("leave buf_get_rsa_priv_key"))
 	return ret;
@@ -147,11 +154,51 @@ void rsa_key_free(dropbear_rsa_key *key) {
 		TRACE2(("leave rsa_key_free: key == NULL"))
 		return;
 	}
-	m_mp_free_multi(&key->d, &key->e, &key->p, &key->q, &key->n, NULL);
+	m_mp_free_multi(&key->d, &key->e, &key->p, &key->q, &key->n,
+		&key->dp, &key->dq, &key->qinv, NULL);
 	m_free(key);
 	TRACE2(("leave rsa_key_free"))
 }
 
+/* Sets up the CRT values used for signing, once p, q and d are loaded.
+ * Keys without p and q, or where they don't match n, are left to sign
+ * with d over the whole modulus */
+void rsa_precompute_crt(dropbear_rsa_key *key) {
+	DEF_MP_INT(pq);
+
+	TRACE(("enter rsa_precompute_crt"))
+
+	m_mp_free_multi(&key->dp, &key->dq, &key->qinv, NULL);
+	if (!(key->p && key->q && key->d)) {
+		TRACE(("leave rsa_precompute_crt: no p and q"))
+		return;
+	}
+
+	m_mp_init(&pq);
+	if (mp_mul(key->p, key->q, &pq) != MP_OKAY) {
+		dropbear_exit("RSA error");
+	}
+	if (mp_cmp(&pq, key->n) != MP_EQ) {
+		mp_clear(&pq);
+		TRACE(("leave rsa_precompute_crt: pq != n"))
+		return;
+	}
+
+	m_mp_alloc_init_multi(&key->dp, &key->dq, &key->qinv, NULL);
+	/* pq is used for p-1 then q-1 */
+	if (mp_sub_d(key->p, 1, &pq) != MP_OKAY
+		|| mp_mod(key->d, &pq, key->dp) != MP_OKAY
+		|| mp_sub_d(key->q, 1, &pq) != MP_OKAY
+		|| mp_mod(key->d, &pq, key->dq) != MP_OKAY
+		|| mp_invmod(key->q, key->p, key->qinv) != MP_OKAY) {
+		/* q has no inverse if p and q aren't coprime */
+		m_mp_free_multi(&key->dp, &key->dq, &key->qinv, NULL);
+	}
+	mp_clear(&pq);
+
+	TRACE(("leave rsa_precompute_crt"))
+}
+
 /* Put the public rsa key into the buffer in the required format:
  *
  * string	"ssh-rsa"
@@ -259,6 +306,7 @@ void buf_put_rsa_sign(buffer* buf, const dropbear_rsa_key *key,
 	unsigned int i;
 	size_t written;
 	DEF_MP_INT(rsa_s);
+	DEF_MP_INT(rsa_em);
 	DEF_MP_INT(rsa_tmp1);
 	DEF_MP_INT(rsa_tmp2);
 	DEF_MP_INT(rsa_tmp3);
@@ -266,9 +314,9 @@ void buf_put_rsa_sign(buffer* buf, const dropbear_rsa_key *key,
 	TRACE(("enter buf_put_rsa_sign"))
 	dropbear_assert(key != NULL);
 
-	m_mp_init_multi(&rsa_s, &rsa_tmp1, &rsa_tmp2, &rsa_tmp3, NULL);
+	m_mp_init_multi(&rsa_s, &rsa_em, &rsa_tmp1, &rsa_tmp2, &rsa_tmp3, NULL);
 
-	rsa_pad_em(key, data_buf, &rsa_tmp1, sigtype);
+	rsa_pad_em(key, data_buf, &rsa_em, sigtype);
 
 	/* the actual signing of the padded data */
 
@@ -280,7 +328,6 @@ void buf_put_rsa_sign(buffer* buf, const dropbear_rsa_key *key,
 	/* rsa_tmp2 is r */
 	gen_random_mpint(key->n, &rsa_tmp2);
 
-	/* rsa_tmp1 is em */
 	/* em' = em * r^e mod n */
 
 	/* rsa_s used as a temp var*/
@@ -290,15 +337,13 @@ void buf_put_rsa_sign(buffer* buf, const dropbear_rsa_key *key,
 	if (mp_invmod(&rsa_tmp2, key->n, &rsa_tmp3) != MP_OKAY) {
 		dropbear_exit("RSA error");
 	}
-	if (mp_mulmod(&rsa_tmp1, &rsa_s, key->n, &rsa_tmp2) != MP_OKAY) {
+	if (mp_mulmod(&rsa_em, &rsa_s, key->n, &rsa_tmp2) != MP_OKAY) {
 		dropbear_exit("RSA error");
 	}
 
 	/* rsa_tmp2 is em' */
 	/* s' = (em')^d mod n */
-	if (mp_exptmod(&rsa_tmp2, key->d, key->n, &rsa_tmp1) != MP_OKAY) {
-		dropbear_exit("RSA error");
-	}
+	rsa_exptmod_d(key, &rsa_tmp2, &rsa_tmp1);
 
 	/* rsa_tmp1 is s' */
 	/* rsa_tmp3 is r^(-1) mod n */
@@ -310,14 +355,21 @@ void buf_put_rsa_sign(buffer* buf, const dropbear_rsa_key *key,
 #else
 
 	/* s = em^d mod n */
-	/* rsa_tmp1 is em */
-	if (mp_exptmod(&rsa_tmp1, key->d, key->n, &rsa_s) != MP_OKAY) {
-		dropbear_exit("RSA error");
-	}
+	rsa_exptmod_d(key, &rsa_em, &rsa_s);
 
 #endif /* DROPBEAR_RSA_BLINDING */
 
-	mp_clear_multi(&rsa_tmp1, &rsa_tmp2, &rsa_tmp3, NULL);
+	/* A fault while signing, particularly in one half of the CRT, could
+	 * give a signature that reveals the key. Check s^e = em before it's
+	 * sent */
+	if (mp_exptmod(&rsa_s, key->e, key->n, &rsa_tmp1) != MP_OKAY) {
+		dropbear_exit("RSA error");
+	}
+	if (mp_cmp(&rsa_tmp1, &rsa_em) != MP_EQ) {
+		dropbear_exit("RSA signature check failed");
+	}
+
+	mp_clear_multi(&rsa_em, &rsa_tmp1, &rsa_tmp2, &rsa_tmp3, NULL);
 	
 	/* create the signature to return */
 	name = signature_name_from_type(sigtype, &namelen);
@@ -350,6 +402,41 @@ void buf_put_rsa_sign(buffer* buf, const dropbear_rsa_key *key,
 	TRACE(("leave buf_put_rsa_sign"))
 }
 
+/* out = in^d mod n. With the CRT values this is two exponentiations
+ * half the size, mod p and mod q, combined with Garner's formula */
+static void rsa_exptmod_d(const dropbear_rsa_key *key, mp_int *in, mp_int *out) {
+	DEF_MP_INT(mp);
+	DEF_MP_INT(mq);
+	DEF_MP_INT(h);
+
+	if (key->dp == NULL) {
+		if (mp_exptmod(in, key->d, key->n, out) != MP_OKAY) {
+			dropbear_exit("RSA error");
+		}
+		return;
+	}
+
+	m_mp_init_multi(&mp, &mq, &h, NULL);
+
+	/* mp = in^dp mod p, mq = in^dq mod q */
+	if (mp_mod(in, key->p, &h) != MP_OKAY
+		|| mp_exptmod(&h, key->dp, key->p, &mp) != MP_OKAY
+		|| mp_mod(in, key->q, &h) != MP_OKAY
+		|| mp_exptmod(&h, key->dq, key->q, &mq) != MP_OKAY) {
+		dropbear_exit("RSA error");
+	}
+
+	/* h = qinv * (mp - mq) mod p, out = mq + h*q */
+	if (mp_submod(&mp, &mq, key->p, &h) != MP_OKAY
+		|| mp_mulmod(&h, key->qinv, key->p, &h) != MP_OKAY
+		|| mp_mul(&h, key->q, out) != MP_OKAY
+		|| mp_add(out, &mq, out) != MP_OKAY) {
+		dropbear_exit("RSA error");
+	}
+
+	mp_clear_multi(&mp, &mq, &h, NULL);
+}
+
 /* Creates the message value as expected by PKCS, 
    see rfc8017 section 9.2 */
 static void rsa_pad_em(const dropbear_rsa_key * key,
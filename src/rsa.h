@@ -39,6 +39,11 @@ typedef struct dropbear_RSA_Key {
 	mp_int* d;
 	mp_int* p;
 	mp_int* q;
+	/* CRT values d mod (p-1), d mod (q-1) and q^-1 mod p, set by
+	 * rsa_precompute_crt(). NULL for keys without p and q */
+	mp_int* dp;
+	mp_int* dq;
+	mp_int* qinv;
 
 } dropbear_rsa_key;
 
@@ -53,6 +58,7 @@ int buf_get_rsa_priv_key(buffer* buf, dropbear_rsa_key *key);
 void buf_put_rsa_pub_key(buffer* buf, const dropbear_rsa_key *key);
 void buf_put_rsa_priv_key(buffer* buf, const dropbear_rsa_key *key);
 void rsa_key_free(dropbear_rsa_key *key);
+void rsa_precompute_crt(dropbear_rsa_key *key);
 
 #endif /* DROPBEAR_RSA */
 
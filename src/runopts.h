@@ -137,6 +137,13 @@ typedef struct svr_runopts {
 
 	int pass_on_env;
 
+#if DROPBEAR_SVR_WORKER_POOL
+	/* number of idle pre-forked workers to keep, 0 disables the pool */
+	unsigned int worker_pool;
+	/* maximum number of workers started per pass of the listener loop */
+	unsigned int worker_refill;
+#endif
+
 } svr_runopts;
 
 extern svr_runopts svr_opts;
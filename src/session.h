@@ -32,6 +32,7 @@
 #include "auth.h"
 #include "channel.h"
 #include "queue.h"
+#include "circbuffer.h"
 #include "listener.h"
 #include "packet.h"
 #include "tcpfwd.h"
@@ -42,7 +43,10 @@
 #include "pubkeyapi.h"
 #endif
 #include "gcm.h"
+#include "cryptpipe.h"
 #include "chachapoly.h"
+#include "umac.h"
+#include "pktbuf.h"
 
 void common_session_init(int sock_in, int sock_out);
 void session_loop(void(*loophandler)(void)) ATTRIB_NORETURN;
@@ -74,7 +78,6 @@ struct key_context_directional {
 	const struct dropbear_cipher *algo_crypt;
 	const struct dropbear_cipher_mode *crypt_mode;
 	const struct dropbear_hash *algo_mac;
-	int hash_index; /* lookup for libtomcrypt */
 	int algo_comp; /* compression */
 #ifndef DISABLE_ZLIB
 	z_streamp zstream;
@@ -95,6 +98,13 @@ struct key_context_directional {
 #endif
 	} cipher_state;
 	unsigned char mackey[MAX_MAC_LEN];
+	/* HMAC hash states after the keyed ipad and opad blocks */
+	hash_state mac_inner;
+	hash_state mac_outer;
+#if DROPBEAR_UMAC
+	/* UMAC subkeys, used instead of the HMAC states for umac-* */
+	dropbear_umac_state umac;
+#endif
 	int valid;
 };
 
@@ -144,6 +154,23 @@ struct sshsession {
 							 buffer with the packet to send. */
 	struct Queue writequeue; /* A queue of encrypted packets to send */
 	unsigned int writequeue_len; /* Number of bytes pending to send in writequeue */
+	unsigned int transqueued; /* Bytes ever added to writequeue, wraps */
+	circbuffer *readahead; /* Raw bytes from the wire not yet taken into
+							  readbuf, filled with one large read() so several
+							  packets can be framed per syscall */
+#if DROPBEAR_IO_URING
+	/* Socket reads and writes are submitted through dbpoll, see packet.c */
+	int sockio_async;
+	int readahead_bufindex; /* the read-ahead ring's registered buffer, or -1 */
+	int read_inflight;
+	int write_inflight;
+	/* results for read_packet() and write_packet() to act on, errors
+	are errno values */
+	int read_eof;
+	int read_error;
+	int write_eof;
+	int write_error;
+#endif
 	buffer *readbuf; /* From the wire, decrypted in-place */
 	buffer *payload; /* Post-decompression, the actual SSH packet. 
 						May have extra data at the beginning, will be
@@ -151,10 +178,21 @@ struct sshsession {
 						that, see payload_beginning */
 	unsigned int payload_beginning;
 	unsigned int transseq, recvseq; /* Sequence IDs */
+#if DROPBEAR_CRYPTO_THREADS
+	/* Packets being encrypted or decrypted by worker threads, see packet.c.
+	recvseq only counts packets collected from recvpipe */
+	struct cryptpipe *transpipe;
+	struct cryptpipe *recvpipe;
+	/* copy of the receive keys for reading AEAD packet lengths while
+	recvpipe has packets */
+	struct key_context_directional *recvframe;
+#endif
+	struct pktbuf_pool pktpool; /* Spare packet buffers, see pktbuf.c */
 
 	/* Packet-handling flags */
-	const packettype * packettypes; /* Packet handler mappings for this
-										session, see process-packet.c */
+	void (*packethandlers[256])(void); /* Packet handlers for this session
+										  indexed by type, filled from a
+										  packettype list, see process-packet.c */
 
 	unsigned dataallowed : 1; /* whether we can send data packets or we are in
 								 the middle of a KEX or something */
@@ -218,6 +256,31 @@ struct sshsession {
 	struct Channel ** channels; /* these pointers may be null */
 	unsigned int chansize; /* the number of Channel*s allocated for channels */
 	unsigned int chancount; /* the number of Channel*s in use */
+	/* channels which need their fd interest updated by setchannelfds(),
+	as indexes into channels. chandirty[] flags which are listed */
+	unsigned int *chandirtylist;
+	unsigned char *chandirty;
+	unsigned int chandirtycount;
+	/* channels with data waiting to be read, per class, see channelio() */
+	struct Channel *chanschedhead[CHAN_SCHED_CLASSES];
+	struct Channel *chanschedtail[CHAN_SCHED_CLASSES];
+	/* ring of bulk channel data on the write queue, oldest first, and
+	its total */
+	struct ChanQueued *chanqueued;
+	unsigned int chanqueuedsize, chanqueuedhead, chanqueuedcount;
+	unsigned int chanbulkqueued;
+	/* whether interactive channels' fds are registered for reads, see
+	setchannelfds() */
+	int chaninteractive;
+	/* channels with a window grown past opts.recv_window, and how far
+	past it in total, see RECV_WINDOW_TUNED_MAX */
+	unsigned int chantuned;
+	unsigned int chantunedbytes;
+	time_t chantunecheck;
+	/* the session socket's round trip time in microseconds, refreshed
+	each second */
+	unsigned int sock_rtt;
+	time_t sock_rtt_time;
 	const struct ChanType **chantypes; /* The valid channel types */
 
 	/* TCP priority level for the main "port 22" tcp socket */
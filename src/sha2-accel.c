@@ -0,0 +1,477 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+/* SHA-256 and SHA-512 compression using x86-64 extensions, installed
+ * behind libtomcrypt's sha256_desc and sha512_desc so HMAC, the exchange
+ * hash and signatures all pick them up. SHA-256 uses the SHA extensions
+ * where the CPU has them. The AVX2 versions compute the message schedule
+ * four words at a time and run unrolled scalar rounds with BMI2 rotates. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "cpufeatures.h"
+#include "sha2-accel.h"
+
+#if DROPBEAR_SHA2_ACCEL
+
+#include <immintrin.h>
+
+#define SHANI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#define AVX2_TARGET __attribute__((target("avx2,bmi2")))
+#define SHA2_INLINE inline __attribute__((always_inline))
+
+#define SHA2_CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define SHA2_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+/* One round, with the caller rotating the variable names */
+#define SHA2_RND(a, b, c, d, e, f, g, h, wk, S0, S1) do { \
+	t0 = (h) + S1(e) + SHA2_CH(e, f, g) + (wk); \
+	t1 = S0(a) + SHA2_MAJ(a, b, c); \
+	(d) += t0; \
+	(h) = t0 + t1; \
+} while (0)
+
+#define SHA2_RND8(wk, i, S0, S1) do { \
+	SHA2_RND(a, b, c, d, e, f, g, h, (wk)[(i)], S0, S1); \
+	SHA2_RND(h, a, b, c, d, e, f, g, (wk)[(i) + 1], S0, S1); \
+	SHA2_RND(g, h, a, b, c, d, e, f, (wk)[(i) + 2], S0, S1); \
+	SHA2_RND(f, g, h, a, b, c, d, e, (wk)[(i) + 3], S0, S1); \
+	SHA2_RND(e, f, g, h, a, b, c, d, (wk)[(i) + 4], S0, S1); \
+	SHA2_RND(d, e, f, g, h, a, b, c, (wk)[(i) + 5], S0, S1); \
+	SHA2_RND(c, d, e, f, g, h, a, b, (wk)[(i) + 6], S0, S1); \
+	SHA2_RND(b, c, d, e, f, g, h, a, (wk)[(i) + 7], S0, S1); \
+} while (0)
+
+#define SHA2_LOAD_STATE() do { \
+	a = state[0]; b = state[1]; c = state[2]; d = state[3]; \
+	e = state[4]; f = state[5]; g = state[6]; h = state[7]; \
+} while (0)
+
+#define SHA2_ADD_STATE() do { \
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d; \
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h; \
+} while (0)
+
+#if DROPBEAR_SHA256
+
+static const ulong32 sha256_k[64] __attribute__((aligned(16))) = {
+	0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL, 0x3956c25bUL,
+	0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL, 0xd807aa98UL, 0x12835b01UL,
+	0x243185beUL, 0x550c7dc3UL, 0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL,
+	0xc19bf174UL, 0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
+	0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL, 0x983e5152UL,
+	0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL, 0xc6e00bf3UL, 0xd5a79147UL,
+	0x06ca6351UL, 0x14292967UL, 0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL,
+	0x53380d13UL, 0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+	0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL, 0xd192e819UL,
+	0xd6990624UL, 0xf40e3585UL, 0x106aa070UL, 0x19a4c116UL, 0x1e376c08UL,
+	0x2748774cUL, 0x34b0bcb5UL, 0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL,
+	0x682e6ff3UL, 0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
+	0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL
+};
+
+#define SHA256_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256_S0(x) (SHA256_ROR(x, 2) ^ SHA256_ROR(x, 13) ^ SHA256_ROR(x, 22))
+#define SHA256_S1(x) (SHA256_ROR(x, 6) ^ SHA256_ROR(x, 11) ^ SHA256_ROR(x, 25))
+
+/* Four rounds with the SHA extensions. wprev is advanced with msg1 and
+ * wnext finished with msg2 while the rounds run, as in Intel's reference
+ * code. */
+#define SHANI_QUAD(q, wq, wprev, wnext) do { \
+	msg = _mm_add_epi32(wq, _mm_load_si128((const __m128i*)&sha256_k[4 * (q)])); \
+	st1 = _mm_sha256rnds2_epu32(st1, st0, msg); \
+	if ((q) >= 3 && (q) <= 14) { \
+		wnext = _mm_add_epi32(wnext, _mm_alignr_epi8(wq, wprev, 4)); \
+		wnext = _mm_sha256msg2_epu32(wnext, wq); \
+	} \
+	msg = _mm_shuffle_epi32(msg, 0x0e); \
+	st0 = _mm_sha256rnds2_epu32(st0, st1, msg); \
+	if ((q) >= 1 && (q) <= 12) { \
+		wprev = _mm_sha256msg1_epu32(wprev, wq); \
+	} \
+} while (0)
+
+static SHANI_TARGET void sha256_shani(ulong32 *state, const unsigned char *in,
+		unsigned long blocks) {
+	const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+			4, 5, 6, 7, 0, 1, 2, 3);
+	__m128i st0, st1, save0, save1, msg, tmp;
+	__m128i m0, m1, m2, m3;
+
+	/* the instructions want ABEF and CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xb1);
+	st1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1b);
+	st0 = _mm_alignr_epi8(tmp, st1, 8);
+	st1 = _mm_blend_epi16(st1, tmp, 0xf0);
+
+	for (; blocks > 0; blocks--, in += 64) {
+		save0 = st0;
+		save1 = st1;
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 16)), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 32)), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 48)), bswap);
+
+		SHANI_QUAD(0, m0, m3, m1);
+		SHANI_QUAD(1, m1, m0, m2);
+		SHANI_QUAD(2, m2, m1, m3);
+		SHANI_QUAD(3, m3, m2, m0);
+		SHANI_QUAD(4, m0, m3, m1);
+		SHANI_QUAD(5, m1, m0, m2);
+		SHANI_QUAD(6, m2, m1, m3);
+		SHANI_QUAD(7, m3, m2, m0);
+		SHANI_QUAD(8, m0, m3, m1);
+		SHANI_QUAD(9, m1, m0, m2);
+		SHANI_QUAD(10, m2, m1, m3);
+		SHANI_QUAD(11, m3, m2, m0);
+		SHANI_QUAD(12, m0, m3, m1);
+		SHANI_QUAD(13, m1, m0, m2);
+		SHANI_QUAD(14, m2, m1, m3);
+		SHANI_QUAD(15, m3, m2, m0);
+
+		st0 = _mm_add_epi32(st0, save0);
+		st1 = _mm_add_epi32(st1, save1);
+	}
+
+	tmp = _mm_shuffle_epi32(st0, 0x1b);
+	st1 = _mm_shuffle_epi32(st1, 0xb1);
+	_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, st1, 0xf0));
+	_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(st1, tmp, 8));
+}
+
+static AVX2_TARGET SHA2_INLINE __m128i sha256_sigma0_x4(__m128i x) {
+	return _mm_xor_si128(_mm_xor_si128(
+			_mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 25)),
+			_mm_or_si128(_mm_srli_epi32(x, 18), _mm_slli_epi32(x, 14))),
+			_mm_srli_epi32(x, 3));
+}
+
+static AVX2_TARGET SHA2_INLINE __m128i sha256_sigma1_x4(__m128i x) {
+	return _mm_xor_si128(_mm_xor_si128(
+			_mm_or_si128(_mm_srli_epi32(x, 17), _mm_slli_epi32(x, 15)),
+			_mm_or_si128(_mm_srli_epi32(x, 19), _mm_slli_epi32(x, 13))),
+			_mm_srli_epi32(x, 10));
+}
+
+/* W[t..t+3] into x0, which holds W[t-16..t-13] with x1-x3 the following
+ * words. sigma1 needs W[t] and W[t+1] for the top two lanes, so it is
+ * done in two halves; lanes fed zeros come out unchanged. */
+#define SHA256_SCHED4(x0, x1, x2, x3, t) do { \
+	__m128i s_; \
+	s_ = _mm_add_epi32(_mm_add_epi32(x0, \
+			sha256_sigma0_x4(_mm_alignr_epi8(x1, x0, 4))), \
+			_mm_alignr_epi8(x3, x2, 4)); \
+	s_ = _mm_add_epi32(s_, sha256_sigma1_x4(_mm_srli_si128(x3, 8))); \
+	x0 = _mm_add_epi32(s_, sha256_sigma1_x4(_mm_slli_si128(s_, 8))); \
+	_mm_store_si128((__m128i*)&wk[(t)], _mm_add_epi32(x0, \
+			_mm_load_si128((const __m128i*)&sha256_k[(t)]))); \
+} while (0)
+
+static AVX2_TARGET void sha256_avx2(ulong32 *state, const unsigned char *in,
+		unsigned long blocks) {
+	const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+			4, 5, 6, 7, 0, 1, 2, 3);
+	ulong32 wk[64] __attribute__((aligned(16)));
+	ulong32 a, b, c, d, e, f, g, h, t0, t1;
+	__m128i x0, x1, x2, x3;
+	int t;
+
+	for (; blocks > 0; blocks--, in += 64) {
+		x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), bswap);
+		x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 16)), bswap);
+		x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 32)), bswap);
+		x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 48)), bswap);
+		_mm_store_si128((__m128i*)&wk[0], _mm_add_epi32(x0,
+				_mm_load_si128((const __m128i*)&sha256_k[0])));
+		_mm_store_si128((__m128i*)&wk[4], _mm_add_epi32(x1,
+				_mm_load_si128((const __m128i*)&sha256_k[4])));
+		_mm_store_si128((__m128i*)&wk[8], _mm_add_epi32(x2,
+				_mm_load_si128((const __m128i*)&sha256_k[8])));
+		_mm_store_si128((__m128i*)&wk[12], _mm_add_epi32(x3,
+				_mm_load_si128((const __m128i*)&sha256_k[12])));
+		for (t = 16; t < 64; t += 16) {
+			SHA256_SCHED4(x0, x1, x2, x3, t);
+			SHA256_SCHED4(x1, x2, x3, x0, t + 4);
+			SHA256_SCHED4(x2, x3, x0, x1, t + 8);
+			SHA256_SCHED4(x3, x0, x1, x2, t + 12);
+		}
+
+		SHA2_LOAD_STATE();
+		for (t = 0; t < 64; t += 8) {
+			SHA2_RND8(wk, t, SHA256_S0, SHA256_S1);
+		}
+		SHA2_ADD_STATE();
+	}
+}
+
+#endif /* DROPBEAR_SHA256 */
+
+#if DROPBEAR_SHA512
+
+static const ulong64 sha512_k[80] __attribute__((aligned(32))) = {
+	CONST64(0x428a2f98d728ae22), CONST64(0x7137449123ef65cd),
+	CONST64(0xb5c0fbcfec4d3b2f), CONST64(0xe9b5dba58189dbbc),
+	CONST64(0x3956c25bf348b538), CONST64(0x59f111f1b605d019),
+	CONST64(0x923f82a4af194f9b), CONST64(0xab1c5ed5da6d8118),
+	CONST64(0xd807aa98a3030242), CONST64(0x12835b0145706fbe),
+	CONST64(0x243185be4ee4b28c), CONST64(0x550c7dc3d5ffb4e2),
+	CONST64(0x72be5d74f27b896f), CONST64(0x80deb1fe3b1696b1),
+	CONST64(0x9bdc06a725c71235), CONST64(0xc19bf174cf692694),
+	CONST64(0xe49b69c19ef14ad2), CONST64(0xefbe4786384f25e3),
+	CONST64(0x0fc19dc68b8cd5b5), CONST64(0x240ca1cc77ac9c65),
+	CONST64(0x2de92c6f592b0275), CONST64(0x4a7484aa6ea6e483),
+	CONST64(0x5cb0a9dcbd41fbd4), CONST64(0x76f988da831153b5),
+	CONST64(0x983e5152ee66dfab), CONST64(0xa831c66d2db43210),
+	CONST64(0xb00327c898fb213f), CONST64(0xbf597fc7beef0ee4),
+	CONST64(0xc6e00bf33da88fc2), CONST64(0xd5a79147930aa725),
+	CONST64(0x06ca6351e003826f), CONST64(0x142929670a0e6e70),
+	CONST64(0x27b70a8546d22ffc), CONST64(0x2e1b21385c26c926),
+	CONST64(0x4d2c6dfc5ac42aed), CONST64(0x53380d139d95b3df),
+	CONST64(0x650a73548baf63de), CONST64(0x766a0abb3c77b2a8),
+	CONST64(0x81c2c92e47edaee6), CONST64(0x92722c851482353b),
+	CONST64(0xa2bfe8a14cf10364), CONST64(0xa81a664bbc423001),
+	CONST64(0xc24b8b70d0f89791), CONST64(0xc76c51a30654be30),
+	CONST64(0xd192e819d6ef5218), CONST64(0xd69906245565a910),
+	CONST64(0xf40e35855771202a), CONST64(0x106aa07032bbd1b8),
+	CONST64(0x19a4c116b8d2d0c8), CONST64(0x1e376c085141ab53),
+	CONST64(0x2748774cdf8eeb99), CONST64(0x34b0bcb5e19b48a8),
+	CONST64(0x391c0cb3c5c95a63), CONST64(0x4ed8aa4ae3418acb),
+	CONST64(0x5b9cca4f7763e373), CONST64(0x682e6ff3d6b2b8a3),
+	CONST64(0x748f82ee5defb2fc), CONST64(0x78a5636f43172f60),
+	CONST64(0x84c87814a1f0ab72), CONST64(0x8cc702081a6439ec),
+	CONST64(0x90befffa23631e28), CONST64(0xa4506cebde82bde9),
+	CONST64(0xbef9a3f7b2c67915), CONST64(0xc67178f2e372532b),
+	CONST64(0xca273eceea26619c), CONST64(0xd186b8c721c0c207),
+	CONST64(0xeada7dd6cde0eb1e), CONST64(0xf57d4f7fee6ed178),
+	CONST64(0x06f067aa72176fba), CONST64(0x0a637dc5a2c898a6),
+	CONST64(0x113f9804bef90dae), CONST64(0x1b710b35131c471b),
+	CONST64(0x28db77f523047d84), CONST64(0x32caab7b40c72493),
+	CONST64(0x3c9ebe0a15c9bebc), CONST64(0x431d67c49c100d4c),
+	CONST64(0x4cc5d4becb3e42b6), CONST64(0x597f299cfc657e2a),
+	CONST64(0x5fcb6fab3ad6faec), CONST64(0x6c44198c4a475817)
+};
+
+#define SHA512_ROR(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define SHA512_S0(x) (SHA512_ROR(x, 28) ^ SHA512_ROR(x, 34) ^ SHA512_ROR(x, 39))
+#define SHA512_S1(x) (SHA512_ROR(x, 14) ^ SHA512_ROR(x, 18) ^ SHA512_ROR(x, 41))
+
+static AVX2_TARGET SHA2_INLINE __m256i sha512_sigma0_x4(__m256i x) {
+	return _mm256_xor_si256(_mm256_xor_si256(
+			_mm256_or_si256(_mm256_srli_epi64(x, 1), _mm256_slli_epi64(x, 63)),
+			_mm256_or_si256(_mm256_srli_epi64(x, 8), _mm256_slli_epi64(x, 56))),
+			_mm256_srli_epi64(x, 7));
+}
+
+static AVX2_TARGET SHA2_INLINE __m256i sha512_sigma1_x4(__m256i x) {
+	return _mm256_xor_si256(_mm256_xor_si256(
+			_mm256_or_si256(_mm256_srli_epi64(x, 19), _mm256_slli_epi64(x, 45)),
+			_mm256_or_si256(_mm256_srli_epi64(x, 61), _mm256_slli_epi64(x, 3))),
+			_mm256_srli_epi64(x, 6));
+}
+
+/* As SHA256_SCHED4, AVX2 byte shifts stay within 128-bit lanes so the
+ * words straddling two registers are gathered with permute2x128 first */
+#define SHA512_SCHED4(x0, x1, x2, x3, t) do { \
+	__m256i s_; \
+	s_ = _mm256_add_epi64(_mm256_add_epi64(x0, sha512_sigma0_x4( \
+			_mm256_alignr_epi8(_mm256_permute2x128_si256(x0, x1, 0x21), x0, 8))), \
+			_mm256_alignr_epi8(_mm256_permute2x128_si256(x2, x3, 0x21), x2, 8)); \
+	s_ = _mm256_add_epi64(s_, \
+			sha512_sigma1_x4(_mm256_permute2x128_si256(x3, x3, 0x81))); \
+	x0 = _mm256_add_epi64(s_, \
+			sha512_sigma1_x4(_mm256_permute2x128_si256(s_, s_, 0x08))); \
+	_mm256_store_si256((__m256i*)&wk[(t)], _mm256_add_epi64(x0, \
+			_mm256_load_si256((const __m256i*)&sha512_k[(t)]))); \
+} while (0)
+
+static AVX2_TARGET void sha512_avx2(ulong64 *state, const unsigned char *in,
+		unsigned long blocks) {
+	const __m256i bswap = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+			0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+			0, 1, 2, 3, 4, 5, 6, 7);
+	ulong64 wk[80] __attribute__((aligned(32)));
+	ulong64 a, b, c, d, e, f, g, h, t0, t1;
+	__m256i x0, x1, x2, x3;
+	int t;
+
+	for (; blocks > 0; blocks--, in += 128) {
+		x0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)in), bswap);
+		x1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in + 32)), bswap);
+		x2 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in + 64)), bswap);
+		x3 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in + 96)), bswap);
+		_mm256_store_si256((__m256i*)&wk[0], _mm256_add_epi64(x0,
+				_mm256_load_si256((const __m256i*)&sha512_k[0])));
+		_mm256_store_si256((__m256i*)&wk[4], _mm256_add_epi64(x1,
+				_mm256_load_si256((const __m256i*)&sha512_k[4])));
+		_mm256_store_si256((__m256i*)&wk[8], _mm256_add_epi64(x2,
+				_mm256_load_si256((const __m256i*)&sha512_k[8])));
+		_mm256_store_si256((__m256i*)&wk[12], _mm256_add_epi64(x3,
+				_mm256_load_si256((const __m256i*)&sha512_k[12])));
+		for (t = 16; t < 80; t += 16) {
+			SHA512_SCHED4(x0, x1, x2, x3, t);
+			SHA512_SCHED4(x1, x2, x3, x0, t + 4);
+			SHA512_SCHED4(x2, x3, x0, x1, t + 8);
+			SHA512_SCHED4(x3, x0, x1, x2, t + 12);
+		}
+
+		SHA2_LOAD_STATE();
+		for (t = 0; t < 80; t += 8) {
+			SHA2_RND8(wk, t, SHA512_S0, SHA512_S1);
+		}
+		SHA2_ADD_STATE();
+	}
+	_mm256_zeroupper();
+}
+
+#endif /* DROPBEAR_SHA512 */
+
+/* Hash a message that covers a multi-block run, a partial block and both
+ * padding cases with whatever compression function is installed */
+static void sha2_accel_sample(const struct ltc_hash_descriptor *desc,
+		unsigned char *out) {
+	unsigned char msg[1000];
+	hash_state hs;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(msg); i++) {
+		msg[i] = (unsigned char)(i * 37 + (i >> 8));
+	}
+	desc->init(&hs);
+	desc->process(&hs, msg, 3);
+	desc->process(&hs, &msg[3], 700);
+	desc->process(&hs, &msg[703], 297);
+	desc->done(&hs, out);
+	/* 119 bytes needs a second block for the length on both hashes */
+	desc->init(&hs);
+	desc->process(&hs, msg, 119);
+	desc->done(&hs, &out[desc->hashsize]);
+}
+
+#if DROPBEAR_SHA256
+static int sha256_impl = DROPBEAR_SHA2_PORTABLE;
+
+int dropbear_sha256_use(int impl) {
+	unsigned int cpu = dropbear_cpu_features();
+
+	switch (impl) {
+		case DROPBEAR_SHA2_PORTABLE:
+			sha256_compress_hook = NULL;
+			break;
+		case DROPBEAR_SHA2_AVX2:
+			if ((cpu & (DROPBEAR_CPU_AVX2 | DROPBEAR_CPU_BMI2))
+					!= (DROPBEAR_CPU_AVX2 | DROPBEAR_CPU_BMI2)) {
+				return 0;
+			}
+			sha256_compress_hook = sha256_avx2;
+			break;
+		case DROPBEAR_SHA2_SHANI:
+			if ((cpu & (DROPBEAR_CPU_SHA | DROPBEAR_CPU_SSE41 | DROPBEAR_CPU_SSSE3))
+					!= (DROPBEAR_CPU_SHA | DROPBEAR_CPU_SSE41 | DROPBEAR_CPU_SSSE3)) {
+				return 0;
+			}
+			sha256_compress_hook = sha256_shani;
+			break;
+		default:
+			return 0;
+	}
+	sha256_impl = impl;
+	return 1;
+}
+#else
+int dropbear_sha256_use(int impl) {
+	return impl == DROPBEAR_SHA2_PORTABLE;
+}
+#endif /* DROPBEAR_SHA256 */
+
+#if DROPBEAR_SHA512
+static int sha512_impl = DROPBEAR_SHA2_PORTABLE;
+
+int dropbear_sha512_use(int impl) {
+	unsigned int cpu = dropbear_cpu_features();
+
+	switch (impl) {
+		case DROPBEAR_SHA2_PORTABLE:
+			sha512_compress_hook = NULL;
+			break;
+		case DROPBEAR_SHA2_AVX2:
+			if ((cpu & (DROPBEAR_CPU_AVX2 | DROPBEAR_CPU_BMI2))
+					!= (DROPBEAR_CPU_AVX2 | DROPBEAR_CPU_BMI2)) {
+				return 0;
+			}
+			sha512_compress_hook = sha512_avx2;
+			break;
+		default:
+			return 0;
+	}
+	sha512_impl = impl;
+	return 1;
+}
+#else
+int dropbear_sha512_use(int impl) {
+	return impl == DROPBEAR_SHA2_PORTABLE;
+}
+#endif /* DROPBEAR_SHA512 */
+
+/* Try each implementation from fastest down, keeping the first that
+ * agrees with the portable code */
+static void sha2_accel_select(const struct ltc_hash_descriptor *desc,
+		int (*use)(int)) {
+	unsigned char expect[2 * MAX_HASH_SIZE], got[2 * MAX_HASH_SIZE];
+	int impl;
+
+	use(DROPBEAR_SHA2_PORTABLE);
+	sha2_accel_sample(desc, expect);
+	for (impl = DROPBEAR_SHA2_SHANI; impl > DROPBEAR_SHA2_PORTABLE; impl--) {
+		if (!use(impl)) {
+			continue;
+		}
+		sha2_accel_sample(desc, got);
+		if (memcmp(expect, got, 2 * desc->hashsize) == 0) {
+			return;
+		}
+		dropbear_log(LOG_WARNING, "%s self test failed, trying slower code",
+				desc->name);
+		use(DROPBEAR_SHA2_PORTABLE);
+	}
+}
+
+void dropbear_sha2_accel_init() {
+	static int done = 0;
+
+	if (done) {
+		return;
+	}
+	done = 1;
+
+#if DROPBEAR_SHA256
+	sha2_accel_select(&sha256_desc, dropbear_sha256_use);
+	TRACE(("sha256 compression %d", sha256_impl))
+#endif
+#if DROPBEAR_SHA512
+	sha2_accel_select(&sha512_desc, dropbear_sha512_use);
+	TRACE(("sha512 compression %d", sha512_impl))
+#endif
+}
+
+#endif /* DROPBEAR_SHA2_ACCEL */
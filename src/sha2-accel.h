@@ -0,0 +1,49 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_SHA2_ACCEL_H_
+#define DROPBEAR_SHA2_ACCEL_H_
+
+#include "includes.h"
+
+#if DROPBEAR_SHA2_ACCEL
+
+/* Compression functions, slowest first */
+#define DROPBEAR_SHA2_PORTABLE 0
+#define DROPBEAR_SHA2_AVX2 1
+#define DROPBEAR_SHA2_SHANI 2
+
+/* Installs the fastest SHA-256 and SHA-512 compression functions the CPU
+ * supports behind sha256_desc/sha512_desc, after checking them against
+ * libtomcrypt's own. Called from crypto_init() */
+void dropbear_sha2_accel_init(void);
+
+/* Switch to a particular implementation, for sha2bench. Returns 0 if it
+ * isn't available. */
+int dropbear_sha256_use(int impl);
+int dropbear_sha512_use(int impl);
+
+#endif /* DROPBEAR_SHA2_ACCEL */
+
+#endif /* DROPBEAR_SHA2_ACCEL_H_ */
@@ -0,0 +1,105 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+/* Compares the SHA-256 and SHA-512 compression functions in sha2-accel.c
+ * with libtomcrypt's portable code. Built with "make sha2bench", it isn't
+ * installed. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "crypto_desc.h"
+#include "sha2-accel.h"
+
+#if DROPBEAR_SHA2_ACCEL
+
+#define BENCH_SECONDS 0.3
+
+static const char *impl_names[] = { "portable", "avx2", "sha-ni" };
+
+static double bench_now(void) {
+	struct timespec ts;
+	gettime_wrapper(&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* MB/s hashing messages of len bytes, init to done */
+static double bench_hash(const struct ltc_hash_descriptor *desc,
+		const unsigned char *buf, unsigned long len) {
+	unsigned char out[MAX_HASH_SIZE];
+	hash_state hs;
+	unsigned long count = 0, i;
+	double start, elapsed;
+
+	start = bench_now();
+	do {
+		for (i = 0; i < 64; i++) {
+			desc->init(&hs);
+			desc->process(&hs, buf, len);
+			desc->done(&hs, out);
+		}
+		count += 64;
+		elapsed = bench_now() - start;
+	} while (elapsed < BENCH_SECONDS);
+
+	return (double)count * len / elapsed / 1e6;
+}
+
+static void bench_desc(const struct ltc_hash_descriptor *desc,
+		int (*use)(int)) {
+	const unsigned long lens[] = { 64, 1024, 16384 };
+	unsigned char *buf;
+	unsigned int i;
+	int impl;
+
+	buf = m_malloc(lens[2]);
+	memset(buf, 0x5a, lens[2]);
+	for (impl = DROPBEAR_SHA2_PORTABLE; impl <= DROPBEAR_SHA2_SHANI; impl++) {
+		if (!use(impl)) {
+			continue;
+		}
+		printf("%-8s %-9s", desc->name, impl_names[impl]);
+		for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+			printf(" %6lu: %8.1f MB/s", lens[i], bench_hash(desc, buf, lens[i]));
+		}
+		printf("\n");
+	}
+	m_free(buf);
+}
+
+#endif /* DROPBEAR_SHA2_ACCEL */
+
+int main(int UNUSED(argc), char ** UNUSED(argv)) {
+	crypto_init();
+#if DROPBEAR_SHA2_ACCEL
+#if DROPBEAR_SHA256
+	bench_desc(&sha256_desc, dropbear_sha256_use);
+#endif
+#if DROPBEAR_SHA512
+	bench_desc(&sha512_desc, dropbear_sha512_use);
+#endif
+#else
+	printf("built without DROPBEAR_SHA2_ACCEL\n");
+#endif
+	return 0;
+}
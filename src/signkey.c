@@ -229,6 +229,13 @@ signkey_key_ptr(sign_key *key, enum signkey_type type) {
 	}
 }
 
+static void sign_key_drop_pub_blob(sign_key *key, enum signkey_type type) {
+	if (type < DROPBEAR_SIGNKEY_NUM_NAMED && key->pubkey_blobs[type]) {
+		buf_free(key->pubkey_blobs[type]);
+		key->pubkey_blobs[type] = NULL;
+	}
+}
+
 /* returns DROPBEAR_SUCCESS on success, DROPBEAR_FAILURE on fail.
  * type should be set by the caller to specify the type to read, and
  * on return is set to the type read (useful when type = _ANY) */
@@ -257,6 +264,8 @@ int buf_get_pub_key(buffer *buf, sign_key *key, enum signkey_type *type) {
 	/* Rewind the buffer back before "ssh-rsa" etc */
 	buf_decrpos(buf, len + 4);
 
+	sign_key_drop_pub_blob(key, keytype);
+
 #if DROPBEAR_DSS
 	if (keytype == DROPBEAR_SIGNKEY_DSS) {
 		dss_key_free(key->dsskey);
@@ -359,6 +368,8 @@ int buf_get_priv_key(buffer *buf, sign_key *key, enum signkey_type *type) {
 	/* Rewind the buffer back before "ssh-rsa" etc */
 	buf_decrpos(buf, len + 4);
 
+	sign_key_drop_pub_blob(key, keytype);
+
 #if DROPBEAR_DSS
 	if (keytype == DROPBEAR_SIGNKEY_DSS) {
 		dss_key_free(key->dsskey);
@@ -415,12 +426,12 @@ int buf_get_priv_key(buffer *buf, sign_key *key, enum signkey_type *type) {
 	
 }
 
-/* type is either DROPBEAR_SIGNKEY_DSS or DROPBEAR_SIGNKEY_RSA */
-void buf_put_pub_key(buffer* buf, sign_key *key, enum signkey_type type) {
+/* Returns a new buffer holding the public key blob, without the
+ * outer string length */
+static buffer * sign_key_pub_blob(sign_key *key, enum signkey_type type) {
 
 	buffer *pubkeys;
 
-	TRACE2(("enter buf_put_pub_key"))
 	pubkeys = buf_new(MAX_PUBKEY_SIZE);
 	
 #if DROPBEAR_DSS
@@ -454,11 +465,58 @@ void buf_put_pub_key(buffer* buf, sign_key *key, enum signkey_type type) {
 		dropbear_exit("Bad key types in buf_put_pub_key");
 	}
 
+	return pubkeys;
+}
+
+/* type is either DROPBEAR_SIGNKEY_DSS or DROPBEAR_SIGNKEY_RSA */
+void buf_put_pub_key(buffer* buf, sign_key *key, enum signkey_type type) {
+
+	buffer *pubkeys;
+
+	TRACE2(("enter buf_put_pub_key"))
+
+	if (type < DROPBEAR_SIGNKEY_NUM_NAMED && key->pubkey_blobs[type]) {
+		buf_putbufstring(buf, key->pubkey_blobs[type]);
+		TRACE2(("leave buf_put_pub_key: cached"))
+		return;
+	}
+
+	pubkeys = sign_key_pub_blob(key, type);
 	buf_putbufstring(buf, pubkeys);
 	buf_free(pubkeys);
 	TRACE2(("leave buf_put_pub_key"))
 }
 
+/* Serializes the public key blob for each key part that is present, so that
+ * buf_put_pub_key() can copy it rather than encoding it again. The blobs
+ * are dropped if a key part is later replaced by buf_get_pub_key() or
+ * buf_get_priv_key(), other changes to the key must not be made after
+ * this is called */
+void sign_key_cache_pub_keys(sign_key *key) {
+	int i;
+
+	TRACE(("enter sign_key_cache_pub_keys"))
+	for (i = 0; i < DROPBEAR_SIGNKEY_NUM_NAMED; i++) {
+		void **part = NULL;
+#if DROPBEAR_SK_ECDSA
+		if (i == DROPBEAR_SIGNKEY_SK_ECDSA_NISTP256) {
+			continue;
+		}
+#endif
+#if DROPBEAR_SK_ED25519
+		if (i == DROPBEAR_SIGNKEY_SK_ED25519) {
+			continue;
+		}
+#endif
+		part = signkey_key_ptr(key, i);
+		sign_key_drop_pub_blob(key, i);
+		if (part && *part) {
+			key->pubkey_blobs[i] = sign_key_pub_blob(key, i);
+		}
+	}
+	TRACE(("leave sign_key_cache_pub_keys"))
+}
+
 /* type is either DROPBEAR_SIGNKEY_DSS or DROPBEAR_SIGNKEY_RSA */
 void buf_put_priv_key(buffer* buf, sign_key *key, enum signkey_type type) {
 
@@ -501,6 +559,8 @@ void buf_put_priv_key(buffer* buf, sign_key *key, enum signkey_type type) {
 
 void sign_key_free(sign_key *key) {
 
+	int i;
+
 	TRACE2(("enter sign_key_free"))
 
 #if DROPBEAR_DSS
@@ -539,6 +599,10 @@ void sign_key_free(sign_key *key) {
 	key->ed25519key = NULL;
 #endif
 
+	for (i = 0; i < DROPBEAR_SIGNKEY_NUM_NAMED; i++) {
+		sign_key_drop_pub_blob(key, i);
+	}
+
 	m_free(key->filename);
 #if DROPBEAR_SK_ECDSA || DROPBEAR_SK_ED25519
 	if (key->sk_app) {
@@ -131,6 +131,10 @@ struct SIGN_key {
 	unsigned int sk_applen;
 	unsigned char sk_flags_mask;
 #endif
+
+	/* Serialized public key blobs by type, set by sign_key_cache_pub_keys()
+	 * for long-lived keys such as hostkeys. NULL otherwise */
+	buffer * pubkey_blobs[DROPBEAR_SIGNKEY_NUM_NAMED];
 };
 
 typedef struct SIGN_key sign_key;
@@ -147,6 +151,7 @@ int buf_get_pub_key(buffer *buf, sign_key *key, enum signkey_type *type);
 int buf_get_priv_key(buffer* buf, sign_key *key, enum signkey_type *type);
 void buf_put_pub_key(buffer* buf, sign_key *key, enum signkey_type type);
 void buf_put_priv_key(buffer* buf, sign_key *key, enum signkey_type type);
+void sign_key_cache_pub_keys(sign_key *key);
 void sign_key_free(sign_key *key);
 void buf_put_sign(buffer* buf, sign_key *key, enum signature_type sigtype, const buffer *data_buf);
 #if DROPBEAR_SIGNKEY_VERIFY
@@ -9,6 +9,7 @@
 #include "rsa.h"
 #include "dss.h"
 #include "ed25519.h"
+#include "curve25519.h"
 
 #if DROPBEAR_RSA
 /* OpenSSH raw private RSA format is
@@ -63,6 +64,7 @@ int buf_get_rsa_priv_ossh(buffer *buf, sign_key *akey) {
 		&& buf_getmpint(buf, &iqmp) == DROPBEAR_SUCCESS
 		&& buf_getmpint(buf, key->p) == DROPBEAR_SUCCESS
 		&& buf_getmpint(buf, key->q) == DROPBEAR_SUCCESS) {
+		rsa_precompute_crt(key);
 		ret = DROPBEAR_SUCCESS;
 	}
 	mp_clear(&iqmp);
@@ -120,6 +122,7 @@ int buf_get_ed25519_priv_ossh(buffer *buf, sign_key *akey) {
 		dropbear_log(LOG_ERR, "Error parsing ed25519 key, mismatch pubkey");
 		return DROPBEAR_FAILURE;
 	}
+	dropbear_ed25519_expand(key->expanded, key->priv);
 	return DROPBEAR_SUCCESS;
 }
 #endif /* DROPBEAR_ED255219 */
@@ -175,6 +175,8 @@ out:
 	if (ret == DROPBEAR_FAILURE) {
 		dropbear_exit("Couldn't read or generate hostkey %s", expand_fn);
 	}
+	/* for any rekeys in this session */
+	sign_key_cache_pub_keys(svr_opts.hostkey);
     m_free(expand_fn);
 }
 #endif
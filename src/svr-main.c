@@ -30,12 +30,17 @@
 #include "runopts.h"
 #include "dbrandom.h"
 #include "crypto_desc.h"
+#include "dbpoll.h"
+#include "svr-pool.h"
 
 static size_t listensockets(int *sock, size_t sockcount, int *maxfd);
 static void sigchld_handler(int dummy);
 static void sigintterm_handler(int fish);
 static void main_inetd(int reexec_fd);
 static void main_noinetd(int argc, char ** argv, const char* multipath);
+#if DROPBEAR_SVR_WORKER_POOL && DROPBEAR_DO_REEXEC
+static void main_worker(int ctrl_fd);
+#endif
 static void commonsetup(void);
 
 #if defined(DBMULTI_dropbear) || !DROPBEAR_MULTI
@@ -71,6 +76,17 @@ int main(int argc, char ** argv)
 		m_str_to_uint(env, &reexec_fd);
 	}
 #endif
+#if DROPBEAR_SVR_WORKER_POOL && DROPBEAR_DO_REEXEC
+	if ((env = getenv("DROPBEAR_WORKER_FD"))) {
+		unsigned int worker_fd;
+		int ret = m_str_to_uint(env, &worker_fd);
+		unsetenv("DROPBEAR_WORKER_FD");
+		if (ret == DROPBEAR_SUCCESS) {
+			main_worker(worker_fd);
+			/* notreached */
+		}
+	}
+#endif
 #if DROPBEAR_DO_REEXEC || INETD_MODE
 	if (svr_opts.inetdmode || reexec_fd >= 0) {
 		main_inetd(reexec_fd);
@@ -115,11 +131,24 @@ static void main_inetd(int reexec_fd) {
 }
 #endif /* INETD_MODE */
 
+#if DROPBEAR_SVR_WORKER_POOL && DROPBEAR_DO_REEXEC
+/* A re-executed pool worker. Do the per-process setup now, before a
+ * connection has been handed to us */
+static void main_worker(int ctrl_fd) {
+	commonsetup();
+
+	seedrandom();
+
+	svr_pool_worker(ctrl_fd);
+	/* notreached */
+}
+#endif
+
 #if NON_INETD_MODE
 static void main_noinetd(int argc, char ** argv, const char* multipath) {
-	fd_set fds;
 	unsigned int i, j;
 	int val;
+	int timeout = -1;
 	int maxsock = -1;
 	int listensocks[MAX_LISTEN_ADDR];
 	size_t listensockcount = 0;
@@ -155,10 +184,6 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 		dropbear_exit("No listening ports available.");
 	}
 
-	for (i = 0; i < listensockcount; i++) {
-		FD_SET(listensocks[i], &fds);
-	}
-
 	/* fork */
 	if (svr_opts.forkbg) {
 		if (daemon(0, opts.log_level >= 0) < 0) {
@@ -184,25 +209,33 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 	}
 #endif
 
+	/* after daemon(), the poll state isn't inherited by the new process */
+	dbpoll_init();
+	for (i = 0; i < listensockcount; i++) {
+		dbpoll_set(listensocks[i], DBPOLL_READ, NULL);
+	}
+
+#if DROPBEAR_SVR_WORKER_POOL
+	svr_pool_init(listensocks, listensockcount, argv);
+#endif
+
 	/* incoming connection select loop */
 	for(;;) {
 
-		DROPBEAR_FD_ZERO(&fds);
-
-		/* listening sockets */
-		for (i = 0; i < listensockcount; i++) {
-			FD_SET(listensocks[i], &fds);
-		}
+#if DROPBEAR_SVR_WORKER_POOL
+		svr_pool_refill(do_reexec);
+#endif
 
-		/* pre-authentication clients */
-		for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
-			if (childpipes[i] >= 0) {
-				FD_SET(childpipes[i], &fds);
-				maxsock = MAX(maxsock, childpipes[i]);
-			}
-		}
+		/* Listening sockets, pre-authentication clients and idle
+		 * workers are registered with dbpoll as they are created,
+		 * m_close() removes them */
+#if DROPBEAR_SVR_WORKER_POOL
+		/* Keep coming back around to start more workers while the
+		 * pool is short, handling any new connections in between */
+		timeout = svr_pool_timeout();
+#endif
 
-		val = select(maxsock+1, &fds, NULL, NULL, NULL);
+		val = dbpoll_wait(timeout);
 
 		if (ses.exitflag) {
 #ifndef DISABLE_PIDFILE
@@ -212,7 +245,7 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 		}
 
 		if (val == 0) {
-			/* timeout reached - shouldn't happen. eh */
+			/* timeout reached - only when refilling the worker pool */
 			continue;
 		}
 
@@ -226,7 +259,8 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 		/* close fds which have been authed or closed - svr-auth.c handles
 		 * closing the auth sockets on success */
 		for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
-			if (childpipes[i] >= 0 && FD_ISSET(childpipes[i], &fds)) {
+			if (childpipes[i] >= 0
+					&& (dbpoll_ready(childpipes[i]) & DBPOLL_READ)) {
 				char c;
 				if(read(childpipes[i], &c, 1) > 0){
 					do_reexec = 0;
@@ -238,6 +272,10 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 			}
 		}
 
+#if DROPBEAR_SVR_WORKER_POOL
+		svr_pool_handle_fds(&do_reexec);
+#endif
+
 		/* handle each socket which has something to say */
 		for (i = 0; i < listensockcount; i++) {
 			size_t num_unauthed_for_addr = 0;
@@ -249,7 +287,7 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 			struct sockaddr_storage remoteaddr;
 			socklen_t remoteaddrlen;
 
-			if (!FD_ISSET(listensocks[i], &fds)) 
+			if (!(dbpoll_ready(listensocks[i]) & DBPOLL_READ)) 
 				continue;
 
 			remoteaddrlen = sizeof(remoteaddr);
@@ -284,13 +322,23 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 				goto out;
 			}
 
-			seedrandom();
-
 			if (pipe(childpipe) < 0) {
 				TRACE(("error creating child pipe"))
 				goto out;
 			}
 
+#if DROPBEAR_SVR_WORKER_POOL
+			if (svr_pool_handoff(childsock, childpipe[1]) == DROPBEAR_SUCCESS) {
+				childpipes[conn_idx] = childpipe[0];
+				dbpoll_set(childpipe[0], DBPOLL_READ, NULL);
+				m_close(childpipe[1]);
+				preauth_addrs[conn_idx] = remote_host;
+				goto out;
+			}
+#endif
+
+			reseedrandom();
+
 #if DEBUG_NOFORK
 			fork_ret = 0;
 #else
@@ -307,6 +355,7 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 
 				/* parent */
 				childpipes[conn_idx] = childpipe[0];
+				dbpoll_set(childpipe[0], DBPOLL_READ, NULL);
 				m_close(childpipe[1]);
 				preauth_addrs[conn_idx] = remote_host;
 			} else {
@@ -325,6 +374,9 @@ static void main_noinetd(int argc, char ** argv, const char* multipath) {
 				for (j = 0; j < listensockcount; j++) {
 					m_close(listensocks[j]);
 				}
+#if DROPBEAR_SVR_WORKER_POOL
+				svr_pool_close_fds();
+#endif
 
 				m_close(childpipe[0]);
 
@@ -419,6 +471,10 @@ static void commonsetup() {
 	/* Now we can setup the hostkeys - needs to be after logging is on,
 	 * otherwise we might end up blatting error messages to the socket */
 	load_all_hostkeys();
+
+#if DROPBEAR_NORMAL_DH
+	kexdh_load_groups();
+#endif
 }
 
 /* Set up listening sockets for all the requested ports */
@@ -0,0 +1,363 @@
+/*
+ * Dropbear - a SSH2 server
+ * 
+ * Copyright (c) 2002-2006 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+/* Pool of pre-forked session workers. Each worker has already been forked
+ * (and re-executed), set up crypto and loaded hostkeys before a client
+ * arrives. The listener passes an accepted socket to an idle worker over a
+ * unix socketpair with SCM_RIGHTS, then starts a replacement in the
+ * background. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "session.h"
+#include "runopts.h"
+#include "dbrandom.h"
+#include "netio.h"
+#include "dbpoll.h"
+#include "svr-pool.h"
+
+#if DROPBEAR_SVR_WORKER_POOL
+
+struct pool_worker {
+	/* listener's end of the socketpair, -1 for an unused slot */
+	int ctrl;
+	pid_t pid;
+	/* set once the worker has finished initialising */
+	int ready;
+};
+
+static struct pool_worker workers[MAX_UNAUTH_CLIENTS];
+static const int *pool_listensocks = NULL;
+static size_t pool_listensockcount = 0;
+static char ** pool_argv = NULL;
+/* set when starting a worker failed, refilling backs off for a while */
+static int spawn_failed = 0;
+
+static void drop_worker(struct pool_worker *worker) {
+	/* The worker exits when it sees EOF, sigchld_handler reaps it */
+	m_close(worker->ctrl);
+	worker->ctrl = -1;
+	worker->pid = 0;
+	worker->ready = 0;
+}
+
+/* Close the listener's ends of the worker sockets, for use in
+ * freshly forked children */
+void svr_pool_close_fds(void) {
+	unsigned int i;
+
+	for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
+		if (workers[i].ctrl >= 0) {
+			m_close(workers[i].ctrl);
+			workers[i].ctrl = -1;
+		}
+	}
+}
+
+static void spawn_worker(struct pool_worker *worker, int do_reexec) {
+	int sv[2];
+	pid_t pid;
+	unsigned int i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		dropbear_log(LOG_WARNING, "worker socketpair:");
+		return;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		dropbear_log(LOG_WARNING, "worker fork:");
+		m_close(sv[0]);
+		m_close(sv[1]);
+		return;
+	}
+
+	if (pid > 0) {
+		/* listener */
+		m_close(sv[1]);
+		setnonblocking(sv[0]);
+		/* Don't leak it into re-executed sessions or workers */
+		if (fcntl(sv[0], F_SETFD, FD_CLOEXEC) < 0) {
+			TRACE(("cloexec for worker ctrl %d failed:", sv[0]))
+		}
+		addrandom((void*)&pid, sizeof(pid));
+		worker->ctrl = sv[0];
+		worker->pid = pid;
+		worker->ready = 0;
+		dbpoll_set(sv[0], DBPOLL_READ, NULL);
+		TRACE(("spawned worker pid %d", pid))
+		return;
+	}
+
+	/* worker */
+	if (setsid() < 0) {
+		dropbear_exit("setsid:");
+	}
+
+	for (i = 0; i < pool_listensockcount; i++) {
+		m_close(pool_listensocks[i]);
+	}
+	svr_pool_close_fds();
+	m_close(sv[0]);
+
+#if DROPBEAR_DO_REEXEC
+	if (do_reexec) {
+		putenv(m_asprintf("DROPBEAR_WORKER_FD=%d", sv[1]));
+		execv("/proc/self/exe", pool_argv);
+		/* Not reached on success */
+
+		/* Carry on as a plain forked worker, and have the listener
+		 * stop re-executing */
+		dropbear_log(LOG_INFO, "execv /proc/self/exe failed, disabling re-exec:");
+		(void)!write(sv[1], "N", 1);
+	}
+#else
+	(void)do_reexec;
+#endif
+
+	svr_pool_worker(sv[1]);
+}
+
+void svr_pool_init(const int *listensocks, size_t listensockcount,
+		char ** argv) {
+	unsigned int i;
+
+	for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
+		workers[i].ctrl = -1;
+		workers[i].pid = 0;
+		workers[i].ready = 0;
+	}
+	pool_listensocks = listensocks;
+	pool_listensockcount = listensockcount;
+	pool_argv = argv;
+}
+
+/* Returns the dbpoll_wait() timeout in milliseconds for coming back
+ * around to refill the pool, or -1 if the pool is full */
+int svr_pool_timeout() {
+	unsigned int i, live = 0;
+
+	for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
+		if (workers[i].ctrl >= 0) {
+			live++;
+		}
+	}
+	if (live >= svr_opts.worker_pool) {
+		return -1;
+	}
+
+	/* Don't spin if fork() is failing */
+	return spawn_failed ? 1000 : 0;
+}
+
+/* Workers write 'R' once they are ready for a connection, or 'N' if
+ * re-exec failed. EOF means the worker has died. */
+void svr_pool_handle_fds(int *do_reexec) {
+	unsigned int i;
+	char buf[4];
+	ssize_t len, j;
+
+	for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
+		if (workers[i].ctrl < 0
+				|| !(dbpoll_ready(workers[i].ctrl) & DBPOLL_READ)) {
+			continue;
+		}
+
+		len = read(workers[i].ctrl, buf, sizeof(buf));
+		if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+			continue;
+		}
+		if (len <= 0) {
+			TRACE(("worker pid %d went away", workers[i].pid))
+			drop_worker(&workers[i]);
+			continue;
+		}
+		for (j = 0; j < len; j++) {
+			if (buf[j] == 'R') {
+				workers[i].ready = 1;
+			} else if (buf[j] == 'N') {
+				*do_reexec = 0;
+			}
+		}
+	}
+}
+
+/* Start up to the configured refill count of workers. Called once per
+ * pass of the listener loop so that accepting clients isn't held up
+ * behind a burst of forks. */
+void svr_pool_refill(int do_reexec) {
+	unsigned int i, live = 0, spawned = 0;
+
+	for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
+		if (workers[i].ctrl >= 0) {
+			live++;
+		}
+	}
+
+	for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
+		if (live >= svr_opts.worker_pool
+				|| spawned >= svr_opts.worker_refill) {
+			break;
+		}
+		if (workers[i].ctrl >= 0) {
+			continue;
+		}
+		spawn_worker(&workers[i], do_reexec);
+		spawn_failed = workers[i].ctrl < 0;
+		if (spawn_failed) {
+			/* try again next time around */
+			break;
+		}
+		live++;
+		spawned++;
+	}
+}
+
+/* Pass a client socket and its childpipe to an idle worker. Returns
+ * DROPBEAR_FAILURE if no worker was ready to take it, the caller
+ * should then fork as usual. */
+int svr_pool_handoff(int sock, int childpipe) {
+	unsigned int i;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	int fds[2];
+	char c = 'C';
+
+	fds[0] = sock;
+	fds[1] = childpipe;
+
+	for (i = 0; i < MAX_UNAUTH_CLIENTS; i++) {
+		if (workers[i].ctrl < 0 || !workers[i].ready) {
+			continue;
+		}
+
+		memset(&msg, 0x0, sizeof(msg));
+		memset(&control, 0x0, sizeof(control));
+		iov.iov_base = &c;
+		iov.iov_len = 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+		if (sendmsg(workers[i].ctrl, &msg, 0) == 1) {
+			TRACE(("handed connection to worker pid %d", workers[i].pid))
+			/* The worker now owns the connection, it is no longer
+			 * part of the pool */
+			drop_worker(&workers[i]);
+			return DROPBEAR_SUCCESS;
+		}
+
+		TRACE(("handoff to worker pid %d failed:", workers[i].pid))
+		drop_worker(&workers[i]);
+	}
+
+	return DROPBEAR_FAILURE;
+}
+
+void svr_pool_worker(int ctrl_fd) {
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	int fds[2];
+	char c;
+	ssize_t len;
+	char *remote = NULL;
+	struct sigaction sa_dfl, old_int, old_term;
+
+	/* An idle worker has nothing to clean up, let signals kill it
+	 * rather than restarting recvmsg() */
+	sa_dfl.sa_handler = SIG_DFL;
+	sa_dfl.sa_flags = 0;
+	sigemptyset(&sa_dfl.sa_mask);
+	if (sigaction(SIGINT, &sa_dfl, &old_int) < 0
+		|| sigaction(SIGTERM, &sa_dfl, &old_term) < 0) {
+		dropbear_exit("signal() error");
+	}
+
+	if (write(ctrl_fd, "R", 1) != 1) {
+		/* listener has gone */
+		exit(EXIT_SUCCESS);
+	}
+
+	do {
+		memset(&msg, 0x0, sizeof(msg));
+		iov.iov_base = &c;
+		iov.iov_len = 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		len = recvmsg(ctrl_fd, &msg, 0);
+	} while (len < 0 && errno == EINTR);
+
+	if (len <= 0) {
+		/* The listener exited or retired us while idle, nothing
+		 * to report */
+		exit(EXIT_SUCCESS);
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL
+			|| (msg.msg_flags & MSG_CTRUNC)
+			|| cmsg->cmsg_level != SOL_SOCKET
+			|| cmsg->cmsg_type != SCM_RIGHTS
+			|| cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		dropbear_exit("Bad worker handoff");
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	m_close(ctrl_fd);
+
+	if (sigaction(SIGINT, &old_int, NULL) < 0
+		|| sigaction(SIGTERM, &old_term, NULL) < 0) {
+		dropbear_exit("signal() error");
+	}
+
+	/* This worker may have been idle for a while */
+	reseedrandom();
+
+	get_socket_address(fds[0], NULL, NULL, &remote, NULL, FULL_ADDRESS);
+	dropbear_log(LOG_INFO, "Child connection from %s", remote);
+	m_free(remote);
+
+	svr_session(fds[0], fds[1]);
+	/* notreached */
+}
+
+#endif /* DROPBEAR_SVR_WORKER_POOL */
@@ -0,0 +1,46 @@
+/*
+ * Dropbear - a SSH2 server
+ * 
+ * Copyright (c) 2002-2006 Matt Johnston
+ * All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_SVR_POOL_H_
+#define DROPBEAR_SVR_POOL_H_
+
+#include "includes.h"
+
+#if DROPBEAR_SVR_WORKER_POOL
+
+/* Listener side */
+void svr_pool_init(const int *listensocks, size_t listensockcount,
+		char ** argv);
+void svr_pool_handle_fds(int *do_reexec);
+int svr_pool_timeout(void);
+void svr_pool_refill(int do_reexec);
+int svr_pool_handoff(int sock, int childpipe);
+void svr_pool_close_fds(void);
+
+/* Worker side, doesn't return */
+void svr_pool_worker(int ctrl_fd) ATTRIB_NORETURN;
+
+#endif /* DROPBEAR_SVR_WORKER_POOL */
+
+#endif /* DROPBEAR_SVR_POOL_H_ */
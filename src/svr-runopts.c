@@ -38,6 +38,9 @@ static void printhelp(const char * progname);
 static void addportandaddress(const char* spec);
 static void loadhostkey(const char *keyfile, int fatal_duplicate);
 static void addhostkey(const char *keyfile);
+#if DROPBEAR_SVR_WORKER_POOL
+static void parse_worker_pool(const char* spec);
+#endif
 
 static void printhelp(const char * progname) {
 
@@ -105,6 +108,11 @@ static void printhelp(const char * progname) {
 					"-i		Start for inetd\n"
 #endif
 					"-W <receive_window_buffer> (default %d, larger may be faster, max 10MB)\n"
+#if DROPBEAR_SVR_WORKER_POOL
+					"-N <workers>[,<refill>]\n"
+					"		Keep a pool of pre-forked session workers (default 0, max %d)\n"
+					"		starting at most <refill> at a time (default 1)\n"
+#endif
 					"-K <keepalive>  (0 is never, default %d, in seconds)\n"
 					"-I <idle_timeout>  (0 is never, default %d, in seconds)\n"
 					"-z    disable QoS\n"
@@ -135,7 +143,11 @@ static void printhelp(const char * progname) {
 				#ifndef DISABLE_PIDFILE
 					DROPBEAR_PIDFILE,
 				#endif
-					DEFAULT_RECV_WINDOW, DEFAULT_KEEPALIVE, DEFAULT_IDLE_TIMEOUT);
+					DEFAULT_RECV_WINDOW,
+#if DROPBEAR_SVR_WORKER_POOL
+					MAX_UNAUTH_CLIENTS,
+#endif
+					DEFAULT_KEEPALIVE, DEFAULT_IDLE_TIMEOUT);
 }
 
 void svr_getopts(int argc, char ** argv) {
@@ -147,6 +159,9 @@ void svr_getopts(int argc, char ** argv) {
 	char* keepalive_arg = NULL;
 	char* idle_timeout_arg = NULL;
 	char* maxauthtries_arg = NULL;
+#if DROPBEAR_SVR_WORKER_POOL
+	char* worker_pool_arg = NULL;
+#endif
 	char* keyfile = NULL;
 	char c;
 #if DROPBEAR_PLUGIN
@@ -187,6 +202,10 @@ void svr_getopts(int argc, char ** argv) {
         svr_opts.pubkey_plugin_options = NULL;
 #endif
 	svr_opts.pass_on_env = 0;
+#if DROPBEAR_SVR_WORKER_POOL
+	svr_opts.worker_pool = 0;
+	svr_opts.worker_refill = 1;
+#endif
 
 	svr_opts.authorized_keys_file = AUTHORIZED_KEYS_FILE;
 
@@ -292,6 +311,11 @@ void svr_getopts(int argc, char ** argv) {
 				case 'W':
 					next = &recv_window_arg;
 					break;
+#if DROPBEAR_SVR_WORKER_POOL
+				case 'N':
+					next = &worker_pool_arg;
+					break;
+#endif
 				case 'K':
 					next = &keepalive_arg;
 					break;
@@ -431,6 +455,12 @@ void svr_getopts(int argc, char ** argv) {
 	}
 
 
+#if DROPBEAR_SVR_WORKER_POOL
+	if (worker_pool_arg) {
+		parse_worker_pool(worker_pool_arg);
+	}
+#endif
+
 	if (keepalive_arg) {
 		unsigned int val;
 		if (m_str_to_uint(keepalive_arg, &val) == DROPBEAR_FAILURE) {
@@ -695,4 +725,36 @@ void load_all_hostkeys() {
 	if (!any_keys) {
 		dropbear_exit("No hostkeys available. 'dropbear -R' may be useful or run dropbearkey.");
 	}
+
+	/* Hostkeys are fixed from here on. Serialize their public parts once
+	 * so that each key exchange can copy them */
+	sign_key_cache_pub_keys(svr_opts.hostkey);
+}
+
+#if DROPBEAR_SVR_WORKER_POOL
+static void parse_worker_pool(const char* spec) {
+	char *workers = m_strdup(spec);
+	char *refill = strchr(workers, ',');
+	unsigned int val;
+
+	if (refill) {
+		*refill = '\0';
+		refill++;
+	}
+
+	if (m_str_to_uint(workers, &val) == DROPBEAR_FAILURE
+			|| val > MAX_UNAUTH_CLIENTS) {
+		dropbear_exit("Bad worker pool size '%s'", spec);
+	}
+	svr_opts.worker_pool = val;
+
+	if (refill) {
+		if (m_str_to_uint(refill, &val) == DROPBEAR_FAILURE || val == 0) {
+			dropbear_exit("Bad worker pool refill '%s'", spec);
+		}
+		svr_opts.worker_refill = val;
+	}
+
+	m_free(workers);
 }
+#endif
@@ -173,7 +173,7 @@ void svr_session(int sock, int childpipe) {
 	ses.extra_session_cleanup = svr_session_cleanup;
 
 	/* packet handlers */
-	ses.packettypes = svr_packettypes;
+	set_packet_handlers(svr_packettypes);
 
 	ses.isserver = 1;
 
@@ -41,6 +41,32 @@
 #define DROPBEAR_DO_REEXEC 1
 #endif
 
+/* epoll is Linux only, and the fuzzer wraps select() */
+#if DROPBEAR_EPOLL && (!defined(__linux__) || DROPBEAR_FUZZ)
+#undef DROPBEAR_EPOLL
+#define DROPBEAR_EPOLL 0
+#endif
+
+/* io_uring needs its kernel header, and epoll for fds it can't poll */
+#if DROPBEAR_IO_URING && (!defined(HAVE_LINUX_IO_URING_H) \
+		|| !DROPBEAR_EPOLL || DROPBEAR_FUZZ)
+#undef DROPBEAR_IO_URING
+#define DROPBEAR_IO_URING 0
+#endif
+
+/* Crypto threads need pthreads, the fuzzer is single threaded */
+#if DROPBEAR_CRYPTO_THREADS && (!defined(HAVE_PTHREAD_H) \
+		|| !defined(HAVE_PTHREAD_CREATE) || DROPBEAR_FUZZ)
+#undef DROPBEAR_CRYPTO_THREADS
+#define DROPBEAR_CRYPTO_THREADS 0
+#endif
+
+/* The worker pool is only used by the listener */
+#if !NON_INETD_MODE
+#undef DROPBEAR_SVR_WORKER_POOL
+#define DROPBEAR_SVR_WORKER_POOL 0
+#endif
+
 /* A client should try and send an initial key exchange packet guessing
  * the algorithm that will match - saves a round trip connecting, has little
  * overhead if the guess was "wrong". */
@@ -211,13 +237,54 @@
 
 #define RECV_MAX_PACKET_LEN (MAX(35000, ((RECV_MAX_PAYLOAD_LEN)+100)))
 
+/* size of the session socket's read-ahead ring, room for a couple of
+ * maximum sized packets per read() */
+#define RECV_READAHEAD_LEN (2*RECV_MAX_PACKET_LEN)
+
+/* how many received packets, or payload bytes, are dispatched per
+ * session loop wakeup before channels and the socket get serviced */
+#define RECV_BATCH_PACKETS 64
+#define RECV_BATCH_BYTES (4*RECV_MAX_PAYLOAD_LEN)
+
+/* Channel reads are scheduled deficit round robin, each readable channel
+ * getting this many bytes per round, times 4 for interactive channels
+ * (which are also served first). Bulk channels stop being read once
+ * their data on the write queue totals CHANNEL_QUEUE_BULK_BYTES, which
+ * bounds how long keystroke echoes wait behind a transfer. Interactive
+ * channels, and reads from the session socket, stop once the queue
+ * holds TRANS_QUEUE_MAX_BYTES */
+#define CHANNEL_QUANTUM_BYTES (2*TRANS_MAX_PAYLOAD_LEN)
+#define CHANNEL_QUEUE_BULK_BYTES (2*TRANS_MAX_PAYLOAD_LEN)
+#define TRANS_QUEUE_MAX_BYTES (16*TRANS_MAX_PAYLOAD_LEN)
+
+/* spare packet buffers kept per size class, and spare links kept per
+ * queue, to avoid malloc/free per packet */
+#define PKTBUF_POOL_DEPTH 4
+#define QUEUE_SPARE_LINKS 32
+
+/* DROPBEAR_CRYPTO_THREADS: packets smaller than this are handled by the
+ * main loop when nothing is with a crypto thread, handing over costs more.
+ * It is also larger than any SSH_MSG_NEWKEYS, which must be processed
+ * before the following packet's length can be read. Each direction has
+ * up to CRYPTO_THREAD_DEPTH packets (a power of two) with its thread */
+#define CRYPTO_THREAD_MIN_PACKET 1024
+#define CRYPTO_THREAD_DEPTH 32
+#define CRYPTO_THREAD_STACK (256*1024)
+
 /* for channel code */
 #define TRANS_MAX_WINDOW 500000000 /* 500MB is sufficient, stopping overflow */
 #define TRANS_MAX_WIN_INCR 500000000 /* overflow prevention */
 
-#define RECV_WINDOWEXTEND (opts.recv_window / 3) /* We send a "window extend" every
-								RECV_WINDOWEXTEND bytes */
+/* We send a "window extend" every RECV_WINDOWEXTEND bytes */
+#define RECV_WINDOWEXTEND(channel) ((channel)->recvmaxwindow / 3)
 #define MAX_RECV_WINDOW (10*1024*1024) /* 10 MB should be enough */
+/* auto-tuned windows are measured over at least this long, and go back
+ * to opts.recv_window after this many seconds without data */
+#define RECV_WINDOW_TUNE_MIN_US 10000
+#define RECV_WINDOW_IDLE_SECS 30
+/* limit on the windows grown past opts.recv_window, totalled over the
+ * session's channels, as each could otherwise commit MAX_RECV_WINDOW */
+#define RECV_WINDOW_TUNED_MAX (32*1024*1024)
 
 #define MAX_CHANNELS 1000 /* simple mem restriction, includes each tcp/x11
 							connection, so can't be _too_ small */
@@ -248,6 +315,16 @@
 
 #define DROPBEAR_AES ((DROPBEAR_AES256) || (DROPBEAR_AES128))
 
+#if DROPBEAR_CPU_ACCEL && defined(__x86_64__) && defined(__GNUC__)
+#define DROPBEAR_X86_64_ACCEL 1
+#else
+#define DROPBEAR_X86_64_ACCEL 0
+#endif
+
+#define DROPBEAR_AESNI ((DROPBEAR_X86_64_ACCEL) && (DROPBEAR_AES))
+#define DROPBEAR_CHACHA_SIMD ((DROPBEAR_X86_64_ACCEL) && (DROPBEAR_CHACHA20POLY1305))
+#define DROPBEAR_SHA2_ACCEL ((DROPBEAR_X86_64_ACCEL) && ((DROPBEAR_SHA256) || (DROPBEAR_SHA512)))
+
 #define DROPBEAR_AEAD_MODE ((DROPBEAR_CHACHA20POLY1305) || (DROPBEAR_ENABLE_GCM_MODE))
 
 #define DROPBEAR_CLI_ANYTCPFWD ((DROPBEAR_CLI_REMOTETCPFWD) || (DROPBEAR_CLI_LOCALTCPFWD))
@@ -295,6 +372,10 @@
 	#error "At least one encryption algorithm must be enabled. AES128 is recommended."
 #endif
 
+#if DROPBEAR_UMAC && !DROPBEAR_AES
+	#error "DROPBEAR_UMAC requires DROPBEAR_AES128 or DROPBEAR_AES256"
+#endif
+
 #if !(DROPBEAR_RSA || DROPBEAR_DSS || DROPBEAR_ECDSA || DROPBEAR_ED25519)
 	#error "At least one hostkey or public-key algorithm must be enabled; RSA is recommended."
 #endif
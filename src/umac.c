@@ -0,0 +1,275 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+/* UMAC (RFC 4418) with 64 and 128 bit tags. Messages are hashed in one
+ * call, so only the 64-bit L2 polynomial is implemented; that limits a
+ * message to 2^24 bytes which is far beyond any SSH packet. */
+
+#include "includes.h"
+#include "dbutil.h"
+#include "umac.h"
+
+#if DROPBEAR_UMAC
+
+#define UMAC_P36 CONST64(0x0000000FFFFFFFFB) /* 2^36 - 5 */
+#define UMAC_P64 CONST64(0xFFFFFFFFFFFFFFC5) /* 2^64 - 59 */
+#define UMAC_MAX_MSG_LEN (1UL << 24)
+
+/* KDF from RFC 4418 section 3.2.1, AES in counter mode with the index
+ * in the upper 64 bits */
+static void umac_kdf(symmetric_key *skey, unsigned char index,
+		unsigned char *out, unsigned int len) {
+	unsigned char in[16], block[16];
+	unsigned int i, n;
+
+	memset(in, 0, sizeof(in));
+	in[7] = index;
+	for (i = 1; len > 0; i++) {
+		in[15] = i;
+		if (aes_desc.ecb_encrypt(in, block, skey) != CRYPT_OK) {
+			dropbear_exit("UMAC error");
+		}
+		n = MIN(len, sizeof(block));
+		memcpy(out, block, n);
+		out += n;
+		len -= n;
+	}
+	m_burn(block, sizeof(block));
+}
+
+int dropbear_umac_setup(dropbear_umac_state *state,
+		const unsigned char *key, unsigned int taglen) {
+	unsigned char buf[UMAC_NH_KEY_WORDS * 4];
+	symmetric_key prf;
+	unsigned int i, j, len;
+
+	if (taglen != 8 && taglen != 16) {
+		return DROPBEAR_FAILURE;
+	}
+	if (aes_desc.setup(key, UMAC_KEY_LEN, 0, &prf) != CRYPT_OK) {
+		return DROPBEAR_FAILURE;
+	}
+	state->streams = taglen / 4;
+
+	/* key for the pad generator */
+	umac_kdf(&prf, 0, buf, UMAC_KEY_LEN);
+	if (aes_desc.setup(buf, UMAC_KEY_LEN, 0, &state->pdf_key) != CRYPT_OK) {
+		m_burn(&prf, sizeof(prf));
+		return DROPBEAR_FAILURE;
+	}
+	state->pdf_valid = 0;
+
+	/* L1 NH key, each stream uses it shifted by 16 bytes */
+	len = UMAC_L1_KEY_LEN + UMAC_L1_KEY_SHIFT * (state->streams - 1);
+	umac_kdf(&prf, 1, buf, len);
+	for (i = 0; i < len / 4; i++) {
+		LOAD32H(state->nh_key[i], &buf[4*i]);
+	}
+
+	/* L2 polynomial keys, only the 64-bit part of each 24 bytes is used */
+	umac_kdf(&prf, 2, buf, 24 * state->streams);
+	for (i = 0; i < state->streams; i++) {
+		LOAD64H(state->poly_key[i], &buf[24*i]);
+		state->poly_key[i] &= CONST64(0x01FFFFFF01FFFFFF);
+	}
+
+	/* L3 inner product keys. The L2 output is always below 2^64 so the
+	 * first four words of each stream multiply zeroes and are skipped */
+	umac_kdf(&prf, 3, buf, 64 * state->streams);
+	for (i = 0; i < state->streams; i++) {
+		for (j = 0; j < 4; j++) {
+			LOAD64H(state->ip_key[i][j], &buf[64*i + 32 + 8*j]);
+			state->ip_key[i][j] %= UMAC_P36;
+		}
+	}
+
+	umac_kdf(&prf, 4, buf, 4 * state->streams);
+	for (i = 0; i < state->streams; i++) {
+		LOAD32H(state->ip_trans[i], &buf[4*i]);
+	}
+
+	m_burn(buf, sizeof(buf));
+	m_burn(&prf, sizeof(prf));
+	return DROPBEAR_SUCCESS;
+}
+
+/* One 32 byte NH block for every stream */
+static void umac_nh_block(const dropbear_umac_state *state,
+		const ulong32 *k, const unsigned char *in, ulong64 *nh) {
+	ulong32 m0, m1, m2, m3, m4, m5, m6, m7;
+	unsigned int s;
+
+	LOAD32L(m0, in);
+	LOAD32L(m1, in + 4);
+	LOAD32L(m2, in + 8);
+	LOAD32L(m3, in + 12);
+	LOAD32L(m4, in + 16);
+	LOAD32L(m5, in + 20);
+	LOAD32L(m6, in + 24);
+	LOAD32L(m7, in + 28);
+	for (s = 0; s < state->streams; s++, k += 4) {
+		nh[s] += (ulong64)(ulong32)(m0 + k[0]) * (ulong32)(m4 + k[4]);
+		nh[s] += (ulong64)(ulong32)(m1 + k[1]) * (ulong32)(m5 + k[5]);
+		nh[s] += (ulong64)(ulong32)(m2 + k[2]) * (ulong32)(m6 + k[6]);
+		nh[s] += (ulong64)(ulong32)(m3 + k[3]) * (ulong32)(m7 + k[7]);
+	}
+}
+
+/* L1-HASH of a chunk of at most UMAC_L1_KEY_LEN bytes. The chunk is
+ * zero padded to a nonzero multiple of 32 bytes and its bit length added */
+static void umac_nh(const dropbear_umac_state *state,
+		const unsigned char *in, unsigned int len, ulong64 *nh) {
+	const ulong32 *k = state->nh_key;
+	unsigned char last[32];
+	unsigned int s, rem;
+
+	for (s = 0; s < state->streams; s++) {
+		nh[s] = (ulong64)len * 8;
+	}
+
+	rem = len % 32;
+	for (; len >= 32; len -= 32, in += 32, k += 8) {
+		umac_nh_block(state, k, in, nh);
+	}
+	if (rem != 0 || k == state->nh_key) {
+		memset(last, 0, sizeof(last));
+		memcpy(last, in, rem);
+		umac_nh_block(state, k, last, nh);
+	}
+}
+
+/* cur * key + data mod 2^64 - 59, the result may not be fully reduced.
+ * key is masked so none of the partial products overflow. */
+static ulong64 umac_poly64(ulong64 cur, ulong64 key, ulong64 data) {
+	ulong32 key_hi = (ulong32)(key >> 32), key_lo = (ulong32)key;
+	ulong32 cur_hi = (ulong32)(cur >> 32), cur_lo = (ulong32)cur;
+	ulong64 x, t, res;
+
+	x = (ulong64)key_hi * cur_lo + (ulong64)cur_hi * key_lo;
+	res = ((ulong64)key_hi * cur_hi + (x >> 32)) * 59
+		+ (ulong64)key_lo * cur_lo;
+	t = x << 32;
+	res += t;
+	if (res < t) {
+		res += 59;
+	}
+	res += data;
+	if (res < data) {
+		res += 59;
+	}
+	return res;
+}
+
+/* L2-HASH step, words beyond 2^64 - 2^32 are split with the marker */
+static ulong64 umac_poly(ulong64 cur, ulong64 key, ulong64 data) {
+	if ((ulong32)(data >> 32) == 0xFFFFFFFFUL) {
+		cur = umac_poly64(cur, key, UMAC_P64 - 1);
+		data -= 59;
+	}
+	return umac_poly64(cur, key, data);
+}
+
+/* L3-HASH of the 64-bit L2 output for one stream */
+static ulong32 umac_ip(const dropbear_umac_state *state, unsigned int s,
+		ulong64 y) {
+	const ulong64 *k = state->ip_key[s];
+	ulong64 t;
+
+	t = k[0] * (ulong64)((y >> 48) & 0xFFFF)
+		+ k[1] * (ulong64)((y >> 32) & 0xFFFF)
+		+ k[2] * (ulong64)((y >> 16) & 0xFFFF)
+		+ k[3] * (ulong64)(y & 0xFFFF);
+	t = (t & CONST64(0x0000000FFFFFFFFF)) + 5 * (t >> 36);
+	if (t >= UMAC_P36) {
+		t -= UMAC_P36;
+	}
+	return (ulong32)t ^ state->ip_trans[s];
+}
+
+/* Pad from RFC 4418 section 3.1, the 8 byte nonce is the big endian
+ * sequence number as for umac-64@openssh.com */
+static void umac_pdf(dropbear_umac_state *state, unsigned int seqno,
+		unsigned char *tag) {
+	unsigned char nonce[16];
+	unsigned int i, index = 0, taglen = state->streams * 4;
+
+	memset(nonce, 0, sizeof(nonce));
+	STORE32H(seqno, &nonce[4]);
+	if (taglen == 8) {
+		index = nonce[7] & 1;
+		nonce[7] &= ~1;
+	}
+	if (!state->pdf_valid || memcmp(nonce, state->pdf_nonce, 8) != 0) {
+		if (aes_desc.ecb_encrypt(nonce, state->pdf_cache,
+					&state->pdf_key) != CRYPT_OK) {
+			dropbear_exit("UMAC error");
+		}
+		memcpy(state->pdf_nonce, nonce, 8);
+		state->pdf_valid = 1;
+	}
+	for (i = 0; i < taglen; i++) {
+		tag[i] ^= state->pdf_cache[index * taglen + i];
+	}
+}
+
+/* Writes the 4*streams byte tag of len bytes from in */
+void dropbear_umac(dropbear_umac_state *state, unsigned int seqno,
+		const unsigned char *in, unsigned long len, unsigned char *tag) {
+	ulong64 nh[UMAC_MAX_STREAMS], acc[UMAC_MAX_STREAMS];
+	unsigned long done, chunk;
+	unsigned int s;
+
+	if (len > UMAC_MAX_MSG_LEN) {
+		dropbear_exit("UMAC error");
+	}
+
+	for (s = 0; s < state->streams; s++) {
+		acc[s] = 1;
+	}
+	done = 0;
+	do {
+		chunk = MIN(len - done, UMAC_L1_KEY_LEN);
+		umac_nh(state, in + done, chunk, nh);
+		done += chunk;
+		if (len > UMAC_L1_KEY_LEN) {
+			for (s = 0; s < state->streams; s++) {
+				acc[s] = umac_poly(acc[s], state->poly_key[s], nh[s]);
+			}
+		}
+	} while (done < len);
+
+	/* messages of a single chunk skip L2 */
+	for (s = 0; s < state->streams; s++) {
+		if (len > UMAC_L1_KEY_LEN) {
+			if (acc[s] >= UMAC_P64) {
+				acc[s] -= UMAC_P64;
+			}
+			nh[s] = acc[s];
+		}
+		STORE32H(umac_ip(state, s, nh[s]), &tag[4*s]);
+	}
+	umac_pdf(state, seqno, tag);
+}
+
+#endif /* DROPBEAR_UMAC */
@@ -0,0 +1,62 @@
+/*
+ * Dropbear SSH
+ *
+ * Copyright (c) 2002,2003 Matt Johnston
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. */
+
+#ifndef DROPBEAR_UMAC_H_
+#define DROPBEAR_UMAC_H_
+
+#include "includes.h"
+
+#if DROPBEAR_UMAC
+
+#define UMAC_KEY_LEN 16
+/* UMAC-128 has four 32-bit hash streams */
+#define UMAC_MAX_STREAMS 4
+#define UMAC_L1_KEY_LEN 1024
+#define UMAC_L1_KEY_SHIFT 16
+#define UMAC_NH_KEY_WORDS \
+	((UMAC_L1_KEY_LEN + UMAC_L1_KEY_SHIFT * (UMAC_MAX_STREAMS - 1)) / 4)
+
+/* RFC 4418 UMAC as used by umac-64@openssh.com and umac-128@openssh.com.
+ * All subkeys are derived once per key, the last AES pad block is
+ * cached since UMAC-64 gets two tags out of each one. */
+typedef struct {
+	unsigned int streams;
+	symmetric_key pdf_key;
+	unsigned char pdf_nonce[8];
+	unsigned char pdf_cache[16];
+	int pdf_valid;
+	ulong32 nh_key[UMAC_NH_KEY_WORDS];
+	ulong64 poly_key[UMAC_MAX_STREAMS];
+	ulong64 ip_key[UMAC_MAX_STREAMS][4];
+	ulong32 ip_trans[UMAC_MAX_STREAMS];
+} dropbear_umac_state;
+
+int dropbear_umac_setup(dropbear_umac_state *state,
+		const unsigned char *key, unsigned int taglen);
+void dropbear_umac(dropbear_umac_state *state, unsigned int seqno,
+		const unsigned char *in, unsigned long len, unsigned char *tag);
+
+#endif /* DROPBEAR_UMAC */
+
+#endif /* DROPBEAR_UMAC_H_ */